@@ -0,0 +1,546 @@
+#include "absorbing_chain.h"
+#include <math.h> // For fabs()
+#include <string.h> // For memset()
+
+// the iterative solvers stop when a sweep changes no value by more than this
+// (relatively), or when less than this much probability is left in walks
+#define TOLERANCE 1e-13
+#define MAX_ITERATIONS 1000000
+// a pivot this small means I - Q is singular for the precision we have
+#define PIVOT_EPSILON 1e-300
+
+/**
+ * returns the probability of a transition of the chain
+ * @param compiled_chain the chain
+ * @param state id of the state the transition is from
+ * @param place place of the transition in the successors array
+ * @return the transition's frequency over the row's total
+ */
+static double get_probability(const CompiledChain *compiled_chain,
+                              uint32_t state, uint64_t place);
+
+/**
+ * checks that every transient state can reach an absorbing state, by a
+ * breadth first search backwards from the absorbing states
+ * @param absorbing_chain the chain, with transient_index set
+ * @param all_reach set to the result
+ * @return true on success, false in case of allocation error
+ */
+static bool check_all_absorbed(const AbsorbingChain *absorbing_chain,
+                               bool *all_reach);
+
+/**
+ * factors I - Q into lu and pivots, with partial pivoting
+ * @param absorbing_chain the chain, with lu allocated
+ * @return true on success, false if I - Q is numerically singular
+ */
+static bool factor(AbsorbingChain *absorbing_chain);
+
+/**
+ * solves (I - Q) x = b, or (I - Q)^T x = b, with the LU factors
+ * @param absorbing_chain the factored chain
+ * @param transpose true to solve the transposed system
+ * @param x b on input, set to the solution, num_transient entries
+ */
+static void solve_factored(const AbsorbingChain *absorbing_chain,
+                           bool transpose, double *x);
+
+/**
+ * solves (I - Q) t = 1 by Gauss-Seidel sweeps
+ * @param absorbing_chain the chain
+ * @param expected_steps set to t by state ids, num_states entries, zeroed
+ * @return true on success, false if it didn't converge
+ */
+static bool solve_iteratively(const AbsorbingChain *absorbing_chain,
+                              double *expected_steps);
+
+/**
+ * moves the probability of being in every transient state one step forward
+ * @param absorbing_chain the chain
+ * @param mass the probability of being in every state, by state ids
+ * @param next set to the probability after the step, by state ids. its
+ * entries of absorbing states are added to, not set.
+ * @return the probability that was absorbed by the step
+ */
+static double propagate(const AbsorbingChain *absorbing_chain,
+                        const double *mass, double *next);
+
+bool is_absorbing_state(const CompiledChain *compiled_chain, uint32_t state)
+{
+  return is_compiled_last (compiled_chain, state)
+         || get_num_successors (compiled_chain, state) == 0;
+}
+
+static double get_probability(const CompiledChain *compiled_chain,
+                              uint32_t state, uint64_t place)
+{
+  const CompiledSuccessor *successors = compiled_chain->successors;
+  uint32_t first = compiled_chain->row_offsets[state];
+  uint32_t last = compiled_chain->row_offsets[state + 1] - 1;
+  uint32_t frequency = successors[place].cumulative_frequency;
+  if (place > first)
+  {
+    frequency -= successors[place - 1].cumulative_frequency;
+  }
+  return (double) frequency / successors[last].cumulative_frequency;
+}
+
+static bool check_all_absorbed(const AbsorbingChain *absorbing_chain,
+                               bool *all_reach)
+{
+  const CompiledChain *compiled_chain = absorbing_chain->compiled_chain;
+  uint32_t num_states = compiled_chain->num_states;
+  // the predecessors of every state, in a reversed CSR
+  uint32_t *offsets = calloc ((size_t) num_states + 1, sizeof (uint32_t));
+  uint32_t *predecessors = malloc ((compiled_chain->num_successors + 1)
+                                   * sizeof (uint32_t));
+  uint32_t *queue = malloc ((size_t) num_states * sizeof (uint32_t) + 1);
+  bool *reached = calloc ((size_t) num_states + 1, sizeof (bool));
+  if (!offsets || !predecessors || !queue || !reached)
+  {
+    free (offsets);
+    free (predecessors);
+    free (queue);
+    free (reached);
+    return false;
+  }
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    for (uint32_t i = compiled_chain->row_offsets[state];
+         i < compiled_chain->row_offsets[state + 1]; i++)
+    {
+      offsets[compiled_chain->successors[i].state + 1]++;
+    }
+  }
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    offsets[state + 1] += offsets[state];
+  }
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    for (uint32_t i = compiled_chain->row_offsets[state];
+         i < compiled_chain->row_offsets[state + 1]; i++)
+    {
+      predecessors[offsets[compiled_chain->successors[i].state]++] = state;
+    }
+  }
+  // filling moved every offset to the start of the next state
+  for (uint32_t state = num_states; state > 0; state--)
+  {
+    offsets[state] = offsets[state - 1];
+  }
+  offsets[0] = 0;
+  uint32_t queue_size = 0;
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    if (absorbing_chain->transient_index[state] == NO_STATE)
+    {
+      reached[state] = true;
+      queue[queue_size++] = state;
+    }
+  }
+  uint32_t num_reached = 0;
+  for (uint32_t head = 0; head < queue_size; head++)
+  {
+    uint32_t state = queue[head];
+    for (uint32_t i = offsets[state]; i < offsets[state + 1]; i++)
+    {
+      uint32_t predecessor = predecessors[i];
+      // walks end in absorbing states, so they are never passed through
+      if (!reached[predecessor])
+      {
+        reached[predecessor] = true;
+        queue[queue_size++] = predecessor;
+        num_reached++;
+      }
+    }
+  }
+  *all_reach = num_reached == absorbing_chain->num_transient;
+  free (offsets);
+  free (predecessors);
+  free (queue);
+  free (reached);
+  return true;
+}
+
+static bool factor(AbsorbingChain *absorbing_chain)
+{
+  const CompiledChain *compiled_chain = absorbing_chain->compiled_chain;
+  uint32_t n = absorbing_chain->num_transient;
+  double *lu = absorbing_chain->lu;
+  for (uint32_t row = 0; row < n; row++)
+  {
+    uint32_t state = absorbing_chain->transient_states[row];
+    lu[(size_t) row * n + row] = 1;
+    for (uint32_t i = compiled_chain->row_offsets[state];
+         i < compiled_chain->row_offsets[state + 1]; i++)
+    {
+      uint32_t column = absorbing_chain
+          ->transient_index[compiled_chain->successors[i].state];
+      if (column != NO_STATE)
+      {
+        lu[(size_t) row * n + column] -= get_probability (compiled_chain,
+                                                          state, i);
+      }
+    }
+  }
+  for (uint32_t k = 0; k < n; k++)
+  {
+    uint32_t pivot = k;
+    for (uint32_t row = k + 1; row < n; row++)
+    {
+      if (fabs (lu[(size_t) row * n + k]) > fabs (lu[(size_t) pivot * n + k]))
+      {
+        pivot = row;
+      }
+    }
+    if (fabs (lu[(size_t) pivot * n + k]) < PIVOT_EPSILON)
+    {
+      return false;
+    }
+    absorbing_chain->pivots[k] = pivot;
+    if (pivot != k)
+    {
+      for (uint32_t column = 0; column < n; column++)
+      {
+        double temp = lu[(size_t) k * n + column];
+        lu[(size_t) k * n + column] = lu[(size_t) pivot * n + column];
+        lu[(size_t) pivot * n + column] = temp;
+      }
+    }
+    for (uint32_t row = k + 1; row < n; row++)
+    {
+      double multiplier = lu[(size_t) row * n + k] / lu[(size_t) k * n + k];
+      lu[(size_t) row * n + k] = multiplier;
+      if (multiplier == 0)
+      {
+        continue;
+      }
+      for (uint32_t column = k + 1; column < n; column++)
+      {
+        lu[(size_t) row * n + column] -= multiplier
+                                         * lu[(size_t) k * n + column];
+      }
+    }
+  }
+  return true;
+}
+
+static void solve_factored(const AbsorbingChain *absorbing_chain,
+                           bool transpose, double *x)
+{
+  uint32_t n = absorbing_chain->num_transient;
+  const double *lu = absorbing_chain->lu;
+  const uint32_t *pivots = absorbing_chain->pivots;
+  if (!transpose)
+  {
+    // P A = L U: solve L y = P b, then U x = y
+    for (uint32_t k = 0; k < n; k++)
+    {
+      double temp = x[k];
+      x[k] = x[pivots[k]];
+      x[pivots[k]] = temp;
+    }
+    for (uint32_t row = 0; row < n; row++)
+    {
+      for (uint32_t column = 0; column < row; column++)
+      {
+        x[row] -= lu[(size_t) row * n + column] * x[column];
+      }
+    }
+    for (uint32_t row = n; row-- > 0;)
+    {
+      for (uint32_t column = row + 1; column < n; column++)
+      {
+        x[row] -= lu[(size_t) row * n + column] * x[column];
+      }
+      x[row] /= lu[(size_t) row * n + row];
+    }
+    return;
+  }
+  // A^T = U^T L^T P: solve U^T z = b, then L^T w = z, then x = P^T w
+  for (uint32_t row = 0; row < n; row++)
+  {
+    for (uint32_t column = 0; column < row; column++)
+    {
+      x[row] -= lu[(size_t) column * n + row] * x[column];
+    }
+    x[row] /= lu[(size_t) row * n + row];
+  }
+  for (uint32_t row = n; row-- > 0;)
+  {
+    for (uint32_t column = row + 1; column < n; column++)
+    {
+      x[row] -= lu[(size_t) column * n + row] * x[column];
+    }
+  }
+  for (uint32_t k = n; k-- > 0;)
+  {
+    double temp = x[k];
+    x[k] = x[pivots[k]];
+    x[pivots[k]] = temp;
+  }
+}
+
+static bool solve_iteratively(const AbsorbingChain *absorbing_chain,
+                              double *expected_steps)
+{
+  const CompiledChain *compiled_chain = absorbing_chain->compiled_chain;
+  for (long iteration = 0; iteration < MAX_ITERATIONS; iteration++)
+  {
+    double max_change = 0;
+    // states are numbered from the start states on, so going backwards
+    // uses the new values of most successors in the same sweep
+    for (uint32_t index = absorbing_chain->num_transient; index-- > 0;)
+    {
+      uint32_t state = absorbing_chain->transient_states[index];
+      double sum = 1;
+      double self = 0;
+      for (uint32_t i = compiled_chain->row_offsets[state];
+           i < compiled_chain->row_offsets[state + 1]; i++)
+      {
+        uint32_t successor = compiled_chain->successors[i].state;
+        double probability = get_probability (compiled_chain, state, i);
+        if (successor == state)
+        {
+          self += probability;
+        }
+        else
+        {
+          sum += probability * expected_steps[successor];
+        }
+      }
+      double value = sum / (1 - self);
+      double change = fabs (value - expected_steps[state])
+                      / (value > 1 ? value : 1);
+      if (change > max_change)
+      {
+        max_change = change;
+      }
+      expected_steps[state] = value;
+    }
+    if (max_change < TOLERANCE)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static double propagate(const AbsorbingChain *absorbing_chain,
+                        const double *mass, double *next)
+{
+  const CompiledChain *compiled_chain = absorbing_chain->compiled_chain;
+  double absorbed = 0;
+  for (uint32_t index = 0; index < absorbing_chain->num_transient; index++)
+  {
+    next[absorbing_chain->transient_states[index]] = 0;
+  }
+  for (uint32_t index = 0; index < absorbing_chain->num_transient; index++)
+  {
+    uint32_t state = absorbing_chain->transient_states[index];
+    if (mass[state] == 0)
+    {
+      continue;
+    }
+    for (uint32_t i = compiled_chain->row_offsets[state];
+         i < compiled_chain->row_offsets[state + 1]; i++)
+    {
+      uint32_t successor = compiled_chain->successors[i].state;
+      double moved = mass[state] * get_probability (compiled_chain, state, i);
+      next[successor] += moved;
+      if (absorbing_chain->transient_index[successor] == NO_STATE)
+      {
+        absorbed += moved;
+      }
+    }
+  }
+  return absorbed;
+}
+
+AbsorbingChain *create_absorbing_chain(const CompiledChain *compiled_chain)
+{
+  AbsorbingChain *absorbing_chain = calloc (1, sizeof (AbsorbingChain));
+  if (!absorbing_chain)
+  {
+    return NULL;
+  }
+  uint32_t num_states = compiled_chain->num_states;
+  absorbing_chain->compiled_chain = compiled_chain;
+  absorbing_chain->transient_index = malloc ((size_t) num_states
+                                             * sizeof (uint32_t) + 1);
+  absorbing_chain->transient_states = malloc ((size_t) num_states
+                                              * sizeof (uint32_t) + 1);
+  if (!absorbing_chain->transient_index || !absorbing_chain->transient_states)
+  {
+    free_absorbing_chain (&absorbing_chain);
+    return NULL;
+  }
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    absorbing_chain->transient_index[state] = NO_STATE;
+    if (!is_absorbing_state (compiled_chain, state))
+    {
+      absorbing_chain->transient_index[state] = absorbing_chain
+          ->num_transient;
+      absorbing_chain->transient_states[absorbing_chain->num_transient++] =
+          state;
+    }
+  }
+  bool all_reach = false;
+  if (!check_all_absorbed (absorbing_chain, &all_reach) || !all_reach)
+  {
+    free_absorbing_chain (&absorbing_chain);
+    return NULL;
+  }
+  uint32_t n = absorbing_chain->num_transient;
+  if (n > DENSE_SOLVE_LIMIT)
+  {
+    return absorbing_chain;
+  }
+  absorbing_chain->lu = calloc ((size_t) n * n + 1, sizeof (double));
+  absorbing_chain->pivots = malloc ((size_t) n * sizeof (uint32_t) + 1);
+  if (!absorbing_chain->lu || !absorbing_chain->pivots
+      || !factor (absorbing_chain))
+  {
+    free_absorbing_chain (&absorbing_chain);
+    return NULL;
+  }
+  return absorbing_chain;
+}
+
+bool get_expected_steps(const AbsorbingChain *absorbing_chain,
+                        double *expected_steps)
+{
+  uint32_t n = absorbing_chain->num_transient;
+  memset (expected_steps, 0, absorbing_chain->compiled_chain->num_states
+                             * sizeof (double));
+  if (!absorbing_chain->lu)
+  {
+    return solve_iteratively (absorbing_chain, expected_steps);
+  }
+  double *x = malloc ((size_t) n * sizeof (double) + 1);
+  if (!x)
+  {
+    return false;
+  }
+  for (uint32_t index = 0; index < n; index++)
+  {
+    x[index] = 1;
+  }
+  solve_factored (absorbing_chain, false, x);
+  for (uint32_t index = 0; index < n; index++)
+  {
+    expected_steps[absorbing_chain->transient_states[index]] = x[index];
+  }
+  free (x);
+  return true;
+}
+
+bool get_absorption_probabilities(const AbsorbingChain *absorbing_chain,
+                                  uint32_t first_state,
+                                  double *probabilities)
+{
+  const CompiledChain *compiled_chain = absorbing_chain->compiled_chain;
+  uint32_t num_states = compiled_chain->num_states;
+  uint32_t first_index = absorbing_chain->transient_index[first_state];
+  memset (probabilities, 0, num_states * sizeof (double));
+  if (first_index == NO_STATE)
+  {
+    probabilities[first_state] = 1;
+    return true;
+  }
+  double *mass = calloc ((size_t) num_states + 1, sizeof (double));
+  double *next = calloc ((size_t) num_states + 1, sizeof (double));
+  if (!mass || !next)
+  {
+    free (mass);
+    free (next);
+    return false;
+  }
+  bool converged = true;
+  if (absorbing_chain->lu)
+  {
+    // the expected visits to every transient state, e_first^T (I - Q)^-1,
+    // then one more step from all of them lands in the absorbing states
+    uint32_t n = absorbing_chain->num_transient;
+    next[first_index] = 1;
+    solve_factored (absorbing_chain, true, next);
+    for (uint32_t index = 0; index < n; index++)
+    {
+      mass[absorbing_chain->transient_states[index]] = next[index];
+    }
+    propagate (absorbing_chain, mass, probabilities);
+  }
+  else
+  {
+    // walk the probability forward until (almost) all of it is absorbed
+    mass[first_state] = 1;
+    double remaining = 1;
+    long iteration = 0;
+    while (remaining > TOLERANCE && iteration++ < MAX_ITERATIONS)
+    {
+      remaining -= propagate (absorbing_chain, mass, probabilities);
+      for (uint32_t index = 0; index < absorbing_chain->num_transient;
+           index++)
+      {
+        uint32_t state = absorbing_chain->transient_states[index];
+        mass[state] = probabilities[state];
+      }
+    }
+    converged = remaining <= TOLERANCE;
+  }
+  for (uint32_t index = 0; index < absorbing_chain->num_transient; index++)
+  {
+    probabilities[absorbing_chain->transient_states[index]] = 0;
+  }
+  free (mass);
+  free (next);
+  return converged;
+}
+
+bool get_step_distribution(const AbsorbingChain *absorbing_chain,
+                           uint32_t first_state, int max_steps,
+                           double *distribution)
+{
+  uint32_t num_states = absorbing_chain->compiled_chain->num_states;
+  memset (distribution, 0, ((size_t) max_steps + 1) * sizeof (double));
+  if (absorbing_chain->transient_index[first_state] == NO_STATE)
+  {
+    distribution[0] = 1;
+    return true;
+  }
+  double *mass = calloc ((size_t) num_states + 1, sizeof (double));
+  double *next = calloc ((size_t) num_states + 1, sizeof (double));
+  if (!mass || !next)
+  {
+    free (mass);
+    free (next);
+    return false;
+  }
+  mass[first_state] = 1;
+  for (int step = 1; step <= max_steps; step++)
+  {
+    distribution[step] = propagate (absorbing_chain, mass, next);
+    double *temp = mass;
+    mass = next;
+    next = temp;
+  }
+  free (mass);
+  free (next);
+  return true;
+}
+
+void free_absorbing_chain(AbsorbingChain **absorbing_chain)
+{
+  if (!*absorbing_chain)
+  {
+    return;
+  }
+  free ((*absorbing_chain)->transient_index);
+  free ((*absorbing_chain)->transient_states);
+  free ((*absorbing_chain)->lu);
+  free ((*absorbing_chain)->pivots);
+  free (*absorbing_chain);
+  *absorbing_chain = NULL;
+}
@@ -0,0 +1,98 @@
+#ifndef _ABSORBING_CHAIN_H_
+#define _ABSORBING_CHAIN_H_
+#include <stdbool.h> // for bool
+#include <stdint.h> // for uint32_t
+#include "compiled_chain.h"
+
+// chains with up to this many transient states are solved exactly by a dense
+// LU factorization, bigger ones iteratively
+#define DENSE_SOLVE_LIMIT 1024
+
+/**
+ * A compiled chain seen as an absorbing markov chain: a walk ends in a last
+ * state or in a state without successors (the absorbing states), and moves
+ * between the other ones (the transient states) by the frequencies of their
+ * rows. With Q the transitions between the transient states, the expected
+ * number of steps and the absorption probabilities are the solutions of
+ * linear systems over I - Q.
+ */
+typedef struct AbsorbingChain {
+    const CompiledChain *compiled_chain;
+    uint32_t num_transient;
+    // index of every state among the transient states, NO_STATE for the
+    // absorbing states
+    uint32_t *transient_index;
+    // the transient states, by their index
+    uint32_t *transient_states;
+    // LU factors of I - Q, num_transient^2 entries by rows (L below the
+    // diagonal, its unit diagonal not stored), and the row swaps of the
+    // factorization. NULL for more than DENSE_SOLVE_LIMIT transient states.
+    double *lu;
+    uint32_t *pivots;
+} AbsorbingChain;
+
+/**
+ * Check if a walk ends in a state.
+ * @param compiled_chain the chain
+ * @param state id of the state
+ * @return true if the state is a last state or has no successors
+ */
+bool is_absorbing_state(const CompiledChain *compiled_chain, uint32_t state);
+
+/**
+ * Prepare a compiled chain for the solvers (and factor I - Q if it is small
+ * enough).
+ * @param compiled_chain the chain, must outlive the absorbing chain
+ * @return the absorbing chain, NULL in case of allocation error or if some
+ * transient state can't reach an absorbing state (so walks from it may never
+ * end)
+ */
+AbsorbingChain *create_absorbing_chain(const CompiledChain *compiled_chain);
+
+/**
+ * Compute the expected number of steps until absorption, from every state.
+ * @param absorbing_chain the chain
+ * @param expected_steps set to the expected steps from state i in entry i
+ * (0 for absorbing states), num_states entries
+ * @return true on success, false in case of allocation error or if the
+ * iterative solver didn't converge
+ */
+bool get_expected_steps(const AbsorbingChain *absorbing_chain,
+                        double *expected_steps);
+
+/**
+ * Compute the probability that a walk from a state ends in each absorbing
+ * state.
+ * @param absorbing_chain the chain
+ * @param first_state id of the state the walks start from
+ * @param probabilities set to the probability to end in state i in entry i
+ * (0 for transient states), num_states entries
+ * @return true on success, false in case of allocation error or if the
+ * iterative solver didn't converge
+ */
+bool get_absorption_probabilities(const AbsorbingChain *absorbing_chain,
+                                  uint32_t first_state,
+                                  double *probabilities);
+
+/**
+ * Compute the distribution of the number of steps until absorption, up to a
+ * maximum number of steps.
+ * @param absorbing_chain the chain
+ * @param first_state id of the state the walks start from
+ * @param max_steps the maximum number of steps
+ * @param distribution set to the probability to be absorbed after exactly i
+ * steps in entry i, max_steps + 1 entries. the rest of the probability is
+ * for walks longer than max_steps.
+ * @return true on success, false in case of allocation error
+ */
+bool get_step_distribution(const AbsorbingChain *absorbing_chain,
+                           uint32_t first_state, int max_steps,
+                           double *distribution);
+
+/**
+ * Free an absorbing chain (not its compiled chain).
+ * @param absorbing_chain the chain to free
+ */
+void free_absorbing_chain(AbsorbingChain **absorbing_chain);
+
+#endif //_ABSORBING_CHAIN_H_
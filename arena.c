@@ -0,0 +1,87 @@
+#include "arena.h"
+#include <stdlib.h> // For malloc(), free()
+#include <stdbool.h> // for bool
+
+#define CHUNK_SIZE (1 << 20)
+#define ALIGNMENT 16
+// allocations at least this big get a chunk of their own, so they don't
+// waste the rest of the current chunk
+#define LARGE_ALLOCATION (CHUNK_SIZE / 4)
+
+/**
+ * allocates a new chunk and adds it to the arena's chunk list: at the head,
+ * or right after it if the chunk is for a single large allocation
+ * @param arena the arena
+ * @param size minimal size of the chunk's data
+ * @return the new chunk, NULL in case of allocation error
+ */
+static ArenaChunk *new_chunk(Arena *arena, size_t size);
+
+static ArenaChunk *new_chunk(Arena *arena, size_t size)
+{
+  bool is_large = size >= LARGE_ALLOCATION && arena->chunks;
+  if (!is_large && size < CHUNK_SIZE)
+  {
+    size = CHUNK_SIZE;
+  }
+  // the header is padded so data starts aligned
+  size_t header_size = (sizeof (ArenaChunk) + ALIGNMENT - 1)
+                       & ~(size_t) (ALIGNMENT - 1);
+  ArenaChunk *chunk = malloc (header_size + size);
+  if (!chunk)
+  {
+    return NULL;
+  }
+  *chunk = (ArenaChunk) {NULL, size, 0, (unsigned char *) chunk + header_size};
+  if (is_large)
+  {
+    chunk->next = arena->chunks->next;
+    arena->chunks->next = chunk;
+  }
+  else
+  {
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+  }
+  arena->num_chunks++;
+  arena->total_size += size;
+  return chunk;
+}
+
+Arena *arena_create(void)
+{
+  return calloc (1, sizeof (Arena));
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+  size = (size + ALIGNMENT - 1) & ~(size_t) (ALIGNMENT - 1);
+  ArenaChunk *chunk = arena->chunks;
+  if (!chunk || chunk->size - chunk->used < size)
+  {
+    chunk = new_chunk (arena, size);
+    if (!chunk)
+    {
+      return NULL;
+    }
+  }
+  void *memory = chunk->data + chunk->used;
+  chunk->used += size;
+  return memory;
+}
+
+void arena_free(Arena *arena)
+{
+  if (!arena)
+  {
+    return;
+  }
+  ArenaChunk *chunk = arena->chunks;
+  while (chunk)
+  {
+    ArenaChunk *next = chunk->next;
+    free (chunk);
+    chunk = next;
+  }
+  free (arena);
+}
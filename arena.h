@@ -0,0 +1,46 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+#include <stddef.h> // for size_t
+
+/**
+ * A chunk of arena memory. Allocations are carved from data one after the
+ * other.
+ */
+typedef struct ArenaChunk {
+    struct ArenaChunk *next;
+    size_t size;
+    size_t used;
+    unsigned char *data;
+} ArenaChunk;
+
+/**
+ * Bump allocator: memory is allocated from large chunks and only released
+ * all at once, by arena_free.
+ */
+typedef struct Arena {
+    ArenaChunk *chunks; // the current chunk, followed by the older ones
+    size_t num_chunks;
+    size_t total_size; // bytes reserved in all the chunks
+} Arena;
+
+/**
+ * Create an empty arena.
+ * @return a newly allocated arena, NULL in case of allocation error
+ */
+Arena *arena_create(void);
+
+/**
+ * Allocate memory from the arena, aligned for any type.
+ * @param arena the arena to allocate from
+ * @param size number of bytes to allocate
+ * @return pointer to the memory, NULL in case of allocation error
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * Free the arena and everything that was allocated from it.
+ * @param arena the arena to free
+ */
+void arena_free(Arena *arena);
+
+#endif //_ARENA_H_
@@ -0,0 +1,276 @@
+#define _POSIX_C_SOURCE 200809L
+#include "batch_generator.h"
+#include "chain_stats.h"
+#include <pthread.h> // For pthread_create()
+#include <unistd.h> // For sysconf()
+
+// walks are generated in rounds of this many, then written
+#define WALKS_PER_ROUND 8192
+#define WRITE_ERROR_MESSAGE "Error: couldn't write the output\n"
+
+/**
+ * The threads of a batch. They are started once, and generate the rounds
+ * together: every round, the calling thread and the workers meet at the
+ * barrier to start it, and again when they formatted their walks.
+ */
+typedef struct WalkPool {
+    // held while the workers are started, the workers wait for it before
+    // they use the barrier
+    pthread_mutex_t lock;
+    pthread_barrier_t barrier;
+    int num_threads; // including the calling thread
+    // set (under the lock) if the barrier couldn't be made, so the workers
+    // end before they use it
+    bool no_barrier;
+    bool stop; // set before the barrier, to end the workers
+} WalkPool;
+
+/**
+ * The walks of one round that one thread generates, and the buffer they
+ * are formatted into (reused between rounds).
+ */
+typedef struct WalkJob {
+    const CompiledChain *compiled_chain;
+    const Sampler *sampler;
+    const WalkConstraints *constraints;
+    uint64_t seed;
+    header_function format_header;
+    WalkPool *pool;
+    long first_walk; // number of the job's first walk
+    int num_walks;
+    OutputBuffer out;
+    bool success;
+} WalkJob;
+
+/**
+ * generates and formats the walks of a job
+ * @param walk_job the job
+ */
+static void generate_walks(WalkJob *walk_job);
+
+/**
+ * thread routine of a worker: generates the walks of its job in every
+ * round, until the pool stops
+ * @param job the WalkJob
+ * @return NULL
+ */
+static void *run_worker(void *job);
+
+/**
+ * starts the workers of a pool, as many as can be started up to
+ * num_threads - 1
+ * @param pool the pool, set to the number of threads started
+ * @param jobs the jobs, one per thread, the calling thread's first
+ * @param threads set to the workers, one per thread after the first
+ * @param num_threads number of threads to use at most
+ */
+static void start_pool(WalkPool *pool, WalkJob *jobs, pthread_t *threads,
+                       int num_threads);
+
+/**
+ * stops and joins the workers of a pool
+ * @param pool the pool
+ * @param threads the workers
+ */
+static void stop_pool(WalkPool *pool, pthread_t *threads);
+
+/**
+ * generates one round of walks with the threads of a pool, each thread a
+ * contiguous range of them, so the buffers are written in order
+ * @param pool the started pool
+ * @param jobs the jobs of the pool's threads
+ * @param round_start number of the round's first walk
+ * @param round_size number of walks in the round
+ * @return true on success, false in case of allocation error
+ */
+static bool generate_round(WalkPool *pool, WalkJob *jobs, long round_start,
+                           int round_size);
+
+static void generate_walks(WalkJob *walk_job)
+{
+  walk_job->success = true;
+  for (int i = 0; walk_job->success && i < walk_job->num_walks; i++)
+  {
+    long walk_number = walk_job->first_walk + i;
+    RandomState rng;
+    seed_random_stream (&rng, walk_job->seed, (uint64_t) walk_number);
+    walk_job->success = walk_job->format_header (walk_number, &walk_job->out)
+                        && generate_constrained_tweet
+                            (walk_job->compiled_chain, walk_job->sampler,
+                             walk_job->constraints, &rng, &walk_job->out)
+                        && output_buffer_append (&walk_job->out, "\n", 1);
+  }
+}
+
+static void *run_worker(void *job)
+{
+  WalkJob *walk_job = job;
+  WalkPool *pool = walk_job->pool;
+  pthread_mutex_lock (&pool->lock);
+  // not stop: a pool stopped before its first round may set it before the
+  // workers get here, and still waits for them at the barrier
+  bool stop = pool->no_barrier;
+  pthread_mutex_unlock (&pool->lock);
+  while (!stop)
+  {
+    pthread_barrier_wait (&pool->barrier);
+    stop = pool->stop;
+    if (!stop)
+    {
+      generate_walks (walk_job);
+      pthread_barrier_wait (&pool->barrier);
+    }
+  }
+  return NULL;
+}
+
+static void start_pool(WalkPool *pool, WalkJob *jobs, pthread_t *threads,
+                       int num_threads)
+{
+  pool->no_barrier = false;
+  pool->stop = false;
+  pool->num_threads = 1;
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_mutex_lock (&pool->lock);
+  for (int t = 1; t < num_threads; t++)
+  {
+    if (pthread_create (threads + t - 1, NULL, run_worker, jobs + t) != 0)
+    {
+      break;
+    }
+    pool->num_threads++;
+  }
+  if (pool->num_threads > 1
+      && pthread_barrier_init (&pool->barrier, NULL,
+                               (unsigned) pool->num_threads) != 0)
+  {
+    // the workers end before they use the barrier, the calling thread
+    // generates all the walks alone
+    pool->no_barrier = true;
+    pthread_mutex_unlock (&pool->lock);
+    for (int t = 1; t < pool->num_threads; t++)
+    {
+      pthread_join (threads[t - 1], NULL);
+    }
+    pool->num_threads = 1;
+    return;
+  }
+  pthread_mutex_unlock (&pool->lock);
+}
+
+static void stop_pool(WalkPool *pool, pthread_t *threads)
+{
+  if (pool->num_threads > 1)
+  {
+    pool->stop = true;
+    pthread_barrier_wait (&pool->barrier);
+    for (int t = 1; t < pool->num_threads; t++)
+    {
+      pthread_join (threads[t - 1], NULL);
+    }
+    pthread_barrier_destroy (&pool->barrier);
+  }
+  pthread_mutex_destroy (&pool->lock);
+}
+
+static bool generate_round(WalkPool *pool, WalkJob *jobs, long round_start,
+                           int round_size)
+{
+  int walks_done = 0;
+  for (int t = 0; t < pool->num_threads; t++)
+  {
+    jobs[t].first_walk = round_start + walks_done;
+    jobs[t].num_walks = round_size / pool->num_threads
+                        + (t < round_size % pool->num_threads ? 1 : 0);
+    walks_done += jobs[t].num_walks;
+  }
+  // the barriers order the jobs' ranges and buffers between the threads
+  if (pool->num_threads > 1)
+  {
+    pthread_barrier_wait (&pool->barrier);
+  }
+  generate_walks (jobs);
+  if (pool->num_threads > 1)
+  {
+    pthread_barrier_wait (&pool->barrier);
+  }
+  bool success = true;
+  for (int t = 0; t < pool->num_threads; t++)
+  {
+    success = success && jobs[t].success;
+  }
+  return success;
+}
+
+bool print_walks(const CompiledChain *compiled_chain, const Sampler *sampler,
+                 const WalkConstraints *constraints, long num_walks,
+                 uint64_t seed, int num_threads, header_function format_header,
+                 int fd)
+{
+  STATS_PHASE_BEGIN (STATS_PHASE_GENERATE);
+  if (num_threads < 1)
+  {
+    num_threads = 1;
+  }
+  if (num_walks < num_threads)
+  {
+    // a thread that has no walks would only wait at the barriers
+    num_threads = num_walks > 1 ? (int) num_walks : 1;
+  }
+  WalkJob *jobs = calloc (num_threads, sizeof (WalkJob));
+  pthread_t *threads = malloc (num_threads * sizeof (pthread_t));
+  if (!jobs || !threads)
+  {
+    free (jobs);
+    free (threads);
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    STATS_PHASE_END (STATS_PHASE_GENERATE);
+    return false;
+  }
+  WalkPool pool;
+  for (int t = 0; t < num_threads; t++)
+  {
+    jobs[t] = (WalkJob) {compiled_chain, sampler, constraints, seed,
+                         format_header, &pool, 0, 0, {0}, true};
+  }
+  start_pool (&pool, jobs, threads, num_threads);
+  bool generated = true, written = true;
+  for (long round_start = 1; generated && written && round_start <= num_walks;
+       round_start += WALKS_PER_ROUND)
+  {
+    long left = num_walks - round_start + 1;
+    int round_size = left < WALKS_PER_ROUND ? (int) left : WALKS_PER_ROUND;
+    generated = generate_round (&pool, jobs, round_start, round_size);
+    for (int t = 0; generated && written && t < pool.num_threads; t++)
+    {
+      written = output_buffer_flush (&jobs[t].out, fd);
+    }
+  }
+  stop_pool (&pool, threads);
+  if (!generated)
+  {
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+  }
+  else if (!written)
+  {
+    printf ("%s", WRITE_ERROR_MESSAGE);
+  }
+  for (int t = 0; t < num_threads; t++)
+  {
+    output_buffer_free (&jobs[t].out);
+  }
+  free (jobs);
+  free (threads);
+  STATS_PHASE_END (STATS_PHASE_GENERATE);
+  return generated && written;
+}
+
+int get_default_num_threads(int max_threads)
+{
+  long num_cores = sysconf (_SC_NPROCESSORS_ONLN);
+  if (num_cores < 1)
+  {
+    return 1;
+  }
+  return num_cores < max_threads ? (int) num_cores : max_threads;
+}
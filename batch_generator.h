@@ -0,0 +1,45 @@
+#ifndef _BATCH_GENERATOR_H_
+#define _BATCH_GENERATOR_H_
+#include <stdint.h> // for uint64_t
+#include "markov_chain.h"
+#include "compiled_chain.h"
+#include "constrained_walk.h"
+
+typedef bool (*header_function) (long, OutputBuffer*);
+
+/**
+ * Generate num_walks random walks on a compiled chain with several threads,
+ * and write them in order to a file descriptor, each one after its header
+ * and followed by a new line. The threads are started once, and generate
+ * the walks in rounds: every thread formats its walks of a round into an
+ * output buffer of its own, and the buffers are written in order with one
+ * write each. Walk number i (counting from 1) draws from its own random
+ * stream (seed_random_stream with stream i), so the output only depends on
+ * the seed, not on the number of threads.
+ * @param compiled_chain the chain to walk on
+ * @param sampler a sampler of the chain, NULL to draw by the frequencies
+ * @param constraints the constraints of every walk (see WalkConstraints),
+ * which include its first state and maximum length, prepared by
+ * prepare_walk_constraints
+ * @param num_walks number of walks to generate
+ * @param seed seed of the random streams
+ * @param num_threads number of threads to generate with
+ * @param format_header formats the header of a walk, given its number
+ * @param fd file descriptor to write the walks to
+ * @return true on success, false in case of allocation or write error
+ * (each reported with a message of its own)
+ */
+bool print_walks(const CompiledChain *compiled_chain, const Sampler *sampler,
+                 const WalkConstraints *constraints, long num_walks,
+                 uint64_t seed, int num_threads, header_function format_header,
+                 int fd);
+
+/**
+ * Get the default number of threads to use: the number of online cores, up
+ * to max_threads.
+ * @param max_threads the maximal number of threads
+ * @return the number of threads
+ */
+int get_default_num_threads(int max_threads);
+
+#endif //_BATCH_GENERATOR_H_
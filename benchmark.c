@@ -0,0 +1,1009 @@
+#define _POSIX_C_SOURCE 200809L
+#include <math.h> // For pow()
+#include <pthread.h> // For pthread_create()
+#include <string.h> // For strlen(), strcmp(), strncmp()
+#include <time.h> // For clock_gettime()
+#include <unistd.h> // For sysconf()
+#include "markov_chain.h"
+#include "corpus.h"
+#include "compiled_chain.h"
+#include "concurrent_chain.h"
+#include "chain_distribution.h"
+
+#define USAGE_MESSAGE "Usage: markov_benchmark [-c <number of readers>] \
+<seed> <number of words> <vocabulary size>x<fanout>...\n"
+#define CONCURRENT_FLAG "-c"
+#define CONCURRENT_ARGS 2 // the flag and the number of readers
+#define MIN_ARGS 4
+#define SEED_PLACE 1
+#define WORDS_PLACE 2
+#define FIRST_RUN_PLACE 3
+#define RUN_SEPARATOR 'x'
+#define BASE_10 10
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// frequencies of the words, and of the successors of a word, fall as
+// 1 / rank^ZIPF_EXPONENT
+#define ZIPF_EXPONENT 1.0
+// one word in LAST_WORD_PERIOD ends a sentence
+#define LAST_WORD_PERIOD 16
+// lines without a last word are cut after this many words
+#define MAX_LINE_WORDS 64
+// "w" + up to 10 digits + "." + NUL
+#define WORD_SIZE 16
+#define NUM_LOOKUPS (1 << 20)
+// steps are timed in groups, to be well above the clock's resolution, and
+// the latency of a step is the mean of its group
+#define NUM_STEP_SAMPLES (1 << 16)
+#define STEPS_PER_SAMPLE 16
+#define PERCENTILE_50 0.5
+#define PERCENTILE_99 0.99
+// the truncated, tempered sampling the sampled steps are timed with
+#define SAMPLED_TEMPERATURE 0.8
+#define SAMPLED_TOP_K 40
+#define SAMPLED_TOP_P 0.95
+// the stationary distribution is computed to this L1 tolerance, with a
+// thread per online CPU
+#define STATIONARY_TOLERANCE 1e-9
+#define STATIONARY_MAX_ITERATIONS 1000
+#define NANOSECONDS 1e9
+#define PAGE_SIZE_FIELD 2 // resident pages are statm's second field
+// the concurrent run: the chain is trained on the first half of the text,
+// the readers generate alone for READERS_ALONE_SECONDS, and then while a
+// writer trains on the second half, in blocks of about WRITER_BLOCK_SIZE
+// bytes, publishing after each one
+#define MAX_CONCURRENT_READERS 256
+#define READERS_ALONE_SECONDS 1
+#define WRITER_BLOCK_SIZE (1 << 16)
+#define CONCURRENT_TWEET_LENGTH 20
+
+/**
+ * A synthetic corpus: every word has fanout successors, drawn from a Zipf
+ * distribution over the vocabulary, and follows them by a Zipf distribution
+ * over their ranks.
+ */
+typedef struct SyntheticCorpus {
+    int vocabulary_size;
+    int fanout;
+    char *words; // vocabulary_size words of WORD_SIZE bytes
+    double *word_cdf; // vocabulary_size cumulative probabilities
+    double *successor_cdf; // fanout cumulative probabilities
+    int *successors; // the successors of word i start at i * fanout
+    char *text;
+    size_t text_length;
+    long num_bigrams;
+} SyntheticCorpus;
+
+/**
+ * The measurements of one run, see print_run for their meaning.
+ */
+typedef struct RunResult {
+    int num_states;
+    double build_seconds;
+    double freeze_seconds;
+    double compile_seconds;
+    double lookup_ns;
+    double lookup_hits; // the share of the looked up words that were found
+    double node_step_ns[2]; // p50 and p99
+    double compiled_step_ns[2];
+    double sampler_seconds; // create_sampler
+    double sampled_step_ns[2];
+    double stationary_seconds; // get_stationary_distribution
+    bool stationary_converged;
+    double bytes_per_state;
+    double free_compiled_seconds;
+    double free_database_seconds;
+} RunResult;
+
+/**
+ * The measurements of a concurrent run.
+ */
+typedef struct ConcurrentResult {
+    int num_readers;
+    double alone_tweets_per_second; // readers only
+    double shared_tweets_per_second; // while the writer trains
+    double writer_seconds;
+    long writer_bigrams;
+    int num_publishes;
+} ConcurrentResult;
+
+/**
+ * A reader thread of a concurrent run: it generates tweets until stop is
+ * set.
+ */
+typedef struct ReaderJob {
+    ConcurrentChain *concurrent_chain;
+    int reader;
+    uint64_t seed;
+    const int *stop; // read atomically
+    long num_tweets;
+    bool success;
+} ReaderJob;
+
+/**
+ * checks if a word is the last word in a sentence
+ * @param word a generic pointer that points to a word
+ * @return true if its the last word, false if not
+ */
+static bool is_word_last(void *word);
+
+/**
+ * formats the word into an output buffer
+ * @param word a generic pointer to a word
+ * @param out the buffer to append to
+ * @return true on success, false in case of allocation error
+ */
+static bool my_format(void *word, OutputBuffer *out);
+
+/**
+ * compares two words
+ * @param first a pointer to the first word
+ * @param second a pointer to the second word
+ * @return a negative value, 0 or a positive value, like strcmp
+ */
+static int my_compare(void *first, void *second);
+
+/**
+ * hashes a word (FNV-1a)
+ * @param word a generic pointer to a word
+ * @return the hash of the word
+ */
+static size_t my_hash(void *word);
+
+/**
+ * copies a word into the arena
+ * @param arena the arena to copy to
+ * @param word a pointer to a word
+ * @return the copy in the arena
+ */
+static void *my_arena_copy(Arena *arena, const void *word);
+
+/**
+ * checks if the word a TokenView points to is the last word in a sentence
+ * @param view a generic pointer to a TokenView
+ * @return true if its the last word, false if not
+ */
+static bool is_view_last(void *view);
+
+/**
+ * compares a word with the word a TokenView points to, like my_compare
+ * @param word a pointer to a word
+ * @param view a pointer to a TokenView
+ * @return a negative value, 0 or a positive value, like strcmp
+ */
+static int my_view_compare(void *word, void *view);
+
+/**
+ * hashes the word a TokenView points to, like my_hash
+ * @param view a generic pointer to a TokenView
+ * @return the hash of the word
+ */
+static size_t my_view_hash(void *view);
+
+/**
+ * copies the word a TokenView points to into the arena
+ * @param arena the arena to copy to
+ * @param view a pointer to a TokenView
+ * @return the NUL terminated copy in the arena
+ */
+static void *my_view_arena_copy(Arena *arena, const void *view);
+
+/**
+ * gets the time of a monotonic clock
+ * @return the time in seconds
+ */
+static double get_seconds(void);
+
+/**
+ * gets the resident memory of the process, from /proc/self/statm
+ * @return the resident memory in bytes, 0 if it can't be read
+ */
+static double get_resident_bytes(void);
+
+/**
+ * fills cumulative probabilities of a Zipf distribution
+ * @param cdf the array to fill, size entries
+ * @param size number of ranks
+ */
+static void fill_zipf_cdf(double *cdf, int size);
+
+/**
+ * draws a rank from a distribution by its cumulative probabilities
+ * @param cdf the cumulative probabilities
+ * @param size number of ranks
+ * @param rng the random state to draw from
+ * @return the rank, in [0, size)
+ */
+static int draw_rank(const double *cdf, int size, RandomState *rng);
+
+/**
+ * builds the vocabulary, the successors and the text of a synthetic corpus
+ * @param corpus the corpus, with its vocabulary size and fanout set
+ * @param num_words number of words in the text
+ * @param rng the random state to draw from
+ * @return true on success, false in case of allocation error
+ */
+static bool create_corpus(SyntheticCorpus *corpus, long num_words,
+                          RandomState *rng);
+
+/**
+ * frees the arrays of a synthetic corpus
+ * @param corpus the corpus
+ */
+static void free_corpus(SyntheticCorpus *corpus);
+
+/**
+ * sets up an empty chain of words, like tweets_generator
+ * @return the chain, NULL in case of allocation error
+ */
+static MarkovChain *create_chain(void);
+
+/**
+ * compares two doubles, for qsort
+ * @param first a pointer to the first double
+ * @param second a pointer to the second double
+ * @return a negative value, 0 or a positive value
+ */
+static int compare_doubles(const void *first, const void *second);
+
+/**
+ * sorts latency samples and takes their 50th and 99th percentiles
+ * @param samples the samples, NUM_STEP_SAMPLES entries
+ * @param percentiles set to the percentiles
+ */
+static void get_percentiles(double *samples, double percentiles[2]);
+
+/**
+ * times walks on a frozen chain in groups of STEPS_PER_SAMPLE steps. walks
+ * that reach a last state or a state without successors go on from a
+ * random first state.
+ * @param markov_chain the frozen chain
+ * @param rng the random state to draw from
+ * @param samples set to the mean step latency of every group, in
+ * nanoseconds, NUM_STEP_SAMPLES entries
+ */
+static void time_node_steps(MarkovChain *markov_chain, RandomState *rng,
+                            double *samples);
+
+/**
+ * times walks on a compiled chain, like time_node_steps
+ * @param compiled_chain the chain
+ * @param sampler a sampler of the chain, NULL to draw by the frequencies
+ * @param rng the random state to draw from
+ * @param samples set to the mean step latency of every group
+ */
+static void time_compiled_steps(const CompiledChain *compiled_chain,
+                                const Sampler *sampler, RandomState *rng,
+                                double *samples);
+
+/**
+ * builds a chain from a corpus and measures every stage, up to freeing it
+ * @param corpus the corpus
+ * @param rng the random state to draw from
+ * @param result set to the measurements
+ * @return true on success, false in case of allocation error
+ */
+static bool run_benchmark(const SyntheticCorpus *corpus, RandomState *rng,
+                          RunResult *result);
+
+/**
+ * generates tweets from a concurrent chain until the job's stop is set
+ * @param job the ReaderJob
+ * @return NULL
+ */
+static void *read_chain(void *job);
+
+/**
+ * starts the reader threads of a concurrent run
+ * @param jobs the readers' jobs, set up but for their counts
+ * @param threads set to the reader threads
+ * @param num_readers number of readers
+ * @return number of readers started, fewer than num_readers if a thread
+ * couldn't be created
+ */
+static int start_readers(ReaderJob *jobs, pthread_t *threads,
+                         int num_readers);
+
+/**
+ * stops and joins the reader threads of a concurrent run
+ * @param jobs the readers' jobs
+ * @param threads the reader threads
+ * @param num_readers number of readers started
+ * @param stop the readers' stop, set by this
+ * @param num_tweets set to the number of tweets the readers generated
+ * @return true if all the readers succeeded, false if not
+ */
+static bool stop_readers(ReaderJob *jobs, pthread_t *threads,
+                         int num_readers, int *stop, long *num_tweets);
+
+/**
+ * returns the end of the line a text position is in, past its newline
+ * @param cur the position
+ * @param end end of the text
+ * @return the start of the next line, end if there is none
+ */
+static const char *get_line_end(const char *cur, const char *end);
+
+/**
+ * counts the bigrams of a synthetic text: the words followed by a space
+ * and another word
+ * @param begin start of the text
+ * @param end end of the text
+ * @return number of bigrams
+ */
+static long count_bigrams(const char *begin, const char *end);
+
+/**
+ * trains a chain on the first half of a corpus, and measures the rate
+ * concurrent readers generate tweets at, alone and while a writer trains it
+ * on the second half
+ * @param corpus the corpus
+ * @param seed the seed of the readers' random streams
+ * @param result set to the measurements, with its num_readers set
+ * @return true on success, false in case of allocation error
+ */
+static bool run_concurrent_benchmark(const SyntheticCorpus *corpus,
+                                     uint64_t seed,
+                                     ConcurrentResult *result);
+
+/**
+ * prints the measurements of a concurrent run as a JSON object
+ * @param corpus the run's corpus
+ * @param result the measurements
+ * @param first true for the first run, which isn't preceded by a comma
+ */
+static void print_concurrent_run(const SyntheticCorpus *corpus,
+                                 const ConcurrentResult *result, bool first);
+
+/**
+ * prints the measurements of a run as a JSON object
+ * @param corpus the run's corpus
+ * @param result the measurements
+ * @param first true for the first run, which isn't preceded by a comma
+ */
+static void print_run(const SyntheticCorpus *corpus, const RunResult *result,
+                      bool first);
+
+/**
+ * parses a run's argument, "<vocabulary size>x<fanout>"
+ * @param arg the argument
+ * @param corpus set to the vocabulary size and fanout
+ * @return true if valid, false if not
+ */
+static bool parse_run(const char *arg, SyntheticCorpus *corpus);
+
+// the corpus looks words up by views into its text
+static const KeyFunctions WORD_KEYS = {my_view_hash, my_view_compare,
+                                       my_view_arena_copy, is_view_last};
+
+static bool is_word_last(void *word)
+{
+  char *new_word = (char *) word;
+  return new_word[strlen (new_word) - 1] == '.';
+}
+
+static bool my_format(void *word, OutputBuffer *out)
+{
+  return output_buffer_append_string (out, (char *) word);
+}
+
+static int my_compare(void *first, void *second)
+{
+  return strcmp ((char *) first, (char *) second);
+}
+
+static size_t my_hash(void *word)
+{
+  unsigned long long hash = FNV_OFFSET_BASIS;
+  for (const unsigned char *cur = word; *cur; cur++)
+  {
+    hash ^= *cur;
+    hash *= FNV_PRIME;
+  }
+  return (size_t) hash;
+}
+
+static void *my_arena_copy(Arena *arena, const void *word)
+{
+  size_t num = strlen ((const char *) word) + 1;
+  void *new = arena_alloc (arena, num);
+  if (!new)
+  {
+    return NULL;
+  }
+  memcpy (new, word, num);
+  return new;
+}
+
+static bool is_view_last(void *view)
+{
+  const TokenView *token = view;
+  return token->start[token->length - 1] == '.';
+}
+
+static int my_view_compare(void *word, void *view)
+{
+  const TokenView *token = view;
+  int result = strncmp ((char *) word, token->start, token->length);
+  return result ? result : (unsigned char) ((char *) word)[token->length];
+}
+
+static size_t my_view_hash(void *view)
+{
+  const TokenView *token = view;
+  unsigned long long hash = FNV_OFFSET_BASIS;
+  for (size_t i = 0; i < token->length; i++)
+  {
+    hash ^= (unsigned char) token->start[i];
+    hash *= FNV_PRIME;
+  }
+  return (size_t) hash;
+}
+
+static void *my_view_arena_copy(Arena *arena, const void *view)
+{
+  const TokenView *token = view;
+  char *new = arena_alloc (arena, token->length + 1);
+  if (!new)
+  {
+    return NULL;
+  }
+  memcpy (new, token->start, token->length);
+  new[token->length] = '\0';
+  return new;
+}
+
+static double get_seconds(void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (double) now.tv_sec + (double) now.tv_nsec / NANOSECONDS;
+}
+
+static double get_resident_bytes(void)
+{
+  FILE *statm = fopen ("/proc/self/statm", "r");
+  if (!statm)
+  {
+    return 0;
+  }
+  long pages[PAGE_SIZE_FIELD] = {0};
+  bool parsed = fscanf (statm, "%ld %ld", pages, pages + 1)
+                == PAGE_SIZE_FIELD;
+  fclose (statm);
+  return parsed ? (double) pages[1] * (double) sysconf (_SC_PAGESIZE) : 0;
+}
+
+static void fill_zipf_cdf(double *cdf, int size)
+{
+  double total = 0;
+  for (int rank = 0; rank < size; rank++)
+  {
+    total += 1 / pow (rank + 1, ZIPF_EXPONENT);
+    cdf[rank] = total;
+  }
+  for (int rank = 0; rank < size; rank++)
+  {
+    cdf[rank] /= total;
+  }
+}
+
+static int draw_rank(const double *cdf, int size, RandomState *rng)
+{
+  double draw = get_random_fraction (rng);
+  int low = 0;
+  int high = size - 1;
+  while (low < high)
+  {
+    int middle = low + (high - low) / 2;
+    if (cdf[middle] <= draw)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+static bool create_corpus(SyntheticCorpus *corpus, long num_words,
+                          RandomState *rng)
+{
+  size_t vocabulary_size = (size_t) corpus->vocabulary_size;
+  size_t fanout = (size_t) corpus->fanout;
+  corpus->words = malloc (vocabulary_size * WORD_SIZE);
+  corpus->word_cdf = malloc (vocabulary_size * sizeof (double));
+  corpus->successor_cdf = malloc (fanout * sizeof (double));
+  corpus->successors = malloc (vocabulary_size * fanout * sizeof (int));
+  corpus->text = malloc ((size_t) num_words * WORD_SIZE + 1);
+  if (!corpus->words || !corpus->word_cdf || !corpus->successor_cdf
+      || !corpus->successors || !corpus->text)
+  {
+    return false;
+  }
+  for (int word = 0; word < corpus->vocabulary_size; word++)
+  {
+    snprintf (corpus->words + (size_t) word * WORD_SIZE, WORD_SIZE, "w%d%s",
+              word, word % LAST_WORD_PERIOD == LAST_WORD_PERIOD - 1 ? "."
+                                                                    : "");
+  }
+  fill_zipf_cdf (corpus->word_cdf, corpus->vocabulary_size);
+  fill_zipf_cdf (corpus->successor_cdf, corpus->fanout);
+  for (size_t i = 0; i < vocabulary_size * fanout; i++)
+  {
+    corpus->successors[i] = draw_rank (corpus->word_cdf,
+                                       corpus->vocabulary_size, rng);
+  }
+  char *cur = corpus->text;
+  int word = draw_rank (corpus->word_cdf, corpus->vocabulary_size, rng);
+  int line_words = 0;
+  corpus->num_bigrams = 0;
+  for (long i = 0; i < num_words; i++)
+  {
+    const char *text = corpus->words + (size_t) word * WORD_SIZE;
+    size_t length = strlen (text);
+    memcpy (cur, text, length);
+    cur += length;
+    line_words++;
+    if (is_word_last ((void *) text) || line_words == MAX_LINE_WORDS)
+    {
+      *cur++ = '\n';
+      line_words = 0;
+      word = draw_rank (corpus->word_cdf, corpus->vocabulary_size, rng);
+      continue;
+    }
+    *cur++ = ' ';
+    if (i + 1 < num_words)
+    {
+      corpus->num_bigrams++;
+    }
+    int rank = draw_rank (corpus->successor_cdf, corpus->fanout, rng);
+    word = corpus->successors[(size_t) word * fanout + rank];
+  }
+  corpus->text_length = (size_t) (cur - corpus->text);
+  return true;
+}
+
+static void free_corpus(SyntheticCorpus *corpus)
+{
+  free (corpus->words);
+  free (corpus->word_cdf);
+  free (corpus->successor_cdf);
+  free (corpus->successors);
+  free (corpus->text);
+}
+
+static MarkovChain *create_chain(void)
+{
+  MarkovChain *markov_chain = calloc (1, sizeof (MarkovChain));
+  if (!markov_chain)
+  {
+    return NULL;
+  }
+  markov_chain->database = calloc (1, sizeof (LinkedList));
+  if (!markov_chain->database)
+  {
+    free (markov_chain);
+    return NULL;
+  }
+  update_funcs (&markov_chain, my_format, my_compare, free, NULL,
+                is_word_last);
+  update_hash_func (&markov_chain, my_hash);
+  update_key_funcs (&markov_chain, &WORD_KEYS);
+  if (!use_arena (&markov_chain, my_arena_copy))
+  {
+    free_database (&markov_chain);
+    return NULL;
+  }
+  return markov_chain;
+}
+
+static int compare_doubles(const void *first, const void *second)
+{
+  double a = *(const double *) first;
+  double b = *(const double *) second;
+  return (a > b) - (a < b);
+}
+
+static void get_percentiles(double *samples, double percentiles[2])
+{
+  qsort (samples, NUM_STEP_SAMPLES, sizeof (double), compare_doubles);
+  percentiles[0] = samples[(int) (PERCENTILE_50 * NUM_STEP_SAMPLES)];
+  percentiles[1] = samples[(int) (PERCENTILE_99 * NUM_STEP_SAMPLES)];
+}
+
+static void time_node_steps(MarkovChain *markov_chain, RandomState *rng,
+                            double *samples)
+{
+  MarkovNode *node = get_first_random_node (markov_chain, rng);
+  for (int sample = 0; sample < NUM_STEP_SAMPLES; sample++)
+  {
+    double start = get_seconds ();
+    for (int step = 0; step < STEPS_PER_SAMPLE; step++)
+    {
+      node = is_last_state (markov_chain, node)
+             || node->frequencies_list_length == 0
+             ? get_first_random_node (markov_chain, rng)
+             : get_next_random_node (node, rng);
+    }
+    samples[sample] = (get_seconds () - start) * NANOSECONDS
+                      / STEPS_PER_SAMPLE;
+  }
+}
+
+static void time_compiled_steps(const CompiledChain *compiled_chain,
+                                const Sampler *sampler, RandomState *rng,
+                                double *samples)
+{
+  uint32_t state = get_first_compiled_state (compiled_chain, rng);
+  for (int sample = 0; sample < NUM_STEP_SAMPLES; sample++)
+  {
+    double start = get_seconds ();
+    for (int step = 0; step < STEPS_PER_SAMPLE; step++)
+    {
+      state = is_compiled_last (compiled_chain, state)
+              || get_num_successors (compiled_chain, state) == 0
+              ? get_first_compiled_state (compiled_chain, rng)
+              : sampler ? get_next_sampled_state (sampler, state, rng)
+              : get_next_compiled_state (compiled_chain, state, rng);
+    }
+    samples[sample] = (get_seconds () - start) * NANOSECONDS
+                      / STEPS_PER_SAMPLE;
+  }
+}
+
+static bool run_benchmark(const SyntheticCorpus *corpus, RandomState *rng,
+                          RunResult *result)
+{
+  double *samples = malloc (NUM_STEP_SAMPLES * sizeof (double));
+  int *lookups = malloc (NUM_LOOKUPS * sizeof (int));
+  MarkovChain *markov_chain = samples && lookups ? create_chain () : NULL;
+  if (!markov_chain)
+  {
+    free (samples);
+    free (lookups);
+    return false;
+  }
+  double resident = get_resident_bytes ();
+  int words_to_read = READ_ALL_WORDS;
+  double start = get_seconds ();
+  bool success = fill_database_from_buffer (corpus->text,
+                                            corpus->text
+                                            + corpus->text_length,
+                                            &words_to_read, markov_chain);
+  result->build_seconds = get_seconds () - start;
+  start = get_seconds ();
+  success = success && freeze_chain (markov_chain);
+  result->freeze_seconds = get_seconds () - start;
+  result->num_states = markov_chain->database->size;
+  result->bytes_per_state = (get_resident_bytes () - resident)
+                            / (result->num_states ? result->num_states : 1);
+  CompiledChain *compiled_chain = NULL;
+  start = get_seconds ();
+  success = success && (compiled_chain = compile_chain (markov_chain));
+  result->compile_seconds = get_seconds () - start;
+  if (success && markov_chain->start_states_size > 0)
+  {
+    for (int i = 0; i < NUM_LOOKUPS; i++)
+    {
+      lookups[i] = draw_rank (corpus->word_cdf, corpus->vocabulary_size, rng);
+    }
+    // the words are drawn by their frequencies, some never made it into
+    // the text
+    int hits = 0;
+    start = get_seconds ();
+    for (int i = 0; i < NUM_LOOKUPS; i++)
+    {
+      char *word = corpus->words + (size_t) lookups[i] * WORD_SIZE;
+      hits += get_node_from_database (markov_chain, word) != NULL;
+    }
+    result->lookup_ns = (get_seconds () - start) * NANOSECONDS / NUM_LOOKUPS;
+    result->lookup_hits = (double) hits / NUM_LOOKUPS;
+    time_node_steps (markov_chain, rng, samples);
+    get_percentiles (samples, result->node_step_ns);
+    time_compiled_steps (compiled_chain, NULL, rng, samples);
+    get_percentiles (samples, result->compiled_step_ns);
+    SamplingParameters sampling = {SAMPLED_TEMPERATURE, SAMPLED_TOP_K,
+                                   SAMPLED_TOP_P};
+    start = get_seconds ();
+    Sampler *sampler = create_sampler (compiled_chain, sampling);
+    result->sampler_seconds = get_seconds () - start;
+    success = sampler != NULL;
+    if (success)
+    {
+      time_compiled_steps (compiled_chain, sampler, rng, samples);
+      get_percentiles (samples, result->sampled_step_ns);
+    }
+    free_sampler (&sampler);
+    double *distribution = malloc (compiled_chain->num_states
+                                   * sizeof (double));
+    start = get_seconds ();
+    success = success && distribution
+              && get_stationary_distribution
+                  (compiled_chain, STATIONARY_TOLERANCE,
+                   STATIONARY_MAX_ITERATIONS,
+                   (int) sysconf (_SC_NPROCESSORS_ONLN), distribution,
+                   &result->stationary_converged);
+    result->stationary_seconds = get_seconds () - start;
+    free (distribution);
+  }
+  start = get_seconds ();
+  free_compiled_chain (&compiled_chain);
+  result->free_compiled_seconds = get_seconds () - start;
+  start = get_seconds ();
+  free_database (&markov_chain);
+  result->free_database_seconds = get_seconds () - start;
+  free (samples);
+  free (lookups);
+  return success;
+}
+
+static void print_run(const SyntheticCorpus *corpus, const RunResult *result,
+                      bool first)
+{
+  printf ("%s\n    {\"vocabulary_size\": %d, \"fanout\": %d, "
+          "\"num_bigrams\": %ld, \"num_states\": %d,\n", first ? "" : ",",
+          corpus->vocabulary_size, corpus->fanout, corpus->num_bigrams,
+          result->num_states);
+  printf ("     \"build_seconds\": %.6f, \"bigrams_per_second\": %.0f, "
+          "\"freeze_seconds\": %.6f, \"compile_seconds\": %.6f,\n",
+          result->build_seconds,
+          corpus->num_bigrams / (result->build_seconds > 0
+                                 ? result->build_seconds : 1),
+          result->freeze_seconds, result->compile_seconds);
+  printf ("     \"lookup_ns\": %.1f, \"lookup_hits\": %.4f, "
+          "\"node_step_ns_p50\": %.1f, \"node_step_ns_p99\": %.1f, "
+          "\"compiled_step_ns_p50\": %.1f, \"compiled_step_ns_p99\": %.1f,\n",
+          result->lookup_ns, result->lookup_hits,
+          result->node_step_ns[0], result->node_step_ns[1],
+          result->compiled_step_ns[0], result->compiled_step_ns[1]);
+  printf ("     \"sampler_seconds\": %.6f, \"sampled_step_ns_p50\": %.1f, "
+          "\"sampled_step_ns_p99\": %.1f,\n", result->sampler_seconds,
+          result->sampled_step_ns[0], result->sampled_step_ns[1]);
+  printf ("     \"stationary_seconds\": %.6f, \"stationary_converged\": "
+          "%s,\n", result->stationary_seconds,
+          result->stationary_converged ? "true" : "false");
+  printf ("     \"bytes_per_state\": %.1f, \"free_compiled_seconds\": %.6f, "
+          "\"free_database_seconds\": %.6f}", result->bytes_per_state,
+          result->free_compiled_seconds, result->free_database_seconds);
+}
+
+static void *read_chain(void *job)
+{
+  ReaderJob *reader_job = job;
+  RandomState rng;
+  seed_random_stream (&rng, reader_job->seed, (uint64_t) reader_job->reader);
+  OutputBuffer out = {0};
+  while (reader_job->success
+         && !__atomic_load_n (reader_job->stop, __ATOMIC_RELAXED))
+  {
+    out.length = 0;
+    reader_job->success = generate_concurrent_tweet
+        (reader_job->concurrent_chain, reader_job->reader, NULL,
+         CONCURRENT_TWEET_LENGTH, &rng, &out);
+    reader_job->num_tweets++;
+  }
+  output_buffer_free (&out);
+  return NULL;
+}
+
+static int start_readers(ReaderJob *jobs, pthread_t *threads,
+                         int num_readers)
+{
+  for (int i = 0; i < num_readers; i++)
+  {
+    jobs[i].num_tweets = 0;
+    jobs[i].success = true;
+    if (pthread_create (threads + i, NULL, read_chain, jobs + i) != 0)
+    {
+      return i;
+    }
+  }
+  return num_readers;
+}
+
+static bool stop_readers(ReaderJob *jobs, pthread_t *threads,
+                         int num_readers, int *stop, long *num_tweets)
+{
+  __atomic_store_n (stop, 1, __ATOMIC_RELAXED);
+  bool success = true;
+  *num_tweets = 0;
+  for (int i = 0; i < num_readers; i++)
+  {
+    pthread_join (threads[i], NULL);
+    success = success && jobs[i].success;
+    *num_tweets += jobs[i].num_tweets;
+  }
+  *stop = 0;
+  return success;
+}
+
+static const char *get_line_end(const char *cur, const char *end)
+{
+  const char *newline = memchr (cur, '\n', (size_t) (end - cur));
+  return newline ? newline + 1 : end;
+}
+
+static long count_bigrams(const char *begin, const char *end)
+{
+  long num_bigrams = 0;
+  for (const char *cur = begin; cur + 1 < end; cur++)
+  {
+    num_bigrams += *cur == ' ';
+  }
+  return num_bigrams;
+}
+
+static bool run_concurrent_benchmark(const SyntheticCorpus *corpus,
+                                     uint64_t seed,
+                                     ConcurrentResult *result)
+{
+  const char *end = corpus->text + corpus->text_length;
+  const char *middle = get_line_end (corpus->text + corpus->text_length / 2,
+                                     end);
+  MarkovChain *markov_chain = create_chain ();
+  int words_to_read = READ_ALL_WORDS;
+  if (!markov_chain
+      || !fill_database_from_buffer (corpus->text, middle, &words_to_read,
+                                     markov_chain))
+  {
+    free_database (&markov_chain);
+    return false;
+  }
+  ConcurrentChain *concurrent_chain
+      = create_concurrent_chain (markov_chain, result->num_readers);
+  ReaderJob jobs[MAX_CONCURRENT_READERS];
+  pthread_t threads[MAX_CONCURRENT_READERS];
+  int stop = 0;
+  for (int i = 0; i < result->num_readers; i++)
+  {
+    jobs[i] = (ReaderJob) {concurrent_chain, i, seed, &stop, 0, true};
+  }
+  bool success = concurrent_chain != NULL;
+  long num_tweets = 0;
+  if (success)
+  {
+    double start = get_seconds ();
+    int started = start_readers (jobs, threads, result->num_readers);
+    struct timespec alone = {READERS_ALONE_SECONDS, 0};
+    nanosleep (&alone, NULL);
+    success = stop_readers (jobs, threads, started, &stop, &num_tweets)
+              && started == result->num_readers;
+    result->alone_tweets_per_second = num_tweets / (get_seconds () - start);
+  }
+  if (success)
+  {
+    double start = get_seconds ();
+    int started = start_readers (jobs, threads, result->num_readers);
+    result->writer_bigrams = count_bigrams (middle, end);
+    result->num_publishes = 0;
+    for (const char *block = middle; success && block < end; )
+    {
+      const char *block_end = block + WRITER_BLOCK_SIZE < end
+                              ? get_line_end (block + WRITER_BLOCK_SIZE, end)
+                              : end;
+      words_to_read = READ_ALL_WORDS;
+      success = fill_database_from_buffer (block, block_end, &words_to_read,
+                                           markov_chain)
+                && publish_chain (concurrent_chain);
+      result->num_publishes++;
+      block = block_end;
+    }
+    result->writer_seconds = get_seconds () - start;
+    success = stop_readers (jobs, threads, started, &stop, &num_tweets)
+              && started == result->num_readers && success;
+    result->shared_tweets_per_second = num_tweets / (get_seconds () - start);
+  }
+  free_concurrent_chain (&concurrent_chain);
+  free_database (&markov_chain);
+  return success;
+}
+
+static void print_concurrent_run(const SyntheticCorpus *corpus,
+                                 const ConcurrentResult *result, bool first)
+{
+  printf ("%s\n    {\"vocabulary_size\": %d, \"fanout\": %d, "
+          "\"num_readers\": %d,\n", first ? "" : ",",
+          corpus->vocabulary_size, corpus->fanout, result->num_readers);
+  printf ("     \"alone_tweets_per_second\": %.0f, "
+          "\"shared_tweets_per_second\": %.0f,\n",
+          result->alone_tweets_per_second, result->shared_tweets_per_second);
+  printf ("     \"writer_seconds\": %.6f, \"writer_bigrams_per_second\": "
+          "%.0f, \"num_publishes\": %d}", result->writer_seconds,
+          result->writer_bigrams / (result->writer_seconds > 0
+                                    ? result->writer_seconds : 1),
+          result->num_publishes);
+}
+
+static bool parse_run(const char *arg, SyntheticCorpus *corpus)
+{
+  char *end = NULL;
+  long vocabulary_size = strtol (arg, &end, BASE_10);
+  if (*end != RUN_SEPARATOR)
+  {
+    return false;
+  }
+  long fanout = strtol (end + 1, &end, BASE_10);
+  corpus->vocabulary_size = (int) vocabulary_size;
+  corpus->fanout = (int) fanout;
+  return *end == '\0' && vocabulary_size > 0 && fanout > 0
+         && vocabulary_size <= INT32_MAX / fanout;
+}
+
+int main(int argc, char *argv[])
+{
+  long num_readers = 0;
+  if (argc > CONCURRENT_ARGS && strcmp (argv[1], CONCURRENT_FLAG) == 0)
+  {
+    num_readers = strtol (argv[2], NULL, BASE_10);
+    if (num_readers <= 0 || num_readers > MAX_CONCURRENT_READERS)
+    {
+      printf ("%s", USAGE_MESSAGE);
+      return EXIT_FAILURE;
+    }
+    // the rest of the arguments are where they are without the flag
+    argc -= CONCURRENT_ARGS;
+    argv += CONCURRENT_ARGS;
+  }
+  long num_words = argc >= MIN_ARGS ? strtol (argv[WORDS_PLACE], NULL,
+                                              BASE_10) : 0;
+  if (num_words <= 0 || num_words > INT32_MAX)
+  {
+    printf ("%s", USAGE_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  for (int i = FIRST_RUN_PLACE; i < argc; i++)
+  {
+    SyntheticCorpus corpus = {0};
+    if (!parse_run (argv[i], &corpus))
+    {
+      printf ("%s", USAGE_MESSAGE);
+      return EXIT_FAILURE;
+    }
+  }
+  RandomState rng;
+  uint64_t seed = strtoull (argv[SEED_PLACE], NULL, BASE_10);
+  seed_random (&rng, seed);
+  printf ("{\"seed\": %llu, \"num_words\": %ld, \"runs\": [",
+          (unsigned long long) seed, num_words);
+  for (int i = FIRST_RUN_PLACE; i < argc; i++)
+  {
+    SyntheticCorpus corpus = {0};
+    RunResult result = {0};
+    ConcurrentResult concurrent_result = {0};
+    concurrent_result.num_readers = (int) num_readers;
+    parse_run (argv[i], &corpus);
+    bool success = create_corpus (&corpus, num_words, &rng);
+    if (num_readers > 0)
+    {
+      success = success && run_concurrent_benchmark (&corpus, seed,
+                                                     &concurrent_result);
+    }
+    else
+    {
+      success = success && run_benchmark (&corpus, &rng, &result);
+    }
+    if (!success)
+    {
+      free_corpus (&corpus);
+      printf ("\n%s", ALLOCATION_ERROR_MASSAGE);
+      return EXIT_FAILURE;
+    }
+    if (num_readers > 0)
+    {
+      print_concurrent_run (&corpus, &concurrent_result,
+                            i == FIRST_RUN_PLACE);
+    }
+    else
+    {
+      print_run (&corpus, &result, i == FIRST_RUN_PLACE);
+    }
+    fflush (stdout);
+    free_corpus (&corpus);
+  }
+  printf ("\n]}\n");
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,469 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chain_distribution.h"
+#include "absorbing_chain.h"
+#include <math.h> // For fabs()
+#include <pthread.h> // For pthread_create()
+#include <string.h> // For memcpy()
+
+// chains with fewer states per thread than this use fewer threads
+#define MIN_STATES_PER_THREAD 4096
+
+/**
+ * The transposed transition matrix, by the rows of the targets: the
+ * predecessors of state j are sources[offsets[j] .. offsets[j + 1]), with
+ * the probabilities of their transitions to j. Rows of states that restart
+ * are left out, their probability goes to the start states instead.
+ */
+typedef struct TransposedMatrix {
+    uint32_t *offsets;
+    uint32_t *sources;
+    double *probabilities;
+} TransposedMatrix;
+
+/**
+ * Everything one iteration reads: the matrix, the probability of every
+ * state to be chosen when a walk restarts, and the current vector.
+ */
+typedef struct PowerIteration {
+    uint32_t num_states;
+    TransposedMatrix matrix;
+    // true for the states whose walks restart
+    bool *restarts;
+    double *restart_weights;
+    // true if walks stay in the states that end them instead of restarting
+    bool keeps_ended;
+    const double *current;
+    double *next;
+    // the probability in current of the states that restart
+    double restarted;
+} PowerIteration;
+
+/**
+ * The threads of a power iteration. They are started once, and step
+ * together: every iteration, the calling thread and the workers meet at
+ * the barrier to start it, and again when they computed their states.
+ */
+typedef struct StepPool {
+    // held while the workers are started, the workers wait for it before
+    // they use the barrier
+    pthread_mutex_t lock;
+    pthread_barrier_t barrier;
+    int num_threads; // including the calling thread
+    // set (under the lock) if the barrier couldn't be made, so the workers
+    // end before they use it
+    bool no_barrier;
+    bool stop; // set before the barrier, to end the workers
+} StepPool;
+
+/**
+ * The states whose next values one thread computes, and what it sums on
+ * the way.
+ */
+typedef struct StepJob {
+    const PowerIteration *iteration;
+    StepPool *pool;
+    uint32_t first_state;
+    uint32_t last_state; // exclusive
+    double change; // L1 distance between next and current in the range
+    double restarted; // the probability in next of the states that restart
+} StepJob;
+
+/**
+ * builds the transposed matrix of a chain
+ * @param compiled_chain the chain
+ * @param restarts the states whose walks restart
+ * @param matrix set to the matrix
+ * @return true on success, false in case of allocation error
+ */
+static bool transpose(const CompiledChain *compiled_chain,
+                      const bool *restarts, TransposedMatrix *matrix);
+
+/**
+ * prepares the matrix and the restart weights of a chain
+ * @param compiled_chain the chain
+ * @param iteration set to the prepared iteration, with no vectors
+ * @return true on success, false in case of allocation error
+ */
+static bool prepare_iteration(const CompiledChain *compiled_chain,
+                              PowerIteration *iteration);
+
+/**
+ * frees the arrays of an iteration (not its vectors)
+ * @param iteration the iteration
+ */
+static void free_iteration(PowerIteration *iteration);
+
+/**
+ * computes one step for the states of a job
+ * @param step_job the job
+ */
+static void step_states(StepJob *step_job);
+
+/**
+ * thread routine of a worker: computes one step for the states of its job
+ * in every iteration, until the pool stops
+ * @param job the StepJob
+ * @return NULL
+ */
+static void *run_worker(void *job);
+
+/**
+ * starts the workers of a pool, as many as can be started up to
+ * num_threads - 1, and splits the states between them and the calling
+ * thread
+ * @param pool the pool, set to the number of threads started
+ * @param jobs the jobs, one per thread, the calling thread's first
+ * @param threads set to the workers, one per thread after the first
+ * @param num_threads number of threads to use at most
+ * @param num_states number of states
+ */
+static void start_pool(StepPool *pool, StepJob *jobs, pthread_t *threads,
+                       int num_threads, uint32_t num_states);
+
+/**
+ * stops and joins the workers of a pool
+ * @param pool the pool
+ * @param threads the workers
+ */
+static void stop_pool(StepPool *pool, pthread_t *threads);
+
+/**
+ * runs power iterations from a vector until the L1 change is below a
+ * tolerance or a maximum number of iterations
+ * @param iteration the prepared iteration
+ * @param vector the first vector, set to the last one, num_states entries
+ * @param tolerance the change to stop at, negative to run all of them
+ * @param max_iterations maximum number of iterations
+ * @param num_threads number of threads to use at most
+ * @param converged set to true if it stopped by the tolerance
+ * @return true on success, false in case of allocation error
+ */
+static bool run_iterations(PowerIteration *iteration, double *vector,
+                           double tolerance, int max_iterations,
+                           int num_threads, bool *converged);
+
+static bool transpose(const CompiledChain *compiled_chain,
+                      const bool *restarts, TransposedMatrix *matrix)
+{
+  uint32_t num_states = compiled_chain->num_states;
+  uint64_t num_successors = compiled_chain->num_successors;
+  matrix->offsets = calloc ((size_t) num_states + 1, sizeof (uint32_t));
+  matrix->sources = malloc (num_successors * sizeof (uint32_t) + 1);
+  matrix->probabilities = malloc (num_successors * sizeof (double) + 1);
+  if (!matrix->offsets || !matrix->sources || !matrix->probabilities)
+  {
+    return false;
+  }
+  const CompiledSuccessor *successors = compiled_chain->successors;
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    for (uint32_t i = compiled_chain->row_offsets[state];
+         !restarts[state] && i < compiled_chain->row_offsets[state + 1]; i++)
+    {
+      matrix->offsets[successors[i].state + 1]++;
+    }
+  }
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    matrix->offsets[state + 1] += matrix->offsets[state];
+  }
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    if (restarts[state])
+    {
+      continue;
+    }
+    uint32_t first = compiled_chain->row_offsets[state];
+    uint32_t last = compiled_chain->row_offsets[state + 1];
+    double total = successors[last - 1].cumulative_frequency;
+    uint32_t previous = 0;
+    for (uint32_t i = first; i < last; i++)
+    {
+      uint32_t place = matrix->offsets[successors[i].state]++;
+      matrix->sources[place] = state;
+      matrix->probabilities[place] = (successors[i].cumulative_frequency
+                                      - previous) / total;
+      previous = successors[i].cumulative_frequency;
+    }
+  }
+  // filling moved every offset to the start of the next state
+  for (uint32_t state = num_states; state > 0; state--)
+  {
+    matrix->offsets[state] = matrix->offsets[state - 1];
+  }
+  matrix->offsets[0] = 0;
+  return true;
+}
+
+static bool prepare_iteration(const CompiledChain *compiled_chain,
+                              PowerIteration *iteration)
+{
+  uint32_t num_states = compiled_chain->num_states;
+  *iteration = (PowerIteration) {0};
+  iteration->num_states = num_states;
+  iteration->restarts = malloc ((size_t) num_states * sizeof (bool) + 1);
+  iteration->restart_weights = calloc ((size_t) num_states + 1,
+                                       sizeof (double));
+  if (!iteration->restarts || !iteration->restart_weights)
+  {
+    return false;
+  }
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    iteration->restarts[state] = is_absorbing_state (compiled_chain, state);
+  }
+  if (compiled_chain->num_start_states == 0)
+  {
+    for (uint32_t state = 0; state < num_states; state++)
+    {
+      iteration->restart_weights[state] = 1.0 / num_states;
+    }
+  }
+  for (uint32_t i = 0; i < compiled_chain->num_start_states; i++)
+  {
+    iteration->restart_weights[compiled_chain->start_states[i]] +=
+        1.0 / compiled_chain->num_start_states;
+  }
+  return transpose (compiled_chain, iteration->restarts, &iteration->matrix);
+}
+
+static void free_iteration(PowerIteration *iteration)
+{
+  free (iteration->matrix.offsets);
+  free (iteration->matrix.sources);
+  free (iteration->matrix.probabilities);
+  free (iteration->restarts);
+  free (iteration->restart_weights);
+}
+
+static void step_states(StepJob *step_job)
+{
+  const PowerIteration *iteration = step_job->iteration;
+  const uint32_t *offsets = iteration->matrix.offsets;
+  const uint32_t *sources = iteration->matrix.sources;
+  const double *probabilities = iteration->matrix.probabilities;
+  const double *current = iteration->current;
+  double change = 0;
+  double restarted = 0;
+  for (uint32_t state = step_job->first_state; state < step_job->last_state;
+       state++)
+  {
+    // the walks that ended either stay or restart from the start states
+    double value = iteration->keeps_ended
+                   ? (iteration->restarts[state] ? current[state] : 0)
+                   : iteration->restarted * iteration->restart_weights[state];
+    // a gather over contiguous sources and probabilities, which the
+    // compiler can vectorize
+    for (uint32_t i = offsets[state]; i < offsets[state + 1]; i++)
+    {
+      value += current[sources[i]] * probabilities[i];
+    }
+    change += fabs (value - current[state]);
+    if (iteration->restarts[state])
+    {
+      restarted += value;
+    }
+    iteration->next[state] = value;
+  }
+  step_job->change = change;
+  step_job->restarted = restarted;
+}
+
+static void *run_worker(void *job)
+{
+  StepJob *step_job = job;
+  StepPool *pool = step_job->pool;
+  pthread_mutex_lock (&pool->lock);
+  // not stop: a pool stopped before its first step may set it before the
+  // workers get here, and still waits for them at the barrier
+  bool stop = pool->no_barrier;
+  pthread_mutex_unlock (&pool->lock);
+  while (!stop)
+  {
+    pthread_barrier_wait (&pool->barrier);
+    stop = pool->stop;
+    if (!stop)
+    {
+      step_states (step_job);
+      pthread_barrier_wait (&pool->barrier);
+    }
+  }
+  return NULL;
+}
+
+static void start_pool(StepPool *pool, StepJob *jobs, pthread_t *threads,
+                       int num_threads, uint32_t num_states)
+{
+  pool->no_barrier = false;
+  pool->stop = false;
+  pool->num_threads = 1;
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_mutex_lock (&pool->lock);
+  for (int t = 1; t < num_threads; t++)
+  {
+    jobs[t].pool = pool;
+    if (pthread_create (threads + t - 1, NULL, run_worker, jobs + t) != 0)
+    {
+      break;
+    }
+    pool->num_threads++;
+  }
+  if (pool->num_threads > 1
+      && pthread_barrier_init (&pool->barrier, NULL,
+                               (unsigned) pool->num_threads) != 0)
+  {
+    // the workers end before they use the barrier, the calling thread
+    // steps all the states alone
+    pool->no_barrier = true;
+    pthread_mutex_unlock (&pool->lock);
+    for (int t = 1; t < pool->num_threads; t++)
+    {
+      pthread_join (threads[t - 1], NULL);
+    }
+    pool->num_threads = 1;
+    pthread_mutex_lock (&pool->lock);
+  }
+  // the workers read their ranges once they can take the lock
+  for (int t = 0; t < pool->num_threads; t++)
+  {
+    jobs[t].first_state = (uint32_t) ((uint64_t) num_states * t
+                                      / pool->num_threads);
+    jobs[t].last_state = (uint32_t) ((uint64_t) num_states * (t + 1)
+                                     / pool->num_threads);
+  }
+  pthread_mutex_unlock (&pool->lock);
+}
+
+static void stop_pool(StepPool *pool, pthread_t *threads)
+{
+  if (pool->num_threads > 1)
+  {
+    pool->stop = true;
+    pthread_barrier_wait (&pool->barrier);
+    for (int t = 1; t < pool->num_threads; t++)
+    {
+      pthread_join (threads[t - 1], NULL);
+    }
+    pthread_barrier_destroy (&pool->barrier);
+  }
+  pthread_mutex_destroy (&pool->lock);
+}
+
+static bool run_iterations(PowerIteration *iteration, double *vector,
+                           double tolerance, int max_iterations,
+                           int num_threads, bool *converged)
+{
+  uint32_t num_states = iteration->num_states;
+  uint32_t max_threads = (num_states + MIN_STATES_PER_THREAD - 1)
+                         / MIN_STATES_PER_THREAD;
+  if (num_threads > (int) max_threads)
+  {
+    num_threads = (int) max_threads;
+  }
+  if (num_threads < 1)
+  {
+    num_threads = 1;
+  }
+  StepJob *jobs = calloc (num_threads, sizeof (StepJob));
+  pthread_t *threads = malloc (num_threads * sizeof (pthread_t));
+  double *other = malloc ((size_t) num_states * sizeof (double) + 1);
+  if (!jobs || !threads || !other)
+  {
+    free (jobs);
+    free (threads);
+    free (other);
+    return false;
+  }
+  for (int t = 0; t < num_threads; t++)
+  {
+    jobs[t].iteration = iteration;
+  }
+  iteration->current = vector;
+  iteration->next = other;
+  iteration->restarted = 0;
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    if (iteration->restarts[state])
+    {
+      iteration->restarted += vector[state];
+    }
+  }
+  StepPool pool;
+  start_pool (&pool, jobs, threads, num_threads, num_states);
+  *converged = false;
+  for (int i = 0; i < max_iterations && !*converged; i++)
+  {
+    // the barriers order this iteration's vectors and restarted before
+    // the workers' reads, and the workers' sums before the reads below
+    if (pool.num_threads > 1)
+    {
+      pthread_barrier_wait (&pool.barrier);
+    }
+    step_states (jobs);
+    if (pool.num_threads > 1)
+    {
+      pthread_barrier_wait (&pool.barrier);
+    }
+    double change = 0;
+    double restarted = 0;
+    for (int t = 0; t < pool.num_threads; t++)
+    {
+      change += jobs[t].change;
+      restarted += jobs[t].restarted;
+    }
+    iteration->restarted = restarted;
+    double *temp = iteration->next;
+    iteration->next = (double *) iteration->current;
+    iteration->current = temp;
+    *converged = change < tolerance;
+  }
+  stop_pool (&pool, threads);
+  if (iteration->current != vector)
+  {
+    memcpy (vector, iteration->current, num_states * sizeof (double));
+  }
+  free (jobs);
+  free (threads);
+  free (other);
+  return true;
+}
+
+bool get_stationary_distribution(const CompiledChain *compiled_chain,
+                                 double tolerance, int max_iterations,
+                                 int num_threads, double *distribution,
+                                 bool *converged)
+{
+  PowerIteration iteration;
+  *converged = false;
+  if (!prepare_iteration (compiled_chain, &iteration))
+  {
+    free_iteration (&iteration);
+    return false;
+  }
+  memcpy (distribution, iteration.restart_weights,
+          compiled_chain->num_states * sizeof (double));
+  bool success = run_iterations (&iteration, distribution, tolerance,
+                                 max_iterations, num_threads, converged);
+  free_iteration (&iteration);
+  return success;
+}
+
+bool get_k_step_distribution(const CompiledChain *compiled_chain,
+                             uint32_t first_state, int num_steps,
+                             int num_threads, double *distribution)
+{
+  PowerIteration iteration;
+  bool converged = false;
+  if (!prepare_iteration (compiled_chain, &iteration))
+  {
+    free_iteration (&iteration);
+    return false;
+  }
+  iteration.keeps_ended = true;
+  memset (distribution, 0, compiled_chain->num_states * sizeof (double));
+  distribution[first_state] = 1;
+  bool success = run_iterations (&iteration, distribution, -1, num_steps,
+                                 num_threads, &converged);
+  free_iteration (&iteration);
+  return success;
+}
@@ -0,0 +1,63 @@
+#ifndef _CHAIN_DISTRIBUTION_H_
+#define _CHAIN_DISTRIBUTION_H_
+#include <stdbool.h> // for bool
+#include <stdint.h> // for uint32_t
+#include "compiled_chain.h"
+
+/**
+ * Distributions over the states of a compiled chain, by power iteration of
+ * its row stochastic transition matrix: x_{k+1} = x_k P, where P has the
+ * frequencies of every row over the row's total.
+ * The chain is walked the way sentences are generated one after the other:
+ * a walk that reaches a last state, or a state without successors, goes on
+ * from a random start state (like get_first_compiled_state). So the
+ * stationary distribution is how often every state is visited in an endless
+ * stream of generated sentences. The k-step distribution is of a single
+ * walk instead, which stays where it ends.
+ * Every step is a sparse matrix-vector product over the transposed matrix,
+ * so every state's new value only reads the values of its predecessors, and
+ * the states are split between threads, which are started once per call
+ * and meet at a barrier every step.
+ */
+
+/**
+ * Compute the stationary distribution of a chain, starting from the start
+ * states and iterating until the L1 distance between two iterations is
+ * below a tolerance.
+ * @param compiled_chain the chain
+ * @param tolerance the L1 distance to stop at
+ * @param max_iterations maximum number of iterations
+ * @param num_threads number of threads to use at most (small chains use
+ * fewer)
+ * @param distribution set to the probability of state i in entry i,
+ * num_states entries
+ * @param converged set to true if it converged, false if it didn't in
+ * max_iterations (e.g. a periodic chain), in which case distribution holds
+ * the last iteration
+ * @return true on success, false in case of allocation error
+ */
+bool get_stationary_distribution(const CompiledChain *compiled_chain,
+                                 double tolerance, int max_iterations,
+                                 int num_threads, double *distribution,
+                                 bool *converged);
+
+/**
+ * Compute the distribution over the states after a number of steps from a
+ * state: row first_state of P^num_steps, where a last state or a state
+ * without successors moves to itself. So a walk that ends before
+ * num_steps steps keeps its probability in the state it ended in, and
+ * doesn't restart.
+ * @param compiled_chain the chain
+ * @param first_state id of the state to start from (see get_compiled_state)
+ * @param num_steps number of steps
+ * @param num_threads number of threads to use at most (small chains use
+ * fewer)
+ * @param distribution set to the probability to be in state i after
+ * num_steps steps in entry i, num_states entries
+ * @return true on success, false in case of allocation error
+ */
+bool get_k_step_distribution(const CompiledChain *compiled_chain,
+                             uint32_t first_state, int num_steps,
+                             int num_threads, double *distribution);
+
+#endif //_CHAIN_DISTRIBUTION_H_
@@ -0,0 +1,236 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chain_snapshot.h"
+#include <string.h> // For memcmp(), memcpy()
+#include <sys/mman.h> // For mmap()
+#include <sys/stat.h> // For fstat()
+#include <unistd.h> // For pread()
+
+#define SNAPSHOT_MAGIC "MKVCHAIN"
+#define MAGIC_LENGTH 8
+#define BYTE_ORDER_MARK 0x01020304u
+#define SNAPSHOT_ALIGNMENT 16
+
+/**
+ * rounds a size up to SNAPSHOT_ALIGNMENT
+ * @param size the size
+ * @return the aligned size
+ */
+static uint64_t align_size(uint64_t size);
+
+/**
+ * writes zero bytes to a file, up to the given offset
+ * @param file the file
+ * @param written number of bytes written to the file so far
+ * @param offset the offset to pad to
+ * @return true on success, false on write error
+ */
+static bool pad_to(FILE *file, uint64_t written, uint64_t offset);
+
+/**
+ * checks that an array of the snapshot lies inside the mapping
+ * @param mapping_size size of the mapping
+ * @param offset offset of the array
+ * @param count number of elements in the array
+ * @param element_size size of an element
+ * @return true if the array is inside the mapping, false otherwise
+ */
+static bool is_in_mapping(size_t mapping_size, uint64_t offset,
+                          uint64_t count, size_t element_size);
+
+/**
+ * writes an array of the snapshot at its offset, after padding
+ * @param file the file
+ * @param written number of bytes written to the file so far, updated
+ * @param offset the offset of the array in the file
+ * @param array the array
+ * @param size size of the array in bytes
+ * @return true on success, false on write error
+ */
+static bool write_section(FILE *file, uint64_t *written, uint64_t offset,
+                          const void *array, size_t size);
+
+/**
+ * returns the number of words in the last states bitset of a chain
+ * @param num_states number of states in the chain
+ * @return number of uint64_t words
+ */
+static uint64_t last_states_words(uint64_t num_states);
+
+static uint64_t align_size(uint64_t size)
+{
+  return (size + SNAPSHOT_ALIGNMENT - 1) & ~(uint64_t) (SNAPSHOT_ALIGNMENT - 1);
+}
+
+static bool pad_to(FILE *file, uint64_t written, uint64_t offset)
+{
+  for (; written < offset; written++)
+  {
+    if (fputc (0, file) == EOF)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool is_in_mapping(size_t mapping_size, uint64_t offset,
+                          uint64_t count, size_t element_size)
+{
+  return offset <= mapping_size && offset % SNAPSHOT_ALIGNMENT == 0
+         && count <= (mapping_size - offset) / element_size;
+}
+
+static bool write_section(FILE *file, uint64_t *written, uint64_t offset,
+                          const void *array, size_t size)
+{
+  bool success = pad_to (file, *written, offset)
+                 && fwrite (array, 1, size, file) == size;
+  *written = offset + size;
+  return success;
+}
+
+static uint64_t last_states_words(uint64_t num_states)
+{
+  return (num_states + 63) / 64;
+}
+
+bool save_snapshot(const CompiledChain *compiled_chain,
+                   size_function payload_size, const char *path)
+{
+  SnapshotHeader header = {0};
+  memcpy (header.magic, SNAPSHOT_MAGIC, MAGIC_LENGTH);
+  header.version = SNAPSHOT_VERSION;
+  header.byte_order = BYTE_ORDER_MARK;
+  header.num_states = compiled_chain->num_states;
+  header.num_start_states = compiled_chain->num_start_states;
+  header.num_successors = compiled_chain->num_successors;
+  uint64_t *payload_offsets = malloc ((header.num_states + 1)
+                                      * sizeof (uint64_t));
+  if (!payload_offsets)
+  {
+    return false;
+  }
+  for (uint32_t i = 0; i < compiled_chain->num_states; i++)
+  {
+    payload_offsets[i] = header.payloads_size;
+    header.payloads_size += align_size (payload_size (compiled_chain->data[i]));
+  }
+  uint64_t sizes[] = {
+      (header.num_states + 1) * sizeof (uint32_t),
+      header.num_successors * sizeof (CompiledSuccessor),
+      header.num_start_states * sizeof (uint32_t),
+      last_states_words (header.num_states) * sizeof (uint64_t),
+      header.num_states * sizeof (uint64_t)};
+  header.row_offsets_offset = align_size (sizeof (SnapshotHeader));
+  header.successors_offset = align_size (header.row_offsets_offset
+                                         + sizes[0]);
+  header.start_states_offset = align_size (header.successors_offset
+                                           + sizes[1]);
+  header.last_states_offset = align_size (header.start_states_offset
+                                          + sizes[2]);
+  header.payload_offsets_offset = align_size (header.last_states_offset
+                                              + sizes[3]);
+  header.payloads_offset = align_size (header.payload_offsets_offset
+                                       + sizes[4]);
+  FILE *file = fopen (path, "wb");
+  if (!file)
+  {
+    free (payload_offsets);
+    return false;
+  }
+  uint64_t written = 0;
+  bool success = write_section (file, &written, 0, &header, sizeof (header))
+                 && write_section (file, &written, header.row_offsets_offset,
+                                   compiled_chain->row_offsets, sizes[0])
+                 && write_section (file, &written, header.successors_offset,
+                                   compiled_chain->successors, sizes[1])
+                 && write_section (file, &written,
+                                   header.start_states_offset,
+                                   compiled_chain->start_states, sizes[2])
+                 && write_section (file, &written, header.last_states_offset,
+                                   compiled_chain->last_states, sizes[3])
+                 && write_section (file, &written,
+                                   header.payload_offsets_offset,
+                                   payload_offsets, sizes[4]);
+  for (uint32_t i = 0; success && i < compiled_chain->num_states; i++)
+  {
+    void *data = compiled_chain->data[i];
+    success = write_section (file, &written,
+                             header.payloads_offset + payload_offsets[i],
+                             data, payload_size (data));
+  }
+  free (payload_offsets);
+  success = success && pad_to (file, written, header.payloads_offset
+                                              + header.payloads_size);
+  if (fclose (file) == EOF)
+  {
+    success = false;
+  }
+  return success;
+}
+
+bool is_snapshot(int fd)
+{
+  char magic[MAGIC_LENGTH];
+  return pread (fd, magic, MAGIC_LENGTH, 0) == MAGIC_LENGTH
+         && memcmp (magic, SNAPSHOT_MAGIC, MAGIC_LENGTH) == 0;
+}
+
+CompiledChain *load_snapshot(int fd, format_function format_func)
+{
+  struct stat file_stat;
+  if (fstat (fd, &file_stat) == -1
+      || (size_t) file_stat.st_size < sizeof (SnapshotHeader))
+  {
+    return NULL;
+  }
+  size_t size = (size_t) file_stat.st_size;
+  void *mapping = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED)
+  {
+    return NULL;
+  }
+  const SnapshotHeader *header = mapping;
+  const unsigned char *base = mapping;
+  if (memcmp (header->magic, SNAPSHOT_MAGIC, MAGIC_LENGTH) != 0
+      || header->version != SNAPSHOT_VERSION
+      || header->byte_order != BYTE_ORDER_MARK
+      || header->num_states >= NO_STATE
+      || header->num_start_states > header->num_states
+      || header->num_successors > UINT32_MAX
+      || !is_in_mapping (size, header->row_offsets_offset,
+                         header->num_states + 1, sizeof (uint32_t))
+      || !is_in_mapping (size, header->successors_offset,
+                         header->num_successors, sizeof (CompiledSuccessor))
+      || !is_in_mapping (size, header->start_states_offset,
+                         header->num_start_states, sizeof (uint32_t))
+      || !is_in_mapping (size, header->last_states_offset,
+                         last_states_words (header->num_states),
+                         sizeof (uint64_t))
+      || !is_in_mapping (size, header->payload_offsets_offset,
+                         header->num_states, sizeof (uint64_t))
+      || !is_in_mapping (size, header->payloads_offset,
+                         header->payloads_size, 1)
+      || ((const uint32_t *) (base + header->row_offsets_offset))
+         [header->num_states] != header->num_successors)
+  {
+    munmap (mapping, size);
+    return NULL;
+  }
+  CompiledChain *compiled_chain = calloc (1, sizeof (CompiledChain));
+  if (!compiled_chain)
+  {
+    munmap (mapping, size);
+    return NULL;
+  }
+  *compiled_chain = (CompiledChain) {
+      (uint32_t) header->num_states, (uint32_t) header->num_start_states,
+      header->num_successors,
+      (const uint32_t *) (base + header->row_offsets_offset),
+      (const CompiledSuccessor *) (base + header->successors_offset),
+      (const uint32_t *) (base + header->start_states_offset),
+      (const uint64_t *) (base + header->last_states_offset),
+      NULL, (const uint64_t *) (base + header->payload_offsets_offset),
+      base + header->payloads_offset, format_func, NULL, NULL, mapping, size};
+  return compiled_chain;
+}
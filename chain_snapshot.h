@@ -0,0 +1,65 @@
+#ifndef _CHAIN_SNAPSHOT_H_
+#define _CHAIN_SNAPSHOT_H_
+#include <stdint.h> // for uint32_t, uint64_t
+#include "markov_chain.h"
+#include "compiled_chain.h"
+
+#define SNAPSHOT_VERSION 2
+
+typedef size_t (*size_function) (void*);
+
+/**
+ * Header at the start of a snapshot file. All offsets are in bytes from the
+ * start of the file, and all the numbers are in the byte order of the
+ * machine that wrote the file (checked by byte_order).
+ * The file holds the arrays of a compiled chain (see compiled_chain.h), and
+ * instead of pointers to the states' data, their offsets in a blob of
+ * payloads.
+ */
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t num_states;
+    uint64_t num_start_states;
+    uint64_t num_successors;
+    uint64_t payloads_size;
+    uint64_t row_offsets_offset;
+    uint64_t successors_offset;
+    uint64_t start_states_offset;
+    uint64_t last_states_offset;
+    uint64_t payload_offsets_offset;
+    uint64_t payloads_offset;
+} SnapshotHeader;
+
+/**
+ * Write a snapshot of a compiled chain to a file. The data of the states
+ * must be plain data (no pointers), payload_size tells its size.
+ * @param compiled_chain the chain to save, made by compile_chain
+ * @param payload_size returns the size in bytes of a state's data
+ * @param path path of the file to write
+ * @return true on success, false if the file couldn't be written
+ */
+bool save_snapshot(const CompiledChain *compiled_chain,
+                   size_function payload_size, const char *path);
+
+/**
+ * Check if a file is a markov chain snapshot (by its magic), without
+ * changing its offset.
+ * @param fd descriptor of the file, open for reading
+ * @return true if it is a snapshot, false otherwise
+ */
+bool is_snapshot(int fd);
+
+/**
+ * Map a snapshot file to memory as a compiled chain. Its arrays point into
+ * the mapping, so nothing is deserialized. The header and the bounds of the
+ * arrays are checked, the contents of the arrays are trusted.
+ * @param fd descriptor of the snapshot file, open for reading
+ * @param format_func formats a state's data
+ * @return the compiled chain (free it with free_compiled_chain), NULL if the
+ * file couldn't be mapped or isn't a valid snapshot of this version
+ */
+CompiledChain *load_snapshot(int fd, format_function format_func);
+
+#endif //_CHAIN_SNAPSHOT_H_
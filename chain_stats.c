@@ -0,0 +1,239 @@
+#define _POSIX_C_SOURCE 200809L
+#include "chain_stats.h"
+#include "markov_chain.h"
+#include "compiled_chain.h"
+#include <string.h> // For memset()
+#include <time.h> // For clock_gettime()
+
+// fanouts are ints, so they fall in at most this many power of 2 buckets
+#define NUM_FANOUT_BUCKETS 33
+#define BITS_PER_WORD 64
+#define NANOSECONDS 1e9
+
+static const char *const COUNTER_NAMES[NUM_STATS_COUNTERS] = {
+    "lookups", "lookup_probes", "comparisons", "states_added", "transitions",
+    "successors_added", "successor_probes", "list_reallocs", "first_draws",
+    "next_draws", "linear_draws", "compiled_draws", "binary_searches"};
+
+static const char *const PHASE_NAMES[NUM_STATS_PHASES] = {
+    "build", "merge", "freeze", "compile", "generate", "free"};
+
+/**
+ * The memory of a chain's structures, in bytes.
+ */
+typedef struct ChainMemory {
+    size_t arena; // reserved by the arena: nodes, plain data, frozen lists
+    size_t frequencies_lists;
+    size_t successor_indexes;
+    size_t alias_tables;
+    size_t state_arrays; // states, start states, dirty states and last bits
+    size_t state_index;
+} ChainMemory;
+
+#ifdef MARKOV_STATS
+
+uint64_t stats_counters[NUM_STATS_COUNTERS];
+uint64_t stats_phase_nanoseconds[NUM_STATS_PHASES];
+
+uint64_t stats_now(void)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * (uint64_t) NANOSECONDS
+         + (uint64_t) now.tv_nsec;
+}
+
+#endif
+
+/**
+ * measures the memory of a chain's structures, and counts its states by
+ * fanout
+ * @param markov_chain the chain
+ * @param memory set to the memory of its structures
+ * @param fanouts set to the number of states in every fanout bucket
+ */
+static void measure_chain(const MarkovChain *markov_chain, ChainMemory *memory,
+                          uint64_t fanouts[NUM_FANOUT_BUCKETS]);
+
+/**
+ * gets the bucket of a fanout
+ * @param fanout the fanout
+ * @return 0 for 0, otherwise the number of bits of the fanout
+ */
+static int get_fanout_bucket(int fanout);
+
+/**
+ * writes the counters and the phase times, if they are compiled in
+ * @param out the buffer to write to
+ * @return true on success, false in case of allocation error
+ */
+static bool write_counters(OutputBuffer *out);
+
+/**
+ * writes the memory of a compiled chain's arrays
+ * @param compiled_chain the chain
+ * @param out the buffer to write to
+ * @return true on success, false in case of allocation error
+ */
+static bool write_compiled_memory(const CompiledChain *compiled_chain,
+                                  OutputBuffer *out);
+
+static int get_fanout_bucket(int fanout)
+{
+  int bucket = 0;
+  while (fanout > 0)
+  {
+    bucket++;
+    fanout >>= 1;
+  }
+  return bucket;
+}
+
+static void measure_chain(const MarkovChain *markov_chain, ChainMemory *memory,
+                          uint64_t fanouts[NUM_FANOUT_BUCKETS])
+{
+  *memory = (ChainMemory) {0};
+  memset (fanouts, 0, NUM_FANOUT_BUCKETS * sizeof (uint64_t));
+  int num_states = markov_chain->database->size;
+  if (markov_chain->arena)
+  {
+    memory->arena = markov_chain->arena->total_size;
+  }
+  for (int id = 0; id < num_states; id++)
+  {
+    const MarkovNode *markov_node = markov_chain->states[id];
+    fanouts[get_fanout_bucket (markov_node->frequencies_list_length)]++;
+    memory->successor_indexes += (size_t) markov_node
+        ->successor_index_capacity * sizeof (int);
+    if (markov_node->lists_in_arena)
+    {
+      continue;
+    }
+    memory->frequencies_lists += (size_t) markov_node
+        ->frequencies_list_capacity * sizeof (MarkovNodeFrequency);
+    if (markov_node->alias_table)
+    {
+      memory->alias_tables += (size_t) markov_node->frequencies_list_length
+                              * sizeof (AliasEntry);
+    }
+  }
+  memory->state_arrays = ((size_t) markov_chain->states_capacity
+                          + (size_t) markov_chain->start_states_capacity
+                          + (size_t) markov_chain->dirty_states_capacity)
+                         * sizeof (MarkovNode *)
+                         + ((size_t) markov_chain->states_capacity
+                            + BITS_PER_WORD - 1) / BITS_PER_WORD
+                           * sizeof (uint64_t);
+  if (markov_chain->index)
+  {
+    memory->state_index = sizeof (StateIndex) + markov_chain->index->capacity
+                                                * sizeof (StateIndexSlot);
+  }
+}
+
+static bool write_counters(OutputBuffer *out)
+{
+#ifdef MARKOV_STATS
+  if (!output_buffer_append_string (out, "\"enabled\": true,\n"
+                                         "  \"counters\": {"))
+  {
+    return false;
+  }
+  for (int i = 0; i < NUM_STATS_COUNTERS; i++)
+  {
+    uint64_t value = __atomic_load_n (stats_counters + i, __ATOMIC_RELAXED);
+    if (!output_buffer_printf (out, "%s\"%s\": %llu", i ? ", " : "",
+                               COUNTER_NAMES[i], (unsigned long long) value))
+    {
+      return false;
+    }
+  }
+  if (!output_buffer_append_string (out, "},\n  \"phase_seconds\": {"))
+  {
+    return false;
+  }
+  for (int i = 0; i < NUM_STATS_PHASES; i++)
+  {
+    uint64_t value = __atomic_load_n (stats_phase_nanoseconds + i,
+                                      __ATOMIC_RELAXED);
+    if (!output_buffer_printf (out, "%s\"%s\": %.6f", i ? ", " : "",
+                               PHASE_NAMES[i], (double) value / NANOSECONDS))
+    {
+      return false;
+    }
+  }
+  return output_buffer_append_string (out, "}");
+#else
+  (void) COUNTER_NAMES;
+  (void) PHASE_NAMES;
+  return output_buffer_append_string (out, "\"enabled\": false");
+#endif
+}
+
+static bool write_compiled_memory(const CompiledChain *compiled_chain,
+                                  OutputBuffer *out)
+{
+  size_t num_states = compiled_chain->num_states;
+  size_t size = compiled_chain->mapping_size;
+  if (!compiled_chain->mapping)
+  {
+    size = (num_states + 1) * sizeof (uint32_t)
+           + compiled_chain->num_successors * sizeof (CompiledSuccessor)
+           + compiled_chain->num_start_states * sizeof (uint32_t)
+           + (num_states + BITS_PER_WORD - 1) / BITS_PER_WORD
+             * sizeof (uint64_t)
+           + num_states * sizeof (void *);
+  }
+  if (compiled_chain->compiled_ids)
+  {
+    size += num_states * sizeof (uint32_t);
+  }
+  return output_buffer_printf (out, ",\n  \"compiled_chain\": {\"states\": "
+                                    "%zu, \"successors\": %llu, \"bytes\": "
+                                    "%zu, \"mapped\": %s}", num_states,
+                               (unsigned long long) compiled_chain
+                                   ->num_successors, size,
+                               compiled_chain->mapping ? "true" : "false");
+}
+
+bool write_chain_stats(const MarkovChain *markov_chain,
+                       const CompiledChain *compiled_chain, int fd)
+{
+  OutputBuffer out = {0};
+  bool success = output_buffer_append_string (&out, "{\n  ")
+                 && write_counters (&out);
+  if (success && markov_chain)
+  {
+    ChainMemory memory;
+    uint64_t fanouts[NUM_FANOUT_BUCKETS];
+    measure_chain (markov_chain, &memory, fanouts);
+    success = output_buffer_printf
+        (&out, ",\n  \"states\": %d,\n  \"memory\": {\"arena\": %zu, "
+               "\"frequencies_lists\": %zu, \"successor_indexes\": %zu, "
+               "\"alias_tables\": %zu, \"state_arrays\": %zu, "
+               "\"state_index\": %zu},\n"
+               "  \"fanout_histogram\": [", markov_chain->database->size,
+         memory.arena, memory.frequencies_lists,
+         memory.successor_indexes, memory.alias_tables, memory.state_arrays,
+         memory.state_index);
+    int num_buckets = NUM_FANOUT_BUCKETS;
+    while (num_buckets > 1 && fanouts[num_buckets - 1] == 0)
+    {
+      num_buckets--;
+    }
+    for (int i = 0; success && i < num_buckets; i++)
+    {
+      success = output_buffer_printf (&out, "%s%llu", i ? ", " : "",
+                                      (unsigned long long) fanouts[i]);
+    }
+    success = success && output_buffer_append_string (&out, "]");
+  }
+  if (success && compiled_chain)
+  {
+    success = write_compiled_memory (compiled_chain, &out);
+  }
+  success = success && output_buffer_append_string (&out, "\n}\n")
+            && output_buffer_flush (&out, fd);
+  output_buffer_free (&out);
+  return success;
+}
@@ -0,0 +1,90 @@
+#ifndef _CHAIN_STATS_H_
+#define _CHAIN_STATS_H_
+#include <stdbool.h> // for bool
+#include <stdint.h> // for uint64_t
+
+/**
+ * Optional counters of the chain's hot paths, and the time spent in each
+ * phase of a chain's life. They are compiled in only if MARKOV_STATS is
+ * defined (e.g. make CFLAGS="... -DMARKOV_STATS"); otherwise the macros
+ * below are empty and cost nothing. The counters are global, summed over
+ * all the chains and threads with relaxed atomic additions, so counting
+ * slows down the parallel phases.
+ */
+
+typedef enum StatsCounter {
+    STATS_LOOKUPS, // get_node_from_database calls
+    STATS_LOOKUP_PROBES, // index slots or list nodes the lookups visited
+    STATS_COMPARISONS, // comp_func calls of the lookups
+    STATS_STATES_ADDED,
+    STATS_TRANSITIONS, // add_transitions calls
+    STATS_SUCCESSORS_ADDED, // transitions that made a new list entry
+    STATS_SUCCESSOR_PROBES, // list entries or index slots find_successor read
+    STATS_LIST_REALLOCS, // reallocations of growing frequencies lists
+    STATS_FIRST_DRAWS, // random first states, of chains or compiled chains
+    STATS_NEXT_DRAWS, // get_next_random_node calls
+    STATS_LINEAR_DRAWS, // of them, the ones without an alias table
+    STATS_COMPILED_DRAWS, // draws of compiled chains' successors
+    STATS_BINARY_SEARCHES, // of them, by frequency, the ones that passed
+                          // the linear prefix
+    NUM_STATS_COUNTERS
+} StatsCounter;
+
+typedef enum StatsPhase {
+    STATS_PHASE_BUILD, // counting the corpus, summed over threads
+    STATS_PHASE_MERGE, // merging shards of a parallel build
+    STATS_PHASE_FREEZE,
+    STATS_PHASE_COMPILE,
+    STATS_PHASE_GENERATE, // print_walks
+    STATS_PHASE_FREE, // free_database and free_compiled_chain
+    NUM_STATS_PHASES
+} StatsPhase;
+
+#ifdef MARKOV_STATS
+
+extern uint64_t stats_counters[NUM_STATS_COUNTERS];
+extern uint64_t stats_phase_nanoseconds[NUM_STATS_PHASES];
+
+/**
+ * Get the time of a monotonic clock, to time a phase.
+ * @return the time in nanoseconds
+ */
+uint64_t stats_now(void);
+
+#define STATS_ADD(counter, amount) \
+  __atomic_fetch_add (stats_counters + (counter), (uint64_t) (amount), \
+                      __ATOMIC_RELAXED)
+#define STATS_COUNT(counter) STATS_ADD (counter, 1)
+// a phase is timed from its BEGIN to its END in the same block
+#define STATS_PHASE_BEGIN(phase) uint64_t stats_start_##phase = stats_now ()
+#define STATS_PHASE_END(phase) \
+  __atomic_fetch_add (stats_phase_nanoseconds + (phase), \
+                      stats_now () - stats_start_##phase, __ATOMIC_RELAXED)
+
+#else
+
+#define STATS_ADD(counter, amount) ((void) 0)
+#define STATS_COUNT(counter) ((void) 0)
+#define STATS_PHASE_BEGIN(phase) ((void) 0)
+#define STATS_PHASE_END(phase) ((void) 0)
+
+#endif
+
+struct MarkovChain;
+struct CompiledChain;
+
+/**
+ * Write the statistics of a chain as JSON: the counters and the phase times
+ * (if compiled in), the memory of each of the chain's structures, and the
+ * histogram of its states' fanouts (numbers of successors). Fanout bucket i
+ * counts the states with a fanout in [2^(i-1), 2^i), bucket 0 those with
+ * none.
+ * @param markov_chain the chain, NULL to leave its memory and fanouts out
+ * @param compiled_chain a compiled chain, NULL to leave its memory out
+ * @param fd file descriptor to write to
+ * @return true on success, false in case of allocation or write error
+ */
+bool write_chain_stats(const struct MarkovChain *markov_chain,
+                       const struct CompiledChain *compiled_chain, int fd);
+
+#endif //_CHAIN_STATS_H_
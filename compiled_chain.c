@@ -0,0 +1,771 @@
+#define _POSIX_C_SOURCE 200809L
+#include "compiled_chain.h"
+#include "chain_stats.h"
+#include <math.h> // For pow()
+#include <sys/mman.h> // For munmap()
+
+// the first successors of a row are scanned, the rest are binary searched
+#define LINEAR_SEARCH_LENGTH 8
+// filtered draws first try this many unfiltered draws, then draw among the
+// allowed successors
+#define FILTERED_DRAW_ATTEMPTS 4
+#define BITS_PER_WORD 64
+
+/**
+ * compares two successors of a row, most frequent first (ties by state id,
+ * so the order doesn't depend on qsort)
+ * @param first the first CompiledSuccessor, frequency in
+ * cumulative_frequency
+ * @param second the second one
+ * @return negative if the first comes first, positive otherwise
+ */
+static int compare_successors(const void *first, const void *second);
+
+/**
+ * copies the frequencies lists of the chain into rows (by the chain's ids),
+ * each sorted from the most frequent successor
+ * @param markov_chain the chain
+ * @param offsets set to the row offsets, num_states + 1 entries
+ * @param rows set to the rows, with the successors' ids in state and their
+ * frequencies in cumulative_frequency
+ */
+static void sort_rows(const MarkovChain *markov_chain, uint32_t *offsets,
+                      CompiledSuccessor *rows);
+
+/**
+ * numbers the states in breadth first order over the sorted rows, from the
+ * start states in their order (and then from any state not reached yet)
+ * @param markov_chain the chain
+ * @param offsets the row offsets of sort_rows
+ * @param rows the rows of sort_rows
+ * @param compiled_ids set to the new id of every state, by its old id
+ * @param order set to the old id of every state, by its new id
+ */
+static void renumber_states(const MarkovChain *markov_chain,
+                            const uint32_t *offsets,
+                            const CompiledSuccessor *rows,
+                            uint32_t *compiled_ids, uint32_t *order);
+
+/**
+ * builds the compiled chain of a built markov chain, see compile_chain
+ * (which times it)
+ * @param markov_chain the chain to compile
+ * @return the compiled chain, NULL in case of allocation error or if the
+ * chain is too large
+ */
+static CompiledChain *build_compiled_chain(const MarkovChain *markov_chain);
+
+/**
+ * finds the successor a number drawn from [0, the cumulative frequency of a
+ * row's prefix) falls on: a linear scan of the first successors, then a
+ * binary search
+ * @param row the row
+ * @param length length of the prefix, positive
+ * @param num the drawn number
+ * @return the place in the row of the first successor whose cumulative
+ * frequency is bigger than num
+ */
+static uint32_t search_frequencies(const CompiledSuccessor *row,
+                                   uint32_t length, uint32_t num);
+
+/**
+ * finds the length of a row's nucleus: its fewest first successors whose
+ * cumulative frequency is at least a fraction of the row's
+ * @param row the row
+ * @param length length of the row, positive
+ * @param top_p the fraction
+ * @return the length of the nucleus
+ */
+static uint32_t get_frequencies_nucleus(const CompiledSuccessor *row,
+                                        uint32_t length, double top_p);
+
+/**
+ * finds the length of a row's nucleus like get_frequencies_nucleus, by its
+ * cumulative weights
+ * @param weights the cumulative weights of the row
+ * @param length length of the row, positive
+ * @param top_p the fraction
+ * @return the length of the nucleus
+ */
+static uint32_t get_weights_nucleus(const double *weights, uint32_t length,
+                                    double top_p);
+
+/**
+ * finds the successor a number drawn from [0, the cumulative weight of a
+ * row's prefix) falls on, by binary search
+ * @param weights the cumulative weights of the row
+ * @param length length of the prefix, positive
+ * @param num the drawn number
+ * @return the place in the row of the first successor whose cumulative
+ * weight is bigger than num
+ */
+static uint32_t search_weights(const double *weights, uint32_t length,
+                               double num);
+
+/**
+ * finds the length of the prefix of a state's row that a sampler draws
+ * from, after its top-k and top-p truncations
+ * @param sampler the sampler
+ * @param state id of the state, must have successors
+ * @return the length of the prefix
+ */
+static uint32_t get_prefix_length(const Sampler *sampler, uint32_t state);
+
+/**
+ * gets the weight of a successor of a row: its frequency, or its tempered
+ * weight
+ * @param row the row
+ * @param weights the cumulative weights of the row, NULL for frequencies
+ * @param place place of the successor in the row
+ * @return the weight
+ */
+static double get_successor_weight(const CompiledSuccessor *row,
+                                   const double *weights, uint32_t place);
+
+/**
+ * sums the weights of the successors a filter allows in a range of a row
+ * @param row the row
+ * @param weights the cumulative weights of the row, NULL for frequencies
+ * @param begin place of the range's first successor
+ * @param end place past the range's last successor
+ * @param is_allowed the filter
+ * @param context passed to the filter
+ * @param first_allowed set to the place of the first allowed successor,
+ * NO_STATE if none is
+ * @return the sum of their weights
+ */
+static double get_allowed_weight(const CompiledSuccessor *row,
+                                 const double *weights, uint32_t begin,
+                                 uint32_t end, successor_filter is_allowed,
+                                 const void *context,
+                                 uint32_t *first_allowed);
+
+static int compare_successors(const void *first, const void *second)
+{
+  const CompiledSuccessor *first_successor = first;
+  const CompiledSuccessor *second_successor = second;
+  if (first_successor->cumulative_frequency
+      != second_successor->cumulative_frequency)
+  {
+    return first_successor->cumulative_frequency
+           > second_successor->cumulative_frequency ? -1 : 1;
+  }
+  return first_successor->state < second_successor->state ? -1 : 1;
+}
+
+static void sort_rows(const MarkovChain *markov_chain, uint32_t *offsets,
+                      CompiledSuccessor *rows)
+{
+  uint32_t position = 0;
+  for (int i = 0; i < markov_chain->database->size; i++)
+  {
+    MarkovNode *markov_node = markov_chain->states[i];
+    offsets[i] = position;
+    for (int j = 0; j < markov_node->frequencies_list_length; j++)
+    {
+      MarkovNodeFrequency *entry = markov_node->frequencies_list + j;
+      rows[position + j] = (CompiledSuccessor) {
+          (uint32_t) entry->markov_node->id, (uint32_t) entry->frequency};
+    }
+    qsort (rows + position, markov_node->frequencies_list_length,
+           sizeof (CompiledSuccessor), compare_successors);
+    position += markov_node->frequencies_list_length;
+  }
+  offsets[markov_chain->database->size] = position;
+}
+
+static void renumber_states(const MarkovChain *markov_chain,
+                            const uint32_t *offsets,
+                            const CompiledSuccessor *rows,
+                            uint32_t *compiled_ids, uint32_t *order)
+{
+  uint32_t num_states = (uint32_t) markov_chain->database->size;
+  for (uint32_t i = 0; i < num_states; i++)
+  {
+    compiled_ids[i] = NO_STATE;
+  }
+  uint32_t size = 0, head = 0;
+  int next_start = 0;
+  uint32_t next_state = 0;
+  while (size < num_states)
+  {
+    if (head == size)
+    {
+      // the queue is empty, start from the next state not reached yet
+      while (next_start < markov_chain->start_states_size
+             && compiled_ids[markov_chain->start_states[next_start]->id]
+                != NO_STATE)
+      {
+        next_start++;
+      }
+      uint32_t root;
+      if (next_start < markov_chain->start_states_size)
+      {
+        root = (uint32_t) markov_chain->start_states[next_start]->id;
+      }
+      else
+      {
+        while (compiled_ids[next_state] != NO_STATE)
+        {
+          next_state++;
+        }
+        root = next_state;
+      }
+      compiled_ids[root] = size;
+      order[size++] = root;
+    }
+    uint32_t cur = order[head++];
+    for (uint32_t i = offsets[cur]; i < offsets[cur + 1]; i++)
+    {
+      if (compiled_ids[rows[i].state] == NO_STATE)
+      {
+        compiled_ids[rows[i].state] = size;
+        order[size++] = rows[i].state;
+      }
+    }
+  }
+}
+
+CompiledChain *compile_chain(const MarkovChain *markov_chain)
+{
+  STATS_PHASE_BEGIN (STATS_PHASE_COMPILE);
+  CompiledChain *compiled_chain = build_compiled_chain (markov_chain);
+  STATS_PHASE_END (STATS_PHASE_COMPILE);
+  return compiled_chain;
+}
+
+static CompiledChain *build_compiled_chain(const MarkovChain *markov_chain)
+{
+  uint64_t num_states = (uint64_t) markov_chain->database->size;
+  uint64_t num_successors = 0;
+  for (uint64_t i = 0; i < num_states; i++)
+  {
+    num_successors += (uint64_t) markov_chain->states[i]
+        ->frequencies_list_length;
+  }
+  if (num_states >= NO_STATE || num_successors > UINT32_MAX)
+  {
+    return NULL;
+  }
+  CompiledChain *compiled_chain = calloc (1, sizeof (CompiledChain));
+  if (!compiled_chain)
+  {
+    return NULL;
+  }
+  uint64_t num_words = (num_states + BITS_PER_WORD - 1) / BITS_PER_WORD;
+  uint32_t *row_offsets = malloc ((num_states + 1) * sizeof (uint32_t));
+  CompiledSuccessor *successors = malloc ((num_successors + 1)
+                                          * sizeof (CompiledSuccessor));
+  uint32_t *start_states = malloc ((markov_chain->start_states_size + 1)
+                                   * sizeof (uint32_t));
+  uint64_t *last_states = calloc (num_words + 1, sizeof (uint64_t));
+  void **data = malloc ((num_states + 1) * sizeof (void *));
+  uint32_t *compiled_ids = malloc ((num_states + 1) * sizeof (uint32_t));
+  *compiled_chain = (CompiledChain) {
+      (uint32_t) num_states, (uint32_t) markov_chain->start_states_size,
+      num_successors, row_offsets, successors, start_states, last_states,
+      data, NULL, NULL, markov_chain->print_func,
+      markov_chain->format_start_func, compiled_ids, NULL, 0};
+  // the rows by the chain's ids, and the chain's id of every new id
+  uint32_t *offsets = malloc ((num_states + 1) * sizeof (uint32_t));
+  CompiledSuccessor *rows = malloc ((num_successors + 1)
+                                    * sizeof (CompiledSuccessor));
+  uint32_t *order = malloc ((num_states + 1) * sizeof (uint32_t));
+  if (!row_offsets || !successors || !start_states || !last_states || !data
+      || !compiled_ids || !offsets || !rows || !order)
+  {
+    free (offsets);
+    free (rows);
+    free (order);
+    free_compiled_chain (&compiled_chain);
+    return NULL;
+  }
+  sort_rows (markov_chain, offsets, rows);
+  renumber_states (markov_chain, offsets, rows, compiled_ids, order);
+  uint32_t position = 0;
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    uint32_t old_state = order[state];
+    MarkovNode *markov_node = markov_chain->states[old_state];
+    row_offsets[state] = position;
+    uint32_t cumulative_frequency = 0;
+    for (uint32_t i = offsets[old_state]; i < offsets[old_state + 1]; i++)
+    {
+      cumulative_frequency += rows[i].cumulative_frequency;
+      successors[position++] = (CompiledSuccessor) {
+          compiled_ids[rows[i].state], cumulative_frequency};
+    }
+    if (is_last_state (markov_chain, markov_node))
+    {
+      last_states[state / BITS_PER_WORD] |= (uint64_t) 1
+                                            << (state % BITS_PER_WORD);
+    }
+    data[state] = markov_node->data;
+  }
+  row_offsets[num_states] = position;
+  for (int i = 0; i < markov_chain->start_states_size; i++)
+  {
+    start_states[i] = compiled_ids[markov_chain->start_states[i]->id];
+  }
+  free (offsets);
+  free (rows);
+  free (order);
+  return compiled_chain;
+}
+
+bool add_compiled_chain(MarkovChain *markov_chain,
+                        const CompiledChain *compiled_chain)
+{
+  MarkovNode **nodes = malloc ((compiled_chain->num_states + 1)
+                               * sizeof (MarkovNode *));
+  if (!nodes)
+  {
+    return false;
+  }
+  bool success = true;
+  for (uint32_t state = 0; success && state < compiled_chain->num_states;
+       state++)
+  {
+    Node *node = add_to_database (markov_chain,
+                                  get_compiled_data (compiled_chain, state));
+    success = node != NULL;
+    nodes[state] = success ? node->data : NULL;
+  }
+  for (uint32_t state = 0; success && state < compiled_chain->num_states;
+       state++)
+  {
+    uint32_t previous = 0;
+    for (uint32_t i = compiled_chain->row_offsets[state];
+         success && i < compiled_chain->row_offsets[state + 1]; i++)
+    {
+      const CompiledSuccessor *successor = compiled_chain->successors + i;
+      success = add_transitions (nodes[state], nodes[successor->state],
+                                 markov_chain,
+                                 (int) (successor->cumulative_frequency
+                                        - previous));
+      previous = successor->cumulative_frequency;
+    }
+  }
+  free (nodes);
+  return success;
+}
+
+uint32_t get_compiled_state(const CompiledChain *compiled_chain,
+                            const MarkovNode *markov_node)
+{
+  return compiled_chain->compiled_ids[markov_node->id];
+}
+
+uint32_t find_compiled_state(const CompiledChain *compiled_chain, void *data,
+                             compare_function comp_func)
+{
+  for (uint32_t state = 0; state < compiled_chain->num_states; state++)
+  {
+    if (comp_func (get_compiled_data (compiled_chain, state), data) == 0)
+    {
+      return state;
+    }
+  }
+  return NO_STATE;
+}
+
+void *get_compiled_data(const CompiledChain *compiled_chain, uint32_t state)
+{
+  if (compiled_chain->data)
+  {
+    return compiled_chain->data[state];
+  }
+  return (void *) (compiled_chain->payloads
+                   + compiled_chain->payload_offsets[state]);
+}
+
+bool is_compiled_last(const CompiledChain *compiled_chain, uint32_t state)
+{
+  return (compiled_chain->last_states[state / BITS_PER_WORD]
+          >> (state % BITS_PER_WORD)) & 1;
+}
+
+uint32_t get_num_successors(const CompiledChain *compiled_chain,
+                            uint32_t state)
+{
+  return compiled_chain->row_offsets[state + 1]
+         - compiled_chain->row_offsets[state];
+}
+
+uint32_t get_first_compiled_state(const CompiledChain *compiled_chain,
+                                  RandomState *rng)
+{
+  if (compiled_chain->num_start_states == 0)
+  {
+    return NO_STATE;
+  }
+  STATS_COUNT (STATS_FIRST_DRAWS);
+  return compiled_chain->start_states[get_bounded_random
+      (rng, compiled_chain->num_start_states)];
+}
+
+uint32_t get_next_compiled_state(const CompiledChain *compiled_chain,
+                                 uint32_t state, RandomState *rng)
+{
+  STATS_COUNT (STATS_COMPILED_DRAWS);
+  const CompiledSuccessor *row = compiled_chain->successors
+                                 + compiled_chain->row_offsets[state];
+  uint32_t length = get_num_successors (compiled_chain, state);
+  uint32_t num = (uint32_t) get_bounded_random
+      (rng, row[length - 1].cumulative_frequency);
+  return row[search_frequencies (row, length, num)].state;
+}
+
+static uint32_t search_frequencies(const CompiledSuccessor *row,
+                                   uint32_t length, uint32_t num)
+{
+  uint32_t low = 0;
+  for (; low < length && low < LINEAR_SEARCH_LENGTH; low++)
+  {
+    if (row[low].cumulative_frequency > num)
+    {
+      return low;
+    }
+  }
+  STATS_COUNT (STATS_BINARY_SEARCHES);
+  uint32_t high = length - 1;
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    if (row[middle].cumulative_frequency > num)
+    {
+      high = middle;
+    }
+    else
+    {
+      low = middle + 1;
+    }
+  }
+  return low;
+}
+
+static uint32_t get_frequencies_nucleus(const CompiledSuccessor *row,
+                                        uint32_t length, double top_p)
+{
+  double threshold = top_p * (double) row[length - 1].cumulative_frequency;
+  uint32_t low = 0, high = length - 1;
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    if ((double) row[middle].cumulative_frequency >= threshold)
+    {
+      high = middle;
+    }
+    else
+    {
+      low = middle + 1;
+    }
+  }
+  return low + 1;
+}
+
+static uint32_t get_weights_nucleus(const double *weights, uint32_t length,
+                                    double top_p)
+{
+  double threshold = top_p * weights[length - 1];
+  uint32_t low = 0, high = length - 1;
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    if (weights[middle] >= threshold)
+    {
+      high = middle;
+    }
+    else
+    {
+      low = middle + 1;
+    }
+  }
+  return low + 1;
+}
+
+static uint32_t search_weights(const double *weights, uint32_t length,
+                               double num)
+{
+  // the last successor of the prefix also takes a num rounded up to its
+  // cumulative weight
+  uint32_t low = 0, high = length - 1;
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    if (weights[middle] > num)
+    {
+      high = middle;
+    }
+    else
+    {
+      low = middle + 1;
+    }
+  }
+  return low;
+}
+
+Sampler *create_sampler(const CompiledChain *compiled_chain,
+                        SamplingParameters parameters)
+{
+  Sampler *sampler = calloc (1, sizeof (Sampler));
+  if (!sampler)
+  {
+    return NULL;
+  }
+  sampler->compiled_chain = compiled_chain;
+  sampler->parameters = parameters;
+  if (parameters.temperature == DEFAULT_TEMPERATURE
+      || parameters.temperature == 0)
+  {
+    return sampler;
+  }
+  double *weights = malloc ((compiled_chain->num_successors + 1)
+                            * sizeof (double));
+  if (!weights)
+  {
+    free (sampler);
+    return NULL;
+  }
+  // relative to the most frequent successor, so no weight overflows
+  double exponent = 1 / parameters.temperature;
+  for (uint32_t state = 0; state < compiled_chain->num_states; state++)
+  {
+    uint32_t start = compiled_chain->row_offsets[state];
+    uint32_t end = compiled_chain->row_offsets[state + 1];
+    const CompiledSuccessor *row = compiled_chain->successors + start;
+    double most_frequent = start < end ? row[0].cumulative_frequency : 1;
+    uint32_t previous = 0;
+    double sum = 0;
+    for (uint32_t i = 0; i < end - start; i++)
+    {
+      sum += pow ((row[i].cumulative_frequency - previous) / most_frequent,
+                  exponent);
+      weights[start + i] = sum;
+      previous = row[i].cumulative_frequency;
+    }
+  }
+  sampler->cumulative_weights = weights;
+  return sampler;
+}
+
+static uint32_t get_prefix_length(const Sampler *sampler, uint32_t state)
+{
+  const CompiledChain *compiled_chain = sampler->compiled_chain;
+  const SamplingParameters *parameters = &sampler->parameters;
+  uint32_t offset = compiled_chain->row_offsets[state];
+  uint32_t length = get_num_successors (compiled_chain, state);
+  uint32_t prefix = length;
+  if (parameters->top_k != NO_TOP_K && parameters->top_k < prefix)
+  {
+    prefix = parameters->top_k;
+  }
+  if (parameters->top_p < NO_TOP_P)
+  {
+    uint32_t nucleus = sampler->cumulative_weights
+                       ? get_weights_nucleus (sampler->cumulative_weights
+                                              + offset, length,
+                                              parameters->top_p)
+                       : get_frequencies_nucleus (compiled_chain->successors
+                                                  + offset, length,
+                                                  parameters->top_p);
+    prefix = nucleus < prefix ? nucleus : prefix;
+  }
+  return prefix;
+}
+
+static double get_successor_weight(const CompiledSuccessor *row,
+                                   const double *weights, uint32_t place)
+{
+  if (weights)
+  {
+    return weights[place] - (place > 0 ? weights[place - 1] : 0);
+  }
+  return row[place].cumulative_frequency
+         - (place > 0 ? row[place - 1].cumulative_frequency : 0);
+}
+
+static double get_allowed_weight(const CompiledSuccessor *row,
+                                 const double *weights, uint32_t begin,
+                                 uint32_t end, successor_filter is_allowed,
+                                 const void *context,
+                                 uint32_t *first_allowed)
+{
+  *first_allowed = NO_STATE;
+  double total = 0;
+  for (uint32_t i = begin; i < end; i++)
+  {
+    if (is_allowed (row[i].state, context))
+    {
+      *first_allowed = *first_allowed == NO_STATE ? i : *first_allowed;
+      total += get_successor_weight (row, weights, i);
+    }
+  }
+  return total;
+}
+
+uint32_t get_next_sampled_state(const Sampler *sampler, uint32_t state,
+                                RandomState *rng)
+{
+  const CompiledChain *compiled_chain = sampler->compiled_chain;
+  const CompiledSuccessor *row = compiled_chain->successors
+                                 + compiled_chain->row_offsets[state];
+  if (sampler->parameters.temperature == 0)
+  {
+    return row[0].state;
+  }
+  uint32_t prefix = get_prefix_length (sampler, state);
+  if (!sampler->cumulative_weights)
+  {
+    if (prefix == get_num_successors (compiled_chain, state))
+    {
+      return get_next_compiled_state (compiled_chain, state, rng);
+    }
+    STATS_COUNT (STATS_COMPILED_DRAWS);
+    uint32_t num = (uint32_t) get_bounded_random
+        (rng, row[prefix - 1].cumulative_frequency);
+    return row[search_frequencies (row, prefix, num)].state;
+  }
+  STATS_COUNT (STATS_COMPILED_DRAWS);
+  const double *weights = sampler->cumulative_weights
+                          + compiled_chain->row_offsets[state];
+  double num = get_random_fraction (rng) * weights[prefix - 1];
+  return row[search_weights (weights, prefix, num)].state;
+}
+
+uint32_t get_next_allowed_state(const CompiledChain *compiled_chain,
+                                const Sampler *sampler, uint32_t state,
+                                successor_filter is_allowed,
+                                const void *context, RandomState *rng)
+{
+  bool greedy = sampler && sampler->parameters.temperature == 0;
+  for (int attempt = 0; attempt < FILTERED_DRAW_ATTEMPTS; attempt++)
+  {
+    uint32_t next = sampler ? get_next_sampled_state (sampler, state, rng)
+                            : get_next_compiled_state (compiled_chain, state,
+                                                       rng);
+    if (is_allowed (next, context))
+    {
+      return next;
+    }
+    if (greedy)
+    {
+      break;
+    }
+  }
+  // most of the row's weight isn't allowed: draw among the allowed
+  // successors of the (truncated) row directly
+  const CompiledSuccessor *row = compiled_chain->successors
+                                 + compiled_chain->row_offsets[state];
+  const double *weights = sampler && sampler->cumulative_weights
+                          ? sampler->cumulative_weights
+                            + compiled_chain->row_offsets[state] : NULL;
+  uint32_t length = get_num_successors (compiled_chain, state);
+  uint32_t prefix = sampler ? get_prefix_length (sampler, state) : length;
+  uint32_t first_allowed;
+  double total = get_allowed_weight (row, weights, 0, prefix, is_allowed,
+                                     context, &first_allowed);
+  if (first_allowed == NO_STATE && prefix < length)
+  {
+    // the truncation left out every allowed successor: the walk goes on
+    // by the rest of the row rather than get stuck
+    total = get_allowed_weight (row, weights, prefix, length, is_allowed,
+                                context, &first_allowed);
+    prefix = length;
+  }
+  // the weights of rare successors may round to 0 at low temperatures
+  if (first_allowed == NO_STATE || greedy || total == 0)
+  {
+    return first_allowed == NO_STATE ? NO_STATE : row[first_allowed].state;
+  }
+  double num = get_random_fraction (rng) * total;
+  uint32_t chosen = first_allowed;
+  for (uint32_t i = first_allowed; i < prefix; i++)
+  {
+    if (is_allowed (row[i].state, context))
+    {
+      chosen = i;
+      num -= get_successor_weight (row, weights, i);
+      if (num < 0)
+      {
+        break;
+      }
+    }
+  }
+  return row[chosen].state;
+}
+
+void free_sampler(Sampler **sampler)
+{
+  if (!*sampler)
+  {
+    return;
+  }
+  free ((*sampler)->cumulative_weights);
+  free (*sampler);
+  *sampler = NULL;
+}
+
+bool generate_compiled_tweet(const CompiledChain *compiled_chain,
+                             const Sampler *sampler, uint32_t first_state,
+                             int max_length, RandomState *rng,
+                             OutputBuffer *out)
+{
+  uint32_t state = first_state;
+  if (state == NO_STATE)
+  {
+    state = get_first_compiled_state (compiled_chain, rng);
+    if (state == NO_STATE)
+    {
+      return true;
+    }
+  }
+  format_function format_start = compiled_chain->format_start_func
+                                 ? compiled_chain->format_start_func
+                                 : compiled_chain->format_func;
+  if (!format_start (get_compiled_data (compiled_chain, state), out))
+  {
+    return false;
+  }
+  for (int i = 1; i < max_length
+                  && get_num_successors (compiled_chain, state) > 0; i++)
+  {
+    state = sampler ? get_next_sampled_state (sampler, state, rng)
+                    : get_next_compiled_state (compiled_chain, state, rng);
+    if (!compiled_chain->format_func (get_compiled_data (compiled_chain,
+                                                         state), out))
+    {
+      return false;
+    }
+    if (is_compiled_last (compiled_chain, state))
+    {
+      break;
+    }
+  }
+  return true;
+}
+
+void free_compiled_chain(CompiledChain **compiled_chain)
+{
+  if (!*compiled_chain)
+  {
+    return;
+  }
+  STATS_PHASE_BEGIN (STATS_PHASE_FREE);
+  if ((*compiled_chain)->mapping)
+  {
+    munmap ((*compiled_chain)->mapping, (*compiled_chain)->mapping_size);
+  }
+  else
+  {
+    free ((void *) (*compiled_chain)->row_offsets);
+    free ((void *) (*compiled_chain)->successors);
+    free ((void *) (*compiled_chain)->start_states);
+    free ((void *) (*compiled_chain)->last_states);
+    free ((void *) (*compiled_chain)->data);
+  }
+  free ((*compiled_chain)->compiled_ids);
+  free (*compiled_chain);
+  *compiled_chain = NULL;
+  STATS_PHASE_END (STATS_PHASE_FREE);
+}
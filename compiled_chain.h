@@ -0,0 +1,265 @@
+#ifndef _COMPILED_CHAIN_H_
+#define _COMPILED_CHAIN_H_
+#include <stdbool.h> // for bool
+#include <stdint.h> // for uint32_t, uint64_t
+#include "markov_chain.h"
+
+// a state id that is no state, e.g. to start walks from random states
+#define NO_STATE UINT32_MAX
+// the sampling parameters that keep the chain's own distribution
+#define DEFAULT_TEMPERATURE 1.0
+#define NO_TOP_K 0
+#define NO_TOP_P 1.0
+
+/**
+ * Checks if a walk may move to a state, see get_next_allowed_state.
+ * @param state id of the state
+ * @param context the context the filter was given
+ * @return true if allowed, false if not
+ */
+typedef bool (*successor_filter) (uint32_t state, const void *context);
+
+typedef struct CompiledSuccessor {
+    uint32_t state;
+    // sum of the frequencies of the row up to and including this successor
+    uint32_t cumulative_frequency;
+} CompiledSuccessor;
+
+/**
+ * An immutable, compressed sparse row (CSR) copy of a built markov chain,
+ * for generation. The successors of state i are the entries
+ * [row_offsets[i], row_offsets[i + 1]) of one contiguous successors array,
+ * most frequent first. States are renumbered in breadth first order from
+ * the start states, so states that follow each other in walks are stored
+ * close to each other.
+ * The arrays are either allocated by compile_chain or point into a mapped
+ * snapshot (see chain_snapshot.h).
+ */
+typedef struct CompiledChain {
+    uint32_t num_states;
+    uint32_t num_start_states;
+    uint64_t num_successors;
+    const uint32_t *row_offsets; // num_states + 1 entries
+    const CompiledSuccessor *successors;
+    const uint32_t *start_states;
+    // bitset: bit i is set if state i is a last state
+    const uint64_t *last_states;
+
+    // the data of state i is data[i] if data isn't NULL (a compiled chain),
+    // otherwise it is at payloads + payload_offsets[i] (a snapshot)
+    void *const *data;
+    const uint64_t *payload_offsets;
+    const unsigned char *payloads;
+
+    // formats a state's data, and optionally the first state of a sentence
+    // (see MarkovChain)
+    format_function format_func;
+    format_function format_start_func;
+
+    // the compiled id of every state of the source chain, by its id. NULL
+    // for a snapshot.
+    uint32_t *compiled_ids;
+
+    // the snapshot mapping the arrays point into, NULL if they are
+    // allocated
+    void *mapping;
+    size_t mapping_size;
+} CompiledChain;
+
+/**
+ * The parameters of a request's sampling. The successors of a state are
+ * drawn with weights frequency^(1 / temperature), from its top_k most
+ * frequent successors only, and from the fewest most frequent successors
+ * whose weights sum to at least top_p of the row's weight (nucleus
+ * sampling). Since the rows are sorted most frequent first, and the weights
+ * keep that order, both truncations keep a prefix of the row.
+ */
+typedef struct SamplingParameters {
+    double temperature; // positive, or 0 to always take the most frequent
+    uint32_t top_k; // NO_TOP_K for all the successors
+    double top_p; // in (0, 1]
+} SamplingParameters;
+
+/**
+ * The sampling structures of a compiled chain for some parameters, which
+ * any number of walks and threads can share. At a temperature other than 1
+ * and 0, every row has the prefix sums of its weights, so drawing from a
+ * (truncated) row is a binary search like drawing by frequency, and the
+ * weights are only computed once for all the walks.
+ */
+typedef struct Sampler {
+    const CompiledChain *compiled_chain;
+    SamplingParameters parameters;
+    // the cumulative weights of every row, parallel to the successors
+    // array, weights relative to the row's most frequent successor. NULL
+    // at temperature 1 (the cumulative frequencies serve) and 0.
+    double *cumulative_weights;
+} Sampler;
+
+/**
+ * Compile a built markov chain. The compiled chain points to the data of
+ * the chain's states, so the chain must outlive it, but it doesn't change
+ * when the chain does.
+ * @param markov_chain the chain to compile
+ * @return the compiled chain, NULL in case of allocation error or if the
+ * chain has 2^32 states or successors or more
+ */
+CompiledChain *compile_chain(const MarkovChain *markov_chain);
+
+/**
+ * Add all the states and transitions of a compiled chain (e.g. a loaded
+ * snapshot) to a markov chain, like merge_chain, so a chain can keep
+ * training after it was saved.
+ * @param markov_chain the chain to add to, its copy_func (or arena_copy)
+ * copies the compiled chain's data
+ * @param compiled_chain the chain to add
+ * @return true on success, false in case of allocation error
+ */
+bool add_compiled_chain(MarkovChain *markov_chain,
+                        const CompiledChain *compiled_chain);
+
+/**
+ * Get the compiled id of a state of the source chain.
+ * @param compiled_chain a chain made by compile_chain
+ * @param markov_node a state of the source chain
+ * @return the id of the state in the compiled chain
+ */
+uint32_t get_compiled_state(const CompiledChain *compiled_chain,
+                            const MarkovNode *markov_node);
+
+/**
+ * Find the state with some data, e.g. to start walks from a given word of a
+ * loaded snapshot. This is a linear scan; if the source chain is at hand,
+ * get_node_from_database and get_compiled_state find the state by its
+ * index.
+ * @param compiled_chain the chain
+ * @param data the data to look for
+ * @param comp_func compares the data of states
+ * @return id of the first state whose data is equal to data, NO_STATE if
+ * there is none
+ */
+uint32_t find_compiled_state(const CompiledChain *compiled_chain, void *data,
+                             compare_function comp_func);
+
+/**
+ * Get the data of a state.
+ * @param compiled_chain the chain
+ * @param state id of the state
+ * @return pointer to the state's data
+ */
+void *get_compiled_data(const CompiledChain *compiled_chain, uint32_t state);
+
+/**
+ * Check if a state is a last state.
+ * @param compiled_chain the chain
+ * @param state id of the state
+ * @return true if last, false if not
+ */
+bool is_compiled_last(const CompiledChain *compiled_chain, uint32_t state);
+
+/**
+ * Get the number of successors of a state.
+ * @param compiled_chain the chain
+ * @param state id of the state
+ * @return the length of the state's row
+ */
+uint32_t get_num_successors(const CompiledChain *compiled_chain,
+                            uint32_t state);
+
+/**
+ * Get one random state, that is not a last state.
+ * @param compiled_chain the chain
+ * @param rng the random state to draw from
+ * @return the chosen state, NO_STATE if all the states are last states
+ */
+uint32_t get_first_compiled_state(const CompiledChain *compiled_chain,
+                                  RandomState *rng);
+
+/**
+ * Choose randomly the next state, by the frequencies of the state's row: a
+ * linear scan of its most frequent successors, then a binary search over the
+ * cumulative frequencies of the rest.
+ * @param compiled_chain the chain
+ * @param state id of the current state, must have successors
+ * @param rng the random state to draw from
+ * @return id of the chosen state
+ */
+uint32_t get_next_compiled_state(const CompiledChain *compiled_chain,
+                                 uint32_t state, RandomState *rng);
+
+/**
+ * Create a sampler of a compiled chain, which must outlive it.
+ * @param compiled_chain the chain
+ * @param parameters the sampling parameters, valid as documented in
+ * SamplingParameters
+ * @return the sampler, NULL in case of allocation error
+ */
+Sampler *create_sampler(const CompiledChain *compiled_chain,
+                        SamplingParameters parameters);
+
+/**
+ * Choose randomly the next state by the sampler's parameters. With the
+ * default parameters this is get_next_compiled_state, with the same draws.
+ * Otherwise, it takes two binary searches over the row's prefix sums: one
+ * for the end of the nucleus, and one for the draw.
+ * @param sampler the sampler
+ * @param state id of the current state, must have successors
+ * @param rng the random state to draw from
+ * @return id of the chosen state
+ */
+uint32_t get_next_sampled_state(const Sampler *sampler, uint32_t state,
+                                RandomState *rng);
+
+/**
+ * Choose randomly the next state like get_next_sampled_state (or
+ * get_next_compiled_state), among the successors a filter allows only. The
+ * first draws are from the whole (truncated) row, and end as soon as one is
+ * allowed; if they all fail, the allowed successors are drawn from
+ * directly, in time linear in the row. Either way, every allowed successor
+ * is drawn with its weight over the allowed successors' total weight. At
+ * temperature 0 this is the most frequent allowed successor. If top-k or
+ * top-p leave out every allowed successor, the rest of the row is drawn
+ * from the same way.
+ * @param compiled_chain the chain
+ * @param sampler a sampler of the chain, NULL to draw by the frequencies
+ * @param state id of the current state, must have successors
+ * @param is_allowed the filter
+ * @param context passed to the filter
+ * @param rng the random state to draw from
+ * @return id of the chosen state, NO_STATE if no successor is allowed
+ */
+uint32_t get_next_allowed_state(const CompiledChain *compiled_chain,
+                                const Sampler *sampler, uint32_t state,
+                                successor_filter is_allowed,
+                                const void *context, RandomState *rng);
+
+/**
+ * Free a sampler.
+ * @param sampler the sampler to free
+ */
+void free_sampler(Sampler **sampler);
+
+/**
+ * Generate a random sentence and format it into out, like generate_tweet,
+ * using only the compiled chain.
+ * @param compiled_chain the chain
+ * @param sampler a sampler of the chain, NULL to draw by the frequencies
+ * @param first_state state to start with, NO_STATE for a random one
+ * @param max_length maximum length of chain to generate
+ * @param rng the random state to draw from. generating with the same chain
+ * from several threads is safe as long as each one has its own state.
+ * @param out the buffer to append the sentence to
+ * @return true on success, false in case of allocation error
+ */
+bool generate_compiled_tweet(const CompiledChain *compiled_chain,
+                             const Sampler *sampler, uint32_t first_state,
+                             int max_length, RandomState *rng,
+                             OutputBuffer *out);
+
+/**
+ * Free a compiled chain (or unmap a snapshot).
+ * @param compiled_chain the chain to free
+ */
+void free_compiled_chain(CompiledChain **compiled_chain);
+
+#endif //_COMPILED_CHAIN_H_
@@ -0,0 +1,418 @@
+#define _POSIX_C_SOURCE 200809L
+#include "concurrent_chain.h"
+#include <string.h> // For memcpy()
+
+// epochs start at 1, a reader slot holds 0 while it isn't reading
+#define FIRST_EPOCH 1
+#define NOT_READING 0
+
+/**
+ * copies a node's frequencies list to a new row
+ * @param markov_chain the chain of the node
+ * @param markov_node the node
+ * @return the row, NULL in case of allocation error
+ */
+static PublishedRow *build_row(const MarkovChain *markov_chain,
+                               const MarkovNode *markov_node);
+
+/**
+ * makes room for one more retired pointer, so retiring can't fail after a
+ * new version was published
+ * @param concurrent_chain the chain
+ * @return true on success, false in case of allocation error
+ */
+static bool reserve_retired_place(ConcurrentChain *concurrent_chain);
+
+/**
+ * adds a replaced pointer to the retired list, which must have room for it
+ * @param concurrent_chain the chain
+ * @param pointer the replaced pointer, may be NULL
+ * @param epoch the current global epoch
+ */
+static void retire(ConcurrentChain *concurrent_chain, void *pointer,
+                   uint64_t epoch);
+
+/**
+ * publishes a new row for a node and retires its old one
+ * @param concurrent_chain the chain
+ * @param markov_node the node
+ * @param epoch the current global epoch
+ * @return true on success, false in case of allocation error
+ */
+static bool publish_row(ConcurrentChain *concurrent_chain,
+                        MarkovNode *markov_node, uint64_t epoch);
+
+/**
+ * publishes the start states added since the last publish, in place if
+ * they fit, otherwise in a bigger copy
+ * @param concurrent_chain the chain
+ * @param epoch the current global epoch
+ * @return true on success, false in case of allocation error
+ */
+static bool publish_starts(ConcurrentChain *concurrent_chain,
+                           uint64_t epoch);
+
+/**
+ * frees the retired pointers that were replaced before the oldest epoch a
+ * reader is in
+ * @param concurrent_chain the chain
+ */
+static void reclaim(ConcurrentChain *concurrent_chain);
+
+/**
+ * chooses randomly the next node, by the cumulative frequencies of a row
+ * (binary search)
+ * @param row the row, with at least one entry
+ * @param rng the random state to draw from
+ * @return the chosen entry
+ */
+static const PublishedEntry *get_next_published_entry(const PublishedRow *row,
+                                                      RandomState *rng);
+
+/**
+ * generates a sentence from the published rows, like generate_tweet. must be
+ * called inside an epoch.
+ * @param concurrent_chain the chain
+ * @param first_node state to start with, if NULL- choose a random one
+ * @param max_length maximum length of chain to generate
+ * @param rng the random state to draw from
+ * @param out the buffer to append the sentence to
+ * @return true on success, false in case of allocation error
+ */
+static bool walk_published(const ConcurrentChain *concurrent_chain,
+                           MarkovNode *first_node, int max_length,
+                           RandomState *rng, OutputBuffer *out);
+
+static PublishedRow *build_row(const MarkovChain *markov_chain,
+                               const MarkovNode *markov_node)
+{
+  uint32_t length = (uint32_t) markov_node->frequencies_list_length;
+  PublishedRow *row = malloc (sizeof (PublishedRow)
+                              + length * sizeof (PublishedEntry));
+  if (!row)
+  {
+    return NULL;
+  }
+  row->length = length;
+  uint32_t cumulative_frequency = 0;
+  for (uint32_t i = 0; i < length; i++)
+  {
+    MarkovNodeFrequency *cur = markov_node->frequencies_list + i;
+    cumulative_frequency += (uint32_t) cur->frequency;
+    row->entries[i].markov_node = cur->markov_node;
+    row->entries[i].cumulative_frequency = cumulative_frequency;
+    row->entries[i].is_last = is_last_state (markov_chain, cur->markov_node);
+  }
+  return row;
+}
+
+static bool reserve_retired_place(ConcurrentChain *concurrent_chain)
+{
+  if (concurrent_chain->retired_size < concurrent_chain->retired_capacity)
+  {
+    return true;
+  }
+  size_t new_capacity = concurrent_chain->retired_capacity
+                        ? concurrent_chain->retired_capacity * 2 : 16;
+  RetiredPointer *temp = realloc (concurrent_chain->retired,
+                                  new_capacity * sizeof (RetiredPointer));
+  if (!temp)
+  {
+    return false;
+  }
+  concurrent_chain->retired = temp;
+  concurrent_chain->retired_capacity = new_capacity;
+  return true;
+}
+
+static void retire(ConcurrentChain *concurrent_chain, void *pointer,
+                   uint64_t epoch)
+{
+  if (!pointer)
+  {
+    return;
+  }
+  concurrent_chain->retired[concurrent_chain->retired_size++] =
+      (RetiredPointer) {pointer, epoch};
+}
+
+static bool publish_row(ConcurrentChain *concurrent_chain,
+                        MarkovNode *markov_node, uint64_t epoch)
+{
+  if (!reserve_retired_place (concurrent_chain))
+  {
+    return false;
+  }
+  PublishedRow *row = build_row (concurrent_chain->markov_chain,
+                                 markov_node);
+  if (!row)
+  {
+    return false;
+  }
+  // only the writer stores rows, so the old one can be read plainly
+  PublishedRow *old_row = markov_node->published_row;
+  __atomic_store_n (&markov_node->published_row, row, __ATOMIC_RELEASE);
+  retire (concurrent_chain, old_row, epoch);
+  return true;
+}
+
+static bool publish_starts(ConcurrentChain *concurrent_chain,
+                           uint64_t epoch)
+{
+  MarkovChain *markov_chain = concurrent_chain->markov_chain;
+  PublishedStarts *starts = concurrent_chain->starts;
+  uint32_t size = starts ? starts->size : 0;
+  uint32_t new_size = (uint32_t) markov_chain->start_states_size;
+  if (new_size == size)
+  {
+    return true;
+  }
+  if (starts && new_size <= starts->capacity)
+  {
+    // readers don't look past size, so the new states can be written in
+    // place before the size is published
+    memcpy (starts->states + size, markov_chain->start_states + size,
+            (new_size - size) * sizeof (MarkovNode *));
+    __atomic_store_n (&starts->size, new_size, __ATOMIC_RELEASE);
+    return true;
+  }
+  if (!reserve_retired_place (concurrent_chain))
+  {
+    return false;
+  }
+  uint32_t capacity = starts ? starts->capacity * 2 : new_size;
+  if (capacity < new_size)
+  {
+    capacity = new_size;
+  }
+  PublishedStarts *new_starts = malloc (sizeof (PublishedStarts)
+                                        + capacity * sizeof (MarkovNode *));
+  if (!new_starts)
+  {
+    return false;
+  }
+  memcpy (new_starts->states, markov_chain->start_states,
+          new_size * sizeof (MarkovNode *));
+  new_starts->size = new_size;
+  new_starts->capacity = capacity;
+  __atomic_store_n (&concurrent_chain->starts, new_starts, __ATOMIC_RELEASE);
+  retire (concurrent_chain, starts, epoch);
+  return true;
+}
+
+static void reclaim(ConcurrentChain *concurrent_chain)
+{
+  uint64_t oldest = UINT64_MAX;
+  for (int i = 0; i < concurrent_chain->num_readers; i++)
+  {
+    uint64_t epoch = __atomic_load_n (&concurrent_chain->readers[i].epoch,
+                                      __ATOMIC_ACQUIRE);
+    if (epoch != NOT_READING && epoch < oldest)
+    {
+      oldest = epoch;
+    }
+  }
+  // a pointer replaced in epoch e may be seen by readers that entered in e
+  // or before it, and by none that entered later
+  size_t kept = 0;
+  for (size_t i = 0; i < concurrent_chain->retired_size; i++)
+  {
+    if (concurrent_chain->retired[i].epoch < oldest)
+    {
+      free (concurrent_chain->retired[i].pointer);
+    }
+    else
+    {
+      concurrent_chain->retired[kept++] = concurrent_chain->retired[i];
+    }
+  }
+  concurrent_chain->retired_size = kept;
+}
+
+ConcurrentChain *create_concurrent_chain(MarkovChain *markov_chain,
+                                         int num_readers)
+{
+  ConcurrentChain *concurrent_chain = calloc (1, sizeof (ConcurrentChain));
+  if (!concurrent_chain)
+  {
+    return NULL;
+  }
+  void *readers = NULL;
+  if (posix_memalign (&readers, CACHE_LINE_SIZE,
+                      (size_t) num_readers * sizeof (ReaderSlot)) != 0)
+  {
+    free (concurrent_chain);
+    return NULL;
+  }
+  memset (readers, 0, (size_t) num_readers * sizeof (ReaderSlot));
+  concurrent_chain->readers = readers;
+  concurrent_chain->num_readers = num_readers;
+  concurrent_chain->markov_chain = markov_chain;
+  concurrent_chain->global_epoch = FIRST_EPOCH;
+  // no reader can see the chain yet, so every node is published here and
+  // publish_chain only needs the dirty ones
+  for (int i = 0; i < markov_chain->database->size; i++)
+  {
+    MarkovNode *markov_node = markov_chain->states[i];
+    if (markov_node->frequencies_list_length > 0
+        && !publish_row (concurrent_chain, markov_node, FIRST_EPOCH))
+    {
+      free_concurrent_chain (&concurrent_chain);
+      return NULL;
+    }
+  }
+  while (markov_chain->dirty_states_size > 0)
+  {
+    markov_chain->dirty_states[--markov_chain->dirty_states_size]->dirty =
+        false;
+  }
+  if (!publish_starts (concurrent_chain, FIRST_EPOCH))
+  {
+    free_concurrent_chain (&concurrent_chain);
+    return NULL;
+  }
+  return concurrent_chain;
+}
+
+bool publish_chain(ConcurrentChain *concurrent_chain)
+{
+  MarkovChain *markov_chain = concurrent_chain->markov_chain;
+  // only the writer changes the epoch
+  uint64_t epoch = concurrent_chain->global_epoch;
+  bool success = true;
+  while (markov_chain->dirty_states_size > 0)
+  {
+    MarkovNode *markov_node = markov_chain
+        ->dirty_states[markov_chain->dirty_states_size - 1];
+    if (!publish_row (concurrent_chain, markov_node, epoch))
+    {
+      success = false;
+      break;
+    }
+    markov_node->dirty = false;
+    markov_chain->dirty_states_size--;
+  }
+  if (success)
+  {
+    success = publish_starts (concurrent_chain, epoch);
+  }
+  // readers that enter from now on see only the new versions. the fence
+  // orders the publishing before reading the reader slots, against the
+  // fence of generate_concurrent_tweet.
+  __atomic_add_fetch (&concurrent_chain->global_epoch, 1, __ATOMIC_SEQ_CST);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  reclaim (concurrent_chain);
+  if (!success)
+  {
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+  }
+  return success;
+}
+
+static const PublishedEntry *get_next_published_entry(const PublishedRow *row,
+                                                      RandomState *rng)
+{
+  uint32_t num = (uint32_t) get_bounded_random
+      (rng, row->entries[row->length - 1].cumulative_frequency);
+  uint32_t low = 0;
+  uint32_t high = row->length - 1;
+  while (low < high)
+  {
+    uint32_t middle = low + (high - low) / 2;
+    if (num < row->entries[middle].cumulative_frequency)
+    {
+      high = middle;
+    }
+    else
+    {
+      low = middle + 1;
+    }
+  }
+  return row->entries + low;
+}
+
+static bool walk_published(const ConcurrentChain *concurrent_chain,
+                           MarkovNode *first_node, int max_length,
+                           RandomState *rng, OutputBuffer *out)
+{
+  if (!first_node)
+  {
+    PublishedStarts *starts = __atomic_load_n (&concurrent_chain->starts,
+                                               __ATOMIC_ACQUIRE);
+    uint32_t size = starts ? __atomic_load_n (&starts->size,
+                                              __ATOMIC_ACQUIRE) : 0;
+    if (size == 0)
+    {
+      return true;
+    }
+    first_node = starts->states[get_bounded_random (rng, size)];
+  }
+  const MarkovChain *markov_chain = concurrent_chain->markov_chain;
+  format_function format_start = markov_chain->format_start_func
+                                 ? markov_chain->format_start_func
+                                 : markov_chain->print_func;
+  if (!format_start (first_node->data, out))
+  {
+    return false;
+  }
+  MarkovNode *next_node = first_node;
+  for (int i = 1; i < max_length; i++)
+  {
+    PublishedRow *row = __atomic_load_n (&next_node->published_row,
+                                         __ATOMIC_ACQUIRE);
+    if (!row || row->length == 0)
+    {
+      break;
+    }
+    const PublishedEntry *entry = get_next_published_entry (row, rng);
+    next_node = entry->markov_node;
+    if (!markov_chain->print_func (next_node->data, out))
+    {
+      return false;
+    }
+    if (entry->is_last)
+    {
+      break;
+    }
+  }
+  return true;
+}
+
+bool generate_concurrent_tweet(ConcurrentChain *concurrent_chain, int reader,
+                               MarkovNode *first_node, int max_length,
+                               RandomState *rng, OutputBuffer *out)
+{
+  ReaderSlot *slot = concurrent_chain->readers + reader;
+  // enter the current epoch. the fence orders announcing it before reading
+  // any published pointer, against the fence of publish_chain.
+  __atomic_store_n (&slot->epoch, __atomic_load_n
+      (&concurrent_chain->global_epoch, __ATOMIC_SEQ_CST), __ATOMIC_SEQ_CST);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  bool success = walk_published (concurrent_chain, first_node, max_length,
+                                 rng, out);
+  __atomic_store_n (&slot->epoch, NOT_READING, __ATOMIC_RELEASE);
+  return success;
+}
+
+void free_concurrent_chain(ConcurrentChain **concurrent_chain)
+{
+  if (!*concurrent_chain)
+  {
+    return;
+  }
+  MarkovChain *markov_chain = (*concurrent_chain)->markov_chain;
+  for (int i = 0; i < markov_chain->database->size; i++)
+  {
+    free (markov_chain->states[i]->published_row);
+    markov_chain->states[i]->published_row = NULL;
+  }
+  for (size_t i = 0; i < (*concurrent_chain)->retired_size; i++)
+  {
+    free ((*concurrent_chain)->retired[i].pointer);
+  }
+  free ((*concurrent_chain)->retired);
+  free ((*concurrent_chain)->starts);
+  free ((*concurrent_chain)->readers);
+  free (*concurrent_chain);
+  *concurrent_chain = NULL;
+}
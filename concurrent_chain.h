@@ -0,0 +1,133 @@
+#ifndef _CONCURRENT_CHAIN_H_
+#define _CONCURRENT_CHAIN_H_
+#include <stdbool.h> // for bool
+#include <stdint.h> // for uint32_t, uint64_t
+#include "markov_chain.h"
+
+// cache line size, so reader slots don't share lines
+#define CACHE_LINE_SIZE 64
+
+/**
+ * One successor of a published row.
+ */
+typedef struct PublishedEntry {
+    MarkovNode *markov_node;
+    // sum of the frequencies of the row up to and including this entry
+    uint32_t cumulative_frequency;
+    // true if markov_node is a last state
+    uint32_t is_last;
+} PublishedEntry;
+
+/**
+ * An immutable copy of a node's frequencies list, as concurrent readers see
+ * it. A writer never changes a published row, it publishes a new one.
+ */
+typedef struct PublishedRow {
+    uint32_t length;
+    PublishedEntry entries[];
+} PublishedRow;
+
+/**
+ * The start states as concurrent readers see them. The writer only appends
+ * to states, past size, and then publishes the new size. When the array is
+ * full it publishes a bigger copy instead.
+ */
+typedef struct PublishedStarts {
+    uint32_t size; // read and written atomically
+    uint32_t capacity;
+    MarkovNode *states[];
+} PublishedStarts;
+
+/**
+ * The epoch a reader is in, on a cache line of its own. 0 if the reader
+ * isn't reading.
+ */
+typedef struct ReaderSlot {
+    uint64_t epoch;
+    char padding[CACHE_LINE_SIZE - sizeof (uint64_t)];
+} ReaderSlot;
+
+/**
+ * A replaced row or start states array, to free once no reader can see it.
+ */
+typedef struct RetiredPointer {
+    void *pointer;
+    uint64_t epoch; // the global epoch when it was replaced
+} RetiredPointer;
+
+/**
+ * A markov chain that many threads can generate from while one thread keeps
+ * adding to it. Readers never take locks: they walk the rows that the
+ * writer published, inside an epoch. The writer adds to the chain as usual
+ * (e.g. with fill_database_from_buffer), which readers don't see, and then
+ * calls publish_chain, which publishes new rows for the changed nodes only.
+ * Replaced rows are freed once every reader left the epoch they were
+ * replaced in (epoch based reclamation).
+ * Readers format the states' data while the writer adds states, so
+ * print_func must only read the state's own data (n-gram contexts look
+ * their tokens up in a table that grows while training, see ngram.h, so
+ * they can't be read concurrently).
+ */
+typedef struct ConcurrentChain {
+    MarkovChain *markov_chain; // only the writer may use it
+
+    PublishedStarts *starts; // read and written atomically
+    uint64_t global_epoch; // read and written atomically
+    ReaderSlot *readers;
+    int num_readers;
+
+    // the writer's list of pointers waiting to be freed
+    RetiredPointer *retired;
+    size_t retired_size;
+    size_t retired_capacity;
+} ConcurrentChain;
+
+/**
+ * Create a concurrent chain over a markov chain and publish all of it. The
+ * markov chain must not be frozen by freeze_chain meanwhile (publish_chain
+ * takes its place).
+ * @param markov_chain the chain, owned by the caller (free it after the
+ * concurrent chain)
+ * @param num_readers number of reader threads, each one uses its own
+ * reader number in [0, num_readers)
+ * @return the concurrent chain, NULL in case of allocation error
+ */
+ConcurrentChain *create_concurrent_chain(MarkovChain *markov_chain,
+                                         int num_readers);
+
+/**
+ * Publish the changes made to the markov chain since the last publish:
+ * a new row for every node whose frequencies list changed, and the new
+ * start states. Then free the replaced rows that no reader can see
+ * anymore. Only the writer may call this. The cost is in proportion to the
+ * changed nodes, readers are never blocked.
+ * @param concurrent_chain the chain
+ * @return true on success, false in case of allocation error (what was
+ * published so far stays published)
+ */
+bool publish_chain(ConcurrentChain *concurrent_chain);
+
+/**
+ * Generate a random sentence from what was published and format it into
+ * out, like generate_tweet. Safe to call while the writer adds and
+ * publishes, from any number of threads with different reader numbers.
+ * @param concurrent_chain the chain
+ * @param reader the reader number of the calling thread
+ * @param first_node state to start with, if NULL- choose a random one
+ * @param max_length maximum length of chain to generate
+ * @param rng the random state to draw from
+ * @param out the buffer to append the sentence to
+ * @return true on success, false in case of allocation error
+ */
+bool generate_concurrent_tweet(ConcurrentChain *concurrent_chain, int reader,
+                               MarkovNode *first_node, int max_length,
+                               RandomState *rng, OutputBuffer *out);
+
+/**
+ * Free the concurrent chain and all the published rows. No reader may be
+ * reading. The markov chain is left for the caller to free.
+ * @param concurrent_chain the chain to free
+ */
+void free_concurrent_chain(ConcurrentChain **concurrent_chain);
+
+#endif //_CONCURRENT_CHAIN_H_
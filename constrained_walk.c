@@ -0,0 +1,272 @@
+#include "constrained_walk.h"
+#include "absorbing_chain.h"
+
+// paths of walks up to this long are kept on the stack
+#define PATH_BUFFER_LENGTH 64
+// random draws of a start state, before drawing among the allowed ones
+// directly
+#define START_DRAW_ATTEMPTS 4
+#define BITS_PER_WORD 64
+
+/**
+ * The context of a step's successor filter.
+ */
+typedef struct StepContext {
+    const CompiledChain *compiled_chain;
+    const WalkConstraints *constraints;
+    int length; // length of the walk with the successor
+} StepContext;
+
+/**
+ * checks if a walk can be completed from a state at some length (see
+ * WalkConstraints)
+ * @param compiled_chain the chain
+ * @param constraints the prepared constraints
+ * @param length number of states in the walk, up to and including state
+ * @param state id of the state
+ * @return true if it can, false if not
+ */
+static bool is_completable(const CompiledChain *compiled_chain,
+                           const WalkConstraints *constraints, int length,
+                           uint32_t state);
+
+/**
+ * checks if a walk can end with a state at some length, as the
+ * constraints go
+ * @param compiled_chain the chain
+ * @param constraints the constraints
+ * @param length number of states in the walk, up to and including state
+ * @param state id of the state
+ * @return true if it can, false if not
+ */
+static bool can_end(const CompiledChain *compiled_chain,
+                    const WalkConstraints *constraints, int length,
+                    uint32_t state);
+
+/**
+ * checks if a walk can be completed from a state, with the length of the
+ * step's context
+ * @param state id of the state
+ * @param context the StepContext, with the length of the walk up to and
+ * including the state
+ * @return true if allowed, false if not
+ */
+static bool is_allowed_step(uint32_t state, const void *context);
+
+/**
+ * chooses the first state of a walk among the start states it can start
+ * from: a few random draws, then a uniform draw among the allowed ones
+ * @param compiled_chain the chain
+ * @param constraints the walk's constraints
+ * @param rng the random state to draw from
+ * @return the chosen state, NO_STATE if no start state is allowed
+ */
+static uint32_t get_first_allowed_state(const CompiledChain *compiled_chain,
+                                        const WalkConstraints *constraints,
+                                        RandomState *rng);
+
+static bool is_completable(const CompiledChain *compiled_chain,
+                           const WalkConstraints *constraints, int length,
+                           uint32_t state)
+{
+  uint64_t bit = (uint64_t) (length - 1) * compiled_chain->num_states + state;
+  return (constraints->completable[bit / BITS_PER_WORD]
+          >> (bit % BITS_PER_WORD)) & 1;
+}
+
+static bool can_end(const CompiledChain *compiled_chain,
+                    const WalkConstraints *constraints, int length,
+                    uint32_t state)
+{
+  if (is_absorbing_state (compiled_chain, state))
+  {
+    return length >= constraints->min_length
+           && (!constraints->end_last
+               || is_compiled_last (compiled_chain, state));
+  }
+  // the walk is cut at max_length, which isn't too short
+  return length == constraints->max_length && !constraints->end_last;
+}
+
+static bool is_allowed_step(uint32_t state, const void *context)
+{
+  const StepContext *step = context;
+  return is_completable (step->compiled_chain, step->constraints,
+                         step->length, state);
+}
+
+static uint32_t get_first_allowed_state(const CompiledChain *compiled_chain,
+                                        const WalkConstraints *constraints,
+                                        RandomState *rng)
+{
+  StepContext context = {compiled_chain, constraints, 1};
+  for (int attempt = 0; attempt < START_DRAW_ATTEMPTS; attempt++)
+  {
+    uint32_t state = get_first_compiled_state (compiled_chain, rng);
+    if (state == NO_STATE || is_allowed_step (state, &context))
+    {
+      return state;
+    }
+  }
+  uint32_t num_allowed = 0;
+  for (uint32_t i = 0; i < compiled_chain->num_start_states; i++)
+  {
+    num_allowed += is_allowed_step (compiled_chain->start_states[i],
+                                    &context);
+  }
+  if (num_allowed == 0)
+  {
+    return NO_STATE;
+  }
+  uint32_t chosen = (uint32_t) get_bounded_random (rng, num_allowed);
+  for (uint32_t i = 0; ; i++)
+  {
+    uint32_t state = compiled_chain->start_states[i];
+    if (is_allowed_step (state, &context) && chosen-- == 0)
+    {
+      return state;
+    }
+  }
+}
+
+bool is_constrained(const WalkConstraints *constraints)
+{
+  return constraints->min_length > 1 || constraints->end_last;
+}
+
+bool prepare_walk_constraints(const CompiledChain *compiled_chain,
+                              WalkConstraints *constraints)
+{
+  if (!is_constrained (constraints))
+  {
+    return true;
+  }
+  uint32_t num_states = compiled_chain->num_states;
+  uint64_t num_bits = (uint64_t) constraints->max_length * num_states;
+  constraints->completable = calloc (num_bits / BITS_PER_WORD + 1,
+                                     sizeof (uint64_t));
+  if (!constraints->completable)
+  {
+    return false;
+  }
+  const CompiledSuccessor *successors = compiled_chain->successors;
+  for (int length = constraints->max_length; length > 0; length--)
+  {
+    for (uint32_t state = 0; state < num_states; state++)
+    {
+      bool completable = can_end (compiled_chain, constraints, length,
+                                  state);
+      // a walk that doesn't end here goes on to a successor
+      for (uint32_t i = compiled_chain->row_offsets[state];
+           !completable && length < constraints->max_length
+           && !is_absorbing_state (compiled_chain, state)
+           && i < compiled_chain->row_offsets[state + 1]; i++)
+      {
+        completable = is_completable (compiled_chain, constraints,
+                                      length + 1, successors[i].state);
+      }
+      uint64_t bit = (uint64_t) (length - 1) * num_states + state;
+      constraints->completable[bit / BITS_PER_WORD] |=
+          (uint64_t) completable << (bit % BITS_PER_WORD);
+    }
+  }
+  return true;
+}
+
+bool has_constrained_walk(const CompiledChain *compiled_chain,
+                          const WalkConstraints *constraints)
+{
+  if (!is_constrained (constraints))
+  {
+    return true;
+  }
+  if (constraints->first_state != NO_STATE)
+  {
+    return is_completable (compiled_chain, constraints, 1,
+                           constraints->first_state);
+  }
+  for (uint32_t i = 0; i < compiled_chain->num_start_states; i++)
+  {
+    if (is_completable (compiled_chain, constraints, 1,
+                        compiled_chain->start_states[i]))
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+int generate_constrained_walk(const CompiledChain *compiled_chain,
+                              const Sampler *sampler,
+                              const WalkConstraints *constraints,
+                              RandomState *rng, uint32_t *path)
+{
+  StepContext context = {compiled_chain, constraints, 1};
+  uint32_t state = constraints->first_state != NO_STATE
+                   ? constraints->first_state
+                   : get_first_allowed_state (compiled_chain, constraints,
+                                              rng);
+  if (state == NO_STATE || !is_allowed_step (state, &context))
+  {
+    return 0;
+  }
+  path[0] = state;
+  int length = 1;
+  // every state of the walk can be completed, so one of its successors
+  // is allowed whenever it doesn't end
+  while (length < constraints->max_length
+         && !is_absorbing_state (compiled_chain, state))
+  {
+    context.length = length + 1;
+    state = get_next_allowed_state (compiled_chain, sampler, state,
+                                    is_allowed_step, &context, rng);
+    path[length++] = state;
+  }
+  return length;
+}
+
+bool generate_constrained_tweet(const CompiledChain *compiled_chain,
+                                const Sampler *sampler,
+                                const WalkConstraints *constraints,
+                                RandomState *rng, OutputBuffer *out)
+{
+  if (!is_constrained (constraints))
+  {
+    return generate_compiled_tweet (compiled_chain, sampler,
+                                    constraints->first_state,
+                                    constraints->max_length, rng, out);
+  }
+  uint32_t buffer[PATH_BUFFER_LENGTH];
+  uint32_t *path = buffer;
+  if (constraints->max_length > PATH_BUFFER_LENGTH)
+  {
+    path = malloc ((size_t) constraints->max_length * sizeof (uint32_t));
+    if (!path)
+    {
+      return false;
+    }
+  }
+  int length = generate_constrained_walk (compiled_chain, sampler,
+                                          constraints, rng, path);
+  format_function format_start = compiled_chain->format_start_func
+                                 ? compiled_chain->format_start_func
+                                 : compiled_chain->format_func;
+  bool success = true;
+  for (int i = 0; success && i < length; i++)
+  {
+    void *data = get_compiled_data (compiled_chain, path[i]);
+    success = i == 0 ? format_start (data, out)
+                     : compiled_chain->format_func (data, out);
+  }
+  if (path != buffer)
+  {
+    free (path);
+  }
+  return success;
+}
+
+void free_walk_constraints(WalkConstraints *constraints)
+{
+  free (constraints->completable);
+  constraints->completable = NULL;
+}
@@ -0,0 +1,99 @@
+#ifndef _CONSTRAINED_WALK_H_
+#define _CONSTRAINED_WALK_H_
+#include <stdbool.h> // for bool
+#include <stdint.h> // for uint32_t, uint64_t
+#include "compiled_chain.h"
+
+/**
+ * The constraints of a request's walks: where they start, how long they
+ * are, and if they must end with a last state. Instead of drawing whole
+ * walks and rejecting the ones that break the constraints, every step
+ * draws only among the successors that leave the walk a way to meet them
+ * (see get_next_allowed_state). Which successors those are is worked out
+ * once per request, by prepare_walk_constraints, backwards from the
+ * longest walks: a walk can be completed from a state at some length if it
+ * may end there, or if it can be completed from one of the state's
+ * successors at the next length. So a walk never gets stuck, and if no
+ * walk meets the constraints it's known up front (see
+ * has_constrained_walk).
+ */
+typedef struct WalkConstraints {
+    uint32_t first_state; // NO_STATE for a random start state
+    int min_length; // number of states, 1 for no minimum
+    int max_length; // at least min_length
+    bool end_last; // walks must end with a last state
+    // set by prepare_walk_constraints: bit (length - 1) * num_states + state
+    // is set if a walk whose state number length is state can be completed
+    uint64_t *completable;
+} WalkConstraints;
+
+/**
+ * Check if constraints constrain more than a walk's first state and maximal
+ * length, which is all generate_compiled_tweet takes.
+ * @param constraints the constraints
+ * @return true if they have a minimum length or end_last, false if not
+ */
+bool is_constrained(const WalkConstraints *constraints);
+
+/**
+ * Work out the states a constrained walk can be completed from, at every
+ * length, in time linear in max_length times the chain's successors, and
+ * max_length times num_states bits. Constraints that aren't constrained
+ * (see is_constrained) need nothing, and are left as they are.
+ * @param compiled_chain the chain
+ * @param constraints the constraints, completable is set
+ * @return true on success, false in case of allocation error
+ */
+bool prepare_walk_constraints(const CompiledChain *compiled_chain,
+                              WalkConstraints *constraints);
+
+/**
+ * Check if any walk meets prepared constraints: from their first state, or
+ * from some start state if they have none.
+ * @param compiled_chain the chain
+ * @param constraints the constraints, prepared by prepare_walk_constraints
+ * @return true if some walk meets them, false if not
+ */
+bool has_constrained_walk(const CompiledChain *compiled_chain,
+                          const WalkConstraints *constraints);
+
+/**
+ * Generate a random walk on a compiled chain that meets some constraints,
+ * and store its states in path.
+ * @param compiled_chain the chain
+ * @param sampler a sampler of the chain, NULL to draw by the frequencies
+ * @param constraints the constraints, prepared by prepare_walk_constraints
+ * @param rng the random state to draw from
+ * @param path set to the states of the walk, at least max_length entries
+ * @return number of states in the walk, 0 if no walk meets the
+ * constraints (see has_constrained_walk)
+ */
+int generate_constrained_walk(const CompiledChain *compiled_chain,
+                              const Sampler *sampler,
+                              const WalkConstraints *constraints,
+                              RandomState *rng, uint32_t *path);
+
+/**
+ * Generate a random sentence that meets some constraints and format it into
+ * out, like generate_compiled_tweet (which this is, for walks that aren't
+ * constrained). Nothing is formatted if no walk meets the constraints (see
+ * has_constrained_walk).
+ * @param compiled_chain the chain
+ * @param sampler a sampler of the chain, NULL to draw by the frequencies
+ * @param constraints the constraints, prepared by prepare_walk_constraints
+ * @param rng the random state to draw from
+ * @param out the buffer to append the sentence to
+ * @return true on success, false in case of allocation error
+ */
+bool generate_constrained_tweet(const CompiledChain *compiled_chain,
+                                const Sampler *sampler,
+                                const WalkConstraints *constraints,
+                                RandomState *rng, OutputBuffer *out);
+
+/**
+ * Free what prepare_walk_constraints allocated (not the constraints).
+ * @param constraints the constraints
+ */
+void free_walk_constraints(WalkConstraints *constraints);
+
+#endif //_CONSTRAINED_WALK_H_
@@ -0,0 +1,465 @@
+#define _POSIX_C_SOURCE 200809L
+#include "corpus.h"
+#include "chain_stats.h"
+#include <string.h> // For memmove()
+#include <sys/mman.h> // For mmap()
+#include <sys/stat.h> // For fstat()
+#include <pthread.h> // For pthread_create()
+
+#define LINE_END '\n'
+// smaller inputs are not worth splitting between threads
+#define MIN_BYTES_PER_THREAD (1 << 20)
+
+/**
+ * A part of the corpus that is counted into a chain of its own by one
+ * thread.
+ */
+typedef struct ShardJob {
+    const char *begin;
+    const char *end;
+    MarkovChain *shard;
+    bool success;
+} ShardJob;
+
+/**
+ * checks if a character separates tokens (same separators as strtok with
+ * " \n\r\t", and NUL, which a string can't hold)
+ * @param c the character
+ * @return true if c is a separator, false otherwise
+ */
+static bool is_separator(char c);
+
+/**
+ * creates an empty chain with the same callbacks (and hash function, key
+ * functions and arena use) as the given one
+ * @param markov_chain the chain to copy the settings of
+ * @return the new chain, NULL in case of allocation error
+ */
+static MarkovChain *create_shard(MarkovChain *markov_chain);
+
+/**
+ * thread routine that fills a shard from its part of the corpus
+ * @param job the ShardJob
+ * @return NULL
+ */
+static void *build_shard(void *job);
+
+/**
+ * finds the first place at or after from where the corpus can be split
+ * without breaking a transition: after a line end or after a last word.
+ * @param from where to start looking, may be in the middle of a word
+ * @param end end of the text
+ * @param markov_chain the chain, for its is_last_key
+ * @return the split point, end if there is none
+ */
+static const char *find_split_point(const char *from, const char *end,
+                                    MarkovChain *markov_chain);
+
+/**
+ * maps a regular, non empty file to memory for a sequential read
+ * @param fd descriptor of the file
+ * @param size set to the size of the file
+ * @return the mapping, NULL if the file couldn't be mapped
+ */
+static void *map_corpus(int fd, size_t *size);
+
+/**
+ * adds the transition of an order-k chain from the context of the window's
+ * first k tokens to the context of its last k tokens
+ * @param markov_chain the chain
+ * @param model the model of the chain's contexts
+ * @param window k + 1 token ids
+ * @param from node of the first context, NULL if it wasn't looked up yet.
+ * set to the node of the second context.
+ * @return true on success, false in case of allocation error
+ */
+static bool add_ngram(MarkovChain *markov_chain, const NgramModel *model,
+                      const uint32_t *window, Node **from);
+
+static bool is_separator(char c)
+{
+  // a NUL would end the token's string early, leaving it empty
+  return c == ' ' || c == LINE_END || c == '\r' || c == '\t' || c == '\0';
+}
+
+bool fill_database_from_buffer(const char *begin, const char *end,
+                               int *words_to_read, MarkovChain *markov_chain)
+{
+  if (*words_to_read == 0)
+  {
+    return true;
+  }
+  STATS_PHASE_BEGIN (STATS_PHASE_BUILD);
+  // the previous word of the line, if it isn't a last word
+  TokenView previous = {0};
+  bool has_previous = false;
+  // database node of the previous word, NULL if it wasn't added yet
+  Node *previous_node = NULL;
+  bool success = true;
+  const char *cur = begin;
+  while (cur < end)
+  {
+    if (is_separator (*cur))
+    {
+      if (*cur == LINE_END)
+      {
+        has_previous = false;
+      }
+      cur++;
+      continue;
+    }
+    const char *start = cur;
+    while (cur < end && !is_separator (*cur))
+    {
+      cur++;
+    }
+    TokenView current = {start, (size_t) (cur - start)};
+    Node *current_node = NULL;
+    if (has_previous)
+    {
+      if (!previous_node)
+      {
+        previous_node = add_key_to_database (markov_chain, &previous);
+      }
+      current_node = add_key_to_database (markov_chain, &current);
+      if (!previous_node || !current_node
+          || !add_node_to_frequencies_list (previous_node->data,
+                                            current_node->data, markov_chain))
+      {
+        success = false;
+        break;
+      }
+    }
+    if (*words_to_read == 0)
+    {
+      break;
+    }
+    if (markov_chain->key_funcs->is_last_key (&current))
+    {
+      if (!current_node && !add_key_to_database (markov_chain, &current))
+      {
+        success = false;
+        break;
+      }
+      has_previous = false;
+    }
+    else
+    {
+      has_previous = true;
+      previous_node = current_node;
+      previous = current;
+    }
+    if (*words_to_read > 0)
+    {
+      (*words_to_read)--;
+    }
+  }
+  STATS_PHASE_END (STATS_PHASE_BUILD);
+  return success;
+}
+
+static bool add_ngram(MarkovChain *markov_chain, const NgramModel *model,
+                      const uint32_t *window, Node **from)
+{
+  if (!*from)
+  {
+    *from = add_context (markov_chain, model, window);
+  }
+  Node *to = add_context (markov_chain, model, window + 1);
+  if (!*from || !to
+      || !add_node_to_frequencies_list ((*from)->data, to->data,
+                                        markov_chain))
+  {
+    return false;
+  }
+  *from = to;
+  return true;
+}
+
+bool fill_ngram_database_from_buffer(const char *begin, const char *end,
+                                     int *words_to_read,
+                                     MarkovChain *markov_chain,
+                                     NgramModel *model)
+{
+  if (*words_to_read == 0)
+  {
+    return true;
+  }
+  STATS_PHASE_BEGIN (STATS_PHASE_BUILD);
+  // ids of the last words of the current sentence in the line, at most
+  // order of them, and one more place for the next word
+  uint32_t window[MAX_NGRAM_ORDER + 1];
+  int window_length = 0;
+  // node of the context of the window, NULL if it wasn't added yet
+  Node *window_node = NULL;
+  bool success = true;
+  const char *cur = begin;
+  while (cur < end)
+  {
+    if (is_separator (*cur))
+    {
+      if (*cur == LINE_END)
+      {
+        window_length = 0;
+        window_node = NULL;
+      }
+      cur++;
+      continue;
+    }
+    const char *start = cur;
+    while (cur < end && !is_separator (*cur))
+    {
+      cur++;
+    }
+    TokenView token = {start, (size_t) (cur - start)};
+    if (!token_table_intern_key (model->tokens, &token,
+                                 window + window_length))
+    {
+      success = false;
+      break;
+    }
+    if (window_length == model->order)
+    {
+      if (!add_ngram (markov_chain, model, window, &window_node))
+      {
+        success = false;
+        break;
+      }
+      memmove (window, window + 1, model->order * sizeof (uint32_t));
+    }
+    else
+    {
+      window_length++;
+    }
+    if (*words_to_read == 0)
+    {
+      break;
+    }
+    if (model->tokens->key_funcs->is_last_key (&token))
+    {
+      if (window_length == model->order && !window_node
+          && !add_context (markov_chain, model, window))
+      {
+        success = false;
+        break;
+      }
+      window_length = 0;
+      window_node = NULL;
+    }
+    if (*words_to_read > 0)
+    {
+      (*words_to_read)--;
+    }
+  }
+  STATS_PHASE_END (STATS_PHASE_BUILD);
+  return success;
+}
+
+static MarkovChain *create_shard(MarkovChain *markov_chain)
+{
+  MarkovChain *shard = calloc (1, sizeof (MarkovChain));
+  if (!shard)
+  {
+    return NULL;
+  }
+  shard->database = calloc (1, sizeof (LinkedList));
+  if (!shard->database)
+  {
+    free (shard);
+    return NULL;
+  }
+  update_funcs (&shard, markov_chain->print_func, markov_chain->comp_func,
+                markov_chain->free_data, markov_chain->copy_func,
+                markov_chain->is_last);
+  shard->format_start_func = markov_chain->format_start_func;
+  update_hash_func (&shard, markov_chain->hash_func);
+  update_key_funcs (&shard, markov_chain->key_funcs);
+  if (markov_chain->arena_copy
+      && !use_arena (&shard, markov_chain->arena_copy))
+  {
+    free_database (&shard);
+    return NULL;
+  }
+  return shard;
+}
+
+static void *build_shard(void *job)
+{
+  ShardJob *shard_job = job;
+  int words_to_read = READ_ALL_WORDS;
+  shard_job->success = fill_database_from_buffer (shard_job->begin,
+                                                  shard_job->end,
+                                                  &words_to_read,
+                                                  shard_job->shard);
+  return NULL;
+}
+
+static const char *find_split_point(const char *from, const char *end,
+                                    MarkovChain *markov_chain)
+{
+  const char *cur = from;
+  // the word we may be in the middle of can't be checked
+  while (cur < end && !is_separator (*cur))
+  {
+    cur++;
+  }
+  while (cur < end)
+  {
+    if (*cur == LINE_END)
+    {
+      return cur + 1;
+    }
+    if (is_separator (*cur))
+    {
+      cur++;
+      continue;
+    }
+    const char *start = cur;
+    while (cur < end && !is_separator (*cur))
+    {
+      cur++;
+    }
+    TokenView token = {start, (size_t) (cur - start)};
+    if (markov_chain->key_funcs->is_last_key (&token))
+    {
+      return cur;
+    }
+  }
+  return end;
+}
+
+bool fill_database_in_parallel(const char *begin, const char *end,
+                               MarkovChain *markov_chain, int num_threads)
+{
+  size_t size = (size_t) (end - begin);
+  if ((size_t) num_threads > size / MIN_BYTES_PER_THREAD)
+  {
+    num_threads = (int) (size / MIN_BYTES_PER_THREAD);
+  }
+  if (num_threads <= 1)
+  {
+    int words_to_read = READ_ALL_WORDS;
+    return fill_database_from_buffer (begin, end, &words_to_read,
+                                      markov_chain);
+  }
+  ShardJob *jobs = calloc (num_threads, sizeof (ShardJob));
+  pthread_t *threads = calloc (num_threads, sizeof (pthread_t));
+  bool *started = calloc (num_threads, sizeof (bool));
+  bool success = jobs && threads && started;
+  const char *job_begin = begin;
+  for (int i = 0; success && i < num_threads; i++)
+  {
+    const char *job_end = end;
+    if (i < num_threads - 1)
+    {
+      const char *target = begin + size / num_threads * (i + 1);
+      job_end = find_split_point (target > job_begin ? target : job_begin,
+                                  end, markov_chain);
+    }
+    jobs[i] = (ShardJob) {job_begin, job_end, create_shard (markov_chain),
+                          false};
+    success = jobs[i].shard != NULL;
+    job_begin = job_end;
+  }
+  for (int i = 0; success && i < num_threads; i++)
+  {
+    started[i] = pthread_create (threads + i, NULL, build_shard,
+                                 jobs + i) == 0;
+    if (!started[i])
+    {
+      build_shard (jobs + i);
+    }
+  }
+  for (int i = 0; jobs && started && i < num_threads; i++)
+  {
+    if (started[i])
+    {
+      pthread_join (threads[i], NULL);
+    }
+  }
+  // merge in corpus order, so the chain is the same as a sequential build
+  for (int i = 0; jobs && i < num_threads; i++)
+  {
+    if (!jobs[i].shard)
+    {
+      continue;
+    }
+    success = success && jobs[i].success
+              && merge_chain (markov_chain, jobs[i].shard);
+    free_database (&jobs[i].shard);
+  }
+  free (jobs);
+  free (threads);
+  free (started);
+  return success;
+}
+
+bool train_chain(const char *begin, const char *end,
+                 MarkovChain *markov_chain, int num_threads)
+{
+  return fill_database_in_parallel (begin, end, markov_chain, num_threads)
+         && freeze_chain (markov_chain);
+}
+
+static void *map_corpus(int fd, size_t *size)
+{
+  struct stat file_stat;
+  if (fstat (fd, &file_stat) == -1 || !S_ISREG (file_stat.st_mode)
+      || file_stat.st_size == 0)
+  {
+    return NULL;
+  }
+  *size = (size_t) file_stat.st_size;
+  void *text = mmap (NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (text == MAP_FAILED)
+  {
+    return NULL;
+  }
+  posix_madvise (text, *size, POSIX_MADV_SEQUENTIAL);
+  return text;
+}
+
+bool fill_database_from_mapped_file(int fd, int words_to_read,
+                                    MarkovChain *markov_chain, bool *mapped,
+                                    int num_threads)
+{
+  size_t size;
+  void *text = map_corpus (fd, &size);
+  *mapped = text != NULL;
+  if (!text)
+  {
+    return true;
+  }
+  bool success;
+  if (words_to_read == READ_ALL_WORDS)
+  {
+    success = fill_database_in_parallel (text, (const char *) text + size,
+                                         markov_chain, num_threads);
+  }
+  else
+  {
+    success = fill_database_from_buffer (text, (const char *) text + size,
+                                         &words_to_read, markov_chain);
+  }
+  munmap (text, size);
+  return success;
+}
+
+bool fill_ngram_database_from_mapped_file(int fd, int words_to_read,
+                                          MarkovChain *markov_chain,
+                                          NgramModel *model, bool *mapped)
+{
+  size_t size;
+  void *text = map_corpus (fd, &size);
+  *mapped = text != NULL;
+  if (!text)
+  {
+    return true;
+  }
+  bool success = fill_ngram_database_from_buffer (text, (const char *) text
+                                                        + size,
+                                                  &words_to_read,
+                                                  markov_chain, model);
+  munmap (text, size);
+  return success;
+}
@@ -0,0 +1,127 @@
+#ifndef _CORPUS_H_
+#define _CORPUS_H_
+#include <stdbool.h> // for bool
+#include <stddef.h> // for size_t
+#include "markov_chain.h"
+#include "ngram.h"
+
+#define READ_ALL_WORDS (-1)
+
+/**
+ * A token of the corpus, as a view into the text (not NUL terminated). The
+ * corpus looks words up by their views, as the keys of the chain's (or the
+ * token table's) key functions (see KeyFunctions), so a word is copied only
+ * when it is new.
+ */
+typedef struct TokenView {
+    const char *start;
+    size_t length;
+} TokenView;
+
+/**
+ * Tokenizes text in place and fills the chain's database with its words:
+ * every word is followed by the next word of the same line, unless it is a
+ * last word. Words are looked up by their TokenView, and only copied when
+ * they are added to the database.
+ * @param begin start of the text
+ * @param end end of the text, the text doesn't have to be NUL terminated
+ * @param words_to_read number of words to read, READ_ALL_WORDS for all the
+ * text. updated to the number of words left to read, so the next part of
+ * the corpus can continue from here.
+ * @param markov_chain the chain to fill, with key functions of TokenView
+ * keys
+ * @return true on success, false in case of allocation error
+ */
+bool fill_database_from_buffer(const char *begin, const char *end,
+                               int *words_to_read, MarkovChain *markov_chain);
+
+/**
+ * Fills the chain's database from all the text, like
+ * fill_database_from_buffer, using several threads: the text is split at
+ * line ends or after last words, each part is counted into a chain of its
+ * own, and these chains are merged in order into markov_chain. The result
+ * is the same as a sequential build.
+ * @param begin start of the text
+ * @param end end of the text
+ * @param markov_chain the chain to fill, its callbacks must be thread safe
+ * @param num_threads number of threads to use at most (small texts use
+ * fewer)
+ * @return true on success, false in case of allocation error
+ */
+bool fill_database_in_parallel(const char *begin, const char *end,
+                               MarkovChain *markov_chain, int num_threads);
+
+/**
+ * Adds new text to a chain that may already be built and frozen, without
+ * reading its old text again, and freezes it again: only the states that
+ * the new text changed are rebuilt (see freeze_chain), so the cost is in
+ * proportion to the new text. The text is counted like in
+ * fill_database_in_parallel.
+ * @param begin start of the new text
+ * @param end end of the new text
+ * @param markov_chain the chain to train
+ * @param num_threads number of threads to use at most
+ * @return true on success, false in case of allocation error
+ */
+bool train_chain(const char *begin, const char *end,
+                 MarkovChain *markov_chain, int num_threads);
+
+/**
+ * Maps a file to memory and fills the chain's database from it (see
+ * fill_database_from_buffer and fill_database_in_parallel).
+ * @param fd descriptor of a regular file open for reading
+ * @param words_to_read number of words to read, READ_ALL_WORDS for all of
+ * them
+ * @param markov_chain the chain to fill
+ * @param mapped set to false if the file couldn't be mapped (e.g. it is a
+ * pipe), in which case the database is left untouched
+ * @param num_threads number of threads to build with when reading the whole
+ * file, 1 for a sequential build
+ * @return true on success (or if the file couldn't be mapped), false in case
+ * of allocation error
+ */
+bool fill_database_from_mapped_file(int fd, int words_to_read,
+                                    MarkovChain *markov_chain, bool *mapped,
+                                    int num_threads);
+
+/**
+ * Tokenizes text in place and fills an order-k chain (see
+ * use_ngram_contexts) with its contexts: every k consecutive words of the
+ * same line, that don't continue past a last word, make a context, which is
+ * followed by the context that the next word of the line gives. Contexts
+ * that end with a last word are added even if nothing follows them. With
+ * k = 1 this is the same as fill_database_from_buffer. Tokens are interned
+ * by their TokenView, and only copied when they are new.
+ * @param begin start of the text
+ * @param end end of the text, the text doesn't have to be NUL terminated
+ * @param words_to_read number of words to read, READ_ALL_WORDS for all the
+ * text. updated to the number of words left to read.
+ * @param markov_chain the chain to fill
+ * @param model the model of the chain's contexts, its tokens are interned.
+ * its token table has key functions of TokenView keys.
+ * @return true on success, false in case of allocation error
+ */
+bool fill_ngram_database_from_buffer(const char *begin, const char *end,
+                                     int *words_to_read,
+                                     MarkovChain *markov_chain,
+                                     NgramModel *model);
+
+/**
+ * Maps a file to memory and fills an order-k chain from it (see
+ * fill_ngram_database_from_buffer). The tokens are interned in corpus order,
+ * so the build is sequential.
+ * @param fd descriptor of a regular file open for reading
+ * @param words_to_read number of words to read, READ_ALL_WORDS for all of
+ * them
+ * @param markov_chain the chain to fill
+ * @param model the model of the chain's contexts
+ * @param mapped set to false if the file couldn't be mapped, in which case
+ * the database is left untouched
+ * @return true on success (or if the file couldn't be mapped), false in case
+ * of allocation error
+ */
+bool fill_ngram_database_from_mapped_file(int fd, int words_to_read,
+                                          MarkovChain *markov_chain,
+                                          NgramModel *model, bool *mapped);
+
+#endif //_CORPUS_H_
@@ -0,0 +1,376 @@
+#define _POSIX_C_SOURCE 200809L
+#include "corpus_stream.h"
+#include "corpus.h"
+#include <errno.h> // For errno
+#include <fcntl.h> // For open()
+#include <signal.h> // For kill()
+#include <spawn.h> // For posix_spawnp()
+#include <string.h> // For memcpy()
+#include <sys/wait.h> // For waitpid()
+#include <unistd.h> // For read()
+
+// the flags every decompressor gets: decompress, to the standard output,
+// quietly
+#define DECOMPRESS_FLAGS "-dcq"
+
+extern char **environ;
+
+/**
+ * A compressed format: the suffix of its files and the program that
+ * decompresses them.
+ */
+typedef struct Decompressor {
+    const char *suffix;
+    const char *program;
+} Decompressor;
+
+static const Decompressor DECOMPRESSORS[] = {{".gz", "gzip"},
+                                             {".zst", "zstd"}};
+
+/**
+ * finds the decompressor of a corpus by the suffix of its path
+ * @param path path of the corpus
+ * @return the decompressor, NULL if the corpus isn't compressed
+ */
+static const Decompressor *get_decompressor(const char *path);
+
+/**
+ * runs a decompressor on a file as a child process, writing to a pipe
+ * @param decompressor the decompressor
+ * @param path path of the compressed file
+ * @param pid set to the id of the child process
+ * @return the read end of the pipe, -1 if the pipe or the process couldn't
+ * be created
+ */
+static int spawn_decompressor(const Decompressor *decompressor,
+                              const char *path, pid_t *pid);
+
+/**
+ * allocates a stream and starts its reader thread
+ * @param fd descriptor to read from
+ * @param owns_fd true if closing the stream closes fd
+ * @param decompressor id of the process that writes to fd, 0 if none
+ * @return the stream, NULL in case of allocation error
+ */
+static CorpusStream *start_stream(int fd, bool owns_fd, pid_t decompressor);
+
+/**
+ * finds the length of the whole lines at the start of a text
+ * @param text the text
+ * @param length length of the text
+ * @return the length up to and including the text's last line end, 0 if it
+ * has none
+ */
+static size_t get_lines_length(const char *text, size_t length);
+
+/**
+ * adds a block to the queue, waiting while the queue is full
+ * @param corpus_stream the stream
+ * @param text text of the block, freed if it isn't added
+ * @param length length of the block
+ * @return true if the block was added, false if the tokenizer stopped
+ */
+static bool push_block(CorpusStream *corpus_stream, char *text,
+                       size_t length);
+
+/**
+ * thread routine that reads a stream into blocks of whole lines until its
+ * end, a failure or until the tokenizer stops
+ * @param corpus_stream the CorpusStream
+ * @return NULL
+ */
+static void *read_stream(void *corpus_stream);
+
+static const Decompressor *get_decompressor(const char *path)
+{
+  size_t path_length = strlen (path);
+  for (size_t i = 0; i < sizeof (DECOMPRESSORS) / sizeof (Decompressor); i++)
+  {
+    size_t suffix_length = strlen (DECOMPRESSORS[i].suffix);
+    if (path_length > suffix_length
+        && strcmp (path + path_length - suffix_length,
+                   DECOMPRESSORS[i].suffix) == 0)
+    {
+      return DECOMPRESSORS + i;
+    }
+  }
+  return NULL;
+}
+
+static int spawn_decompressor(const Decompressor *decompressor,
+                              const char *path, pid_t *pid)
+{
+  int pipe_fds[2];
+  if (pipe (pipe_fds) == -1)
+  {
+    return -1;
+  }
+  // the path is an argument of its own, so it needs no quoting, and "--"
+  // keeps a path that starts with '-' from being read as flags
+  char *const args[] = {(char *) decompressor->program, DECOMPRESS_FLAGS,
+                        "--", (char *) path, NULL};
+  posix_spawn_file_actions_t actions;
+  bool spawned = posix_spawn_file_actions_init (&actions) == 0;
+  if (spawned)
+  {
+    spawned = posix_spawn_file_actions_adddup2 (&actions, pipe_fds[1],
+                                                STDOUT_FILENO) == 0
+              && posix_spawn_file_actions_addclose (&actions,
+                                                    pipe_fds[0]) == 0
+              && posix_spawn_file_actions_addclose (&actions,
+                                                    pipe_fds[1]) == 0
+              && posix_spawnp (pid, decompressor->program, &actions, NULL,
+                               args, environ) == 0;
+    posix_spawn_file_actions_destroy (&actions);
+  }
+  close (pipe_fds[1]);
+  if (!spawned)
+  {
+    close (pipe_fds[0]);
+    return -1;
+  }
+  return pipe_fds[0];
+}
+
+static CorpusStream *start_stream(int fd, bool owns_fd, pid_t decompressor)
+{
+  CorpusStream *corpus_stream = calloc (1, sizeof (CorpusStream));
+  if (!corpus_stream)
+  {
+    return NULL;
+  }
+  corpus_stream->fd = fd;
+  corpus_stream->owns_fd = owns_fd;
+  corpus_stream->decompressor = decompressor;
+  pthread_mutex_init (&corpus_stream->lock, NULL);
+  pthread_cond_init (&corpus_stream->not_empty, NULL);
+  pthread_cond_init (&corpus_stream->not_full, NULL);
+  if (pthread_create (&corpus_stream->reader, NULL, read_stream,
+                      corpus_stream) != 0)
+  {
+    pthread_mutex_destroy (&corpus_stream->lock);
+    pthread_cond_destroy (&corpus_stream->not_empty);
+    pthread_cond_destroy (&corpus_stream->not_full);
+    free (corpus_stream);
+    return NULL;
+  }
+  return corpus_stream;
+}
+
+static size_t get_lines_length(const char *text, size_t length)
+{
+  while (length > 0 && text[length - 1] != '\n')
+  {
+    length--;
+  }
+  return length;
+}
+
+static bool push_block(CorpusStream *corpus_stream, char *text,
+                       size_t length)
+{
+  pthread_mutex_lock (&corpus_stream->lock);
+  while (corpus_stream->size == STREAM_QUEUE_CAPACITY
+         && !corpus_stream->stopped)
+  {
+    pthread_cond_wait (&corpus_stream->not_full, &corpus_stream->lock);
+  }
+  bool pushed = !corpus_stream->stopped;
+  if (pushed)
+  {
+    int place = (corpus_stream->first + corpus_stream->size)
+                % STREAM_QUEUE_CAPACITY;
+    corpus_stream->queue[place] = (StreamBlock) {text, length};
+    corpus_stream->size++;
+    pthread_cond_signal (&corpus_stream->not_empty);
+  }
+  pthread_mutex_unlock (&corpus_stream->lock);
+  if (!pushed)
+  {
+    free (text);
+  }
+  return pushed;
+}
+
+static void *read_stream(void *corpus_stream)
+{
+  CorpusStream *stream = corpus_stream;
+  size_t capacity = STREAM_BLOCK_SIZE;
+  size_t length = 0;
+  char *text = malloc (capacity);
+  bool failed = !text;
+  bool end = false;
+  while (!failed && !end)
+  {
+    ssize_t num_read = read (stream->fd, text + length, capacity - length);
+    if (num_read == -1)
+    {
+      failed = errno != EINTR;
+      continue;
+    }
+    end = num_read == 0;
+    length += (size_t) num_read;
+    // full blocks keep the tokenizer's cost per block low
+    if (!end && length < capacity)
+    {
+      continue;
+    }
+    size_t block_length = end ? length : get_lines_length (text, length);
+    size_t rest = length - block_length;
+    // a line longer than the block is kept whole in a bigger one
+    size_t next_capacity = rest < STREAM_BLOCK_SIZE / 2 ? STREAM_BLOCK_SIZE
+                                                       : 2 * rest;
+    char *next = NULL;
+    if (!end)
+    {
+      next = malloc (next_capacity);
+      if (!next)
+      {
+        failed = true;
+        continue;
+      }
+      memcpy (next, text + block_length, rest);
+    }
+    if (block_length == 0)
+    {
+      free (text);
+    }
+    else if (!push_block (stream, text, block_length))
+    {
+      text = next;
+      break;
+    }
+    text = next;
+    length = rest;
+    capacity = next_capacity;
+  }
+  free (text);
+  pthread_mutex_lock (&stream->lock);
+  stream->finished = true;
+  stream->failed = failed;
+  pthread_cond_signal (&stream->not_empty);
+  pthread_mutex_unlock (&stream->lock);
+  return NULL;
+}
+
+bool is_compressed_corpus(const char *path)
+{
+  return get_decompressor (path) != NULL;
+}
+
+CorpusStream *open_corpus_stream(const char *path)
+{
+  if (strcmp (path, STDIN_PATH) == 0)
+  {
+    return open_corpus_stream_fd (STDIN_FILENO);
+  }
+  const Decompressor *decompressor = get_decompressor (path);
+  pid_t pid = 0;
+  int fd = decompressor ? spawn_decompressor (decompressor, path, &pid)
+                        : open (path, O_RDONLY);
+  if (fd == -1)
+  {
+    return NULL;
+  }
+  CorpusStream *corpus_stream = start_stream (fd, true, pid);
+  if (!corpus_stream)
+  {
+    close (fd);
+    if (pid)
+    {
+      waitpid (pid, NULL, 0);
+    }
+  }
+  return corpus_stream;
+}
+
+CorpusStream *open_corpus_stream_fd(int fd)
+{
+  return start_stream (fd, false, 0);
+}
+
+bool next_stream_block(CorpusStream *corpus_stream, StreamBlock *block)
+{
+  pthread_mutex_lock (&corpus_stream->lock);
+  while (corpus_stream->size == 0 && !corpus_stream->finished)
+  {
+    pthread_cond_wait (&corpus_stream->not_empty, &corpus_stream->lock);
+  }
+  bool taken = corpus_stream->size > 0;
+  if (taken)
+  {
+    *block = corpus_stream->queue[corpus_stream->first];
+    corpus_stream->first = (corpus_stream->first + 1) % STREAM_QUEUE_CAPACITY;
+    corpus_stream->size--;
+    pthread_cond_signal (&corpus_stream->not_full);
+  }
+  else
+  {
+    corpus_stream->drained = true;
+  }
+  pthread_mutex_unlock (&corpus_stream->lock);
+  return taken;
+}
+
+bool fill_database_from_stream(CorpusStream *corpus_stream, int words_to_read,
+                               MarkovChain *markov_chain, NgramModel *model)
+{
+  StreamBlock block;
+  bool success = true;
+  while (success && words_to_read != 0
+         && next_stream_block (corpus_stream, &block))
+  {
+    const char *end = block.text + block.length;
+    success = model ? fill_ngram_database_from_buffer (block.text, end,
+                                                       &words_to_read,
+                                                       markov_chain, model)
+                    : fill_database_from_buffer (block.text, end,
+                                                 &words_to_read,
+                                                 markov_chain);
+    free (block.text);
+  }
+  return success;
+}
+
+bool close_corpus_stream(CorpusStream **corpus_stream)
+{
+  if (!corpus_stream || !*corpus_stream)
+  {
+    return false;
+  }
+  CorpusStream *stream = *corpus_stream;
+  pthread_mutex_lock (&stream->lock);
+  stream->stopped = true;
+  bool drained = stream->drained;
+  pthread_cond_signal (&stream->not_full);
+  pthread_mutex_unlock (&stream->lock);
+  if (stream->decompressor && !drained)
+  {
+    // the rest of the output isn't needed, and the reader may be waiting
+    // for it
+    kill (stream->decompressor, SIGTERM);
+  }
+  pthread_join (stream->reader, NULL);
+  for (int i = 0; i < stream->size; i++)
+  {
+    free (stream->queue[(stream->first + i) % STREAM_QUEUE_CAPACITY].text);
+  }
+  bool success = !stream->failed;
+  if (stream->owns_fd)
+  {
+    close (stream->fd);
+  }
+  if (stream->decompressor)
+  {
+    int status = 0;
+    bool exited = waitpid (stream->decompressor, &status, 0) != -1
+                  && WIFEXITED (status) && WEXITSTATUS (status) == 0;
+    success = success && (exited || !drained);
+  }
+  pthread_mutex_destroy (&stream->lock);
+  pthread_cond_destroy (&stream->not_empty);
+  pthread_cond_destroy (&stream->not_full);
+  free (stream);
+  *corpus_stream = NULL;
+  return success;
+}
@@ -0,0 +1,114 @@
+#ifndef _CORPUS_STREAM_H_
+#define _CORPUS_STREAM_H_
+#include <pthread.h> // for pthread_t
+#include <stdbool.h> // for bool
+#include <stddef.h> // for size_t
+#include <sys/types.h> // for pid_t
+#include "markov_chain.h"
+#include "ngram.h"
+
+// the path that stands for the standard input
+#define STDIN_PATH "-"
+// the reader reads the stream in blocks of this many bytes (more if a line
+// is longer)
+#define STREAM_BLOCK_SIZE (1 << 20)
+// number of blocks that can wait between the reader and the tokenizer
+#define STREAM_QUEUE_CAPACITY 4
+
+/**
+ * A block of a corpus stream: whole lines, except for the last block of a
+ * stream that doesn't end with a line end.
+ */
+typedef struct StreamBlock {
+    char *text;
+    size_t length;
+} StreamBlock;
+
+/**
+ * A corpus that is read sequentially, from a pipe, the standard input or
+ * the output of a decompressor. A reader thread reads the stream in large
+ * blocks that it cuts at line ends, and hands them to the tokenizer through
+ * a bounded queue, so reading (and decompressing, in the decompressor's
+ * process) overlaps with filling the chain, and the slowest of them sets
+ * the pace.
+ */
+typedef struct CorpusStream {
+    int fd;
+    bool owns_fd;
+    pid_t decompressor; // 0 if the stream isn't decompressed
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    StreamBlock queue[STREAM_QUEUE_CAPACITY];
+    int first; // place of the queue's first block
+    int size;
+    bool finished; // the reader read the whole stream or failed
+    bool failed; // a read or an allocation of the reader failed
+    bool stopped; // the tokenizer stopped before the end of the stream
+    bool drained; // the tokenizer took every block of the stream
+} CorpusStream;
+
+/**
+ * Check if a corpus is compressed, by the suffix of its path (.gz or .zst).
+ * @param path path of the corpus
+ * @return true if it is compressed, false if not
+ */
+bool is_compressed_corpus(const char *path);
+
+/**
+ * Open a corpus for streaming and start reading it: STDIN_PATH for the
+ * standard input, a compressed corpus (see is_compressed_corpus) through
+ * its decompressor (gzip or zstd, run as a child process), and any other
+ * path as is.
+ * @param path path of the corpus
+ * @return the stream, NULL in case of allocation error or if the corpus or
+ * its decompressor couldn't be opened
+ */
+CorpusStream *open_corpus_stream(const char *path);
+
+/**
+ * Start reading a corpus from an open descriptor, which the stream doesn't
+ * close.
+ * @param fd descriptor open for reading, e.g. of a pipe
+ * @return the stream, NULL in case of allocation error
+ */
+CorpusStream *open_corpus_stream_fd(int fd);
+
+/**
+ * Take the next block of a stream, waiting for the reader if needed.
+ * @param corpus_stream the stream
+ * @param block set to the block, which the caller frees (its text) and may
+ * tokenize in place
+ * @return true if a block was taken, false at the end of the stream or if
+ * reading it failed (see close_corpus_stream)
+ */
+bool next_stream_block(CorpusStream *corpus_stream, StreamBlock *block);
+
+/**
+ * Fill a chain's database from a stream, block by block (see
+ * fill_database_from_buffer and fill_ngram_database_from_buffer). Blocks
+ * are whole lines, so the result is the same as from a mapped file. Stops
+ * taking blocks once words_to_read words were read.
+ * @param corpus_stream the stream
+ * @param words_to_read number of words to read, READ_ALL_WORDS for all of
+ * them
+ * @param markov_chain the chain to fill
+ * @param model the model of an order-k chain's contexts, NULL for order 1
+ * @return true on success, false in case of allocation error
+ */
+bool fill_database_from_stream(CorpusStream *corpus_stream, int words_to_read,
+                               MarkovChain *markov_chain, NgramModel *model);
+
+/**
+ * Stop reading a stream and free it. If the stream wasn't read to its end,
+ * the reader stops after its current read, and the decompressor is left to
+ * fail on its closed pipe.
+ * @param corpus_stream the stream to close, may point to NULL
+ * @return true if every read succeeded and, for a stream that was read to
+ * its end, its decompressor succeeded too. false if not or if the stream
+ * is NULL.
+ */
+bool close_corpus_stream(CorpusStream **corpus_stream);
+
+#endif //_CORPUS_STREAM_H_
@@ -21,4 +21,12 @@ typedef struct LinkedList {
  */
 int add (LinkedList *link_list, void *data);
 
+/**
+ * Append an already allocated node (e.g. from an arena) to the end of the
+ * given link list.
+ * @param link_list Link list to append to
+ * @param node the node to append, its data already set
+ */
+void append_node (LinkedList *link_list, Node *node);
+
 #endif //_LINKEDLIST_H_
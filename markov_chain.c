@@ -1,206 +1,989 @@
-
-#include "markov_chain.h"
-
-
-int get_random_number(int max_number)
-{
-  return rand() % max_number;
-}
-
-int get_num_appearances(MarkovNode *state_struct_ptr)
-{
-  int total_appearances = 0;
-  MarkovNodeFrequency *cur_node = state_struct_ptr->frequencies_list;
-  for (int counter = 0; counter < state_struct_ptr->frequencies_list_length;
-       counter++)
-  {
-    total_appearances += cur_node->frequency;
-    cur_node++;
-  }
-  return total_appearances;
-}
-
-MarkovNode* get_first_random_node(MarkovChain *markov_chain)
-{
-  Node *temp = NULL;
-  do
-  {
-    temp = markov_chain->database->first;
-    int node_number = get_random_number (markov_chain->database->size);
-    for (int node_counter = 0; node_counter < node_number; node_counter++)
-    {
-      temp = temp->next;
-    }
-  }
-  while (markov_chain->is_last(temp->data->data));
-  return temp->data;
-}
-
-
-MarkovNode* get_next_random_node(MarkovNode *state_struct_ptr)
-{
-  MarkovNodeFrequency *cur_node = state_struct_ptr->frequencies_list;
-  int num = get_random_number (get_num_appearances (state_struct_ptr));
-  while (num >= cur_node->frequency)
-  {
-    num -= cur_node->frequency;
-    cur_node++;
-  }
-  return cur_node->markov_node;
-}
-
-void generate_tweet(MarkovChain *markov_chain, MarkovNode *
-first_node, int max_length)
-{
-  if (!first_node)
-  {
-    first_node = get_first_random_node (markov_chain);
-  }
-  MarkovNode *next_node = first_node;
-  markov_chain->print_func(next_node->data);
-  for (int i = 1; i < max_length; i++)
-  {
-    next_node = get_next_random_node (next_node);
-    markov_chain->print_func(next_node->data);
-    if (markov_chain->is_last(next_node->data))
-    {
-      break;
-    }
-  }
-}
-
-void free_database(MarkovChain **markov_chain)
-{
-  Node *temp = (*markov_chain)->database->first;
-  while (temp)
-  {
-    free(temp->data->frequencies_list);
-    temp->data->frequencies_list = NULL;
-    (*markov_chain)->free_data(temp->data->data);
-    temp->data->data = NULL;
-    free(temp->data);
-    temp->data = NULL;
-    Node *prev = temp;
-    temp = temp->next;
-    free(prev);
-    prev = NULL;
-  }
-  free ((*markov_chain)->database);
-  (*markov_chain)->database = NULL;
-  free ((*markov_chain));
-  *markov_chain = NULL;
-}
-
-bool update_frequency_if_found(MarkovNode *first_node, MarkovNode
-*second_node, MarkovChain *markov_chain)
-{
-  if (!first_node || !second_node || !markov_chain)
-  {
-    return false;
-  }
-  if (!first_node->frequencies_list)
-  {
-    return false;
-  }
-  for (int i = 0; i < first_node->frequencies_list_length; i++)
-  {
-    MarkovNodeFrequency *cur_marc_node = first_node->frequencies_list +
-                                         i;
-    if (markov_chain->comp_func(cur_marc_node->markov_node->data,
-                                second_node->data) == 0)
-    {
-      cur_marc_node->frequency++;
-      return true;
-    }
-  }
-  return false;
-}
-
-bool add_node_to_frequencies_list(MarkovNode *first_node, MarkovNode
-*second_node, MarkovChain *markov_chain)
-{
-  if (!first_node || !second_node || !markov_chain)
-  {
-    return false;
-  }
-  if (update_frequency_if_found (first_node, second_node, markov_chain))
-  {
-    return true;
-  }
-  MarkovNodeFrequency *temp = realloc (first_node->frequencies_list,
-                                       (first_node->frequencies_list_length
-                                        + 1) * sizeof (MarkovNodeFrequency));
-  if (!temp)
-  {
-    printf ("%s", ALLOCATION_ERROR_MASSAGE);
-    return false;
-  }
-  first_node->frequencies_list = temp;
-  temp = NULL;
-  MarkovNodeFrequency *new_node_location = first_node->frequencies_list +
-                                           first_node->frequencies_list_length;
-  new_node_location->markov_node = second_node;
-  new_node_location->frequency = 1;
-  first_node->frequencies_list_length++;
-  return true;
-}
-
-Node* get_node_from_database(MarkovChain *markov_chain, void *data_ptr)
-{
-  Node *temp = markov_chain->database->first;
-  while (temp)
-  {
-    if (markov_chain->comp_func(temp->data->data, data_ptr) == 0)
-    {
-      return temp;
-    }
-    temp = temp->next;
-  }
-  return NULL;
-}
-
-Node* add_to_database(MarkovChain *markov_chain, void *data_ptr)
-{
-  Node *new_node = (get_node_from_database (markov_chain, data_ptr));
-  if (new_node)
-  {
-    return new_node;
-  }
-  MarkovNodeFrequency *new_freq_list = NULL;
-  MarkovNode *new_marc_node = calloc (1, sizeof (MarkovNode));
-  if (!new_marc_node)
-  {
-    return NULL;
-  }
-  new_marc_node->data = markov_chain->copy_func(data_ptr);
-  if (!new_marc_node->data)
-  {
-    free(new_marc_node);
-    new_marc_node = NULL;
-    return NULL;
-  }
-  new_marc_node->frequencies_list = new_freq_list;
-  new_marc_node->frequencies_list_length = 0;
-  int is_success = add (markov_chain->database, new_marc_node);
-  if (is_success == FAILED_ADD)
-  {
-    markov_chain->free_data(new_marc_node->data);
-    new_marc_node->data = NULL;
-    free(new_marc_node);
-    new_marc_node = NULL;
-    return NULL;
-  }
-  return markov_chain->database->last;
-}
-
-void update_funcs(MarkovChain **markov_chain, print_function print_func,
-                         compare_function comp_func, free_function free_func,
-                         copy_function copy_func, is_last_function
-                         is_last_func)
-{
-  (*markov_chain)->print_func = print_func;
-  (*markov_chain)->comp_func = comp_func;
-  (*markov_chain)->free_data = free_func;
-  (*markov_chain)->copy_func = copy_func;
-  (*markov_chain)->is_last = is_last_func;
+
+#define _POSIX_C_SOURCE 200809L
+#include "markov_chain.h"
+#include "chain_stats.h"
+#include <pthread.h> // For pthread_create()
+#include <string.h> // For memcpy(), memset()
+
+#define INITIAL_ARRAY_CAPACITY 16
+// frequencies lists at least this long get a successor index
+#define SUCCESSOR_INDEX_THRESHOLD 16
+#define GOLDEN_RATIO_64 0x9E3779B97F4A7C15ULL
+
+// number of chains that background threads are still freeing
+static int background_frees = 0;
+static pthread_mutex_t background_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t background_done = PTHREAD_COND_INITIALIZER;
+
+/**
+ * makes room for one more element at the end of a growable array, doubling
+ * its capacity if it is full
+ * @param array pointer to the array
+ * @param size number of elements in the array
+ * @param capacity pointer to the capacity of the array
+ * @return true on success, false in case of allocation error
+ */
+static bool reserve_array_place(MarkovNode ***array, int size, int *capacity);
+
+/**
+ * hashes the id of a markov node
+ * @param markov_node the node
+ * @return the hash
+ */
+static size_t hash_node_id(const MarkovNode *markov_node);
+
+/**
+ * grows the last states bitset of the chain to cover the capacity of its
+ * states array
+ * @param markov_chain the chain
+ * @param old_capacity the capacity of the states array the bitset covers
+ * @return true on success, false in case of allocation error
+ */
+static bool reserve_last_states(MarkovChain *markov_chain, int old_capacity);
+
+/**
+ * finds the place of a successor in a node's frequencies list
+ * @param first_node the node whose list to look in
+ * @param second_node the successor to look for
+ * @return the index of second_node in the list, -1 if not in it
+ */
+static int find_successor(const MarkovNode *first_node,
+                          const MarkovNode *second_node);
+
+/**
+ * puts the list entry at the given place in the node's successor index
+ * (without checking the load of the index)
+ * @param markov_node the node
+ * @param place index of the entry in the frequencies list
+ */
+static void place_in_successor_index(MarkovNode *markov_node, int place);
+
+/**
+ * keeps the successor index of a node up to date after an entry was added
+ * to the end of its frequencies list: builds the index once the list is
+ * long enough and doubles it when it gets half full.
+ * @param markov_node the node
+ * @return true on success, false in case of allocation error
+ */
+static bool update_successor_index(MarkovNode *markov_node);
+
+/**
+ * (re)builds the successor index of a node over its whole frequencies list,
+ * with room for twice the list
+ * @param markov_node the node
+ * @return true on success, false in case of allocation error
+ */
+static bool build_successor_index(MarkovNode *markov_node);
+
+/**
+ * looks for the node of a state in the database, by a probe that is either
+ * the state's data or a key that stands for it (see KeyFunctions)
+ * @param markov_chain the chain to look in its database
+ * @param probe the data or key to look for
+ * @param is_key true if probe is a key
+ * @return the node of the state, NULL if not in the database
+ */
+static Node *find_in_database(MarkovChain *markov_chain, void *probe,
+                              bool is_key);
+
+/**
+ * returns the node of a state in the database, adding the state if it isn't
+ * in it yet
+ * @param markov_chain the chain
+ * @param probe the state's data, or a key that stands for it
+ * @param is_key true if probe is a key
+ * @return the node of the state, NULL in case of allocation error
+ */
+static Node *add_state(MarkovChain *markov_chain, void *probe, bool is_key);
+
+/**
+ * adds a new state, that was just appended to the database, to the hash
+ * index and the array indexes of the chain
+ * @param markov_chain the chain
+ * @param new_marc_node the new state
+ * @return the database node of the new state, NULL in case of allocation
+ * error
+ */
+static Node *add_to_indexes(MarkovChain *markov_chain,
+                            MarkovNode *new_marc_node);
+
+/**
+ * adds a new state to the array indexes of the chain
+ * @param markov_chain the chain
+ * @param markov_node the state that was added to the database
+ * @return true on success, false in case of allocation error
+ */
+static bool add_to_state_arrays(MarkovChain *markov_chain,
+                                MarkovNode *markov_node);
+
+/**
+ * builds the alias table of a markov node (Vose's method, on integer
+ * weights so the table is exact)
+ * @param markov_node the node to build the table for
+ * @param arena if not NULL, the compacted frequencies list and the table are
+ * put in this arena
+ * @param finalize true to compact the frequencies list and free the
+ * successor index, false to keep them for more transitions
+ * @return true on success, false in case of allocation error
+ */
+static bool build_alias_table(MarkovNode *markov_node, Arena *arena,
+                              bool finalize);
+
+/**
+ * records that a node's frequencies list changed, so the next freeze_chain
+ * rebuilds it
+ * @param markov_chain the chain
+ * @param markov_node the node
+ * @return true on success, false in case of allocation error
+ */
+static bool mark_dirty(MarkovChain *markov_chain, MarkovNode *markov_node);
+
+/**
+ * creates a node for data_ptr in the chain's arena (creating the arena if
+ * needed) and appends it to the database. the data is copied into the
+ * arena if it is plain data, otherwise by copy_func.
+ * @param markov_chain the chain
+ * @param data_ptr the state to add, or a key that stands for it
+ * @param is_key true if data_ptr is a key, which arena_copy_key copies
+ * @return the new markov node, NULL in case of allocation error
+ */
+static MarkovNode *add_to_arena_database(MarkovChain *markov_chain,
+                                         void *data_ptr, bool is_key);
+
+/**
+ * frees the heap allocated lists of a markov node, the ones in the arena
+ * are left alone
+ * @param markov_node the node
+ */
+static void free_node_lists(MarkovNode *markov_node);
+
+/**
+ * thread routine that frees a chain, see free_database_in_background
+ * @param markov_chain the MarkovChain
+ * @return NULL
+ */
+static void *free_in_background(void *markov_chain);
+
+/**
+ * makes the frequencies list of a node growable again: a list that is in
+ * the arena is copied to the heap, the (now stale) alias table is dropped,
+ * and the successor index of a long list that freeze_chain dropped is
+ * rebuilt, so the lookups of the transitions that follow don't scan it.
+ * @param markov_node the node
+ * @return true on success, false in case of allocation error
+ */
+static bool make_lists_mutable(MarkovNode *markov_node);
+
+
+int get_random_number(RandomState *rng, int max_number)
+{
+  return (int) get_bounded_random (rng, (uint64_t) max_number);
+}
+
+int get_num_appearances(MarkovNode *state_struct_ptr)
+{
+  int total_appearances = 0;
+  MarkovNodeFrequency *cur_node = state_struct_ptr->frequencies_list;
+  for (int counter = 0; counter < state_struct_ptr->frequencies_list_length;
+       counter++)
+  {
+    total_appearances += cur_node->frequency;
+    cur_node++;
+  }
+  return total_appearances;
+}
+
+MarkovNode* get_first_random_node(MarkovChain *markov_chain, RandomState *rng)
+{
+  if (markov_chain->start_states_size == 0)
+  {
+    return NULL;
+  }
+  STATS_COUNT (STATS_FIRST_DRAWS);
+  return markov_chain->start_states[get_random_number
+      (rng, markov_chain->start_states_size)];
+}
+
+
+MarkovNode* get_next_random_node(MarkovNode *state_struct_ptr,
+                                 RandomState *rng)
+{
+  STATS_COUNT (STATS_NEXT_DRAWS);
+  if (state_struct_ptr->alias_table)
+  {
+    // one draw picks both the column and the threshold to compare with
+    uint64_t total = (uint64_t) state_struct_ptr->total_frequency;
+    uint64_t num = get_bounded_random
+        (rng, (uint64_t) state_struct_ptr->frequencies_list_length * total);
+    int column = (int) (num / total);
+    AliasEntry *entry = state_struct_ptr->alias_table + column;
+    if ((int) (num % total) >= entry->threshold)
+    {
+      column = entry->alias;
+    }
+    return state_struct_ptr->frequencies_list[column].markov_node;
+  }
+  STATS_COUNT (STATS_LINEAR_DRAWS);
+  MarkovNodeFrequency *cur_node = state_struct_ptr->frequencies_list;
+  int num = get_random_number (rng, get_num_appearances (state_struct_ptr));
+  while (num >= cur_node->frequency)
+  {
+    num -= cur_node->frequency;
+    cur_node++;
+  }
+  return cur_node->markov_node;
+}
+
+bool generate_tweet(MarkovChain *markov_chain, MarkovNode *
+first_node, int max_length, RandomState *rng, OutputBuffer *out)
+{
+  if (!first_node)
+  {
+    first_node = get_first_random_node (markov_chain, rng);
+    if (!first_node)
+    {
+      return true;
+    }
+  }
+  MarkovNode *next_node = first_node;
+  format_function format_start = markov_chain->format_start_func
+                                 ? markov_chain->format_start_func
+                                 : markov_chain->print_func;
+  if (!format_start (next_node->data, out))
+  {
+    return false;
+  }
+  for (int i = 1; i < max_length && next_node->frequencies_list_length > 0;
+       i++)
+  {
+    next_node = get_next_random_node (next_node, rng);
+    if (!markov_chain->print_func(next_node->data, out))
+    {
+      return false;
+    }
+    if (is_last_state (markov_chain, next_node))
+    {
+      break;
+    }
+  }
+  return true;
+}
+
+void free_database(MarkovChain **markov_chain)
+{
+  STATS_PHASE_BEGIN (STATS_PHASE_FREE);
+  // nodes are in the arena, only data that isn't plain and lists may be on
+  // the heap. the nodes were allocated in order, so the walk is sequential.
+  bool plain_data = (*markov_chain)->arena_copy != NULL;
+  for (Node *temp = (*markov_chain)->database->first;
+       temp && (!(*markov_chain)->lists_in_arena || !plain_data);
+       temp = temp->next)
+  {
+    MarkovNode *markov_node = temp->data;
+    free_node_lists (markov_node);
+    if (!plain_data)
+    {
+      (*markov_chain)->free_data (markov_node->data);
+      markov_node->data = NULL;
+    }
+  }
+  arena_free ((*markov_chain)->arena);
+  (*markov_chain)->arena = NULL;
+  free ((*markov_chain)->database);
+  (*markov_chain)->database = NULL;
+  free ((*markov_chain)->states);
+  (*markov_chain)->states = NULL;
+  free ((*markov_chain)->start_states);
+  (*markov_chain)->start_states = NULL;
+  free ((*markov_chain)->last_states);
+  (*markov_chain)->last_states = NULL;
+  free ((*markov_chain)->dirty_states);
+  (*markov_chain)->dirty_states = NULL;
+  state_index_free ((*markov_chain)->index);
+  (*markov_chain)->index = NULL;
+  free ((*markov_chain));
+  *markov_chain = NULL;
+  STATS_PHASE_END (STATS_PHASE_FREE);
+}
+
+static void *free_in_background(void *markov_chain)
+{
+  MarkovChain *chain = markov_chain;
+  free_database (&chain);
+  pthread_mutex_lock (&background_lock);
+  background_frees--;
+  pthread_cond_broadcast (&background_done);
+  pthread_mutex_unlock (&background_lock);
+  return NULL;
+}
+
+void free_database_in_background(MarkovChain **markov_chain)
+{
+  pthread_mutex_lock (&background_lock);
+  background_frees++;
+  pthread_mutex_unlock (&background_lock);
+  pthread_attr_t attributes;
+  pthread_t thread;
+  bool started = pthread_attr_init (&attributes) == 0;
+  if (started)
+  {
+    started = pthread_attr_setdetachstate (&attributes,
+                                           PTHREAD_CREATE_DETACHED) == 0
+              && pthread_create (&thread, &attributes, free_in_background,
+                                 *markov_chain) == 0;
+    pthread_attr_destroy (&attributes);
+  }
+  if (!started)
+  {
+    free_in_background (*markov_chain);
+  }
+  *markov_chain = NULL;
+}
+
+void wait_for_background_frees(void)
+{
+  pthread_mutex_lock (&background_lock);
+  while (background_frees > 0)
+  {
+    pthread_cond_wait (&background_done, &background_lock);
+  }
+  pthread_mutex_unlock (&background_lock);
+}
+
+bool update_frequency_if_found(MarkovNode *first_node, MarkovNode
+*second_node, MarkovChain *markov_chain)
+{
+  if (!first_node || !second_node || !markov_chain)
+  {
+    return false;
+  }
+  if (!first_node->frequencies_list)
+  {
+    return false;
+  }
+  int place = find_successor (first_node, second_node);
+  if (place == -1)
+  {
+    return false;
+  }
+  first_node->frequencies_list[place].frequency++;
+  return true;
+}
+
+bool add_node_to_frequencies_list(MarkovNode *first_node, MarkovNode
+*second_node, MarkovChain *markov_chain)
+{
+  return add_transitions (first_node, second_node, markov_chain, 1);
+}
+
+bool add_transitions(MarkovNode *first_node, MarkovNode *second_node,
+                     MarkovChain *markov_chain, int count)
+{
+  if (!first_node || !second_node || !markov_chain)
+  {
+    return false;
+  }
+  STATS_COUNT (STATS_TRANSITIONS);
+  markov_chain->lists_in_arena = false;
+  if (!make_lists_mutable (first_node)
+      || !mark_dirty (markov_chain, first_node))
+  {
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  int place = find_successor (first_node, second_node);
+  if (place != -1)
+  {
+    first_node->frequencies_list[place].frequency += count;
+    return true;
+  }
+  if (first_node->frequencies_list_length
+      == first_node->frequencies_list_capacity)
+  {
+    int new_capacity = first_node->frequencies_list_capacity
+                       ? first_node->frequencies_list_capacity * 2 : 1;
+    STATS_COUNT (STATS_LIST_REALLOCS);
+    MarkovNodeFrequency *temp = realloc (first_node->frequencies_list,
+                                         new_capacity
+                                         * sizeof (MarkovNodeFrequency));
+    if (!temp)
+    {
+      printf ("%s", ALLOCATION_ERROR_MASSAGE);
+      return false;
+    }
+    first_node->frequencies_list = temp;
+    first_node->frequencies_list_capacity = new_capacity;
+    temp = NULL;
+  }
+  MarkovNodeFrequency *new_node_location = first_node->frequencies_list +
+                                           first_node->frequencies_list_length;
+  new_node_location->markov_node = second_node;
+  new_node_location->frequency = count;
+  first_node->frequencies_list_length++;
+  STATS_COUNT (STATS_SUCCESSORS_ADDED);
+  if (!update_successor_index (first_node))
+  {
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  return true;
+}
+
+bool merge_chain(MarkovChain *markov_chain, MarkovChain *other)
+{
+  // the node in markov_chain of every state of other, by id
+  MarkovNode **merged = malloc ((other->database->size + 1)
+                                * sizeof (MarkovNode *));
+  if (!merged)
+  {
+    return false;
+  }
+  STATS_PHASE_BEGIN (STATS_PHASE_MERGE);
+  bool success = true;
+  for (Node *temp = other->database->first; success && temp;
+       temp = temp->next)
+  {
+    Node *node = add_to_database (markov_chain, temp->data->data);
+    success = node != NULL;
+    merged[temp->data->id] = success ? node->data : NULL;
+  }
+  for (int id = 0; success && id < other->database->size; id++)
+  {
+    MarkovNode *from_node = other->states[id];
+    for (int i = 0; success && i < from_node->frequencies_list_length; i++)
+    {
+      MarkovNodeFrequency *entry = from_node->frequencies_list + i;
+      success = add_transitions (merged[id], merged[entry->markov_node->id],
+                                 markov_chain, entry->frequency);
+    }
+  }
+  free (merged);
+  STATS_PHASE_END (STATS_PHASE_MERGE);
+  return success;
+}
+
+static Node *find_in_database(MarkovChain *markov_chain, void *probe,
+                              bool is_key)
+{
+  STATS_COUNT (STATS_LOOKUPS);
+  if (markov_chain->hash_func && !markov_chain->index)
+  {
+    markov_chain->index = state_index_create (markov_chain);
+  }
+  if (markov_chain->index)
+  {
+    return is_key ? state_index_find_key (markov_chain, probe)
+                  : state_index_find (markov_chain, probe);
+  }
+  compare_function comp_func = is_key ? markov_chain->key_funcs->comp_key
+                                      : markov_chain->comp_func;
+  Node *temp = markov_chain->database->first;
+  while (temp)
+  {
+    STATS_COUNT (STATS_LOOKUP_PROBES);
+    STATS_COUNT (STATS_COMPARISONS);
+    if (comp_func (temp->data->data, probe) == 0)
+    {
+      return temp;
+    }
+    temp = temp->next;
+  }
+  return NULL;
+}
+
+static Node *add_state(MarkovChain *markov_chain, void *probe, bool is_key)
+{
+  Node *new_node = find_in_database (markov_chain, probe, is_key);
+  if (new_node)
+  {
+    return new_node;
+  }
+  MarkovNode *new_marc_node = add_to_arena_database (markov_chain, probe,
+                                                     is_key);
+  if (!new_marc_node)
+  {
+    return NULL;
+  }
+  return add_to_indexes (markov_chain, new_marc_node);
+}
+
+Node* get_node_from_database(MarkovChain *markov_chain, void *data_ptr)
+{
+  return find_in_database (markov_chain, data_ptr, false);
+}
+
+Node* get_node_from_database_by_key(MarkovChain *markov_chain,
+                                    const void *key)
+{
+  return find_in_database (markov_chain, (void *) key, true);
+}
+
+Node* add_to_database(MarkovChain *markov_chain, void *data_ptr)
+{
+  return add_state (markov_chain, data_ptr, false);
+}
+
+Node* add_key_to_database(MarkovChain *markov_chain, const void *key)
+{
+  return add_state (markov_chain, (void *) key, true);
+}
+
+static Node *add_to_indexes(MarkovChain *markov_chain,
+                            MarkovNode *new_marc_node)
+{
+  if (markov_chain->index
+      && !state_index_insert (markov_chain, markov_chain->database->last))
+  {
+    return NULL;
+  }
+  if (!add_to_state_arrays (markov_chain, new_marc_node))
+  {
+    return NULL;
+  }
+  STATS_COUNT (STATS_STATES_ADDED);
+  return markov_chain->database->last;
+}
+
+static size_t hash_node_id(const MarkovNode *markov_node)
+{
+  unsigned long long mixed = (unsigned long long) markov_node->id
+                             * GOLDEN_RATIO_64;
+  return (size_t) (mixed ^ (mixed >> 32));
+}
+
+static int find_successor(const MarkovNode *first_node,
+                          const MarkovNode *second_node)
+{
+  if (!first_node->successor_index)
+  {
+    for (int i = 0; i < first_node->frequencies_list_length; i++)
+    {
+      if (first_node->frequencies_list[i].markov_node == second_node)
+      {
+        STATS_ADD (STATS_SUCCESSOR_PROBES, i + 1);
+        return i;
+      }
+    }
+    STATS_ADD (STATS_SUCCESSOR_PROBES, first_node->frequencies_list_length);
+    return -1;
+  }
+  size_t mask = (size_t) first_node->successor_index_capacity - 1;
+  size_t position = hash_node_id (second_node) & mask;
+  while (first_node->successor_index[position])
+  {
+    STATS_COUNT (STATS_SUCCESSOR_PROBES);
+    int place = first_node->successor_index[position] - 1;
+    if (first_node->frequencies_list[place].markov_node == second_node)
+    {
+      return place;
+    }
+    position = (position + 1) & mask;
+  }
+  return -1;
+}
+
+static void place_in_successor_index(MarkovNode *markov_node, int place)
+{
+  size_t mask = (size_t) markov_node->successor_index_capacity - 1;
+  size_t position = hash_node_id
+                        (markov_node->frequencies_list[place].markov_node)
+                    & mask;
+  while (markov_node->successor_index[position])
+  {
+    position = (position + 1) & mask;
+  }
+  markov_node->successor_index[position] = place + 1;
+}
+
+static bool update_successor_index(MarkovNode *markov_node)
+{
+  int length = markov_node->frequencies_list_length;
+  if (markov_node->successor_index
+      && length * 2 <= markov_node->successor_index_capacity)
+  {
+    place_in_successor_index (markov_node, length - 1);
+    return true;
+  }
+  if (length < SUCCESSOR_INDEX_THRESHOLD)
+  {
+    return true;
+  }
+  return build_successor_index (markov_node);
+}
+
+static bool build_successor_index(MarkovNode *markov_node)
+{
+  int length = markov_node->frequencies_list_length;
+  int capacity = SUCCESSOR_INDEX_THRESHOLD * 2;
+  while (capacity < length * 4)
+  {
+    capacity *= 2;
+  }
+  int *index = calloc (capacity, sizeof (int));
+  if (!index)
+  {
+    return false;
+  }
+  free (markov_node->successor_index);
+  markov_node->successor_index = index;
+  markov_node->successor_index_capacity = capacity;
+  for (int i = 0; i < length; i++)
+  {
+    place_in_successor_index (markov_node, i);
+  }
+  return true;
+}
+
+static bool reserve_array_place(MarkovNode ***array, int size, int *capacity)
+{
+  if (size < *capacity)
+  {
+    return true;
+  }
+  int new_capacity = *capacity ? *capacity * 2 : INITIAL_ARRAY_CAPACITY;
+  MarkovNode **temp = realloc (*array, new_capacity * sizeof (MarkovNode *));
+  if (!temp)
+  {
+    return false;
+  }
+  *array = temp;
+  *capacity = new_capacity;
+  return true;
+}
+
+static bool add_to_state_arrays(MarkovChain *markov_chain,
+                                MarkovNode *markov_node)
+{
+  // the node is already counted in the database size
+  int num_states = markov_chain->database->size - 1;
+  int old_capacity = markov_chain->states_capacity;
+  if (!reserve_array_place (&markov_chain->states, num_states,
+                            &markov_chain->states_capacity)
+      || !reserve_last_states (markov_chain, old_capacity))
+  {
+    return false;
+  }
+  markov_chain->states[num_states] = markov_node;
+  markov_node->id = num_states;
+  if (markov_chain->is_last (markov_node->data))
+  {
+    markov_chain->last_states[num_states / 64] |= (uint64_t) 1
+                                                  << (num_states % 64);
+    return true;
+  }
+  if (!reserve_array_place (&markov_chain->start_states,
+                            markov_chain->start_states_size,
+                            &markov_chain->start_states_capacity))
+  {
+    return false;
+  }
+  markov_chain->start_states[markov_chain->start_states_size++] = markov_node;
+  return true;
+}
+
+static bool reserve_last_states(MarkovChain *markov_chain, int old_capacity)
+{
+  size_t old_words = ((size_t) old_capacity + 63) / 64;
+  size_t new_words = ((size_t) markov_chain->states_capacity + 63) / 64;
+  if (new_words == old_words)
+  {
+    return true;
+  }
+  uint64_t *temp = realloc (markov_chain->last_states,
+                            new_words * sizeof (uint64_t));
+  if (!temp)
+  {
+    return false;
+  }
+  memset (temp + old_words, 0, (new_words - old_words) * sizeof (uint64_t));
+  markov_chain->last_states = temp;
+  return true;
+}
+
+bool is_last_state(const MarkovChain *markov_chain,
+                   const MarkovNode *markov_node)
+{
+  return (markov_chain->last_states[markov_node->id / 64]
+          >> (markov_node->id % 64)) & 1;
+}
+
+void update_funcs(MarkovChain **markov_chain, format_function print_func,
+                         compare_function comp_func, free_function free_func,
+                         copy_function copy_func, is_last_function
+                         is_last_func)
+{
+  (*markov_chain)->print_func = print_func;
+  (*markov_chain)->comp_func = comp_func;
+  (*markov_chain)->free_data = free_func;
+  (*markov_chain)->copy_func = copy_func;
+  (*markov_chain)->is_last = is_last_func;
+}
+
+void update_hash_func(MarkovChain **markov_chain, hash_function hash_func)
+{
+  state_index_free ((*markov_chain)->index);
+  (*markov_chain)->index = NULL;
+  (*markov_chain)->hash_func = hash_func;
+}
+
+void update_key_funcs(MarkovChain **markov_chain,
+                      const KeyFunctions *key_funcs)
+{
+  (*markov_chain)->key_funcs = key_funcs;
+}
+
+static bool build_alias_table(MarkovNode *markov_node, Arena *arena,
+                              bool finalize)
+{
+  int length = markov_node->frequencies_list_length;
+  if (markov_node->lists_in_arena)
+  {
+    return true;
+  }
+  free (markov_node->alias_table);
+  markov_node->alias_table = NULL;
+  if (finalize)
+  {
+    free (markov_node->successor_index);
+    markov_node->successor_index = NULL;
+    markov_node->successor_index_capacity = 0;
+  }
+  if (finalize && arena && length > 0)
+  {
+    // move the list to the arena, its length is final
+    MarkovNodeFrequency *compact = arena_alloc (arena, length
+                                                * sizeof
+                                                    (MarkovNodeFrequency));
+    if (!compact)
+    {
+      return false;
+    }
+    memcpy (compact, markov_node->frequencies_list,
+            length * sizeof (MarkovNodeFrequency));
+    free (markov_node->frequencies_list);
+    markov_node->frequencies_list = compact;
+    markov_node->frequencies_list_capacity = length;
+    markov_node->lists_in_arena = true;
+  }
+  else if (finalize && length < markov_node->frequencies_list_capacity)
+  {
+    // compact the list, its length is final
+    MarkovNodeFrequency *compact = realloc (markov_node->frequencies_list,
+                                            length
+                                            * sizeof (MarkovNodeFrequency));
+    if (compact)
+    {
+      markov_node->frequencies_list = compact;
+      markov_node->frequencies_list_capacity = length;
+    }
+  }
+  markov_node->total_frequency = get_num_appearances (markov_node);
+  if (length == 0)
+  {
+    return true;
+  }
+  AliasEntry *table = arena ? arena_alloc (arena, length * sizeof (AliasEntry))
+                            : malloc (length * sizeof (AliasEntry));
+  // scaled weights, then the small ones followed by the large ones (counted
+  // from the end) in one work array
+  long long *weights = malloc (length * sizeof (long long));
+  int *work = malloc (length * sizeof (int));
+  if (!table || !weights || !work)
+  {
+    if (!arena)
+    {
+      free (table);
+    }
+    free (weights);
+    free (work);
+    return false;
+  }
+  long long total = markov_node->total_frequency;
+  int num_small = 0, num_large = 0;
+  for (int i = 0; i < length; i++)
+  {
+    weights[i] = (long long) markov_node->frequencies_list[i].frequency
+                 * length;
+    if (weights[i] < total)
+    {
+      work[num_small++] = i;
+    }
+    else
+    {
+      work[length - 1 - num_large++] = i;
+    }
+  }
+  while (num_small > 0 && num_large > 0)
+  {
+    int small = work[--num_small];
+    int large = work[length - num_large];
+    table[small] = (AliasEntry) {(int) weights[small], large};
+    weights[large] -= total - weights[small];
+    if (weights[large] < total)
+    {
+      // the large entry became small: move it to the small part
+      num_large--;
+      work[num_small++] = large;
+    }
+  }
+  while (num_small > 0)
+  {
+    int small = work[--num_small];
+    table[small] = (AliasEntry) {(int) total, small};
+  }
+  while (num_large > 0)
+  {
+    int large = work[length - num_large--];
+    table[large] = (AliasEntry) {(int) total, large};
+  }
+  free (weights);
+  free (work);
+  markov_node->alias_table = table;
+  return true;
+}
+
+bool freeze_chain(MarkovChain *markov_chain)
+{
+  // after the first freeze, rebuilt lists stay on the heap, so the arena
+  // doesn't grow with every update of a node
+  bool finalize = !markov_chain->frozen;
+  Arena *arena = finalize ? markov_chain->arena : NULL;
+  STATS_PHASE_BEGIN (STATS_PHASE_FREEZE);
+  bool success = true;
+  while (success && markov_chain->dirty_states_size > 0)
+  {
+    MarkovNode *markov_node = markov_chain
+        ->dirty_states[markov_chain->dirty_states_size - 1];
+    success = build_alias_table (markov_node, arena, finalize);
+    if (success)
+    {
+      markov_node->dirty = false;
+      markov_chain->dirty_states_size--;
+    }
+  }
+  if (!success)
+  {
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+  }
+  else
+  {
+    if (finalize)
+    {
+      markov_chain->lists_in_arena = markov_chain->arena != NULL;
+    }
+    markov_chain->frozen = true;
+  }
+  STATS_PHASE_END (STATS_PHASE_FREEZE);
+  return success;
+}
+
+static bool mark_dirty(MarkovChain *markov_chain, MarkovNode *markov_node)
+{
+  if (markov_node->dirty)
+  {
+    return true;
+  }
+  if (!reserve_array_place (&markov_chain->dirty_states,
+                            markov_chain->dirty_states_size,
+                            &markov_chain->dirty_states_capacity))
+  {
+    return false;
+  }
+  markov_chain->dirty_states[markov_chain->dirty_states_size++] = markov_node;
+  markov_node->dirty = true;
+  return true;
+}
+
+static MarkovNode *add_to_arena_database(MarkovChain *markov_chain,
+                                         void *data_ptr, bool is_key)
+{
+  if (!markov_chain->arena && !(markov_chain->arena = arena_create ()))
+  {
+    return NULL;
+  }
+  Node *new_node = arena_alloc (markov_chain->arena, sizeof (Node));
+  MarkovNode *new_marc_node = arena_alloc (markov_chain->arena,
+                                           sizeof (MarkovNode));
+  if (!new_node || !new_marc_node)
+  {
+    return NULL;
+  }
+  *new_marc_node = (MarkovNode) {0};
+  if (is_key)
+  {
+    new_marc_node->data = markov_chain->key_funcs->arena_copy_key
+        (markov_chain->arena, data_ptr);
+  }
+  else
+  {
+    new_marc_node->data = markov_chain->arena_copy
+                          ? markov_chain->arena_copy (markov_chain->arena,
+                                                      data_ptr)
+                          : markov_chain->copy_func (data_ptr);
+  }
+  if (!new_marc_node->data)
+  {
+    return NULL;
+  }
+  new_node->data = new_marc_node;
+  append_node (markov_chain->database, new_node);
+  return new_marc_node;
+}
+
+static void free_node_lists(MarkovNode *markov_node)
+{
+  if (!markov_node->lists_in_arena)
+  {
+    free (markov_node->frequencies_list);
+    free (markov_node->alias_table);
+  }
+  markov_node->frequencies_list = NULL;
+  markov_node->alias_table = NULL;
+  free (markov_node->successor_index);
+  markov_node->successor_index = NULL;
+}
+
+static bool make_lists_mutable(MarkovNode *markov_node)
+{
+  int length = markov_node->frequencies_list_length;
+  if (!markov_node->lists_in_arena)
+  {
+    free (markov_node->alias_table);
+    markov_node->alias_table = NULL;
+  }
+  else
+  {
+    MarkovNodeFrequency *list = malloc (length
+                                        * sizeof (MarkovNodeFrequency));
+    if (!list)
+    {
+      return false;
+    }
+    memcpy (list, markov_node->frequencies_list,
+            length * sizeof (MarkovNodeFrequency));
+    markov_node->frequencies_list = list;
+    markov_node->frequencies_list_capacity = length;
+    markov_node->alias_table = NULL;
+    markov_node->lists_in_arena = false;
+  }
+  // only a frozen list can be long without an index
+  if (!markov_node->successor_index && length >= SUCCESSOR_INDEX_THRESHOLD)
+  {
+    return build_successor_index (markov_node);
+  }
+  return true;
+}
+
+bool use_arena(MarkovChain **markov_chain, arena_copy_function arena_copy)
+{
+  if (!(*markov_chain)->arena)
+  {
+    (*markov_chain)->arena = arena_create ();
+    if (!(*markov_chain)->arena)
+    {
+      return false;
+    }
+  }
+  (*markov_chain)->arena_copy = arena_copy;
+  return true;
 }
\ No newline at end of file
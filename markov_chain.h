@@ -1,177 +1,426 @@
-#ifndef _MARKOV_CHAIN_H
-#define _MARKOV_CHAIN_H
-#define FAILED_ADD 1
-
-#include "linked_list.h"
-#include <stdio.h>  // For printf(), sscanf()
-#include <stdlib.h> // For exit(), malloc()
-#include <stdbool.h> // for bool
-
-#define ALLOCATION_ERROR_MASSAGE "Allocation failure: Failed to allocate new memory\n"
-
-
-/***************************/
-/*   insert typedefs here  */
-typedef void (*print_function) (void*);
-typedef int (*compare_function) (void*, void*);
-typedef void (*free_function) (void*);
-typedef void* (*copy_function) (const void*);
-typedef bool (*is_last_function) (void*);
-/***************************/
-
-
-/***************************/
-
-
-
-/***************************/
-/*        STRUCTS          */
-/***************************/
-
-typedef struct MarkovNode {
-    void *data;
-    struct MarkovNodeFrequency *frequencies_list;
-    int frequencies_list_length;
-} MarkovNode;
-
-typedef struct MarkovNodeFrequency {
-    struct MarkovNode *markov_node;
-    int frequency;
-} MarkovNodeFrequency;
-
-/* DO NOT ADD or CHANGE variable names in this struct */
-typedef struct MarkovChain {
-    LinkedList *database;
-
-    // pointer to a func that receives data from a generic type and prints it
-    // returns void.
-    print_function print_func;
-
-    // pointer to a func that gets 2 pointers of generic data type(same one)
-    // and compare between them */
-    // returns: - a positive value if the first is bigger
-    //          - a negative value if the second is bigger
-    //          - 0 if equal
-    compare_function comp_func;
-
-    // a pointer to a function that gets a pointer of generic data type and
-    // frees it.
-    // returns void.
-    free_function free_data;
-
-    // a pointer to a function that  gets a pointer of generic data type and
-    // returns a newly allocated copy of it
-    // returns a generic pointer.
-    copy_function copy_func;
-
-    //  a pointer to function that gets a pointer of generic data type
-    //  and returns:
-    //      - true if it's the last state.
-    //      - false otherwise.
-    is_last_function is_last;
-} MarkovChain;
-
-/**
- * returns a random number
- * @param max_number the max possible number
- * @return
- */
-int get_random_number(int max_number);
-
-/**
- * counter the frequencies of all markov nodes in a node's frequency list
- * @param state_struct_ptr
- * @return
- */
-int get_num_appearances(MarkovNode *state_struct_ptr);
-
-/**
- * looks for a markov node on a frequency list of another and updates it's
- * frequency if found
- * @param first_node the first markov node
- * @param second_node the second
- * @param markov_chain the markov chain
- * @return true if found, false if not
- */
-bool update_frequency_if_found(MarkovNode *first_node, MarkovNode
-*second_node, MarkovChain *markov_chain);
-
-
-
-
-/**
- * Get one random state from the given markov_chain's database.
- * @param markov_chain
- * @return
- */
-MarkovNode* get_first_random_node(MarkovChain *markov_chain);
-
-/**
- * Choose randomly the next state, depend on it's occurrence frequency.
- * @param state_struct_ptr MarkovNode to choose from
- * @return MarkovNode of the chosen state
- */
-MarkovNode* get_next_random_node(MarkovNode *state_struct_ptr);
-
-/**
- * Receive markov_chain, generate and print random sentence out of it. The
- * sentence most have at least 2 words in it.
- * @param markov_chain
- * @param first_node markov_node to start with, if NULL- choose a random markov_node
- * @param  max_length maximum length of chain to generate
- */
-void generate_tweet(MarkovChain *markov_chain, MarkovNode *
-first_node, int max_length);
-
-/**
- * Free markov_chain and all of it's content from memory
- * @param markov_chain markov_chain to free
- */
-void free_database(MarkovChain **markov_chain);
-
-/**
- * Add the second markov_node to the counter list of the first markov_node.
- * If already in list, update it's counter value.
- * @param first_node
- * @param second_node
- * @param markov_chain
- * @return success/failure: true if the process was successful, false if in
- * case of allocation error.
- */
-bool add_node_to_frequencies_list(MarkovNode *first_node, MarkovNode
-*second_node, MarkovChain *markov_chain);
-
-/**
-* Check if data_ptr is in database. If so, return the markov_node wrapping it in
- * the markov_chain, otherwise return NULL.
- * @param markov_chain the chain to look in its database
- * @param data_ptr the state to look for
- * @return Pointer to the Node wrapping given state, NULL if state not in
- * database.
- */
-Node* get_node_from_database(MarkovChain *markov_chain, void *data_ptr);
-
-/**
-* If data_ptr in markov_chain, return it's node. Otherwise, create new
- * node, add to end of markov_chain's database and return it.
- * @param markov_chain the chain to look in its database
- * @param data_ptr the state to look for
- * @return node wrapping given data_ptr in given chain's database
- */
-Node* add_to_database(MarkovChain *markov_chain, void *data_ptr);
-
-/**
- * receives 5 functions and a pointer to a pointer to markov chain and
- * updates the fields of the markov chain.
- * @param markov_chain
- * @param print_func
- * @param comp_func
- * @param free_func
- * @param copy_func
- * @param is_last_func
- */
-void update_funcs(MarkovChain **markov_chain, print_function print_func,
-                  compare_function comp_func, free_function free_func,
-                  copy_function copy_func, is_last_function is_last_func);
-
-#endif /* MARKOV_CHAIN_H */
+#ifndef _MARKOV_CHAIN_H
+#define _MARKOV_CHAIN_H
+#define FAILED_ADD 1
+
+#include "linked_list.h"
+#include "state_index.h"
+#include "arena.h"
+#include "random_state.h"
+#include "output_buffer.h"
+#include <stdio.h>  // For printf(), sscanf()
+#include <stdlib.h> // For exit(), malloc()
+#include <stdbool.h> // for bool
+#include <stdint.h> // for uint64_t
+
+#define ALLOCATION_ERROR_MASSAGE "Allocation failure: Failed to allocate new memory\n"
+
+
+/***************************/
+/*   insert typedefs here  */
+typedef bool (*format_function) (void*, OutputBuffer*);
+typedef int (*compare_function) (void*, void*);
+typedef void (*free_function) (void*);
+typedef void* (*copy_function) (const void*);
+typedef bool (*is_last_function) (void*);
+typedef size_t (*hash_function) (void*);
+typedef void* (*arena_copy_function) (Arena*, const void*);
+/***************************/
+
+
+/***************************/
+
+
+
+/***************************/
+/*        STRUCTS          */
+/***************************/
+
+/**
+ * Optional functions that look states up by a key that stands for them,
+ * e.g. a word by a view into the text it was read from, so a key is only
+ * copied when its state is new (see add_key_to_database).
+ */
+typedef struct KeyFunctions {
+    // hash of a key, equal to the hash_func of the state it stands for
+    hash_function hash_key;
+    // compares the data of a state (first) with a key (second), 0 if the
+    // key stands for the state
+    compare_function comp_key;
+    // copies a key into an arena as the data of a new state
+    arena_copy_function arena_copy_key;
+    // checks if a key stands for a last state
+    is_last_function is_last_key;
+} KeyFunctions;
+
+typedef struct MarkovNode {
+    void *data;
+    // index of the node in its chain's states array
+    int id;
+    struct MarkovNodeFrequency *frequencies_list;
+    int frequencies_list_length;
+    int frequencies_list_capacity;
+    // open-addressing index from a successor's address to its place in
+    // frequencies_list plus one (0 marks an empty slot). only built for long
+    // lists, dropped by the first freeze_chain and rebuilt by the next
+    // transition added to the list.
+    int *successor_index;
+    int successor_index_capacity;
+    // sum of the frequencies in frequencies_list, cached by freeze_chain
+    int total_frequency;
+    // alias table over frequencies_list, NULL unless the chain is frozen
+    struct AliasEntry *alias_table;
+    // true if frequencies_list and alias_table were moved to the chain's
+    // arena by freeze_chain, so they must not be freed or reallocated
+    bool lists_in_arena;
+    // true if frequencies_list changed since the last freeze_chain (the
+    // node is then in the chain's dirty_states)
+    bool dirty;
+    // the successors as last published for concurrent readers, owned by a
+    // ConcurrentChain (see concurrent_chain.h). NULL if never published.
+    struct PublishedRow *published_row;
+} MarkovNode;
+
+typedef struct MarkovNodeFrequency {
+    struct MarkovNode *markov_node;
+    int frequency;
+} MarkovNodeFrequency;
+
+/**
+ * one column of a Walker/Vose alias table: the column's own entry is chosen
+ * if a random number in [0, total_frequency) is smaller than threshold,
+ * otherwise the entry at index alias is chosen.
+ */
+typedef struct AliasEntry {
+    int threshold;
+    int alias;
+} AliasEntry;
+
+/* DO NOT ADD or CHANGE variable names in this struct */
+typedef struct MarkovChain {
+    LinkedList *database;
+
+    // pointer to a func that receives data from a generic type and prints
+    // it, by formatting it into an output buffer.
+    // returns true on success, false in case of allocation error.
+    format_function print_func;
+
+    // optional pointer to a func that formats the first state of a
+    // sentence, for states that stand for more than their newest token
+    // (see ngram.h). if NULL, print_func is used.
+    format_function format_start_func;
+
+    // pointer to a func that gets 2 pointers of generic data type(same one)
+    // and compare between them */
+    // returns: - a positive value if the first is bigger
+    //          - a negative value if the second is bigger
+    //          - 0 if equal
+    compare_function comp_func;
+
+    // a pointer to a function that gets a pointer of generic data type and
+    // frees it.
+    // returns void.
+    free_function free_data;
+
+    // a pointer to a function that  gets a pointer of generic data type and
+    // returns a newly allocated copy of it
+    // returns a generic pointer.
+    copy_function copy_func;
+
+    //  a pointer to function that gets a pointer of generic data type
+    //  and returns:
+    //      - true if it's the last state.
+    //      - false otherwise.
+    is_last_function is_last;
+
+    // optional pointer to a func that gets a pointer of generic data type
+    // and returns a hash of it. states that are equal by comp_func must have
+    // the same hash.
+    // if NULL, states are looked up by a linear scan of the database.
+    hash_function hash_func;
+
+    // hash index over the database, built on the first lookup after
+    // hash_func is set. NULL if hash_func is NULL.
+    StateIndex *index;
+
+    // array index of the database: all the states, in insertion order.
+    // kept up to date by add_to_database.
+    MarkovNode **states;
+    int states_capacity;
+
+    // bitset over the states' ids: bit id is set if states[id] is a last
+    // state, so walks don't need to call is_last
+    uint64_t *last_states;
+
+    // the states that are not last states, to choose a first state from
+    MarkovNode **start_states;
+    int start_states_size;
+    int start_states_capacity;
+
+    // arena that owns the Node and MarkovNode of every state, the data of
+    // the states if they are plain data (see use_arena), and the
+    // frequencies lists of frozen nodes. created by the first state.
+    Arena *arena;
+
+    // optional pointer to a function that gets an arena and a pointer of
+    // generic data type and returns a copy of it allocated from the arena.
+    // used instead of copy_func for plain data, which free_database
+    // releases with the arena instead of calling free_data. NULL if the
+    // data is copied by copy_func.
+    arena_copy_function arena_copy;
+
+    // optional functions that look states up by keys (see KeyFunctions),
+    // for plain data only. NULL if states are only looked up by their data.
+    const KeyFunctions *key_funcs;
+
+    // true if all the frequencies lists are in the arena, so free_database
+    // doesn't need to visit the nodes
+    bool lists_in_arena;
+
+    // the states whose frequencies lists changed since the last
+    // freeze_chain, which are the only ones it rebuilds
+    MarkovNode **dirty_states;
+    int dirty_states_size;
+    int dirty_states_capacity;
+
+    // true once freeze_chain was called
+    bool frozen;
+} MarkovChain;
+
+/**
+ * returns a random number in [0, max_number), without modulo bias
+ * @param rng the random state to draw from
+ * @param max_number the max possible number (exclusive), positive
+ * @return
+ */
+int get_random_number(RandomState *rng, int max_number);
+
+/**
+ * counter the frequencies of all markov nodes in a node's frequency list
+ * @param state_struct_ptr
+ * @return
+ */
+int get_num_appearances(MarkovNode *state_struct_ptr);
+
+/**
+ * looks for a markov node on a frequency list of another and updates it's
+ * frequency if found. states are unique in a chain, so nodes are matched by
+ * address (through the successor index for long lists).
+ * @param first_node the first markov node
+ * @param second_node the second
+ * @param markov_chain the markov chain
+ * @return true if found, false if not
+ */
+bool update_frequency_if_found(MarkovNode *first_node, MarkovNode
+*second_node, MarkovChain *markov_chain);
+
+
+
+
+/**
+ * Get one random state, that is not a last state, from the given
+ * markov_chain's database.
+ * @param markov_chain
+ * @param rng the random state to draw from
+ * @return the chosen state, NULL if all the states are last states
+ */
+MarkovNode* get_first_random_node(MarkovChain *markov_chain, RandomState *rng);
+
+/**
+ * Check if a state of the chain is a last state, by the chain's bitset
+ * instead of is_last.
+ * @param markov_chain the chain
+ * @param markov_node a state of the chain
+ * @return true if last, false if not
+ */
+bool is_last_state(const MarkovChain *markov_chain,
+                   const MarkovNode *markov_node);
+
+/**
+ * Choose randomly the next state, depend on it's occurrence frequency.
+ * If the node has an alias table (see freeze_chain) this takes constant
+ * time, otherwise it is linear in the length of the frequencies list.
+ * @param state_struct_ptr MarkovNode to choose from
+ * @param rng the random state to draw from
+ * @return MarkovNode of the chosen state
+ */
+MarkovNode* get_next_random_node(MarkovNode *state_struct_ptr,
+                                 RandomState *rng);
+
+/**
+ * Receive markov_chain, generate random sentence out of it and format it
+ * into out. The sentence has at least 2 words in it, unless its first state
+ * has no successors, and ends at a last state or after max_length states
+ * (see generate_constrained_tweet for bounds that are enforced). The first
+ * state is formatted by format_start_func, if the chain has one.
+ * @param markov_chain
+ * @param first_node markov_node to start with, if NULL- choose a random markov_node
+ * @param  max_length maximum length of chain to generate
+ * @param rng the random state to draw from. generating with the same chain
+ * from several threads is safe as long as each one has its own state.
+ * @param out the buffer to append the sentence to
+ * @return true on success, false in case of allocation error
+ */
+bool generate_tweet(MarkovChain *markov_chain, MarkovNode *
+first_node, int max_length, RandomState *rng, OutputBuffer *out);
+
+/**
+ * Free markov_chain and all of it's content from memory. The states are
+ * released in bulk with the arena's chunks: only the data that isn't plain
+ * (see use_arena) and the frequencies lists that aren't in the arena are
+ * freed one by one, so a frozen chain of plain data takes a few frees.
+ * @param markov_chain markov_chain to free
+ */
+void free_database(MarkovChain **markov_chain);
+
+/**
+ * Free markov_chain like free_database, on a thread of its own, so a caller
+ * that replaces a chain doesn't wait for its teardown. Frees it right away
+ * if the thread can't be created.
+ * @param markov_chain markov_chain to free, set to NULL
+ */
+void free_database_in_background(MarkovChain **markov_chain);
+
+/**
+ * Wait until every chain passed to free_database_in_background is freed,
+ * e.g. before the program exits.
+ */
+void wait_for_background_frees(void);
+
+/**
+ * Add the second markov_node to the counter list of the first markov_node.
+ * If already in list, update it's counter value.
+ * @param first_node
+ * @param second_node
+ * @param markov_chain
+ * @return success/failure: true if the process was successful, false if in
+ * case of allocation error.
+ */
+bool add_node_to_frequencies_list(MarkovNode *first_node, MarkovNode
+*second_node, MarkovChain *markov_chain);
+
+/**
+ * Add count transitions from the first markov_node to the second one: like
+ * calling add_node_to_frequencies_list count times.
+ * @param first_node
+ * @param second_node
+ * @param markov_chain
+ * @param count number of transitions to add, positive
+ * @return true on success, false in case of allocation error
+ */
+bool add_transitions(MarkovNode *first_node, MarkovNode *second_node,
+                     MarkovChain *markov_chain, int count);
+
+/**
+ * Add all the states and transitions of another chain (with the same
+ * callbacks) to the markov chain, summing the frequencies. Every state of
+ * the other chain is looked up once, and its transitions are then mapped by
+ * the states' ids. New states are added in the other chain's order, so
+ * merging the chains built from consecutive parts of a corpus, in order,
+ * gives the same chain as building from the whole corpus.
+ * @param markov_chain the chain to add to
+ * @param other the chain to add, left unchanged
+ * @return true on success, false in case of allocation error
+ */
+bool merge_chain(MarkovChain *markov_chain, MarkovChain *other);
+
+/**
+* Check if data_ptr is in database. If so, return the markov_node wrapping it in
+ * the markov_chain, otherwise return NULL.
+ * @param markov_chain the chain to look in its database
+ * @param data_ptr the state to look for
+ * @return Pointer to the Node wrapping given state, NULL if state not in
+ * database.
+ */
+Node* get_node_from_database(MarkovChain *markov_chain, void *data_ptr);
+
+/**
+ * Like get_node_from_database, by a key that stands for the state (see
+ * KeyFunctions).
+ * @param markov_chain the chain to look in its database, with key_funcs
+ * @param key the key of the state to look for
+ * @return Pointer to the Node of the state, NULL if state not in database.
+ */
+Node* get_node_from_database_by_key(MarkovChain *markov_chain,
+                                    const void *key);
+
+/**
+ * Like add_to_database, by a key that stands for the state (see
+ * KeyFunctions): the key is copied into the chain's arena only if the state
+ * is new.
+ * @param markov_chain the chain to look in its database, with key_funcs
+ * @param key the key of the state to look for
+ * @return node of the state in given chain's database, NULL in case of
+ * allocation error
+ */
+Node* add_key_to_database(MarkovChain *markov_chain, const void *key);
+
+/**
+* If data_ptr in markov_chain, return it's node. Otherwise, create new
+ * node, add to end of markov_chain's database (and its array indexes) and
+ * return it.
+ * @param markov_chain the chain to look in its database
+ * @param data_ptr the state to look for
+ * @return node wrapping given data_ptr in given chain's database
+ */
+Node* add_to_database(MarkovChain *markov_chain, void *data_ptr);
+
+/**
+ * receives 5 functions and a pointer to a pointer to markov chain and
+ * updates the fields of the markov chain.
+ * @param markov_chain
+ * @param print_func
+ * @param comp_func
+ * @param free_func
+ * @param copy_func
+ * @param is_last_func
+ */
+void update_funcs(MarkovChain **markov_chain, format_function print_func,
+                  compare_function comp_func, free_function free_func,
+                  copy_function copy_func, is_last_function is_last_func);
+
+/**
+ * sets the hash function of the markov chain, so states are looked up in a
+ * hash index instead of by a linear scan of the database.
+ * @param markov_chain
+ * @param hash_func hash function of the states, NULL to go back to scans
+ */
+void update_hash_func(MarkovChain **markov_chain, hash_function hash_func);
+
+/**
+ * sets the key functions of the markov chain, so states can be looked up
+ * by keys that stand for them (see KeyFunctions). The chain's states must be
+ * plain data (see use_arena).
+ * @param markov_chain
+ * @param key_funcs the key functions, which must outlive the chain. NULL to
+ * look states up by their data only.
+ */
+void update_key_funcs(MarkovChain **markov_chain,
+                      const KeyFunctions *key_funcs);
+
+/**
+ * Precompute the sampling structures of the chain's nodes (cached total
+ * frequency and alias table), so get_next_random_node takes constant time.
+ * Only the nodes whose frequencies lists changed since the last call are
+ * rebuilt, so after adding text to a frozen chain, freezing it again costs
+ * time in proportion to the states the text changed, not to the chain.
+ * The first call compacts the frequencies lists (into the arena if the chain
+ * has one) and frees the successor indexes used while building; adding to
+ * a long list afterwards rebuilds its index. Later calls keep the indexes,
+ * so the chain can keep growing cheaply. Until a changed node is
+ * frozen again, get_next_random_node samples it by a linear scan.
+ * @param markov_chain the chain to freeze
+ * @return true on success, false in case of allocation error
+ */
+bool freeze_chain(MarkovChain *markov_chain);
+
+/**
+ * declares the chain's states plain data, which is copied into the chain's
+ * arena and freed all at once with it by free_database, without calling
+ * free_data. must be called before anything is added to the database.
+ * @param markov_chain
+ * @param arena_copy copies a state into the arena, used instead of copy_func
+ * @return true on success, false in case of allocation error
+ */
+bool use_arena(MarkovChain **markov_chain, arena_copy_function arena_copy);
+
+#endif /* MARKOV_CHAIN_H */
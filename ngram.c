@@ -0,0 +1,215 @@
+#include "ngram.h"
+#include <string.h> // For memcmp(), memcpy()
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/**
+ * A context with room for the tokens of any order, to look contexts up
+ * without allocating.
+ */
+typedef union ContextKey {
+    NgramContext context;
+    unsigned char bytes[sizeof (NgramContext)
+                        + MAX_NGRAM_ORDER * sizeof (uint32_t)];
+} ContextKey;
+
+/**
+ * returns the size of a context of the model
+ * @param model the model
+ * @return size in bytes
+ */
+static size_t context_size(const NgramModel *model);
+
+/**
+ * formats the newest token of a context
+ * @param context a generic pointer to an NgramContext
+ * @param out the buffer to append to
+ * @return true on success, false in case of allocation error
+ */
+static bool format_context(void *context, OutputBuffer *out);
+
+/**
+ * formats all the tokens of a context, oldest first
+ * @param context a generic pointer to an NgramContext
+ * @param out the buffer to append to
+ * @return true on success, false in case of allocation error
+ */
+static bool format_whole_context(void *context, OutputBuffer *out);
+
+/**
+ * compares two contexts of the same model by their token ids
+ * @param first the first context
+ * @param second the second context
+ * @return 0 if equal, non zero otherwise
+ */
+static int compare_context(void *first, void *second);
+
+/**
+ * hashes the token ids of a context (FNV-1a)
+ * @param context a generic pointer to an NgramContext
+ * @return the hash of the context
+ */
+static size_t hash_context(void *context);
+
+/**
+ * copies a context to a newly allocated pointer
+ * @param context a pointer to an NgramContext
+ * @return the copy, NULL in case of allocation error
+ */
+static void *copy_context(const void *context);
+
+/**
+ * copies a context into an arena
+ * @param arena the arena to copy to
+ * @param context a pointer to an NgramContext
+ * @return the copy, NULL in case of allocation error
+ */
+static void *arena_copy_context(Arena *arena, const void *context);
+
+/**
+ * checks if the newest token of a context is a last token
+ * @param context a generic pointer to an NgramContext
+ * @return true if last, false if not
+ */
+static bool is_last_context(void *context);
+
+static size_t context_size(const NgramModel *model)
+{
+  return sizeof (NgramContext) + (size_t) model->order * sizeof (uint32_t);
+}
+
+static bool format_context(void *context, OutputBuffer *out)
+{
+  NgramContext *cur = context;
+  const NgramModel *model = cur->model;
+  return model->format_token (model->tokens->tokens[cur->tokens[model->order
+                                                                 - 1]], out);
+}
+
+static bool format_whole_context(void *context, OutputBuffer *out)
+{
+  NgramContext *cur = context;
+  const NgramModel *model = cur->model;
+  for (int i = 0; i < model->order; i++)
+  {
+    if (!model->format_token (model->tokens->tokens[cur->tokens[i]], out))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int compare_context(void *first, void *second)
+{
+  NgramContext *first_context = first;
+  NgramContext *second_context = second;
+  return memcmp (first_context->tokens, second_context->tokens,
+                 (size_t) first_context->model->order * sizeof (uint32_t));
+}
+
+static size_t hash_context(void *context)
+{
+  NgramContext *cur = context;
+  unsigned long long hash = FNV_OFFSET_BASIS;
+  for (int i = 0; i < cur->model->order; i++)
+  {
+    hash ^= cur->tokens[i];
+    hash *= FNV_PRIME;
+  }
+  return (size_t) hash;
+}
+
+static void *copy_context(const void *context)
+{
+  const NgramContext *cur = context;
+  size_t size = context_size (cur->model);
+  void *new = malloc (size);
+  if (!new)
+  {
+    return NULL;
+  }
+  memcpy (new, context, size);
+  return new;
+}
+
+static void *arena_copy_context(Arena *arena, const void *context)
+{
+  const NgramContext *cur = context;
+  size_t size = context_size (cur->model);
+  void *new = arena_alloc (arena, size);
+  if (!new)
+  {
+    return NULL;
+  }
+  memcpy (new, context, size);
+  return new;
+}
+
+static bool is_last_context(void *context)
+{
+  NgramContext *cur = context;
+  const NgramModel *model = cur->model;
+  return model->is_last_token (model->tokens->tokens[cur->tokens[model->order
+                                                                 - 1]]);
+}
+
+NgramModel *create_ngram_model(int order, format_function format_token,
+                               compare_function comp_token,
+                               hash_function hash_token,
+                               arena_copy_function arena_copy_token,
+                               is_last_function is_last_token,
+                               const KeyFunctions *key_funcs)
+{
+  if (order < MIN_NGRAM_ORDER || order > MAX_NGRAM_ORDER)
+  {
+    return NULL;
+  }
+  NgramModel *model = calloc (1, sizeof (NgramModel));
+  if (!model)
+  {
+    return NULL;
+  }
+  model->tokens = token_table_create (hash_token, comp_token,
+                                      arena_copy_token, key_funcs);
+  if (!model->tokens)
+  {
+    free (model);
+    return NULL;
+  }
+  model->order = order;
+  model->format_token = format_token;
+  model->is_last_token = is_last_token;
+  return model;
+}
+
+bool use_ngram_contexts(MarkovChain **markov_chain)
+{
+  update_funcs (markov_chain, format_context, compare_context, free,
+                copy_context, is_last_context);
+  (*markov_chain)->format_start_func = format_whole_context;
+  update_hash_func (markov_chain, hash_context);
+  return use_arena (markov_chain, arena_copy_context);
+}
+
+Node *add_context(MarkovChain *markov_chain, const NgramModel *model,
+                  const uint32_t *tokens)
+{
+  ContextKey key;
+  key.context.model = model;
+  memcpy (key.context.tokens, tokens,
+          (size_t) model->order * sizeof (uint32_t));
+  return add_to_database (markov_chain, &key.context);
+}
+
+void free_ngram_model(NgramModel **model)
+{
+  if (!*model)
+  {
+    return;
+  }
+  token_table_free (&(*model)->tokens);
+  free (*model);
+  *model = NULL;
+}
@@ -0,0 +1,87 @@
+#ifndef _NGRAM_H_
+#define _NGRAM_H_
+#include <stdbool.h> // for bool
+#include <stdint.h> // for uint32_t
+#include "markov_chain.h"
+#include "token_table.h"
+
+#define MIN_NGRAM_ORDER 1
+#define MAX_NGRAM_ORDER 5
+
+/**
+ * An order-k markov model over tokens: the states of its chain are contexts
+ * of the last k tokens, and a transition appends one token to a context and
+ * drops its oldest one. Tokens are interned once in a token table that all
+ * the contexts share, and contexts hold only their tokens' ids.
+ */
+typedef struct NgramModel {
+    int order;
+    TokenTable *tokens;
+
+    // formats a single token into an output buffer
+    format_function format_token;
+
+    // checks if a single token is a last token
+    is_last_function is_last_token;
+} NgramModel;
+
+/**
+ * The state of an order-k chain: the ids of its k tokens, oldest first.
+ * Contexts are allocated with exactly order ids.
+ */
+typedef struct NgramContext {
+    const NgramModel *model;
+    uint32_t tokens[];
+} NgramContext;
+
+/**
+ * Create an order-k model with an empty token table.
+ * @param order the order of the model, between MIN_NGRAM_ORDER and
+ * MAX_NGRAM_ORDER
+ * @param format_token formats a token
+ * @param comp_token compares two tokens
+ * @param hash_token hash function of the tokens
+ * @param arena_copy_token copies a token into an arena
+ * @param is_last_token checks if a token is a last token
+ * @param key_funcs functions of keys that stand for tokens (see
+ * KeyFunctions), so the corpus interns tokens without copying them, and
+ * must outlive the model. NULL if tokens are only interned by themselves.
+ * @return a newly allocated model, NULL if the order is invalid or in case
+ * of allocation error
+ */
+NgramModel *create_ngram_model(int order, format_function format_token,
+                               compare_function comp_token,
+                               hash_function hash_token,
+                               arena_copy_function arena_copy_token,
+                               is_last_function is_last_token,
+                               const KeyFunctions *key_funcs);
+
+/**
+ * Set the callbacks of an empty markov chain so its states are contexts
+ * (see add_context). A generated sentence starts with all the tokens of its
+ * first context, and every step adds the newest token of the next context.
+ * The chain's states are kept in an arena. The model of the contexts must
+ * outlive the chain.
+ * @param markov_chain the chain, nothing must be added to it yet
+ * @return true on success, false in case of allocation error
+ */
+bool use_ngram_contexts(MarkovChain **markov_chain);
+
+/**
+ * If the context of the given token ids is in the chain, return its node.
+ * Otherwise, add it to the chain and return the new node.
+ * @param markov_chain a chain that uses the model
+ * @param model the model
+ * @param tokens order ids of tokens, oldest first
+ * @return node wrapping the context, NULL in case of allocation error
+ */
+Node *add_context(MarkovChain *markov_chain, const NgramModel *model,
+                  const uint32_t *tokens);
+
+/**
+ * Free the model and its token table.
+ * @param model the model to free
+ */
+void free_ngram_model(NgramModel **model);
+
+#endif //_NGRAM_H_
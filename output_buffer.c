@@ -0,0 +1,105 @@
+#define _POSIX_C_SOURCE 200809L
+#include "output_buffer.h"
+#include <errno.h> // For errno
+#include <stdarg.h> // For va_list
+#include <stdio.h> // For vsnprintf()
+#include <stdlib.h> // For realloc()
+#include <string.h> // For memcpy(), strlen()
+#include <unistd.h> // For write()
+
+#define MIN_CAPACITY 4096
+
+/**
+ * makes sure the buffer has room for more bytes (and a terminating NUL)
+ * @param buffer the buffer
+ * @param extra number of bytes to make room for
+ * @return true on success, false in case of allocation error
+ */
+static bool reserve(OutputBuffer *buffer, size_t extra);
+
+static bool reserve(OutputBuffer *buffer, size_t extra)
+{
+  size_t needed = buffer->length + extra + 1;
+  if (needed <= buffer->capacity)
+  {
+    return true;
+  }
+  size_t new_capacity = buffer->capacity ? buffer->capacity : MIN_CAPACITY;
+  while (new_capacity < needed)
+  {
+    new_capacity *= 2;
+  }
+  char *temp = realloc (buffer->data, new_capacity);
+  if (!temp)
+  {
+    return false;
+  }
+  buffer->data = temp;
+  buffer->capacity = new_capacity;
+  return true;
+}
+
+bool output_buffer_append(OutputBuffer *buffer, const char *text,
+                          size_t length)
+{
+  if (!reserve (buffer, length))
+  {
+    return false;
+  }
+  memcpy (buffer->data + buffer->length, text, length);
+  buffer->length += length;
+  buffer->data[buffer->length] = '\0';
+  return true;
+}
+
+bool output_buffer_append_string(OutputBuffer *buffer, const char *text)
+{
+  return output_buffer_append (buffer, text, strlen (text));
+}
+
+bool output_buffer_printf(OutputBuffer *buffer, const char *format, ...)
+{
+  va_list args;
+  va_start (args, format);
+  int length = vsnprintf (NULL, 0, format, args);
+  va_end (args);
+  if (length < 0 || !reserve (buffer, (size_t) length))
+  {
+    return false;
+  }
+  va_start (args, format);
+  vsnprintf (buffer->data + buffer->length, (size_t) length + 1, format,
+             args);
+  va_end (args);
+  buffer->length += (size_t) length;
+  return true;
+}
+
+bool output_buffer_flush(OutputBuffer *buffer, int fd)
+{
+  size_t written = 0;
+  while (written < buffer->length)
+  {
+    ssize_t result = write (fd, buffer->data + written,
+                            buffer->length - written);
+    if (result < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    written += (size_t) result;
+  }
+  buffer->length = 0;
+  return true;
+}
+
+void output_buffer_free(OutputBuffer *buffer)
+{
+  free (buffer->data);
+  buffer->data = NULL;
+  buffer->length = 0;
+  buffer->capacity = 0;
+}
@@ -0,0 +1,58 @@
+#ifndef _OUTPUT_BUFFER_H_
+#define _OUTPUT_BUFFER_H_
+#include <stdbool.h> // for bool
+#include <stddef.h> // for size_t
+
+/**
+ * Growable byte buffer that generated text is formatted into, so it can be
+ * written out with a few large writes (or used in memory) instead of one
+ * stdio call per token.
+ */
+typedef struct OutputBuffer {
+    char *data;
+    size_t length;
+    size_t capacity;
+} OutputBuffer;
+
+/**
+ * Append bytes to the buffer.
+ * @param buffer the buffer
+ * @param text the bytes to append
+ * @param length number of bytes to append
+ * @return true on success, false in case of allocation error
+ */
+bool output_buffer_append(OutputBuffer *buffer, const char *text,
+                          size_t length);
+
+/**
+ * Append a NUL terminated string to the buffer (without the NUL).
+ * @param buffer the buffer
+ * @param text the string to append
+ * @return true on success, false in case of allocation error
+ */
+bool output_buffer_append_string(OutputBuffer *buffer, const char *text);
+
+/**
+ * Append printf formatted text to the buffer.
+ * @param buffer the buffer
+ * @param format printf format
+ * @return true on success, false in case of allocation or format error
+ */
+bool output_buffer_printf(OutputBuffer *buffer, const char *format, ...);
+
+/**
+ * Write the whole content of the buffer to a file descriptor and empty the
+ * buffer (keeping its memory for reuse).
+ * @param buffer the buffer
+ * @param fd the file descriptor to write to
+ * @return true on success, false on write error
+ */
+bool output_buffer_flush(OutputBuffer *buffer, int fd);
+
+/**
+ * Free the memory of the buffer.
+ * @param buffer the buffer
+ */
+void output_buffer_free(OutputBuffer *buffer);
+
+#endif //_OUTPUT_BUFFER_H_
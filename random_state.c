@@ -0,0 +1,99 @@
+#include "random_state.h"
+
+#define SPLITMIX_INCREMENT 0x9E3779B97F4A7C15ULL
+#define SPLITMIX_MULTIPLIER_1 0xBF58476D1CE4E5B9ULL
+#define SPLITMIX_MULTIPLIER_2 0x94D049BB133111EBULL
+#define STREAM_MULTIPLIER 0xD1342543DE82EF95ULL
+// a double has 53 bits of mantissa
+#define FRACTION_SHIFT 11
+#define FRACTION_SCALE 0x1.0p-53
+
+/**
+ * advances a splitmix64 generator, used to expand seeds
+ * @param state the splitmix64 state
+ * @return the next number
+ */
+static uint64_t next_splitmix(uint64_t *state);
+
+/**
+ * rotates a number left
+ * @param x the number
+ * @param k number of bits to rotate by, in (0, 64)
+ * @return the rotated number
+ */
+static uint64_t rotate_left(uint64_t x, int k);
+
+static uint64_t next_splitmix(uint64_t *state)
+{
+  uint64_t z = (*state += SPLITMIX_INCREMENT);
+  z = (z ^ (z >> 30)) * SPLITMIX_MULTIPLIER_1;
+  z = (z ^ (z >> 27)) * SPLITMIX_MULTIPLIER_2;
+  return z ^ (z >> 31);
+}
+
+static uint64_t rotate_left(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+void seed_random(RandomState *rng, uint64_t seed)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    rng->s[i] = next_splitmix (&seed);
+  }
+}
+
+void seed_random_stream(RandomState *rng, uint64_t seed, uint64_t stream)
+{
+  uint64_t mixed = seed;
+  uint64_t stream_seed = next_splitmix (&mixed) ^ (stream * STREAM_MULTIPLIER);
+  seed_random (rng, next_splitmix (&stream_seed));
+}
+
+uint64_t next_random(RandomState *rng)
+{
+  uint64_t *s = rng->s;
+  uint64_t result = rotate_left (s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rotate_left (s[3], 45);
+  return result;
+}
+
+uint64_t get_bounded_random(RandomState *rng, uint64_t bound)
+{
+#ifdef __SIZEOF_INT128__
+  // Lemire's multiply and reject
+  unsigned __int128 product = (unsigned __int128) next_random (rng) * bound;
+  uint64_t low = (uint64_t) product;
+  if (low < bound)
+  {
+    uint64_t threshold = -bound % bound;
+    while (low < threshold)
+    {
+      product = (unsigned __int128) next_random (rng) * bound;
+      low = (uint64_t) product;
+    }
+  }
+  return (uint64_t) (product >> 64);
+#else
+  // reject the top partial range, then the modulo is unbiased
+  uint64_t threshold = -bound % bound;
+  uint64_t number = next_random (rng);
+  while (number < threshold)
+  {
+    number = next_random (rng);
+  }
+  return number % bound;
+#endif
+}
+
+double get_random_fraction(RandomState *rng)
+{
+  return (double) (next_random (rng) >> FRACTION_SHIFT) * FRACTION_SCALE;
+}
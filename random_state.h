@@ -0,0 +1,51 @@
+#ifndef _RANDOM_STATE_H_
+#define _RANDOM_STATE_H_
+#include <stdint.h> // for uint64_t
+
+/**
+ * State of a xoshiro256** pseudo random generator. Every thread (or every
+ * independent stream of output) should use its own state.
+ */
+typedef struct RandomState {
+    uint64_t s[4];
+} RandomState;
+
+/**
+ * Seed a random state. The same seed always gives the same sequence.
+ * @param rng the state to seed
+ * @param seed the seed
+ */
+void seed_random(RandomState *rng, uint64_t seed);
+
+/**
+ * Seed a random state for one of several independent streams derived from
+ * the same seed (e.g. one per thread or per generated sequence).
+ * @param rng the state to seed
+ * @param seed the seed shared by all the streams
+ * @param stream number of the stream
+ */
+void seed_random_stream(RandomState *rng, uint64_t seed, uint64_t stream);
+
+/**
+ * Get the next 64 random bits.
+ * @param rng the random state
+ * @return a uniformly distributed 64 bit number
+ */
+uint64_t next_random(RandomState *rng);
+
+/**
+ * Get a uniformly distributed number in [0, bound), without modulo bias.
+ * @param rng the random state
+ * @param bound the bound, positive
+ * @return the number
+ */
+uint64_t get_bounded_random(RandomState *rng, uint64_t bound);
+
+/**
+ * Get a uniformly distributed number in [0, 1), a multiple of 2^-53.
+ * @param rng the random state
+ * @return the number
+ */
+double get_random_fraction(RandomState *rng);
+
+#endif //_RANDOM_STATE_H_
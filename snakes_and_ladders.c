@@ -1,310 +1,545 @@
-#include <string.h> // For strlen(), strcmp(), strcpy()
-#include "markov_chain.h"
-
-#define MAX(X, Y) (((X) < (Y)) ? (Y) : (X))
-#define FIRST_NODE "Random Walk"
-#define EMPTY -1
-#define BOARD_SIZE 100
-#define MAX_GENERATION_LENGTH 60
-
-#define DICE_MAX 6
-#define NUM_OF_TRANSITIONS 20
-
-#define VALID_ARGS 3
-
-#define BASE_10 10
-/**
- * checkes if the number of arguments is invalid
- * @param argc number of arguments
- * @return true if invalid number of args, false if valid
- */
-static bool invalid_args(int argc);
-
-/**
- * prints the content of a cell as described
- * @param cell a generic pointer to a cell
- */
-static void my_print(void *cell);
-
-/**
- * compared to cells based on their values
- * @param first the first cell
- * @param second the second cell
- * @return negative value if the first cell is smaller, 0 if equal and
- * positive otherwise
- */
-static int my_compare(void* first, void* second);
-
-/**
- * copies the content of a cell to a newly allocated generic pointer
- * @param cell a pointer to a cell
- * @return the newly allocated pointer
- */
-static void* my_copy(const void* cell);
-
-/**
- * checks if a cell is the last one on the board
- * @param cell a pointer to cell
- * @return true if last, false if not
- */
-static bool my_is_last(void* cell);
-
-
-
-/**
- * represents the transitions by ladders and snakes in the game
- * each tuple (x,y) represents a ladder from x to if x<y or a snake otherwise
- */
-const int transitions[][2] = {{13, 4},
-                              {85, 17},
-                              {95, 67},
-                              {97, 58},
-                              {66, 89},
-                              {87, 31},
-                              {57, 83},
-                              {91, 25},
-                              {28, 50},
-                              {35, 11},
-                              {8,  30},
-                              {41, 62},
-                              {81, 43},
-                              {69, 32},
-                              {20, 39},
-                              {33, 70},
-                              {79, 99},
-                              {23, 76},
-                              {15, 47},
-                              {61, 14}};
-
-/**
- * struct represents a Cell in the game board
- */
-typedef struct Cell {
-    int number; // Cell number 1-100
-    int ladder_to;  // ladder_to represents the jump of the ladder in case there is one from this square
-    int snake_to;  // snake_to represents the jump of the snake in case there is one from this square
-    //both ladder_to and snake_to should be -1 if the Cell doesn't have them
-} Cell;
-
-/** Error handler **/
-static int handle_error(char *error_msg, MarkovChain **database)
-{
-    printf("%s", error_msg);
-    if (database != NULL)
-    {
-      free_database (database);
-    }
-    return EXIT_FAILURE;
-}
-
-
-static int create_board(Cell *cells[BOARD_SIZE])
-{
-    for (int i = 0; i < BOARD_SIZE; i++)
-    {
-        cells[i] = malloc(sizeof(Cell));
-        if (cells[i] == NULL)
-        {
-            for (int j = 0; j < i; j++) {
-                free(cells[j]);
-            }
-            handle_error(ALLOCATION_ERROR_MASSAGE,NULL);
-            return EXIT_FAILURE;
-        }
-        *(cells[i]) = (Cell) {i + 1, EMPTY, EMPTY};
-    }
-
-    for (int i = 0; i < NUM_OF_TRANSITIONS; i++)
-    {
-        int from = transitions[i][0];
-        int to = transitions[i][1];
-        if (from < to)
-        {
-            cells[from - 1]->ladder_to = to;
-        }
-        else
-        {
-            cells[from - 1]->snake_to = to;
-        }
-    }
-    return EXIT_SUCCESS;
-}
-
-/**
- * fills database
- * @param markov_chain
- * @return EXIT_SUCCESS or EXIT_FAILURE
- */
-static int fill_database(MarkovChain *markov_chain)
-{
-    Cell* cells[BOARD_SIZE];
-    if(create_board(cells) == EXIT_FAILURE)
-    {
-        return EXIT_FAILURE;
-    }
-    MarkovNode *from_node = NULL, *to_node = NULL;
-    size_t index_to;
-    for (size_t i = 0; i < BOARD_SIZE; i++)
-    {
-        add_to_database(markov_chain, cells[i]);
-    }
-
-    for (size_t i = 0; i < BOARD_SIZE; i++)
-    {
-        from_node = get_node_from_database(markov_chain,cells[i])->data;
-
-        if (cells[i]->snake_to != EMPTY || cells[i]->ladder_to != EMPTY)
-        {
-            index_to = MAX(cells[i]->snake_to,cells[i]->ladder_to) - 1;
-            to_node = get_node_from_database(markov_chain, cells[index_to])
-                    ->data;
-          add_node_to_frequencies_list (from_node, to_node, markov_chain);
-        }
-        else
-        {
-            for (int j = 1; j <= DICE_MAX; j++)
-            {
-                index_to = ((Cell*) (from_node->data))->number + j - 1;
-                if (index_to >= BOARD_SIZE)
-                {
-                    break;
-                }
-                to_node = get_node_from_database(markov_chain, cells[index_to])
-                        ->data;
-              add_node_to_frequencies_list (from_node, to_node, markov_chain);
-            }
-        }
-    }
-    // free temp arr
-    for (size_t i = 0; i < BOARD_SIZE; i++)
-    {
-        free(cells[i]);
-    }
-    return EXIT_SUCCESS;
-}
-
-static bool invalid_args(int argc)
-{
-  if (argc != VALID_ARGS)
-  {
-    return true;
-  }
-  return false;
-}
-
-static void my_print(void *cell)
-{
-  Cell *cur_cell = (Cell*)cell;
-  if (my_is_last (cell))
-  {
-    printf ("[%d]", cur_cell->number);
-  }
-  else
-  {
-    printf ("[%d]", cur_cell->number);
-    if (cur_cell->ladder_to != EMPTY)
-    {
-      printf ("-ladder to %d ->", cur_cell->ladder_to);
-    }
-    else if (cur_cell->snake_to != EMPTY)
-    {
-      printf ("-snake to %d ->", cur_cell->snake_to);
-    }
-    else if (cur_cell->number != BOARD_SIZE)
-    {
-      printf (" ->");
-    }
-    printf (" ");
-  }
-}
-
-static int my_compare(void* first, void* second)
-{
-  Cell *first_cell = (Cell*)first;
-  Cell *second_cell = (Cell*)second;
-  if (first_cell->number < second_cell->number)
-  {
-    return -1;
-  }
-  else if (first_cell->number == second_cell->number)
-  {
-    return 0;
-  }
-  else
-  {
-    return 1;
-  }
-}
-
-static void* my_copy(const void* cell)
-{
-  Cell *new_cell = calloc (1, sizeof (Cell));
-  if (!new_cell)
-  {
-    return NULL;
-  }
-  Cell *cur_cell = (Cell*)cell;
-  new_cell->number = cur_cell->number;
-  new_cell->snake_to = cur_cell->snake_to;
-  new_cell->ladder_to = cur_cell->ladder_to;
-  return (void*)new_cell;
-}
-
-static bool my_is_last(void* cell)
-{
-  Cell *cur_cell = (Cell*)cell;
-  if (cur_cell->number == BOARD_SIZE)
-  {
-    return true;
-  }
-  return false;
-}
-
-/**
- * @param argc num of arguments
- * @param argv 1) Seed
- *             2) Number of sentences to generate
- * @return EXIT_SUCCESS or EXIT_FAILURE
- */
-int main(int argc, char *argv[])
-{
-  if (invalid_args(argc))
-  {
-    printf ("%s", ALLOCATION_ERROR_MASSAGE);
-    return EXIT_FAILURE;
-  }
-  unsigned seed = (unsigned)strtol(argv[1], NULL, BASE_10);
-  srand (seed);
-
-  MarkovChain *markov_chain = calloc (1, sizeof (MarkovChain));
-  if (!markov_chain)
-  {
-    printf ("%s", ALLOCATION_ERROR_MASSAGE);
-    return EXIT_FAILURE;
-  }
-  markov_chain->database = calloc (1, sizeof (LinkedList));
-  if (!markov_chain->database)
-  {
-    printf ("%s", ALLOCATION_ERROR_MASSAGE);
-    free(markov_chain);
-    return EXIT_FAILURE;
-  }
-  update_funcs (&markov_chain, my_print, my_compare, free, my_copy,
-                my_is_last);
-  if (fill_database (markov_chain) == EXIT_FAILURE)
-  {
-    free_database (&markov_chain);
-    printf ("%s", ALLOCATION_ERROR_MASSAGE);
-    return EXIT_FAILURE;
-  }
-  int num_tracks = (int)strtol(argv[2], NULL, BASE_10);
-  MarkovNode *first = markov_chain->database->first->data;
-  for (int i = 1; i <= num_tracks; i++)
-  {
-    printf ( "%s %d: ",FIRST_NODE, i);
-    generate_tweet (markov_chain, first, MAX_GENERATION_LENGTH);
-    printf("\n");
-  }
-  free_database (&markov_chain);
-  return EXIT_SUCCESS;
-}
+#define _POSIX_C_SOURCE 200809L
+#include <string.h> // For strlen(), strcmp(), strcpy()
+#include <unistd.h> // For STDOUT_FILENO
+#include "markov_chain.h"
+#include "batch_generator.h"
+#include "absorbing_chain.h"
+#include "chain_distribution.h"
+#include "walker_simulation.h"
+
+#define MAX(X, Y) (((X) < (Y)) ? (Y) : (X))
+#define FIRST_NODE "Random Walk"
+#define EMPTY -1
+#define BOARD_SIZE 100
+#define MAX_GENERATION_LENGTH 60
+
+#define DICE_MAX 6
+#define NUM_OF_TRANSITIONS 20
+
+#define VALID_ARGS 3
+#define ANALYSIS_FLAG "-a"
+#define ANALYSIS_ARGS 2
+#define SIMULATION_FLAG "-m"
+#define SIMULATION_ARGS 4
+// simulated games longer than this are cut
+#define SIMULATION_MAX_STEPS 10000
+// the share of the turns on every cell in an endless stream of games is
+// computed to this L1 tolerance, and the most visited cells are printed
+#define STATIONARY_TOLERANCE 1e-12
+#define STATIONARY_MAX_ITERATIONS 100000
+#define NUM_VISITED_CELLS 5
+#define SNAKE_EVENT 0
+#define LADDER_EVENT 1
+
+#define BASE_10 10
+#define MAX_THREADS 64
+/**
+ * checkes if the number of arguments is invalid
+ * @param argc number of arguments
+ * @return true if invalid number of args, false if valid
+ */
+static bool invalid_args(int argc);
+
+/**
+ * prints the exact statistics of games from a cell: the expected number of
+ * steps to the last cell, and the probability to get there after each
+ * number of steps, up to MAX_GENERATION_LENGTH
+ * @param compiled_chain the board's chain
+ * @param first_state id of the cell the games start from
+ * @return true on success, false in case of allocation error
+ */
+static bool print_analysis(const CompiledChain *compiled_chain,
+                           uint32_t first_state);
+
+/**
+ * prints the NUM_VISITED_CELLS cells that an endless stream of games spends
+ * the most turns on, with their share of the turns: the chain's stationary
+ * distribution, where a game that reaches the last cell is followed by one
+ * from a random cell (see chain_distribution.h)
+ * @param compiled_chain the board's chain
+ * @return true on success, false in case of allocation error
+ */
+static bool print_visited_cells(const CompiledChain *compiled_chain);
+
+/**
+ * simulates games from a cell in bulk and prints their statistics: the
+ * mean number of steps, snakes and ladders, and the share of the games
+ * that ended after each number of steps, up to MAX_GENERATION_LENGTH
+ * @param compiled_chain the board's chain
+ * @param first_state id of the cell the games start from
+ * @param seed the seed of the simulation
+ * @param num_games number of games to simulate
+ * @return true on success, false in case of allocation error
+ */
+static bool print_simulation(const CompiledChain *compiled_chain,
+                             uint32_t first_state, uint64_t seed,
+                             uint64_t num_games);
+
+/**
+ * formats the content of a cell as described into an output buffer
+ * @param cell a generic pointer to a cell
+ * @param out the buffer to append to
+ * @return true on success, false in case of allocation error
+ */
+static bool my_format(void *cell, OutputBuffer *out);
+
+/**
+ * formats the header of a random walk into an output buffer
+ * @param walk_number number of the walk
+ * @param out the buffer to append to
+ * @return true on success, false in case of allocation error
+ */
+static bool format_walk_header(long walk_number, OutputBuffer *out);
+
+/**
+ * compared to cells based on their values
+ * @param first the first cell
+ * @param second the second cell
+ * @return negative value if the first cell is smaller, 0 if equal and
+ * positive otherwise
+ */
+static int my_compare(void* first, void* second);
+
+/**
+ * hashes a cell by its number
+ * @param cell a pointer to a cell
+ * @return the hash of the cell
+ */
+static size_t my_hash(void* cell);
+
+/**
+ * copies the content of a cell to a newly allocated generic pointer
+ * @param cell a pointer to a cell
+ * @return the newly allocated pointer
+ */
+static void* my_copy(const void* cell);
+
+/**
+ * checks if a cell is the last one on the board
+ * @param cell a pointer to cell
+ * @return true if last, false if not
+ */
+static bool my_is_last(void* cell);
+
+
+
+/**
+ * represents the transitions by ladders and snakes in the game
+ * each tuple (x,y) represents a ladder from x to if x<y or a snake otherwise
+ */
+const int transitions[][2] = {{13, 4},
+                              {85, 17},
+                              {95, 67},
+                              {97, 58},
+                              {66, 89},
+                              {87, 31},
+                              {57, 83},
+                              {91, 25},
+                              {28, 50},
+                              {35, 11},
+                              {8,  30},
+                              {41, 62},
+                              {81, 43},
+                              {69, 32},
+                              {20, 39},
+                              {33, 70},
+                              {79, 99},
+                              {23, 76},
+                              {15, 47},
+                              {61, 14}};
+
+/**
+ * struct represents a Cell in the game board
+ */
+typedef struct Cell {
+    int number; // Cell number 1-100
+    int ladder_to;  // ladder_to represents the jump of the ladder in case there is one from this square
+    int snake_to;  // snake_to represents the jump of the snake in case there is one from this square
+    //both ladder_to and snake_to should be -1 if the Cell doesn't have them
+} Cell;
+
+/** Error handler **/
+static int handle_error(char *error_msg, MarkovChain **database)
+{
+    printf("%s", error_msg);
+    if (database != NULL)
+    {
+      free_database (database);
+    }
+    return EXIT_FAILURE;
+}
+
+
+static int create_board(Cell *cells[BOARD_SIZE])
+{
+    for (int i = 0; i < BOARD_SIZE; i++)
+    {
+        cells[i] = malloc(sizeof(Cell));
+        if (cells[i] == NULL)
+        {
+            for (int j = 0; j < i; j++) {
+                free(cells[j]);
+            }
+            handle_error(ALLOCATION_ERROR_MASSAGE,NULL);
+            return EXIT_FAILURE;
+        }
+        *(cells[i]) = (Cell) {i + 1, EMPTY, EMPTY};
+    }
+
+    for (int i = 0; i < NUM_OF_TRANSITIONS; i++)
+    {
+        int from = transitions[i][0];
+        int to = transitions[i][1];
+        if (from < to)
+        {
+            cells[from - 1]->ladder_to = to;
+        }
+        else
+        {
+            cells[from - 1]->snake_to = to;
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+/**
+ * fills database
+ * @param markov_chain
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+static int fill_database(MarkovChain *markov_chain)
+{
+    Cell* cells[BOARD_SIZE];
+    if(create_board(cells) == EXIT_FAILURE)
+    {
+        return EXIT_FAILURE;
+    }
+    MarkovNode *from_node = NULL, *to_node = NULL;
+    size_t index_to;
+    for (size_t i = 0; i < BOARD_SIZE; i++)
+    {
+        add_to_database(markov_chain, cells[i]);
+    }
+
+    for (size_t i = 0; i < BOARD_SIZE; i++)
+    {
+        from_node = get_node_from_database(markov_chain,cells[i])->data;
+
+        if (cells[i]->snake_to != EMPTY || cells[i]->ladder_to != EMPTY)
+        {
+            index_to = MAX(cells[i]->snake_to,cells[i]->ladder_to) - 1;
+            to_node = get_node_from_database(markov_chain, cells[index_to])
+                    ->data;
+          add_node_to_frequencies_list (from_node, to_node, markov_chain);
+        }
+        else
+        {
+            for (int j = 1; j <= DICE_MAX; j++)
+            {
+                index_to = ((Cell*) (from_node->data))->number + j - 1;
+                if (index_to >= BOARD_SIZE)
+                {
+                    break;
+                }
+                to_node = get_node_from_database(markov_chain, cells[index_to])
+                        ->data;
+              add_node_to_frequencies_list (from_node, to_node, markov_chain);
+            }
+        }
+    }
+    // free temp arr
+    for (size_t i = 0; i < BOARD_SIZE; i++)
+    {
+        free(cells[i]);
+    }
+    return EXIT_SUCCESS;
+}
+
+static bool invalid_args(int argc)
+{
+  if (argc != VALID_ARGS)
+  {
+    return true;
+  }
+  return false;
+}
+
+static bool print_analysis(const CompiledChain *compiled_chain,
+                           uint32_t first_state)
+{
+  AbsorbingChain *absorbing_chain = create_absorbing_chain (compiled_chain);
+  double *expected_steps = malloc (compiled_chain->num_states
+                                   * sizeof (double));
+  double distribution[MAX_GENERATION_LENGTH + 1];
+  if (!absorbing_chain || !expected_steps
+      || !get_expected_steps (absorbing_chain, expected_steps)
+      || !get_step_distribution (absorbing_chain, first_state,
+                                 MAX_GENERATION_LENGTH, distribution))
+  {
+    free_absorbing_chain (&absorbing_chain);
+    free (expected_steps);
+    return false;
+  }
+  printf ("Expected steps to cell %d: %f\n", BOARD_SIZE,
+          expected_steps[first_state]);
+  double cumulative = 0;
+  for (int steps = 1; steps <= MAX_GENERATION_LENGTH; steps++)
+  {
+    cumulative += distribution[steps];
+    if (distribution[steps] > 0)
+    {
+      printf ("%d steps: %f (up to %d: %f)\n", steps, distribution[steps],
+              steps, cumulative);
+    }
+  }
+  free_absorbing_chain (&absorbing_chain);
+  free (expected_steps);
+  return print_visited_cells (compiled_chain);
+}
+
+static bool print_visited_cells(const CompiledChain *compiled_chain)
+{
+  double *visits = malloc (compiled_chain->num_states * sizeof (double));
+  bool converged = false;
+  if (!visits
+      || !get_stationary_distribution (compiled_chain, STATIONARY_TOLERANCE,
+                                       STATIONARY_MAX_ITERATIONS, MAX_THREADS,
+                                       visits, &converged))
+  {
+    free (visits);
+    return false;
+  }
+  if (!converged)
+  {
+    printf ("Most visited cells: no convergence in %d iterations\n",
+            STATIONARY_MAX_ITERATIONS);
+    free (visits);
+    return true;
+  }
+  printf ("Most visited cells:\n");
+  for (int i = 0; i < NUM_VISITED_CELLS; i++)
+  {
+    uint32_t most = 0;
+    for (uint32_t state = 1; state < compiled_chain->num_states; state++)
+    {
+      most = visits[state] > visits[most] ? state : most;
+    }
+    if (visits[most] < 0)
+    {
+      break;
+    }
+    Cell *cell = get_compiled_data (compiled_chain, most);
+    printf ("cell %d: %f of the turns\n", cell->number, visits[most]);
+    visits[most] = -1; // printed
+  }
+  free (visits);
+  return true;
+}
+
+static bool print_simulation(const CompiledChain *compiled_chain,
+                             uint32_t first_state, uint64_t seed,
+                             uint64_t num_games)
+{
+  unsigned char *state_events = malloc (compiled_chain->num_states);
+  if (!state_events)
+  {
+    return false;
+  }
+  for (uint32_t state = 0; state < compiled_chain->num_states; state++)
+  {
+    Cell *cell = get_compiled_data (compiled_chain, state);
+    state_events[state] = (unsigned char)
+        (((cell->snake_to != EMPTY) << SNAKE_EVENT)
+         | ((cell->ladder_to != EMPTY) << LADDER_EVENT));
+  }
+  WalkerTable *walker_table = create_walker_table (compiled_chain,
+                                                   state_events);
+  free (state_events);
+  WalkerStats *walker_stats = walker_table
+                              ? simulate_walkers (walker_table, first_state,
+                                                  num_games,
+                                                  SIMULATION_MAX_STEPS, seed)
+                              : NULL;
+  free_walker_table (&walker_table);
+  if (!walker_stats)
+  {
+    return false;
+  }
+  double games = walker_stats->num_walks ? (double) walker_stats->num_walks
+                                         : 1;
+  printf ("Mean steps to cell %d: %f\n", BOARD_SIZE,
+          walker_stats->total_steps / games);
+  printf ("Mean snakes: %f\n",
+          walker_stats->total_events[SNAKE_EVENT] / games);
+  printf ("Mean ladders: %f\n",
+          walker_stats->total_events[LADDER_EVENT] / games);
+  double cumulative = 0;
+  for (int steps = 1; steps <= MAX_GENERATION_LENGTH; steps++)
+  {
+    double share = walker_stats->steps[steps] / games;
+    cumulative += share;
+    if (share > 0)
+    {
+      printf ("%d steps: %f (up to %d: %f)\n", steps, share, steps,
+              cumulative);
+    }
+  }
+  free_walker_stats (&walker_stats);
+  return true;
+}
+
+static bool my_format(void *cell, OutputBuffer *out)
+{
+  Cell *cur_cell = (Cell*)cell;
+  if (!output_buffer_printf (out, "[%d]", cur_cell->number))
+  {
+    return false;
+  }
+  if (my_is_last (cell))
+  {
+    return true;
+  }
+  bool success = true;
+  if (cur_cell->ladder_to != EMPTY)
+  {
+    success = output_buffer_printf (out, "-ladder to %d ->",
+                                    cur_cell->ladder_to);
+  }
+  else if (cur_cell->snake_to != EMPTY)
+  {
+    success = output_buffer_printf (out, "-snake to %d ->",
+                                    cur_cell->snake_to);
+  }
+  else if (cur_cell->number != BOARD_SIZE)
+  {
+    success = output_buffer_append_string (out, " ->");
+  }
+  return success && output_buffer_append (out, " ", 1);
+}
+
+static bool format_walk_header(long walk_number, OutputBuffer *out)
+{
+  return output_buffer_printf (out, "%s %ld: ", FIRST_NODE, walk_number);
+}
+
+static int my_compare(void* first, void* second)
+{
+  Cell *first_cell = (Cell*)first;
+  Cell *second_cell = (Cell*)second;
+  if (first_cell->number < second_cell->number)
+  {
+    return -1;
+  }
+  else if (first_cell->number == second_cell->number)
+  {
+    return 0;
+  }
+  else
+  {
+    return 1;
+  }
+}
+
+static size_t my_hash(void* cell)
+{
+  return (size_t)((Cell*)cell)->number;
+}
+
+static void* my_copy(const void* cell)
+{
+  Cell *new_cell = calloc (1, sizeof (Cell));
+  if (!new_cell)
+  {
+    return NULL;
+  }
+  Cell *cur_cell = (Cell*)cell;
+  new_cell->number = cur_cell->number;
+  new_cell->snake_to = cur_cell->snake_to;
+  new_cell->ladder_to = cur_cell->ladder_to;
+  return (void*)new_cell;
+}
+
+static bool my_is_last(void* cell)
+{
+  Cell *cur_cell = (Cell*)cell;
+  if (cur_cell->number == BOARD_SIZE)
+  {
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @param argc num of arguments
+ * @param argv 1) Seed
+ *             2) Number of sentences to generate
+ *             or only -a, to print the exact statistics of the games
+ *             instead of random walks
+ *             or -m, a seed and a number of games, to print the
+ *             statistics of that many simulated games
+ * @return EXIT_SUCCESS or EXIT_FAILURE
+ */
+int main(int argc, char *argv[])
+{
+  bool analysis = argc == ANALYSIS_ARGS
+                  && strcmp (argv[1], ANALYSIS_FLAG) == 0;
+  bool simulation = argc == SIMULATION_ARGS
+                    && strcmp (argv[1], SIMULATION_FLAG) == 0;
+  if (!analysis && !simulation && invalid_args(argc))
+  {
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+
+  MarkovChain *markov_chain = calloc (1, sizeof (MarkovChain));
+  if (!markov_chain)
+  {
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  markov_chain->database = calloc (1, sizeof (LinkedList));
+  if (!markov_chain->database)
+  {
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    free(markov_chain);
+    return EXIT_FAILURE;
+  }
+  update_funcs (&markov_chain, my_format, my_compare, free, my_copy,
+                my_is_last);
+  update_hash_func (&markov_chain, my_hash);
+  CompiledChain *compiled_chain = NULL;
+  if (fill_database (markov_chain) == EXIT_FAILURE
+      || !(compiled_chain = compile_chain (markov_chain)))
+  {
+    free_database (&markov_chain);
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    return EXIT_FAILURE;
+  }
+  MarkovNode *first = markov_chain->database->first->data;
+  if (analysis || simulation)
+  {
+    uint32_t first_state = get_compiled_state (compiled_chain, first);
+    bool analyzed = analysis
+                    ? print_analysis (compiled_chain, first_state)
+                    : print_simulation (compiled_chain, first_state,
+                                        strtoull (argv[2], NULL, BASE_10),
+                                        strtoull (argv[3], NULL, BASE_10));
+    free_compiled_chain (&compiled_chain);
+    free_database (&markov_chain);
+    if (!analyzed)
+    {
+      printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    }
+    return analyzed ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  unsigned seed = (unsigned)strtol(argv[1], NULL, BASE_10);
+  int num_tracks = (int)strtol(argv[2], NULL, BASE_10);
+  WalkConstraints constraints = {get_compiled_state (compiled_chain, first),
+                                 1, MAX_GENERATION_LENGTH, false, NULL};
+  bool printed = print_walks (compiled_chain, NULL, &constraints, num_tracks,
+                              seed, get_default_num_threads (MAX_THREADS),
+                              format_walk_header, STDOUT_FILENO);
+  free_compiled_chain (&compiled_chain);
+  free_database (&markov_chain);
+  return printed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
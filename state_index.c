@@ -0,0 +1,176 @@
+#include "state_index.h"
+#include "markov_chain.h"
+#include "chain_stats.h"
+
+#define INITIAL_CAPACITY 64
+// grow when more than 3/4 of the slots are taken
+#define MAX_LOAD_NUMERATOR 3
+#define MAX_LOAD_DENOMINATOR 4
+#define GOLDEN_RATIO_64 0x9E3779B97F4A7C15ULL
+
+/**
+ * spreads the bits of a user supplied hash, so weak hashes (like a small
+ * integer) still spread over the whole table
+ * @param hash the hash to mix
+ * @return the mixed hash
+ */
+static size_t mix_hash(size_t hash);
+
+/**
+ * places a slot in the first free place of its probe sequence, without
+ * checking the load factor
+ * @param slots the slots array
+ * @param capacity number of slots, power of 2
+ * @param slot the slot to place
+ */
+static void place_slot(StateIndexSlot *slots, size_t capacity,
+                       StateIndexSlot slot);
+
+/**
+ * looks for the node of a state in the index, by a probe that is either the
+ * state's data or a key that stands for it
+ * @param markov_chain the chain that owns the index
+ * @param probe the data or key to look for
+ * @param hash_func hash function of the probe
+ * @param comp_func compares the data of a state with the probe
+ * @return the node of the state, NULL if not in the index
+ */
+static Node *find_node(const MarkovChain *markov_chain, void *probe,
+                       hash_function hash_func, compare_function comp_func);
+
+/**
+ * doubles the capacity of the index
+ * @param index the index to grow
+ * @return true on success, false in case of allocation error
+ */
+static bool grow_index(StateIndex *index);
+
+static size_t mix_hash(size_t hash)
+{
+  unsigned long long mixed = (unsigned long long) hash * GOLDEN_RATIO_64;
+  return (size_t) (mixed ^ (mixed >> 32));
+}
+
+static void place_slot(StateIndexSlot *slots, size_t capacity,
+                       StateIndexSlot slot)
+{
+  size_t position = slot.hash & (capacity - 1);
+  while (slots[position].node)
+  {
+    position = (position + 1) & (capacity - 1);
+  }
+  slots[position] = slot;
+}
+
+static bool grow_index(StateIndex *index)
+{
+  size_t new_capacity = index->capacity * 2;
+  StateIndexSlot *new_slots = calloc (new_capacity, sizeof (StateIndexSlot));
+  if (!new_slots)
+  {
+    return false;
+  }
+  for (size_t i = 0; i < index->capacity; i++)
+  {
+    if (index->slots[i].node)
+    {
+      place_slot (new_slots, new_capacity, index->slots[i]);
+    }
+  }
+  free (index->slots);
+  index->slots = new_slots;
+  index->capacity = new_capacity;
+  return true;
+}
+
+StateIndex *state_index_create(const MarkovChain *markov_chain)
+{
+  StateIndex *index = calloc (1, sizeof (StateIndex));
+  if (!index)
+  {
+    return NULL;
+  }
+  size_t capacity = INITIAL_CAPACITY;
+  size_t size = (size_t) markov_chain->database->size;
+  while (size * MAX_LOAD_DENOMINATOR >= capacity * MAX_LOAD_NUMERATOR)
+  {
+    capacity *= 2;
+  }
+  index->slots = calloc (capacity, sizeof (StateIndexSlot));
+  if (!index->slots)
+  {
+    free (index);
+    return NULL;
+  }
+  index->capacity = capacity;
+  for (Node *temp = markov_chain->database->first; temp; temp = temp->next)
+  {
+    StateIndexSlot slot = {mix_hash (markov_chain->hash_func
+                                         (temp->data->data)), temp};
+    place_slot (index->slots, index->capacity, slot);
+    index->size++;
+  }
+  return index;
+}
+
+static Node *find_node(const MarkovChain *markov_chain, void *probe,
+                       hash_function hash_func, compare_function comp_func)
+{
+  const StateIndex *index = markov_chain->index;
+  size_t hash = mix_hash (hash_func (probe));
+  size_t position = hash & (index->capacity - 1);
+  while (index->slots[position].node)
+  {
+    STATS_COUNT (STATS_LOOKUP_PROBES);
+    StateIndexSlot *slot = index->slots + position;
+    if (slot->hash == hash)
+    {
+      STATS_COUNT (STATS_COMPARISONS);
+      if (comp_func (slot->node->data->data, probe) == 0)
+      {
+        return slot->node;
+      }
+    }
+    position = (position + 1) & (index->capacity - 1);
+  }
+  return NULL;
+}
+
+Node *state_index_find(const MarkovChain *markov_chain, void *data_ptr)
+{
+  return find_node (markov_chain, data_ptr, markov_chain->hash_func,
+                    markov_chain->comp_func);
+}
+
+Node *state_index_find_key(const MarkovChain *markov_chain, const void *key)
+{
+  return find_node (markov_chain, (void *) key,
+                    markov_chain->key_funcs->hash_key,
+                    markov_chain->key_funcs->comp_key);
+}
+
+bool state_index_insert(const MarkovChain *markov_chain, Node *node)
+{
+  StateIndex *index = markov_chain->index;
+  if ((index->size + 1) * MAX_LOAD_DENOMINATOR
+      > index->capacity * MAX_LOAD_NUMERATOR && !grow_index (index))
+  {
+    return false;
+  }
+  StateIndexSlot slot = {mix_hash (markov_chain->hash_func (node->data->data)),
+                         node};
+  place_slot (index->slots, index->capacity, slot);
+  index->size++;
+  return true;
+}
+
+void state_index_free(StateIndex *index)
+{
+  if (!index)
+  {
+    return;
+  }
+  free (index->slots);
+  index->slots = NULL;
+  free (index);
+}
@@ -0,0 +1,65 @@
+#ifndef _STATE_INDEX_H_
+#define _STATE_INDEX_H_
+#include <stdbool.h> // for bool
+#include <stddef.h> // for size_t
+#include "linked_list.h"
+
+struct MarkovChain;
+
+typedef struct StateIndexSlot {
+    size_t hash;
+    Node *node; // NULL if the slot is empty
+} StateIndexSlot;
+
+/**
+ * Open-addressing (linear probing) hash index over the nodes of a markov
+ * chain's database. The index does not own the nodes it points to.
+ */
+typedef struct StateIndex {
+    StateIndexSlot *slots;
+    size_t capacity; // always a power of 2
+    size_t size;
+} StateIndex;
+
+/**
+ * Create an index over all the nodes currently in the given database.
+ * @param markov_chain the chain whose database to index, must have a
+ * hash_func
+ * @return a newly allocated index, NULL in case of allocation error
+ */
+StateIndex *state_index_create(const struct MarkovChain *markov_chain);
+
+/**
+ * Look for the node wrapping data_ptr in the index.
+ * @param markov_chain the chain that owns the index
+ * @param data_ptr the state to look for
+ * @return the node wrapping data_ptr, NULL if not in the index
+ */
+Node *state_index_find(const struct MarkovChain *markov_chain,
+                       void *data_ptr);
+
+/**
+ * Look for the node of the state a key stands for in the index (see
+ * KeyFunctions).
+ * @param markov_chain the chain that owns the index, with key_funcs
+ * @param key the key of the state to look for
+ * @return the node of the state, NULL if not in the index
+ */
+Node *state_index_find_key(const struct MarkovChain *markov_chain,
+                           const void *key);
+
+/**
+ * Insert a node to the index. The node's state must not be in the index yet.
+ * @param markov_chain the chain that owns the index
+ * @param node the node to insert
+ * @return true on success, false in case of allocation error
+ */
+bool state_index_insert(const struct MarkovChain *markov_chain, Node *node);
+
+/**
+ * Free the index (but not the nodes it points to).
+ * @param index the index to free
+ */
+void state_index_free(StateIndex *index);
+
+#endif //_STATE_INDEX_H_
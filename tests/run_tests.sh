@@ -0,0 +1,70 @@
+#!/bin/sh
+# Runs the programs on the sample corpora and board, and compares their
+# output (with their exit status) against the recorded one in expected/.
+# Usage: run_tests.sh <directory of the programs> [case...]
+# With RECORD=1, the output is recorded instead of compared.
+
+if [ $# -lt 1 ]; then
+  echo "Usage: run_tests.sh <directory of the programs> [case...]"
+  exit 2
+fi
+BIN_DIR=$(cd "$1" && pwd) || exit 2
+shift
+TESTS_DIR=$(cd "$(dirname "$0")" && pwd)
+TWEETS="$BIN_DIR/tweets_generator"
+SNAKES="$BIN_DIR/snakes_and_ladders"
+BENCHMARK="$BIN_DIR/markov_benchmark"
+CORPUS="$TESTS_DIR/corpus.txt"
+NUL_CORPUS="$TESTS_DIR/nul_corpus.txt"
+WORK_DIR=$(mktemp -d) || exit 2
+trap 'rm -rf "$WORK_DIR"' EXIT
+
+ALL_CASES="tweets tweets_words_limit tweets_order2 tweets_sampling
+tweets_constrained tweets_impossible tweets_stdin tweets_snapshot tweets_nul
+snakes snakes_absorbing snakes_simulation benchmark benchmark_concurrent"
+
+# the keys of the benchmark's report, its values being timings
+report_keys() {
+  grep -o '"[a-z_0-9]*":' | sort -u
+}
+
+run_case() {
+  case "$1" in
+    tweets) "$TWEETS" 1 5 "$CORPUS" ;;
+    tweets_words_limit) "$TWEETS" 2 4 "$CORPUS" 40 ;;
+    tweets_order2) "$TWEETS" -k 2 3 6 "$CORPUS" ;;
+    tweets_sampling) "$TWEETS" -t 0.5 -top-k 2 -top-p 0.9 4 6 "$CORPUS" ;;
+    tweets_constrained) "$TWEETS" -start cat -min 6 -end 5 5 "$CORPUS" ;;
+    tweets_impossible) "$TWEETS" -start door. -min 3 6 2 "$CORPUS" ;;
+    tweets_stdin) "$TWEETS" 7 3 - < "$CORPUS" ;;
+    tweets_snapshot)
+      "$TWEETS" 8 2 "$CORPUS" 100 "$WORK_DIR/chain.snapshot" \
+        && "$TWEETS" 8 2 "$WORK_DIR/chain.snapshot" ;;
+    tweets_nul) "$TWEETS" 9 4 "$NUL_CORPUS" ;;
+    snakes) "$SNAKES" 3 5 ;;
+    snakes_absorbing) "$SNAKES" -a ;;
+    snakes_simulation) "$SNAKES" -m 1 100000 ;;
+    benchmark) "$BENCHMARK" 1 2000 50x4 10x2 | report_keys ;;
+    benchmark_concurrent) "$BENCHMARK" -c 2 1 2000 50x4 | report_keys ;;
+    *) echo "Unknown case: $1"; return 2 ;;
+  esac
+}
+
+[ $# -eq 0 ] && set -- $ALL_CASES
+failed=0
+for name in "$@"; do
+  output="$WORK_DIR/$name.txt"
+  run_case "$name" > "$output" 2>&1
+  echo "exit status $?" >> "$output"
+  expected="$TESTS_DIR/expected/$name.txt"
+  if [ "$RECORD" = 1 ]; then
+    cp "$output" "$expected"
+    echo "recorded $name"
+  elif diff -u "$expected" "$output"; then
+    echo "passed $name"
+  else
+    echo "FAILED $name"
+    failed=1
+  fi
+done
+exit $failed
@@ -0,0 +1,131 @@
+#include "test_chain.h"
+#include "corpus.h"
+#include "absorbing_chain.h"
+#include <math.h> // For fabs()
+#define SMALL_TEXT "a a b.\na a c.\n"
+#define BIG_WORDS 1500
+#define BIG_SIZE (512 << 10)
+#define SEED 3
+#define BIG_CHECKED_STATES 4
+#define EPSILON 1e-9
+
+/**
+ * checks that the absorption probabilities from transient states of a chain
+ * are distributions over its absorbing states
+ * @param markov_chain the chain, built
+ * @param num_checked number of transient states to check, spread over all
+ * of them
+ * @param is_dense true if the chain should be solved by the dense
+ * factorization, false if iteratively
+ */
+static void check_absorption_sums(const MarkovChain *markov_chain,
+                                  uint32_t num_checked, bool is_dense);
+
+/**
+ * checks the absorption probabilities of a small chain (solved by the
+ * dense factorization) against their exact values: from a, a walk goes to
+ * b. or c. with 1/4 each, and back to a with 1/2, so it ends in each with
+ * probability 1/2
+ */
+static void test_small_chain(void);
+
+/**
+ * checks that the absorption probabilities of a chain with more than
+ * DENSE_SOLVE_LIMIT transient states (solved iteratively) sum to 1
+ */
+static void test_big_chain(void);
+
+static void check_absorption_sums(const MarkovChain *markov_chain,
+                                  uint32_t num_checked, bool is_dense)
+{
+  CompiledChain *compiled_chain = compile_chain (markov_chain);
+  AbsorbingChain *absorbing_chain = compiled_chain
+                                    ? create_absorbing_chain (compiled_chain)
+                                    : NULL;
+  double *probabilities = compiled_chain
+                          ? malloc (compiled_chain->num_states
+                                    * sizeof (double)) : NULL;
+  if (CHECK(absorbing_chain && probabilities))
+  {
+    CHECK(absorbing_chain->num_transient >= num_checked);
+    CHECK((absorbing_chain->lu != NULL) == is_dense);
+    uint32_t stride = absorbing_chain->num_transient / num_checked + 1;
+    for (uint32_t i = 0; i < absorbing_chain->num_transient; i += stride)
+    {
+      if (!CHECK(get_absorption_probabilities
+                     (absorbing_chain, absorbing_chain->transient_states[i],
+                      probabilities)))
+      {
+        break;
+      }
+      double sum = 0;
+      bool is_distribution = true;
+      for (uint32_t state = 0; state < compiled_chain->num_states; state++)
+      {
+        sum += probabilities[state];
+        is_distribution = is_distribution && probabilities[state] >= 0
+                          && (probabilities[state] == 0
+                              || is_absorbing_state (compiled_chain, state));
+      }
+      CHECK(is_distribution);
+      CHECK(fabs (sum - 1) < EPSILON);
+    }
+  }
+  free (probabilities);
+  free_absorbing_chain (&absorbing_chain);
+  free_compiled_chain (&compiled_chain);
+}
+
+static void test_small_chain(void)
+{
+  MarkovChain *markov_chain = build_word_chain (SMALL_TEXT);
+  CompiledChain *compiled_chain = markov_chain
+                                  ? compile_chain (markov_chain) : NULL;
+  AbsorbingChain *absorbing_chain = compiled_chain
+                                    ? create_absorbing_chain (compiled_chain)
+                                    : NULL;
+  double probabilities[3];
+  if (CHECK(absorbing_chain) && CHECK(compiled_chain->num_states == 3)
+      && CHECK(get_absorption_probabilities
+                   (absorbing_chain,
+                    get_compiled_state (compiled_chain, markov_chain
+                        ->database->first->data), probabilities)))
+  {
+    for (int i = 0; i < 2; i++)
+    {
+      MarkovNode *last = get_node_from_database (markov_chain,
+                                                 i ? "c." : "b.")->data;
+      CHECK(fabs (probabilities[get_compiled_state (compiled_chain, last)]
+                  - 0.5) < EPSILON);
+    }
+  }
+  free_absorbing_chain (&absorbing_chain);
+  free_compiled_chain (&compiled_chain);
+  if (markov_chain)
+  {
+    check_absorption_sums (markov_chain, 1, true);
+  }
+  free_database (&markov_chain);
+}
+
+static void test_big_chain(void)
+{
+  char *corpus = make_word_corpus (BIG_SIZE, BIG_WORDS, SEED);
+  MarkovChain *markov_chain = corpus ? create_word_chain () : NULL;
+  int words_to_read = READ_ALL_WORDS;
+  if (CHECK(markov_chain)
+      && CHECK(fill_database_from_buffer (corpus, corpus + BIG_SIZE,
+                                          &words_to_read, markov_chain)))
+  {
+    check_absorption_sums (markov_chain, BIG_CHECKED_STATES, false);
+  }
+  free_database (&markov_chain);
+  free (corpus);
+}
+
+int main (void)
+{
+  test_small_chain ();
+  test_big_chain ();
+  return report_checks ();
+}
@@ -0,0 +1,103 @@
+#include "test_chain.h"
+#define NUM_CHAINS 4
+#define NUM_STATES 2000
+#define STRIDE 7
+#define MAX_WORD 16
+
+// words freed so far, by any thread. read and written atomically.
+static int num_freed = 0;
+
+/**
+ * frees a word and counts it
+ * @param word the word
+ */
+static void count_free(void *word);
+
+/**
+ * builds a chain of NUM_STATES words, each one followed by the next one
+ * and by another one further on, every tenth word a last word
+ * @param frozen true to freeze the chain, so its lists are in its arena
+ * @return the chain, NULL in case of allocation error
+ */
+static MarkovChain *build_chain(bool frozen);
+
+/**
+ * checks that chains passed to free_database_in_background are all freed
+ * (their words counted) once wait_for_background_frees returns, while the
+ * calling thread keeps building and freeing chains of its own
+ */
+static void test_free_in_background(void);
+
+static void count_free(void *word)
+{
+  __atomic_add_fetch (&num_freed, 1, __ATOMIC_RELAXED);
+  free (word);
+}
+
+static MarkovChain *build_chain(bool frozen)
+{
+  MarkovChain *markov_chain = create_heap_word_chain (count_free);
+  Node *nodes[NUM_STATES];
+  char word[MAX_WORD];
+  for (int i = 0; markov_chain && i < NUM_STATES; i++)
+  {
+    snprintf (word, sizeof (word), "w%d%s", i, i % 10 == 9 ? "." : "");
+    nodes[i] = add_to_database (markov_chain, word);
+    if (!nodes[i])
+    {
+      free_database (&markov_chain);
+    }
+  }
+  for (int i = 0; markov_chain && i < NUM_STATES; i++)
+  {
+    MarkovNode *markov_node = nodes[i]->data;
+    if (!is_last_state (markov_chain, markov_node)
+        && (!add_node_to_frequencies_list
+                (markov_node, nodes[(i + 1) % NUM_STATES]->data,
+                 markov_chain)
+            || !add_node_to_frequencies_list
+                (markov_node, nodes[(i * STRIDE) % NUM_STATES]->data,
+                 markov_chain)))
+    {
+      free_database (&markov_chain);
+    }
+  }
+  if (markov_chain && frozen && !freeze_chain (markov_chain))
+  {
+    free_database (&markov_chain);
+  }
+  return markov_chain;
+}
+
+static void test_free_in_background(void)
+{
+  int num_words = 0;
+  for (int i = 0; i < NUM_CHAINS; i++)
+  {
+    MarkovChain *markov_chain = build_chain (i % 2 == 0);
+    if (!CHECK(markov_chain))
+    {
+      continue;
+    }
+    num_words += markov_chain->database->size;
+    free_database_in_background (&markov_chain);
+    CHECK(!markov_chain);
+    // a chain of the calling thread's own, built and freed meanwhile
+    markov_chain = build_chain (false);
+    if (CHECK(markov_chain))
+    {
+      num_words += markov_chain->database->size;
+      free_database (&markov_chain);
+    }
+  }
+  wait_for_background_frees ();
+  CHECK(__atomic_load_n (&num_freed, __ATOMIC_RELAXED) == num_words);
+  // nothing left to wait for
+  wait_for_background_frees ();
+}
+
+int main (void)
+{
+  test_free_in_background ();
+  return report_checks ();
+}
@@ -0,0 +1,382 @@
+#define _POSIX_C_SOURCE 200809L
+#include "test_chain.h"
+#include "corpus.h"
+#include "chain_snapshot.h"
+#include <string.h>
+#include <unistd.h> // For close(), unlink()
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+#define SNAPSHOT_TEMPLATE "/tmp/markov_test_XXXXXX"
+
+/**
+ * checks if a word is the last word in a sentence
+ * @param word a generic pointer to a word
+ * @return true if its the last word, false if not
+ */
+static bool is_word_last(void *word);
+
+/**
+ * formats a word into an output buffer
+ * @param word a generic pointer to a word
+ * @param out the buffer to append to
+ * @return true on success, false in case of allocation error
+ */
+static bool format_word(void *word, OutputBuffer *out);
+
+/**
+ * compares two words like strcmp
+ * @param first a pointer to the first word
+ * @param second a pointer to the second word
+ * @return a negative value, 0 or a positive value
+ */
+static int compare_words(void *first, void *second);
+
+/**
+ * hashes a word (FNV-1a)
+ * @param word a generic pointer to a word
+ * @return the hash of the word
+ */
+static size_t hash_word(void *word);
+
+/**
+ * copies a word to the heap
+ * @param word a pointer to a word
+ * @return the copy, NULL in case of allocation error
+ */
+static void *copy_word(const void *word);
+
+/**
+ * copies a word into an arena
+ * @param arena the arena to copy to
+ * @param word a pointer to a word
+ * @return the copy, NULL in case of allocation error
+ */
+static void *arena_copy_word(Arena *arena, const void *word);
+
+/**
+ * returns the size of a word's data, for snapshots
+ * @param word a generic pointer to a word
+ * @return the length of the word including its terminating NUL
+ */
+static size_t word_size(void *word);
+
+/**
+ * checks if the word a TokenView points to is the last word in a sentence
+ * @param view a generic pointer to a TokenView
+ * @return true if its the last word, false if not
+ */
+static bool is_view_last(void *view);
+
+/**
+ * compares a word with the word a TokenView points to
+ * @param word a pointer to a word
+ * @param view a pointer to a TokenView
+ * @return 0 if they are the same word, non zero otherwise
+ */
+static int compare_word_view(void *word, void *view);
+
+/**
+ * hashes the word a TokenView points to, like hash_word
+ * @param view a generic pointer to a TokenView
+ * @return the hash of the word
+ */
+static size_t hash_view(void *view);
+
+/**
+ * copies the word a TokenView points to into an arena
+ * @param arena the arena to copy to
+ * @param view a pointer to a TokenView
+ * @return the NUL terminated copy, NULL in case of allocation error
+ */
+static void *arena_copy_view(Arena *arena, const void *view);
+
+/**
+ * checks if a node's frequencies list has a successor with the data of
+ * another chain's successor, at the same frequency
+ * @param markov_chain the chain of markov_node
+ * @param markov_node the node
+ * @param other the other chain's successor
+ * @return true if it has, false otherwise
+ */
+static bool has_transition(const MarkovChain *markov_chain,
+                           const MarkovNode *markov_node,
+                           const MarkovNodeFrequency *other);
+
+static const KeyFunctions WORD_KEYS = {hash_view, compare_word_view,
+                                       arena_copy_view, is_view_last};
+
+static int num_failures = 0;
+
+bool check(bool condition, const char *text, const char *file, int line)
+{
+  if (!condition)
+  {
+    printf ("%s:%d: check failed: %s\n", file, line, text);
+    num_failures++;
+  }
+  return condition;
+}
+
+int report_checks(void)
+{
+  if (num_failures)
+  {
+    printf ("%d checks failed\n", num_failures);
+    return EXIT_FAILURE;
+  }
+  printf ("all checks passed\n");
+  return EXIT_SUCCESS;
+}
+
+MarkovChain *create_word_chain(void)
+{
+  MarkovChain *markov_chain = calloc (1, sizeof (MarkovChain));
+  if (!markov_chain)
+  {
+    return NULL;
+  }
+  markov_chain->database = calloc (1, sizeof (LinkedList));
+  if (!markov_chain->database)
+  {
+    free (markov_chain);
+    return NULL;
+  }
+  update_funcs (&markov_chain, format_word, compare_words, free, copy_word,
+                is_word_last);
+  update_hash_func (&markov_chain, hash_word);
+  update_key_funcs (&markov_chain, &WORD_KEYS);
+  if (!use_arena (&markov_chain, arena_copy_word))
+  {
+    free_database (&markov_chain);
+    return NULL;
+  }
+  return markov_chain;
+}
+
+TokenTable *create_word_table(void)
+{
+  return token_table_create (hash_word, compare_words, arena_copy_word,
+                             &WORD_KEYS);
+}
+
+MarkovChain *create_heap_word_chain(free_function free_data)
+{
+  MarkovChain *markov_chain = calloc (1, sizeof (MarkovChain));
+  if (!markov_chain)
+  {
+    return NULL;
+  }
+  markov_chain->database = calloc (1, sizeof (LinkedList));
+  if (!markov_chain->database)
+  {
+    free (markov_chain);
+    return NULL;
+  }
+  update_funcs (&markov_chain, format_word, compare_words, free_data,
+                copy_word, is_word_last);
+  update_hash_func (&markov_chain, hash_word);
+  return markov_chain;
+}
+
+MarkovChain *build_word_chain(const char *text)
+{
+  MarkovChain *markov_chain = create_word_chain ();
+  int words_to_read = READ_ALL_WORDS;
+  if (markov_chain
+      && !fill_database_from_buffer (text, text + strlen (text),
+                                     &words_to_read, markov_chain))
+  {
+    free_database (&markov_chain);
+  }
+  return markov_chain;
+}
+
+char *make_word_corpus(size_t size, int num_words, uint64_t seed)
+{
+  char *corpus = malloc (size);
+  if (!corpus)
+  {
+    return NULL;
+  }
+  uint64_t random = seed;
+  size_t length = 0;
+  int words_in_line = 0;
+  while (length + MAX_TEST_WORD < size)
+  {
+    // xorshift64, so the corpus is the same everywhere
+    random ^= random << 13;
+    random ^= random >> 7;
+    random ^= random << 17;
+    bool is_last = random % LAST_WORD_CHANCE == 0;
+    length += (size_t) sprintf (corpus + length, "w%d%s",
+                                (int) (random / LAST_WORD_CHANCE
+                                       % num_words), is_last ? "." : "");
+    words_in_line++;
+    corpus[length++] = words_in_line % WORDS_PER_LINE ? ' ' : '\n';
+  }
+  memset (corpus + length, '\n', size - length);
+  return corpus;
+}
+
+CompiledChain *round_trip_snapshot(const MarkovChain *markov_chain)
+{
+  CompiledChain *compiled_chain = compile_chain (markov_chain);
+  if (!compiled_chain)
+  {
+    return NULL;
+  }
+  char path[] = SNAPSHOT_TEMPLATE;
+  int fd = mkstemp (path);
+  if (fd == -1)
+  {
+    free_compiled_chain (&compiled_chain);
+    return NULL;
+  }
+  bool saved = save_snapshot (compiled_chain, word_size, path);
+  free_compiled_chain (&compiled_chain);
+  CompiledChain *snapshot = saved ? load_snapshot (fd, format_word) : NULL;
+  close (fd);
+  unlink (path);
+  return snapshot;
+}
+
+bool are_chains_equal(MarkovChain *first, MarkovChain *second)
+{
+  if (first->database->size != second->database->size)
+  {
+    return false;
+  }
+  for (Node *node = first->database->first; node; node = node->next)
+  {
+    MarkovNode *markov_node = node->data;
+    Node *other_node = get_node_from_database (second, markov_node->data);
+    if (!other_node)
+    {
+      return false;
+    }
+    MarkovNode *other = other_node->data;
+    if (is_last_state (first, markov_node) != is_last_state (second, other)
+        || markov_node->frequencies_list_length
+           != other->frequencies_list_length)
+    {
+      return false;
+    }
+    for (int i = 0; i < markov_node->frequencies_list_length; i++)
+    {
+      if (!has_transition (second, other,
+                           &markov_node->frequencies_list[i]))
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+static bool has_transition(const MarkovChain *markov_chain,
+                           const MarkovNode *markov_node,
+                           const MarkovNodeFrequency *other)
+{
+  for (int i = 0; i < markov_node->frequencies_list_length; i++)
+  {
+    const MarkovNodeFrequency *cur = &markov_node->frequencies_list[i];
+    if (markov_chain->comp_func (cur->markov_node->data,
+                                 other->markov_node->data) == 0)
+    {
+      return cur->frequency == other->frequency;
+    }
+  }
+  return false;
+}
+
+static bool is_word_last(void *word)
+{
+  size_t length = strlen ((char*)word);
+  return length > 0 && ((char*)word)[length - 1] == '.';
+}
+
+static bool format_word(void *word, OutputBuffer *out)
+{
+  return output_buffer_append_string (out, (char*)word)
+         && (is_word_last (word) || output_buffer_append (out, " ", 1));
+}
+
+static int compare_words(void *first, void *second)
+{
+  return strcmp ((char*)first, (char*)second);
+}
+
+static size_t hash_word(void *word)
+{
+  unsigned long long hash = FNV_OFFSET_BASIS;
+  for (const unsigned char *cur = word; *cur; cur++)
+  {
+    hash ^= *cur;
+    hash *= FNV_PRIME;
+  }
+  return (size_t) hash;
+}
+
+static void *copy_word(const void *word)
+{
+  size_t size = strlen ((const char*)word) + 1;
+  void *copy = malloc (size);
+  if (copy)
+  {
+    memcpy (copy, word, size);
+  }
+  return copy;
+}
+
+static void *arena_copy_word(Arena *arena, const void *word)
+{
+  size_t size = strlen ((const char*)word) + 1;
+  void *copy = arena_alloc (arena, size);
+  if (copy)
+  {
+    memcpy (copy, word, size);
+  }
+  return copy;
+}
+
+static size_t word_size(void *word)
+{
+  return strlen ((char*)word) + 1;
+}
+
+static bool is_view_last(void *view)
+{
+  const TokenView *token = view;
+  return token->length > 0 && token->start[token->length - 1] == '.';
+}
+
+static int compare_word_view(void *word, void *view)
+{
+  const TokenView *token = view;
+  int result = strncmp ((char*)word, token->start, token->length);
+  return result ? result : (unsigned char) ((char*)word)[token->length];
+}
+
+static size_t hash_view(void *view)
+{
+  const TokenView *token = view;
+  unsigned long long hash = FNV_OFFSET_BASIS;
+  for (size_t i = 0; i < token->length; i++)
+  {
+    hash ^= (unsigned char) token->start[i];
+    hash *= FNV_PRIME;
+  }
+  return (size_t) hash;
+}
+
+static void *arena_copy_view(Arena *arena, const void *view)
+{
+  const TokenView *token = view;
+  char *copy = arena_alloc (arena, token->length + 1);
+  if (copy)
+  {
+    memcpy (copy, token->start, token->length);
+    copy[token->length] = '\0';
+  }
+  return copy;
+}
@@ -0,0 +1,92 @@
+#ifndef _TEST_CHAIN_H_
+#define _TEST_CHAIN_H_
+#include <stdbool.h> // for bool
+#include "markov_chain.h"
+#include "compiled_chain.h"
+#include "token_table.h"
+
+#define WORDS_PER_LINE 12
+#define LAST_WORD_CHANCE 10
+#define MAX_TEST_WORD 16
+
+/**
+ * checks a condition of a test, and reports it with its place if it fails
+ */
+#define CHECK(condition) check ((condition), #condition, __FILE__, __LINE__)
+
+/**
+ * reports a failed condition of a test, and counts it
+ * @param condition the condition's value
+ * @param text the condition's source text
+ * @param file the file of the condition
+ * @param line the line of the condition
+ * @return the condition's value
+ */
+bool check(bool condition, const char *text, const char *file, int line);
+
+/**
+ * prints the number of failed checks
+ * @return EXIT_SUCCESS if no check failed, EXIT_FAILURE otherwise
+ */
+int report_checks(void);
+
+/**
+ * creates an empty chain of words (NUL terminated strings), set up like
+ * the tweets generator's: hashed, in an arena, and with TokenView keys
+ * @return the chain, NULL in case of allocation error
+ */
+MarkovChain *create_word_chain(void);
+
+/**
+ * creates an empty table of words, which interns them by themselves or by
+ * TokenView keys, like create_word_chain's states
+ * @return the table, NULL in case of allocation error
+ */
+TokenTable *create_word_table(void);
+
+/**
+ * creates an empty chain of words whose data is copied to the heap by its
+ * copy_func and freed by free_data (no arena copies, so no key functions)
+ * @param free_data frees a word
+ * @return the chain, NULL in case of allocation error
+ */
+MarkovChain *create_heap_word_chain(free_function free_data);
+
+/**
+ * creates a chain of words (see create_word_chain) and fills it from a text
+ * @param text the text, NUL terminated
+ * @return the chain, not frozen, NULL in case of allocation error
+ */
+MarkovChain *build_word_chain(const char *text);
+
+/**
+ * writes a synthetic corpus of random words w0..w<num_words - 1>, some of
+ * them last words (ending with a dot), in lines of WORDS_PER_LINE words.
+ * every word has many different successors, all of them seen in any long
+ * part of the corpus.
+ * @param size the size of the corpus, at least MAX_TEST_WORD
+ * @param num_words number of different words
+ * @param seed seed of the words, not 0
+ * @return the corpus (not NUL terminated), NULL in case of allocation error
+ */
+char *make_word_corpus(size_t size, int num_words, uint64_t seed);
+
+/**
+ * compiles a chain of words, saves it as a snapshot to a temporary file
+ * and loads it back
+ * @param markov_chain the chain, built
+ * @return the loaded snapshot, NULL if it couldn't be saved or loaded
+ */
+CompiledChain *round_trip_snapshot(const MarkovChain *markov_chain);
+
+/**
+ * checks if two chains have the same states (by their comp_func), the same
+ * last states, and the same transitions with the same frequencies, in any
+ * order
+ * @param first a chain
+ * @param second a chain of the same data type
+ * @return true if they are equal, false otherwise
+ */
+bool are_chains_equal(MarkovChain *first, MarkovChain *second);
+
+#endif //_TEST_CHAIN_H_
@@ -0,0 +1,183 @@
+#define _POSIX_C_SOURCE 200809L
+#include "test_chain.h"
+#include "corpus.h"
+#include "concurrent_chain.h"
+#include <pthread.h>
+#include <sched.h> // For sched_yield()
+#include <string.h>
+#define NUM_READERS 3
+#define FIRST_WORDS 20
+#define LATER_WORDS 60
+#define FIRST_SIZE (64 << 10)
+#define LATER_SIZE (1 << 20)
+#define BLOCK_SIZE (16 << 10)
+#define TWEET_LENGTH 20
+#define SEED 7
+
+/**
+ * A reader thread of the test: it generates tweets until stop is set, and
+ * checks that they are made of the corpus' words.
+ */
+typedef struct ReaderJob {
+    ConcurrentChain *concurrent_chain;
+    int reader;
+    int *stop; // read and written atomically
+    int *num_started; // read and written atomically
+    long num_tweets;
+    bool success; // false on allocation error or a malformed tweet
+} ReaderJob;
+
+/**
+ * checks if a generated tweet is made of words w<number>, the last one
+ * possibly ending with a dot
+ * @param tweet the tweet
+ * @param length its length
+ * @return true if it is, false otherwise
+ */
+static bool is_valid_tweet(const char *tweet, size_t length);
+
+/**
+ * generates tweets from the concurrent chain until the job's stop is set,
+ * one at least
+ * @param job the reader's ReaderJob
+ * @return NULL
+ */
+static void *read_chain(void *job);
+
+/**
+ * checks that readers walking a concurrent chain see well formed rows while
+ * a writer keeps adding new states and transitions to it, publishing it
+ * and reclaiming the rows it replaced
+ */
+static void test_read_while_training(void);
+
+static bool is_valid_tweet(const char *tweet, size_t length)
+{
+  size_t i = 0;
+  while (i < length)
+  {
+    if (tweet[i++] != 'w' || i == length || tweet[i] < '0' || tweet[i] > '9')
+    {
+      return false;
+    }
+    while (i < length && tweet[i] >= '0' && tweet[i] <= '9')
+    {
+      i++;
+    }
+    if (i < length && tweet[i] == '.')
+    {
+      return i + 1 == length;
+    }
+    if (i < length && tweet[i++] != ' ')
+    {
+      return false;
+    }
+  }
+  return length > 0;
+}
+
+static void *read_chain(void *job)
+{
+  ReaderJob *reader_job = job;
+  RandomState rng;
+  seed_random_stream (&rng, SEED, (uint64_t) reader_job->reader);
+  OutputBuffer out = {0};
+  do
+  {
+    out.length = 0;
+    reader_job->success = generate_concurrent_tweet
+        (reader_job->concurrent_chain, reader_job->reader, NULL,
+         TWEET_LENGTH, &rng, &out)
+        && is_valid_tweet (out.data, out.length);
+    if (reader_job->num_tweets++ == 0)
+    {
+      __atomic_add_fetch (reader_job->num_started, 1, __ATOMIC_RELAXED);
+    }
+  }
+  while (reader_job->success
+         && !__atomic_load_n (reader_job->stop, __ATOMIC_RELAXED));
+  output_buffer_free (&out);
+  return NULL;
+}
+
+static void test_read_while_training(void)
+{
+  // the later text has new words, so readers also see new start states
+  char *first = make_word_corpus (FIRST_SIZE, FIRST_WORDS, SEED);
+  char *later = make_word_corpus (LATER_SIZE, LATER_WORDS, SEED + 1);
+  MarkovChain *markov_chain = create_word_chain ();
+  int words_to_read = READ_ALL_WORDS;
+  if (!CHECK(first && later && markov_chain)
+      || !CHECK(fill_database_from_buffer (first, first + FIRST_SIZE,
+                                           &words_to_read, markov_chain)))
+  {
+    free (first);
+    free (later);
+    free_database (&markov_chain);
+    return;
+  }
+  int num_states = markov_chain->database->size;
+  ConcurrentChain *concurrent_chain = create_concurrent_chain (markov_chain,
+                                                               NUM_READERS);
+  CHECK(concurrent_chain);
+  ReaderJob jobs[NUM_READERS];
+  pthread_t threads[NUM_READERS];
+  int stop = 0;
+  int num_started = 0;
+  int started = 0;
+  while (concurrent_chain && started < NUM_READERS)
+  {
+    jobs[started] = (ReaderJob) {concurrent_chain, started, &stop,
+                                 &num_started, 0, true};
+    if (!CHECK(pthread_create (threads + started, NULL, read_chain,
+                               jobs + started) == 0))
+    {
+      break;
+    }
+    started++;
+  }
+  // the writer starts once every reader is walking
+  while (__atomic_load_n (&num_started, __ATOMIC_RELAXED) < started)
+  {
+    sched_yield ();
+  }
+  bool trained = concurrent_chain != NULL;
+  const char *end = later + LATER_SIZE;
+  for (const char *block = later; trained && block < end; )
+  {
+    // blocks end at line ends, so they don't split words
+    const char *block_end = block + BLOCK_SIZE < end
+                            ? memchr (block + BLOCK_SIZE, '\n',
+                                      (size_t) (end - block - BLOCK_SIZE))
+                            : end;
+    words_to_read = READ_ALL_WORDS;
+    trained = fill_database_from_buffer (block, block_end, &words_to_read,
+                                         markov_chain)
+              && publish_chain (concurrent_chain);
+    block = block_end;
+  }
+  CHECK(trained);
+  __atomic_store_n (&stop, 1, __ATOMIC_RELAXED);
+  for (int i = 0; i < started; i++)
+  {
+    pthread_join (threads[i], NULL);
+    CHECK(jobs[i].success);
+  }
+  CHECK(markov_chain->database->size > num_states);
+  if (concurrent_chain)
+  {
+    // with no reader left, publishing frees every replaced row
+    CHECK(publish_chain (concurrent_chain));
+    CHECK(concurrent_chain->retired_size == 0);
+  }
+  free_concurrent_chain (&concurrent_chain);
+  free_database (&markov_chain);
+  free (first);
+  free (later);
+}
+
+int main (void)
+{
+  test_read_while_training ();
+  return report_checks ();
+}
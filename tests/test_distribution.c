@@ -0,0 +1,165 @@
+#include "test_chain.h"
+#include "corpus.h"
+#include "absorbing_chain.h"
+#include "chain_distribution.h"
+#include <math.h> // For fabs()
+#include <string.h>
+#define SMALL_TEXT "a a b.\na a c.\n"
+#define BIG_WORDS 12000
+#define BIG_SIZE (2 << 20)
+#define NUM_THREADS 4
+#define MAX_STEPS 6
+#define SEED 5
+#define EPSILON 1e-12
+
+/**
+ * computes one step of a single walk by scattering every state's
+ * probability over its row, an absorbing state keeping its own
+ * @param compiled_chain the chain
+ * @param current the distribution before the step
+ * @param next set to the distribution after it
+ */
+static void step_walk(const CompiledChain *compiled_chain,
+                      const double *current, double *next);
+
+/**
+ * checks that the k-step distributions from a state, for every k up to
+ * MAX_STEPS, are rows of P^k
+ * @param compiled_chain the chain
+ * @param first_state the state the walks start from
+ */
+static void check_k_steps(const CompiledChain *compiled_chain,
+                          uint32_t first_state);
+
+/**
+ * checks the k-step distributions of a small chain against their exact
+ * values: from a, a walk goes to a with 1/2, and to b. or c. with 1/4 each,
+ * where it stays, so after two steps it is in a with 1/4, and in b. or c.
+ * with 3/8 each
+ */
+static void test_small_chain(void);
+
+/**
+ * checks the k-step distributions of a chain big enough for several
+ * threads against P^k
+ */
+static void test_big_chain(void);
+
+static void step_walk(const CompiledChain *compiled_chain,
+                      const double *current, double *next)
+{
+  memset (next, 0, compiled_chain->num_states * sizeof (double));
+  for (uint32_t state = 0; state < compiled_chain->num_states; state++)
+  {
+    if (is_absorbing_state (compiled_chain, state))
+    {
+      next[state] += current[state];
+      continue;
+    }
+    uint32_t first = compiled_chain->row_offsets[state];
+    uint32_t last = compiled_chain->row_offsets[state + 1];
+    double total = compiled_chain->successors[last - 1].cumulative_frequency;
+    uint32_t previous = 0;
+    for (uint32_t i = first; i < last; i++)
+    {
+      const CompiledSuccessor *successor = &compiled_chain->successors[i];
+      next[successor->state] += current[state]
+                                * (successor->cumulative_frequency - previous)
+                                / total;
+      previous = successor->cumulative_frequency;
+    }
+  }
+}
+
+static void check_k_steps(const CompiledChain *compiled_chain,
+                          uint32_t first_state)
+{
+  uint32_t num_states = compiled_chain->num_states;
+  double *expected = calloc (num_states, sizeof (double));
+  double *next = malloc (num_states * sizeof (double));
+  double *distribution = malloc (num_states * sizeof (double));
+  if (!CHECK(expected && next && distribution))
+  {
+    free (expected);
+    free (next);
+    free (distribution);
+    return;
+  }
+  expected[first_state] = 1;
+  for (int k = 0; k <= MAX_STEPS; k++)
+  {
+    if (!CHECK(get_k_step_distribution (compiled_chain, first_state, k,
+                                        NUM_THREADS, distribution)))
+    {
+      break;
+    }
+    double distance = 0;
+    double sum = 0;
+    for (uint32_t state = 0; state < num_states; state++)
+    {
+      distance += fabs (distribution[state] - expected[state]);
+      sum += distribution[state];
+    }
+    CHECK(distance < EPSILON);
+    CHECK(fabs (sum - 1) < EPSILON);
+    step_walk (compiled_chain, expected, next);
+    memcpy (expected, next, num_states * sizeof (double));
+  }
+  free (expected);
+  free (next);
+  free (distribution);
+}
+
+static void test_small_chain(void)
+{
+  MarkovChain *markov_chain = build_word_chain (SMALL_TEXT);
+  CompiledChain *compiled_chain = markov_chain
+                                  ? compile_chain (markov_chain) : NULL;
+  double distribution[3];
+  if (CHECK(compiled_chain) && CHECK(compiled_chain->num_states == 3))
+  {
+    uint32_t a = get_compiled_state (compiled_chain,
+                                     get_node_from_database (markov_chain,
+                                                             "a")->data);
+    uint32_t b = get_compiled_state (compiled_chain,
+                                     get_node_from_database (markov_chain,
+                                                             "b.")->data);
+    if (CHECK(get_k_step_distribution (compiled_chain, a, 2, 1,
+                                       distribution)))
+    {
+      CHECK(fabs (distribution[a] - 0.25) < EPSILON);
+      CHECK(fabs (distribution[b] - 0.375) < EPSILON);
+    }
+    check_k_steps (compiled_chain, a);
+  }
+  free_compiled_chain (&compiled_chain);
+  free_database (&markov_chain);
+}
+
+static void test_big_chain(void)
+{
+  char *corpus = make_word_corpus (BIG_SIZE, BIG_WORDS, SEED);
+  MarkovChain *markov_chain = corpus ? create_word_chain () : NULL;
+  int words_to_read = READ_ALL_WORDS;
+  CompiledChain *compiled_chain = NULL;
+  if (CHECK(markov_chain)
+      && CHECK(fill_database_from_buffer (corpus, corpus + BIG_SIZE,
+                                          &words_to_read, markov_chain)))
+  {
+    compiled_chain = compile_chain (markov_chain);
+  }
+  if (CHECK(compiled_chain))
+  {
+    check_k_steps (compiled_chain, compiled_chain->start_states[0]);
+  }
+  free_compiled_chain (&compiled_chain);
+  free_database (&markov_chain);
+  free (corpus);
+}
+
+int main (void)
+{
+  test_small_chain ();
+  test_big_chain ();
+  return report_checks ();
+}
@@ -0,0 +1,89 @@
+#include "test_chain.h"
+#include "corpus.h"
+#include <string.h>
+#define TEXT "the cat sat.\nthe dog ran.\n"
+#define NUM_WORDS 5
+#define LONGER_TEXT "catalog"
+
+/**
+ * makes a key of the first length bytes of a text
+ * @param text the text
+ * @param length the key's length
+ * @return the key
+ */
+static TokenView make_key(const char *text, size_t length);
+
+/**
+ * checks that a chain's states are found by their views as by their data,
+ * that a view finds only the word it spans (not a longer or shorter one),
+ * and that adding a key copies it only if its state is new
+ */
+static void test_chain_keys(void);
+
+/**
+ * checks that a token table gives a token the same id by itself and by a
+ * key, so the hashes of keys and tokens agree
+ */
+static void test_table_keys(void);
+
+static TokenView make_key(const char *text, size_t length)
+{
+  TokenView key = {text, length};
+  return key;
+}
+
+static void test_chain_keys(void)
+{
+  MarkovChain *markov_chain = build_word_chain (TEXT);
+  if (!CHECK(markov_chain))
+  {
+    return;
+  }
+  CHECK(markov_chain->database->size == NUM_WORDS);
+  for (Node *node = markov_chain->database->first; node; node = node->next)
+  {
+    const char *word = node->data->data;
+    TokenView key = make_key (word, strlen (word));
+    CHECK(get_node_from_database_by_key (markov_chain, &key) == node);
+    CHECK(add_key_to_database (markov_chain, &key) == node);
+  }
+  CHECK(markov_chain->database->size == NUM_WORDS);
+  TokenView prefix = make_key (LONGER_TEXT, strlen ("ca"));
+  TokenView longer = make_key (LONGER_TEXT, strlen ("cata"));
+  CHECK(!get_node_from_database_by_key (markov_chain, &prefix));
+  CHECK(!get_node_from_database_by_key (markov_chain, &longer));
+  Node *added = add_key_to_database (markov_chain, &longer);
+  if (CHECK(added))
+  {
+    CHECK(strcmp (added->data->data, "cata") == 0);
+    CHECK(get_node_from_database (markov_chain, "cata") == added);
+  }
+  CHECK(markov_chain->database->size == NUM_WORDS + 1);
+  free_database (&markov_chain);
+}
+
+static void test_table_keys(void)
+{
+  TokenTable *table = create_word_table ();
+  if (!CHECK(table))
+  {
+    return;
+  }
+  uint32_t id = 0;
+  uint32_t key_id = 0;
+  TokenView key = make_key (LONGER_TEXT, strlen ("cat"));
+  CHECK(token_table_intern (table, "cat", &id));
+  CHECK(token_table_intern_key (table, &key, &key_id) && key_id == id);
+  key = make_key (LONGER_TEXT, strlen ("cata"));
+  CHECK(token_table_intern_key (table, &key, &key_id) && key_id != id);
+  CHECK(token_table_intern (table, "cata", &id) && key_id == id);
+  CHECK(table->size == 2);
+  token_table_free (&table);
+}
+
+int main (void)
+{
+  test_chain_keys ();
+  test_table_keys ();
+  return report_checks ();
+}
@@ -0,0 +1,114 @@
+#include "test_chain.h"
+#include "corpus.h"
+#include <string.h>
+#define NUM_WORDS 40
+#define CORPUS_SIZE (6 << 20)
+#define NUM_THREADS 4
+#define FANOUT_THRESHOLD 16
+#define HUB_WORD "w0"
+
+/**
+ * finds the start of the line that contains a place in the corpus
+ * @param begin start of the corpus
+ * @param place the place
+ * @return the start of the line
+ */
+static const char *find_line_start(const char *begin, const char *place);
+
+/**
+ * checks that adding text to a frozen chain (which rebuilds the successor
+ * indexes that the first freeze dropped), with several threads, gives the
+ * chain that reading all the text at once gives
+ * @param corpus the corpus
+ * @param size its size
+ */
+static void test_train_after_freeze(const char *corpus, size_t size);
+
+/**
+ * checks that a chain saved as a snapshot and added to an empty chain by
+ * add_compiled_chain is the chain that was saved
+ * @param corpus the corpus
+ * @param size its size
+ */
+static void test_snapshot_round_trip(const char *corpus, size_t size);
+
+static const char *find_line_start(const char *begin, const char *place)
+{
+  while (place > begin && place[-1] != '\n')
+  {
+    place--;
+  }
+  return place;
+}
+
+static void test_train_after_freeze(const char *corpus, size_t size)
+{
+  MarkovChain *whole = create_word_chain ();
+  MarkovChain *trained = create_word_chain ();
+  if (!CHECK(whole && trained))
+  {
+    free_database (&whole);
+    free_database (&trained);
+    return;
+  }
+  int words_to_read = READ_ALL_WORDS;
+  CHECK(fill_database_from_buffer (corpus, corpus + size, &words_to_read,
+                                   whole) && freeze_chain (whole));
+  // the second part is long enough to be counted by several threads
+  const char *split = find_line_start (corpus, corpus + size / 4);
+  words_to_read = READ_ALL_WORDS;
+  CHECK(fill_database_from_buffer (corpus, split, &words_to_read, trained)
+        && freeze_chain (trained));
+  Node *hub = get_node_from_database (trained, HUB_WORD);
+  if (CHECK(hub))
+  {
+    CHECK(hub->data->frequencies_list_length >= FANOUT_THRESHOLD);
+    CHECK(!hub->data->successor_index);
+  }
+  // the hub already has all its successors, so only the lookups rebuild
+  // its index
+  CHECK(train_chain (split, corpus + size, trained, NUM_THREADS));
+  if (hub)
+  {
+    CHECK(hub->data->successor_index);
+  }
+  CHECK(are_chains_equal (whole, trained));
+  free_database (&whole);
+  free_database (&trained);
+}
+
+static void test_snapshot_round_trip(const char *corpus, size_t size)
+{
+  MarkovChain *original = create_word_chain ();
+  MarkovChain *loaded = create_word_chain ();
+  if (!CHECK(original && loaded))
+  {
+    free_database (&original);
+    free_database (&loaded);
+    return;
+  }
+  CHECK(train_chain (corpus, corpus + size, original, 1));
+  CompiledChain *snapshot = round_trip_snapshot (original);
+  if (CHECK(snapshot))
+  {
+    CHECK(snapshot->num_states == (uint32_t) original->database->size);
+    CHECK(add_compiled_chain (loaded, snapshot));
+    free_compiled_chain (&snapshot);
+    CHECK(are_chains_equal (original, loaded));
+  }
+  free_database (&original);
+  free_database (&loaded);
+}
+
+int main (void)
+{
+  char *corpus = make_word_corpus (CORPUS_SIZE, NUM_WORDS, 1);
+  if (!CHECK(corpus))
+  {
+    return report_checks ();
+  }
+  test_train_after_freeze (corpus, CORPUS_SIZE);
+  test_snapshot_round_trip (corpus, CORPUS_SIZE / 16);
+  free (corpus);
+  return report_checks ();
+}
@@ -0,0 +1,190 @@
+#include "token_table.h"
+
+#define INITIAL_CAPACITY 64
+// grow when more than 3/4 of the slots are taken
+#define MAX_LOAD_NUMERATOR 3
+#define MAX_LOAD_DENOMINATOR 4
+#define GOLDEN_RATIO_64 0x9E3779B97F4A7C15ULL
+
+/**
+ * spreads the bits of a user supplied hash over the whole table
+ * @param hash the hash to mix
+ * @return the mixed hash
+ */
+static size_t mix_hash(size_t hash);
+
+/**
+ * places a slot in the first free place of its probe sequence
+ * @param slots the slots array
+ * @param capacity number of slots, power of 2
+ * @param slot the slot to place
+ */
+static void place_slot(TokenTableSlot *slots, size_t capacity,
+                       TokenTableSlot slot);
+
+/**
+ * makes room for one more token, in the slots and in the tokens array
+ * @param table the table
+ * @return true on success, false in case of allocation error
+ */
+static bool reserve_token(TokenTable *table);
+
+/**
+ * gets the id of a token, interning it if it isn't in the table yet, by a
+ * probe that is either the token or a key that stands for it
+ * @param table the table
+ * @param probe the token or key
+ * @param hash_func hash function of the probe
+ * @param comp_func compares a token with the probe
+ * @param arena_copy copies the probe into an arena as a token
+ * @param id set to the id of the token
+ * @return true on success, false in case of allocation error
+ */
+static bool intern(TokenTable *table, void *probe, hash_function hash_func,
+                   compare_function comp_func,
+                   arena_copy_function arena_copy, uint32_t *id);
+
+static size_t mix_hash(size_t hash)
+{
+  unsigned long long mixed = (unsigned long long) hash * GOLDEN_RATIO_64;
+  return (size_t) (mixed ^ (mixed >> 32));
+}
+
+static void place_slot(TokenTableSlot *slots, size_t capacity,
+                       TokenTableSlot slot)
+{
+  size_t position = slot.hash & (capacity - 1);
+  while (slots[position].id)
+  {
+    position = (position + 1) & (capacity - 1);
+  }
+  slots[position] = slot;
+}
+
+static bool reserve_token(TokenTable *table)
+{
+  if (table->size == table->capacity)
+  {
+    uint32_t new_capacity = table->capacity * 2;
+    void **temp = realloc (table->tokens, new_capacity * sizeof (void *));
+    if (!temp)
+    {
+      return false;
+    }
+    table->tokens = temp;
+    table->capacity = new_capacity;
+  }
+  if ((table->size + 1) * MAX_LOAD_DENOMINATOR
+      > table->slots_capacity * MAX_LOAD_NUMERATOR)
+  {
+    size_t new_capacity = table->slots_capacity * 2;
+    TokenTableSlot *new_slots = calloc (new_capacity,
+                                        sizeof (TokenTableSlot));
+    if (!new_slots)
+    {
+      return false;
+    }
+    for (size_t i = 0; i < table->slots_capacity; i++)
+    {
+      if (table->slots[i].id)
+      {
+        place_slot (new_slots, new_capacity, table->slots[i]);
+      }
+    }
+    free (table->slots);
+    table->slots = new_slots;
+    table->slots_capacity = new_capacity;
+  }
+  return true;
+}
+
+TokenTable *token_table_create(hash_function hash_func,
+                               compare_function comp_func,
+                               arena_copy_function arena_copy,
+                               const KeyFunctions *key_funcs)
+{
+  TokenTable *table = calloc (1, sizeof (TokenTable));
+  if (!table)
+  {
+    return NULL;
+  }
+  table->tokens = malloc (INITIAL_CAPACITY * sizeof (void *));
+  table->slots = calloc (INITIAL_CAPACITY, sizeof (TokenTableSlot));
+  table->arena = arena_create ();
+  if (!table->tokens || !table->slots || !table->arena)
+  {
+    token_table_free (&table);
+    return NULL;
+  }
+  table->capacity = INITIAL_CAPACITY;
+  table->slots_capacity = INITIAL_CAPACITY;
+  table->hash_func = hash_func;
+  table->comp_func = comp_func;
+  table->arena_copy = arena_copy;
+  table->key_funcs = key_funcs;
+  return table;
+}
+
+static bool intern(TokenTable *table, void *probe, hash_function hash_func,
+                   compare_function comp_func,
+                   arena_copy_function arena_copy, uint32_t *id)
+{
+  size_t hash = mix_hash (hash_func (probe));
+  size_t position = hash & (table->slots_capacity - 1);
+  while (table->slots[position].id)
+  {
+    TokenTableSlot *slot = table->slots + position;
+    if (slot->hash == hash
+        && comp_func (table->tokens[slot->id - 1], probe) == 0)
+    {
+      *id = slot->id - 1;
+      return true;
+    }
+    position = (position + 1) & (table->slots_capacity - 1);
+  }
+  if (!reserve_token (table))
+  {
+    return false;
+  }
+  void *copy = arena_copy (table->arena, probe);
+  if (!copy)
+  {
+    return false;
+  }
+  table->tokens[table->size] = copy;
+  table->size++;
+  TokenTableSlot slot = {hash, table->size};
+  place_slot (table->slots, table->slots_capacity, slot);
+  *id = table->size - 1;
+  return true;
+}
+
+bool token_table_intern(TokenTable *table, void *token, uint32_t *id)
+{
+  return intern (table, token, table->hash_func, table->comp_func,
+                 table->arena_copy, id);
+}
+
+bool token_table_intern_key(TokenTable *table, const void *key,
+                            uint32_t *id)
+{
+  return intern (table, (void *) key, table->key_funcs->hash_key,
+                 table->key_funcs->comp_key,
+                 table->key_funcs->arena_copy_key, id);
+}
+
+void token_table_free(TokenTable **table)
+{
+  if (!*table)
+  {
+    return;
+  }
+  free ((*table)->tokens);
+  free ((*table)->slots);
+  if ((*table)->arena)
+  {
+    arena_free ((*table)->arena);
+  }
+  free (*table);
+  *table = NULL;
+}
@@ -0,0 +1,81 @@
+#ifndef _TOKEN_TABLE_H_
+#define _TOKEN_TABLE_H_
+#include <stdbool.h> // for bool
+#include <stddef.h> // for size_t
+#include <stdint.h> // for uint32_t
+#include "markov_chain.h"
+
+typedef struct TokenTableSlot {
+    size_t hash;
+    uint32_t id; // id of the token plus one, 0 if the slot is empty
+} TokenTableSlot;
+
+/**
+ * Interns tokens: every distinct token gets a small integer id (in order of
+ * appearance) and one copy of it, in the table's arena. Tokens are looked up
+ * in an open-addressing (linear probing) hash table.
+ */
+typedef struct TokenTable {
+    // id -> the interned copy of the token
+    void **tokens;
+    uint32_t size;
+    uint32_t capacity;
+
+    TokenTableSlot *slots;
+    size_t slots_capacity; // always a power of 2
+
+    // owns the interned copies
+    Arena *arena;
+
+    // callbacks for a single token, like the ones of a markov chain
+    hash_function hash_func;
+    compare_function comp_func;
+    arena_copy_function arena_copy;
+
+    // functions that intern tokens by keys (see KeyFunctions), NULL if
+    // tokens are only interned by themselves
+    const KeyFunctions *key_funcs;
+} TokenTable;
+
+/**
+ * Create an empty token table.
+ * @param hash_func hash function of the tokens
+ * @param comp_func compares two tokens, 0 if equal
+ * @param arena_copy copies a token into an arena
+ * @param key_funcs functions of keys that stand for tokens, which must
+ * outlive the table. NULL if tokens are only interned by themselves.
+ * @return a newly allocated table, NULL in case of allocation error
+ */
+TokenTable *token_table_create(hash_function hash_func,
+                               compare_function comp_func,
+                               arena_copy_function arena_copy,
+                               const KeyFunctions *key_funcs);
+
+/**
+ * Get the id of a token, interning it if it isn't in the table yet.
+ * @param table the table
+ * @param token the token, copied if it is new
+ * @param id set to the id of the token
+ * @return true on success, false in case of allocation error
+ */
+bool token_table_intern(TokenTable *table, void *token, uint32_t *id);
+
+/**
+ * Get the id of the token a key stands for (see KeyFunctions), interning it
+ * if it isn't in the table yet.
+ * @param table the table, with key_funcs
+ * @param key the key of the token, copied by arena_copy_key if the token is
+ * new
+ * @param id set to the id of the token
+ * @return true on success, false in case of allocation error
+ */
+bool token_table_intern_key(TokenTable *table, const void *key,
+                            uint32_t *id);
+
+/**
+ * Free the table and all the tokens it interned.
+ * @param table the table to free
+ */
+void token_table_free(TokenTable **table);
+
+#endif //_TOKEN_TABLE_H_
@@ -1,235 +1,633 @@
-#include "markov_chain.h"
-#include <string.h>
-#define TOKEN_DETERMINE " \n\r\t"
-#define MAX_LINE 1000
-#define NO_WORDS_LIMIT 4
-#define WORDS_LIMIT 5
-#define SUCCESS 0
-#define FAILED 1
-#define INVALID_ARGS_ERROR_MESSAGE "Usage: invalid number of arguments"
-#define FILE_ERROR_MESSAGE "Error: couldn't open file"
-#define MAX_TWEET 20
-#define READ_ALL_FILE (-1)
-#define BASE_10 10
-
-#define SEED_PLACE 1
-#define FILE_PLACE 3
-#define TWEETS_PLACE 2
-#define WORDS_PLACE 4
-/**
- * receives a pointer to the file, the number of words to read and a markov
- * chain with a valid database in it, and fills it with the words from the file
- * @param fp a file pointer
- * @param words_to_read number of words to read
- * @param markov_chain a pointer to the markov chain
- * @return 0 upon success, 1 if failed
- */
-static int fill_database(FILE *fp, int words_to_read, MarkovChain
-*markov_chain);
-
-/**
- * checks if a word is the last word in a sentence
- * @param word a generic pointer that points to a word
- * @return true if its the last word, false if not
- */
-static bool is_word_last(void * word);
-
-/**
- * prints the word
- * @param word a generic pointer to a word
- */
-static void my_print(void *word);
-
-/**
- * gets two generic pointers to two words, returns a negative value if the
- * first should appear before the second, 0 if they are the same and 1
- * otherwise
- * @param first a pointer to the first word
- * @param second a pointer to the second word
- * @return a number
- */
-static int my_compare(void *first, void *second);
-
-/**
- * copies a pointer of a word to a new allocated generic pointer
- * @param word a pointer to a word
- * @return the newly allocated pointer
- */
-static void* my_copy (const void* word);
-
-/**
- * checks if the program receives a valid amount of arguments
- * @param argc the number of arguments
- * @return true if valid, false if not
- */
-static bool is_valid_args(int argc);
-
-/**
- * prints random tweets
- * @param markov_chain a pointer to the markov chain
- * @param tweets_num number of tweets to print
- */
-static void print_tweets(MarkovChain *markov_chain, int tweets_num);
-
-static int fill_database(FILE *fp, int words_to_read, MarkovChain
-*markov_chain)
-{
-  char line[MAX_LINE] = {0};
-  int word_counter = 0;
-  while (word_counter != words_to_read)
-  {
-    if (!fgets(line, MAX_LINE, fp))
-    {
-      return SUCCESS;
-    }
-    void *token = (void*)strtok(line, TOKEN_DETERMINE); char* word_pointer =
-        NULL;
-    while (token != NULL)
-    {
-      if (word_counter == words_to_read)
-      {
-        return SUCCESS;
-      }
-      if (!markov_chain->is_last(token))
-      {
-        word_pointer = token;
-      }
-      else
-      {
-        if (!add_to_database (markov_chain,token))
-        {
-          return FAILED;
-        }
-        word_pointer = NULL;
-      }
-      token = strtok(NULL, TOKEN_DETERMINE);
-      if (word_pointer && token)
-      {
-        Node *last_node = add_to_database (markov_chain,
-                                           word_pointer);
-        Node *cur_node = add_to_database (markov_chain, token);
-        if (!last_node || !cur_node)
-        {
-          return FAILED;
-        }
-        if (!add_node_to_frequencies_list (last_node->data, cur_node->data, markov_chain))
-        {
-          return FAILED;
-        }
-      }
-      word_counter++;
-    }
-  }
-  return EXIT_SUCCESS;
-}
-
-static bool is_word_last(void * word)
-{
-  char* new_word = (char*) word;
-  if (new_word[strlen (new_word) - 1] == '.')
-  {
-    return true;
-  }
-  return false;
-}
-
-static void my_print(void *word)
-{
-  if (is_word_last (word))
-  {
-    printf ("%s", (char*)word);
-  }
-  else
-  {
-    printf ("%s ", (char*)word);
-  }
-
-}
-
-static int my_compare(void *first, void *second)
-{
-  return strcmp ((char*)first, (char*)second);
-}
-
-static void* my_copy (const void* word)
-{
-  char* cur = (char*)word;
-  size_t num = strlen (cur) + 1;
-  void* new = calloc (num, sizeof (char));
-  if (!new)
-  {
-    return NULL;
-  }
-  memcpy (new, word, num);
-  return new;
-}
-
-static bool is_valid_args(int argc)
-{
-  if (argc != WORDS_LIMIT && argc != NO_WORDS_LIMIT)
-  {
-    printf ("%s\n", INVALID_ARGS_ERROR_MESSAGE);
-    return false;
-  }
-  return true;
-}
-
-static void print_tweets(MarkovChain *markov_chain, int tweets_num)
-{
-  for (int i = 1; i <= tweets_num; i++)
-  {
-    printf ( "Tweet %d: ", i);
-    generate_tweet (markov_chain, NULL, MAX_TWEET);
-    printf("\n");
-  }
-}
-
-int main (int argc, char *argv[])
-{
-  if (!is_valid_args (argc))
-  {
-    return EXIT_FAILURE;
-  }
-  unsigned seed = (unsigned)strtol(argv[SEED_PLACE], NULL, BASE_10);
-  srand (seed);
-  FILE *input = fopen (argv[FILE_PLACE], "r");
-  if (input == NULL)
-  {
-    printf ("%s", FILE_ERROR_MESSAGE);
-    return EXIT_FAILURE;
-  }
-  MarkovChain *my_chain = calloc (1, sizeof (MarkovChain));
-  if (!my_chain)
-  {
-    printf ("%s", ALLOCATION_ERROR_MASSAGE);
-    fclose (input);
-    return EXIT_FAILURE;
-  }
-  my_chain->database = calloc(1,sizeof (LinkedList));
-  if (!my_chain->database)
-  {
-    printf ("%s", ALLOCATION_ERROR_MASSAGE);
-    free(my_chain);
-    my_chain = NULL;
-    fclose (input);
-    return EXIT_FAILURE;
-  }
-  update_funcs (&my_chain, my_print, my_compare, free, my_copy, is_word_last);
-  int words_to_read = READ_ALL_FILE;
-  if (argc == WORDS_LIMIT)
-  {
-    words_to_read = (int) strtol (argv[WORDS_PLACE],NULL, BASE_10);
-  }
-  if (fill_database (input, words_to_read,my_chain))
-  {
-    free_database (&my_chain);
-    fclose (input);
-    printf ("%s", ALLOCATION_ERROR_MASSAGE);
-    return EXIT_FAILURE;
-  }
-  int tweets_num = (int) strtol (argv[TWEETS_PLACE], NULL, BASE_10);
-  print_tweets (my_chain, tweets_num);
-  free_database (&my_chain);
-  fclose (input);
-  return EXIT_SUCCESS;
-}
+#define _POSIX_C_SOURCE 200809L
+#include "markov_chain.h"
+#include "corpus.h"
+#include "corpus_stream.h"
+#include "chain_snapshot.h"
+#include "batch_generator.h"
+#include "chain_stats.h"
+#include <fcntl.h> // For open()
+#include <math.h> // For HUGE_VAL
+#include <string.h>
+#include <unistd.h> // For STDOUT_FILENO
+#define NO_WORDS_LIMIT 4
+#define WORDS_LIMIT 5
+#define WITH_SNAPSHOT 6
+#define INVALID_ARGS_ERROR_MESSAGE "Usage: invalid number of arguments"
+#define FILE_ERROR_MESSAGE "Error: couldn't open file"
+#define SNAPSHOT_ERROR_MESSAGE "Error: couldn't read or write snapshot"
+#define ORDER_ERROR_MESSAGE "Usage: the order must be between 1 and 5, and \
+snapshots and first words are only supported for order 1"
+#define STATS_ERROR_MESSAGE "Error: couldn't write statistics"
+#define SAMPLING_ERROR_MESSAGE "Usage: the temperature and top-k must be at \
+least 0, and top-p must be above 0 and at most 1"
+#define ORDER_FLAG "-k"
+#define STATS_FLAG "-s"
+#define TEMPERATURE_FLAG "-t"
+#define TOP_K_FLAG "-top-k"
+#define TOP_P_FLAG "-top-p"
+#define START_FLAG "-start"
+#define MIN_WORDS_FLAG "-min"
+#define END_LAST_FLAG "-end"
+#define MIN_WORDS_ERROR_MESSAGE "Usage: the minimum length must be between 1 \
+and 20 words"
+#define START_ERROR_MESSAGE "Error: the first word isn't in the corpus"
+#define CONSTRAINTS_ERROR_MESSAGE "Error: no tweet meets the constraints"
+#define STATS_FILE_MODE 0644
+#define MAX_TWEET 20
+#define READ_ALL_FILE (-1)
+#define BASE_10 10
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+#define SEED_PLACE 1
+#define FILE_PLACE 3
+#define TWEETS_PLACE 2
+#define WORDS_PLACE 4
+#define SNAPSHOT_PLACE 5
+#define MAX_THREADS 64
+#define FLAG_VALUE_PLACE 2
+
+/**
+ * What a request asks of its tweets, besides their number.
+ */
+typedef struct TweetRequest {
+    SamplingParameters sampling;
+    const char *first_word; // NULL for random first words
+    int min_words;
+    bool end_last; // tweets must end with a last word
+} TweetRequest;
+
+/**
+ * sets up an empty chain for words (order 1) or for contexts of the model
+ * @param markov_chain the chain
+ * @param model the model of an order-k chain, NULL for order 1
+ * @return true on success, false in case of allocation error
+ */
+static bool set_up_chain(MarkovChain **markov_chain, NgramModel *model);
+
+/**
+ * checks if a word is the last word in a sentence
+ * @param word a generic pointer that points to a word
+ * @return true if its the last word, false if not
+ */
+static bool is_word_last(void * word);
+
+/**
+ * formats the word into an output buffer
+ * @param word a generic pointer to a word
+ * @param out the buffer to append to
+ * @return true on success, false in case of allocation error
+ */
+static bool my_format(void *word, OutputBuffer *out);
+
+/**
+ * gets two generic pointers to two words, returns a negative value if the
+ * first should appear before the second, 0 if they are the same and 1
+ * otherwise
+ * @param first a pointer to the first word
+ * @param second a pointer to the second word
+ * @return a number
+ */
+static int my_compare(void *first, void *second);
+
+/**
+ * hashes a word (FNV-1a)
+ * @param word a generic pointer to a word
+ * @return the hash of the word
+ */
+static size_t my_hash (void *word);
+
+/**
+ * copies a pointer of a word to a new allocated generic pointer
+ * @param word a pointer to a word
+ * @return the newly allocated pointer
+ */
+static void* my_copy (const void* word);
+
+/**
+ * copies a word into the arena (interns it), used instead of my_copy when
+ * the chain's states live in an arena
+ * @param arena the arena to copy to
+ * @param word a pointer to a word
+ * @return the copy in the arena
+ */
+static void* my_arena_copy (Arena *arena, const void* word);
+
+/**
+ * returns the size of a word's data, for snapshots
+ * @param word a generic pointer to a word
+ * @return the length of the word including its terminating NUL
+ */
+static size_t my_size (void *word);
+
+/**
+ * checks if the word a TokenView points to is the last word in a sentence
+ * @param view a generic pointer to a TokenView
+ * @return true if its the last word, false if not
+ */
+static bool is_view_last (void *view);
+
+/**
+ * compares a word with the word a TokenView points to, like my_compare
+ * @param word a pointer to a word
+ * @param view a pointer to a TokenView
+ * @return a number, 0 if they are the same
+ */
+static int my_view_compare (void *word, void *view);
+
+/**
+ * hashes the word a TokenView points to, like my_hash
+ * @param view a generic pointer to a TokenView
+ * @return the hash of the word
+ */
+static size_t my_view_hash (void *view);
+
+/**
+ * copies the word a TokenView points to into the arena, like my_arena_copy
+ * @param arena the arena to copy to
+ * @param view a pointer to a TokenView
+ * @return the NUL terminated copy in the arena
+ */
+static void* my_view_arena_copy (Arena *arena, const void* view);
+
+/**
+ * prints random tweets from a compiled chain
+ * @param compiled_chain the chain, compiled or loaded from a snapshot
+ * @param markov_chain the chain it was compiled from, NULL for a snapshot
+ * @param order the order of the chain
+ * @param request what the tweets must be like
+ * @param tweets_num number of tweets to print
+ * @param seed the seed of the tweets' random streams
+ * @return true on success, false in case of allocation or write error, if
+ * the first word isn't in the chain, or if no tweet meets the request
+ */
+static bool print_tweets(const CompiledChain *compiled_chain,
+                         MarkovChain *markov_chain, int order,
+                         const TweetRequest *request, long tweets_num,
+                         unsigned seed);
+
+/**
+ * finds the state of a word in a compiled chain, by the index of its source
+ * chain if it has one
+ * @param compiled_chain the chain
+ * @param markov_chain the chain it was compiled from, NULL for a snapshot
+ * @param word the word
+ * @return id of the word's state, NO_STATE if it isn't in the chain
+ */
+static uint32_t find_word_state(const CompiledChain *compiled_chain,
+                                MarkovChain *markov_chain, const char *word);
+
+/**
+ * checks if sampling parameters are valid (see SamplingParameters)
+ * @param sampling the parameters
+ * @param top_k the top-k argument, before it was converted
+ * @return true if valid, false if not
+ */
+static bool is_valid_sampling(SamplingParameters sampling, long top_k);
+
+/**
+ * checks if the program receives a valid amount of arguments
+ * @param argc the number of arguments
+ * @return true if valid, false if not
+ */
+static bool is_valid_args(int argc);
+
+/**
+ * formats the header of a tweet into an output buffer
+ * @param tweet_number number of the tweet
+ * @param out the buffer to append to
+ * @return true on success, false in case of allocation error
+ */
+static bool format_tweet_header(long tweet_number, OutputBuffer *out);
+
+/**
+ * writes the statistics of a chain to a file (see write_chain_stats)
+ * @param path path of the file, NULL to write nothing
+ * @param markov_chain the chain, NULL for a loaded snapshot
+ * @param compiled_chain the compiled chain
+ * @return true on success, false if the file couldn't be written
+ */
+static bool write_stats(const char *path, const MarkovChain *markov_chain,
+                        const CompiledChain *compiled_chain);
+
+/**
+ * Looks words up by views into the corpus, so only new words are copied.
+ */
+static const KeyFunctions WORD_KEYS = {my_view_hash, my_view_compare,
+                                       my_view_arena_copy, is_view_last};
+
+static bool set_up_chain(MarkovChain **markov_chain, NgramModel *model)
+{
+  if (model)
+  {
+    return use_ngram_contexts (markov_chain);
+  }
+  update_funcs (markov_chain, my_format, my_compare, free, my_copy,
+                is_word_last);
+  update_hash_func (markov_chain, my_hash);
+  update_key_funcs (markov_chain, &WORD_KEYS);
+  return use_arena (markov_chain, my_arena_copy);
+}
+
+static bool is_word_last(void * word)
+{
+  char* new_word = (char*) word;
+  size_t length = strlen (new_word);
+  if (length > 0 && new_word[length - 1] == '.')
+  {
+    return true;
+  }
+  return false;
+}
+
+static bool my_format(void *word, OutputBuffer *out)
+{
+  if (!output_buffer_append_string (out, (char*)word))
+  {
+    return false;
+  }
+  return is_word_last (word) || output_buffer_append (out, " ", 1);
+}
+
+static int my_compare(void *first, void *second)
+{
+  return strcmp ((char*)first, (char*)second);
+}
+
+static size_t my_hash (void *word)
+{
+  unsigned long long hash = FNV_OFFSET_BASIS;
+  for (const unsigned char *cur = word; *cur; cur++)
+  {
+    hash ^= *cur;
+    hash *= FNV_PRIME;
+  }
+  return (size_t) hash;
+}
+
+static void* my_copy (const void* word)
+{
+  char* cur = (char*)word;
+  size_t num = strlen (cur) + 1;
+  void* new = calloc (num, sizeof (char));
+  if (!new)
+  {
+    return NULL;
+  }
+  memcpy (new, word, num);
+  return new;
+}
+
+static void* my_arena_copy (Arena *arena, const void* word)
+{
+  size_t num = strlen ((const char*)word) + 1;
+  void* new = arena_alloc (arena, num);
+  if (!new)
+  {
+    return NULL;
+  }
+  memcpy (new, word, num);
+  return new;
+}
+
+static size_t my_size (void *word)
+{
+  return strlen ((char*)word) + 1;
+}
+
+static bool is_view_last (void *view)
+{
+  const TokenView *token = view;
+  return token->length > 0 && token->start[token->length - 1] == '.';
+}
+
+static int my_view_compare (void *word, void *view)
+{
+  const TokenView *token = view;
+  int result = strncmp ((char*)word, token->start, token->length);
+  return result ? result : (unsigned char) ((char*)word)[token->length];
+}
+
+static size_t my_view_hash (void *view)
+{
+  const TokenView *token = view;
+  unsigned long long hash = FNV_OFFSET_BASIS;
+  for (size_t i = 0; i < token->length; i++)
+  {
+    hash ^= (unsigned char) token->start[i];
+    hash *= FNV_PRIME;
+  }
+  return (size_t) hash;
+}
+
+static void* my_view_arena_copy (Arena *arena, const void* view)
+{
+  const TokenView *token = view;
+  char* new = arena_alloc (arena, token->length + 1);
+  if (!new)
+  {
+    return NULL;
+  }
+  memcpy (new, token->start, token->length);
+  new[token->length] = '\0';
+  return new;
+}
+
+static uint32_t find_word_state(const CompiledChain *compiled_chain,
+                                MarkovChain *markov_chain, const char *word)
+{
+  if (!markov_chain)
+  {
+    return find_compiled_state (compiled_chain, (void *) word, my_compare);
+  }
+  Node *node = get_node_from_database (markov_chain, (void *) word);
+  return node ? get_compiled_state (compiled_chain, node->data) : NO_STATE;
+}
+
+static bool print_tweets(const CompiledChain *compiled_chain,
+                         MarkovChain *markov_chain, int order,
+                         const TweetRequest *request, long tweets_num,
+                         unsigned seed)
+{
+  // the first context of an order-k tweet already has k words
+  WalkConstraints constraints = {NO_STATE, request->min_words - order + 1,
+                                 MAX_TWEET - order + 1, request->end_last,
+                                 NULL};
+  constraints.min_length = constraints.min_length > 1
+                           ? constraints.min_length : 1;
+  if (request->first_word)
+  {
+    constraints.first_state = find_word_state (compiled_chain, markov_chain,
+                                               request->first_word);
+    if (constraints.first_state == NO_STATE)
+    {
+      printf ("%s\n", START_ERROR_MESSAGE);
+      return false;
+    }
+  }
+  if (!prepare_walk_constraints (compiled_chain, &constraints))
+  {
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  if (!has_constrained_walk (compiled_chain, &constraints))
+  {
+    free_walk_constraints (&constraints);
+    printf ("%s\n", CONSTRAINTS_ERROR_MESSAGE);
+    return false;
+  }
+  Sampler *sampler = create_sampler (compiled_chain, request->sampling);
+  if (!sampler)
+  {
+    free_walk_constraints (&constraints);
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    return false;
+  }
+  bool printed = print_walks (compiled_chain, sampler, &constraints,
+                              tweets_num, seed,
+                              get_default_num_threads (MAX_THREADS),
+                              format_tweet_header, STDOUT_FILENO);
+  free_sampler (&sampler);
+  free_walk_constraints (&constraints);
+  return printed;
+}
+
+static bool is_valid_sampling(SamplingParameters sampling, long top_k)
+{
+  // written so NaNs fail too
+  return sampling.temperature >= 0 && sampling.temperature <= HUGE_VAL
+         && top_k >= 0 && top_k <= (long) UINT32_MAX
+         && sampling.top_p > 0 && sampling.top_p <= NO_TOP_P;
+}
+
+static bool is_valid_args(int argc)
+{
+  if (argc != WORDS_LIMIT && argc != NO_WORDS_LIMIT && argc != WITH_SNAPSHOT)
+  {
+    printf ("%s\n", INVALID_ARGS_ERROR_MESSAGE);
+    return false;
+  }
+  return true;
+}
+
+static bool format_tweet_header(long tweet_number, OutputBuffer *out)
+{
+  return output_buffer_printf (out, "Tweet %ld: ", tweet_number);
+}
+
+static bool write_stats(const char *path, const MarkovChain *markov_chain,
+                        const CompiledChain *compiled_chain)
+{
+  if (!path)
+  {
+    return true;
+  }
+  int fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, STATS_FILE_MODE);
+  if (fd == -1)
+  {
+    printf ("%s", STATS_ERROR_MESSAGE);
+    return false;
+  }
+  bool written = write_chain_stats (markov_chain, compiled_chain, fd);
+  if (close (fd) == -1 || !written)
+  {
+    printf ("%s", STATS_ERROR_MESSAGE);
+    return false;
+  }
+  return true;
+}
+
+int main (int argc, char *argv[])
+{
+  int order = 1;
+  const char *stats_path = NULL;
+  TweetRequest request = {{DEFAULT_TEMPERATURE, NO_TOP_K, NO_TOP_P}, NULL, 1,
+                          false};
+  long top_k = NO_TOP_K;
+  while (argc > FLAG_VALUE_PLACE)
+  {
+    if (strcmp (argv[1], END_LAST_FLAG) == 0)
+    {
+      // the only flag without a value
+      request.end_last = true;
+      argc--;
+      argv++;
+      continue;
+    }
+    if (strcmp (argv[1], ORDER_FLAG) == 0)
+    {
+      order = (int) strtol (argv[FLAG_VALUE_PLACE], NULL, BASE_10);
+    }
+    else if (strcmp (argv[1], STATS_FLAG) == 0)
+    {
+      stats_path = argv[FLAG_VALUE_PLACE];
+    }
+    else if (strcmp (argv[1], TEMPERATURE_FLAG) == 0)
+    {
+      request.sampling.temperature = strtod (argv[FLAG_VALUE_PLACE], NULL);
+    }
+    else if (strcmp (argv[1], TOP_K_FLAG) == 0)
+    {
+      top_k = strtol (argv[FLAG_VALUE_PLACE], NULL, BASE_10);
+    }
+    else if (strcmp (argv[1], TOP_P_FLAG) == 0)
+    {
+      request.sampling.top_p = strtod (argv[FLAG_VALUE_PLACE], NULL);
+    }
+    else if (strcmp (argv[1], START_FLAG) == 0)
+    {
+      request.first_word = argv[FLAG_VALUE_PLACE];
+    }
+    else if (strcmp (argv[1], MIN_WORDS_FLAG) == 0)
+    {
+      request.min_words = (int) strtol (argv[FLAG_VALUE_PLACE], NULL,
+                                        BASE_10);
+    }
+    else
+    {
+      break;
+    }
+    argc -= FLAG_VALUE_PLACE;
+    argv += FLAG_VALUE_PLACE;
+  }
+  if (!is_valid_args (argc))
+  {
+    return EXIT_FAILURE;
+  }
+  if (order < MIN_NGRAM_ORDER || order > MAX_NGRAM_ORDER
+      || (order > 1 && (argc == WITH_SNAPSHOT || request.first_word)))
+  {
+    printf ("%s\n", ORDER_ERROR_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  if (!is_valid_sampling (request.sampling, top_k))
+  {
+    printf ("%s\n", SAMPLING_ERROR_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  request.sampling.top_k = (uint32_t) top_k;
+  if (request.min_words < 1 || request.min_words > MAX_TWEET)
+  {
+    printf ("%s\n", MIN_WORDS_ERROR_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  unsigned seed = (unsigned)strtol(argv[SEED_PLACE], NULL, BASE_10);
+  FILE *input = strcmp (argv[FILE_PLACE], STDIN_PATH) == 0
+                ? stdin : fopen (argv[FILE_PLACE], "r");
+  if (input == NULL)
+  {
+    printf ("%s", FILE_ERROR_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  bool compressed = is_compressed_corpus (argv[FILE_PLACE]);
+  int tweets_num = (int) strtol (argv[TWEETS_PLACE], NULL, BASE_10);
+  if (!compressed && is_snapshot (fileno (input)))
+  {
+    CompiledChain *snapshot = load_snapshot (fileno (input), my_format);
+    fclose (input);
+    if (!snapshot)
+    {
+      printf ("%s", SNAPSHOT_ERROR_MESSAGE);
+      return EXIT_FAILURE;
+    }
+    bool printed = print_tweets (snapshot, NULL, 1, &request, tweets_num,
+                                 seed)
+                   && write_stats (stats_path, NULL, snapshot);
+    free_compiled_chain (&snapshot);
+    return printed ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  NgramModel *model = NULL;
+  if (order > 1)
+  {
+    model = create_ngram_model (order, my_format, my_compare, my_hash,
+                                my_arena_copy, is_word_last, &WORD_KEYS);
+    if (!model)
+    {
+      printf ("%s", ALLOCATION_ERROR_MASSAGE);
+      fclose (input);
+      return EXIT_FAILURE;
+    }
+  }
+  MarkovChain *my_chain = calloc (1, sizeof (MarkovChain));
+  if (!my_chain)
+  {
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    free_ngram_model (&model);
+    fclose (input);
+    return EXIT_FAILURE;
+  }
+  my_chain->database = calloc(1,sizeof (LinkedList));
+  if (!my_chain->database)
+  {
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    free(my_chain);
+    my_chain = NULL;
+    free_ngram_model (&model);
+    fclose (input);
+    return EXIT_FAILURE;
+  }
+  if (!set_up_chain (&my_chain, model))
+  {
+    printf ("%s", ALLOCATION_ERROR_MASSAGE);
+    free_database (&my_chain);
+    free_ngram_model (&model);
+    fclose (input);
+    return EXIT_FAILURE;
+  }
+  int words_to_read = READ_ALL_FILE;
+  if (argc >= WORDS_LIMIT)
+  {
+    words_to_read = (int) strtol (argv[WORDS_PLACE],NULL, BASE_10);
+  }
+  // compressed corpora and pipes are streamed, regular files are mapped
+  bool mapped = false, filled = true, readable = true;
+  if (!compressed && model)
+  {
+    filled = fill_ngram_database_from_mapped_file (fileno (input),
+                                                   words_to_read, my_chain,
+                                                   model, &mapped);
+  }
+  else if (!compressed)
+  {
+    filled = fill_database_from_mapped_file (fileno (input), words_to_read,
+                                             my_chain, &mapped,
+                                             get_default_num_threads
+                                                 (MAX_THREADS));
+  }
+  if (filled && !mapped)
+  {
+    CorpusStream *stream = compressed
+                           ? open_corpus_stream (argv[FILE_PLACE])
+                           : open_corpus_stream_fd (fileno (input));
+    filled = stream && fill_database_from_stream (stream, words_to_read,
+                                                  my_chain, model);
+    readable = close_corpus_stream (&stream);
+  }
+  CompiledChain *compiled_chain = filled && readable
+                                  ? compile_chain (my_chain) : NULL;
+  if (!compiled_chain)
+  {
+    free_database (&my_chain);
+    free_ngram_model (&model);
+    fclose (input);
+    printf ("%s", readable ? ALLOCATION_ERROR_MASSAGE : FILE_ERROR_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  if (argc == WITH_SNAPSHOT
+      && !save_snapshot (compiled_chain, my_size, argv[SNAPSHOT_PLACE]))
+  {
+    free_compiled_chain (&compiled_chain);
+    free_database (&my_chain);
+    fclose (input);
+    printf ("%s", SNAPSHOT_ERROR_MESSAGE);
+    return EXIT_FAILURE;
+  }
+  bool printed = print_tweets (compiled_chain, my_chain, order, &request,
+                               tweets_num, seed)
+                 && write_stats (stats_path, my_chain, compiled_chain);
+  free_compiled_chain (&compiled_chain);
+  free_database (&my_chain);
+  free_ngram_model (&model);
+  fclose (input);
+  return printed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
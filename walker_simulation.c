@@ -0,0 +1,517 @@
+#include "walker_simulation.h"
+#include "absorbing_chain.h"
+#include <limits.h> // For CHAR_BIT
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h> // For the AVX2 intrinsics
+#define HAVE_AVX2_PATH
+#endif
+
+// walkers advanced in lockstep, so the loads of many walkers are in flight
+// at once
+#define NUM_LANES 1024
+// lanes per AVX2 vector
+#define VECTOR_WIDTH 8
+
+// a walker is one word: its state, then the state's info (its total
+// frequency, its event bits, and a bit for states walks end in)
+#define STATE_MASK (MAX_WALKER_STATES - 1)
+#define TOTAL_SHIFT 20
+#define TOTAL_MASK 0xFF
+#define EVENT_SHIFT 28
+#define END_BIT (1 << 30)
+// the event counts of a walk are packed in one word, 16 bits each
+#define EVENT_COUNT_BITS 16
+#define EVENT_COUNT_MASK 0xFFFF
+
+// splitmix64, to hash the 64 bit counters of the draws
+#define SPLITMIX_INCREMENT 0x9E3779B97F4A7C15ULL
+#define SPLITMIX_MULTIPLIER_1 0xBF58476D1CE4E5B9ULL
+#define SPLITMIX_MULTIPLIER_2 0x94D049BB133111EBULL
+// the counter of a draw is the walk's number, then the step's number in
+// STEP_BITS bits (MAX_WALKER_STEPS fits)
+#define STEP_BITS 16
+#define LOW_HALF 0xFFFFFFFFULL
+#define HALF_BITS 32
+
+/**
+ * The walkers in lockstep, by lanes. A lane moves on to a new walk when its
+ * walk ends, until all the walks were started.
+ */
+typedef struct Lanes {
+    int32_t walkers[NUM_LANES];
+    int32_t steps[NUM_LANES];
+    int32_t events[NUM_LANES];
+    // the counter of the walk's first draw, xored with the seed's key
+    uint64_t walk_counters[NUM_LANES];
+    // the lanes that just ended, num_ended of them. Lanes are appended a
+    // vector at a time, ended or not, so there is room for a vector more.
+    int32_t ended[NUM_LANES + VECTOR_WIDTH];
+    int num_ended;
+    // for every mask of the ended lanes of a vector, the places of its set
+    // lanes, one byte each: the permutation that packs them first
+    uint64_t packing_orders[1 << VECTOR_WIDTH];
+    bool active[NUM_LANES];
+} Lanes;
+
+/**
+ * hashes 64 bits (the splitmix64 finalizer)
+ * @param x the bits
+ * @return the hash
+ */
+static uint64_t hash64(uint64_t x);
+
+/**
+ * moves every lane one step, without vector instructions. the draw of a
+ * step is the high half of the hash of its counter.
+ * @param walker_table the table
+ * @param lanes the lanes
+ * @param max_steps maximum number of steps of a walk
+ */
+static void advance_lanes(const WalkerTable *walker_table, Lanes *lanes,
+                          int max_steps);
+
+#ifdef HAVE_AVX2_PATH
+/**
+ * multiplies every 64 bit lane by a constant, modulo 2^64, by 32 bit
+ * products (AVX2 has no 64 bit multiplication)
+ * @param x the lanes
+ * @param multiplier the constant
+ * @return the products
+ */
+__attribute__((target ("avx2")))
+static __m256i multiply64_avx2(__m256i x, uint64_t multiplier);
+
+/**
+ * hashes every 64 bit lane, like hash64
+ * @param x the lanes
+ * @return the hashes
+ */
+__attribute__((target ("avx2")))
+static __m256i hash64_avx2(__m256i x);
+
+/**
+ * moves every lane one step, eight lanes at a time, with the draws of
+ * advance_lanes
+ * @param walker_table the table
+ * @param lanes the lanes
+ * @param max_steps maximum number of steps of a walk
+ */
+__attribute__((target ("avx2,popcnt")))
+static void advance_lanes_avx2(const WalkerTable *walker_table, Lanes *lanes,
+                               int max_steps);
+#endif
+
+/**
+ * starts a walk in a lane
+ * @param walker_table the table
+ * @param lanes the lanes
+ * @param lane the lane
+ * @param first_state the state the walk starts from
+ * @param walk_counter the counter of the walk's first draw, xored with the
+ * seed's key
+ */
+static void start_walk(const WalkerTable *walker_table, Lanes *lanes,
+                       int lane, uint32_t first_state, uint64_t walk_counter);
+
+/**
+ * adds an ended walk to the histograms
+ * @param lanes the lanes
+ * @param lane the lane of the walk
+ * @param walker_stats the histograms
+ */
+static void record_walk(const Lanes *lanes, int lane,
+                        WalkerStats *walker_stats);
+
+static uint64_t hash64(uint64_t x)
+{
+  x += SPLITMIX_INCREMENT;
+  x = (x ^ (x >> 30)) * SPLITMIX_MULTIPLIER_1;
+  x = (x ^ (x >> 27)) * SPLITMIX_MULTIPLIER_2;
+  return x ^ (x >> 31);
+}
+
+WalkerTable *create_walker_table(const CompiledChain *compiled_chain,
+                                 const unsigned char *state_events)
+{
+  uint32_t num_states = compiled_chain->num_states;
+  if (num_states > MAX_WALKER_STATES)
+  {
+    return NULL;
+  }
+  uint32_t row_width = 1;
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    uint32_t length = get_num_successors (compiled_chain, state);
+    if (length == 0)
+    {
+      continue;
+    }
+    uint32_t total = compiled_chain->successors
+        [compiled_chain->row_offsets[state] + length - 1]
+        .cumulative_frequency;
+    if (total > MAX_ROW_TOTAL)
+    {
+      return NULL;
+    }
+    row_width = total > row_width ? total : row_width;
+  }
+  WalkerTable *walker_table = calloc (1, sizeof (WalkerTable));
+  if (!walker_table)
+  {
+    return NULL;
+  }
+  walker_table->num_states = num_states;
+  walker_table->row_width = row_width;
+  walker_table->next_walkers = malloc ((size_t) num_states * row_width
+                                       * sizeof (int32_t) + 1);
+  walker_table->walkers = malloc ((size_t) num_states * sizeof (int32_t)
+                                  + 1);
+  if (!walker_table->next_walkers || !walker_table->walkers)
+  {
+    free_walker_table (&walker_table);
+    return NULL;
+  }
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    int32_t walker = (int32_t) state;
+    if (state_events)
+    {
+      walker |= (int32_t) state_events[state] << EVENT_SHIFT;
+    }
+    if (is_absorbing_state (compiled_chain, state))
+    {
+      walker |= END_BIT;
+    }
+    else
+    {
+      uint32_t length = get_num_successors (compiled_chain, state);
+      walker |= (int32_t) compiled_chain->successors
+          [compiled_chain->row_offsets[state] + length - 1]
+          .cumulative_frequency << TOTAL_SHIFT;
+    }
+    walker_table->walkers[state] = walker;
+  }
+  for (uint32_t state = 0; state < num_states; state++)
+  {
+    int32_t *row = walker_table->next_walkers + (size_t) state * row_width;
+    if (is_absorbing_state (compiled_chain, state))
+    {
+      // walks end here, but lanes with no walk left may stay here
+      row[0] = walker_table->walkers[state];
+      continue;
+    }
+    uint32_t filled = 0;
+    for (uint32_t i = compiled_chain->row_offsets[state];
+         i < compiled_chain->row_offsets[state + 1]; i++)
+    {
+      while (filled < compiled_chain->successors[i].cumulative_frequency)
+      {
+        row[filled++] = walker_table->walkers
+            [compiled_chain->successors[i].state];
+      }
+    }
+  }
+  return walker_table;
+}
+
+static void advance_lanes(const WalkerTable *walker_table, Lanes *lanes,
+                          int max_steps)
+{
+  int num_ended = 0;
+  for (int lane = 0; lane < NUM_LANES; lane++)
+  {
+    uint32_t draw = (uint32_t) (hash64 (lanes->walk_counters[lane]
+                                        ^ (uint32_t) lanes->steps[lane])
+                                >> HALF_BITS);
+    int32_t walker = lanes->walkers[lane];
+    uint32_t total = ((uint32_t) walker >> TOTAL_SHIFT) & TOTAL_MASK;
+    uint32_t index = (uint32_t) (((uint64_t) draw * total) >> 32);
+    walker = walker_table->next_walkers[(walker & STATE_MASK)
+                                        * walker_table->row_width + index];
+    lanes->walkers[lane] = walker;
+    lanes->steps[lane]++;
+    for (int kind = 0; kind < NUM_EVENT_KINDS; kind++)
+    {
+      lanes->events[lane] += ((walker >> (EVENT_SHIFT + kind)) & 1)
+                             << (EVENT_COUNT_BITS * kind);
+    }
+    bool ended = (walker & END_BIT) || lanes->steps[lane] >= max_steps;
+    // appended either way, and kept only if ended, without a branch
+    lanes->ended[num_ended] = lane;
+    num_ended += ended;
+  }
+  lanes->num_ended = num_ended;
+}
+
+#ifdef HAVE_AVX2_PATH
+__attribute__((target ("avx2")))
+static __m256i multiply64_avx2(__m256i x, uint64_t multiplier)
+{
+  const __m256i low = _mm256_set1_epi64x ((long long) (multiplier
+                                                       & LOW_HALF));
+  const __m256i high = _mm256_set1_epi64x ((long long) (multiplier
+                                                        >> HALF_BITS));
+  // x * multiplier = x_low * m_low + ((x_high * m_low + x_low * m_high)
+  // << 32), the high halves' product being past 64 bits
+  __m256i cross = _mm256_add_epi64 (_mm256_mul_epu32 (_mm256_srli_epi64
+                                                          (x, HALF_BITS),
+                                                      low),
+                                    _mm256_mul_epu32 (x, high));
+  return _mm256_add_epi64 (_mm256_mul_epu32 (x, low),
+                           _mm256_slli_epi64 (cross, HALF_BITS));
+}
+
+__attribute__((target ("avx2")))
+static __m256i hash64_avx2(__m256i x)
+{
+  x = _mm256_add_epi64 (x, _mm256_set1_epi64x ((long long)
+                                                   SPLITMIX_INCREMENT));
+  x = multiply64_avx2 (_mm256_xor_si256 (x, _mm256_srli_epi64 (x, 30)),
+                       SPLITMIX_MULTIPLIER_1);
+  x = multiply64_avx2 (_mm256_xor_si256 (x, _mm256_srli_epi64 (x, 27)),
+                       SPLITMIX_MULTIPLIER_2);
+  return _mm256_xor_si256 (x, _mm256_srli_epi64 (x, 31));
+}
+
+__attribute__((target ("avx2,popcnt")))
+static void advance_lanes_avx2(const WalkerTable *walker_table, Lanes *lanes,
+                               int max_steps)
+{
+  // the high halves of four 64 bit lanes, in the low 128 bits
+  const __m256i high_halves = _mm256_setr_epi32 (1, 3, 5, 7, 1, 3, 5, 7);
+  const __m256i total_mask = _mm256_set1_epi32 (TOTAL_MASK);
+  const __m256i state_mask = _mm256_set1_epi32 (STATE_MASK);
+  const __m256i row_width = _mm256_set1_epi32 ((int) walker_table
+      ->row_width);
+  const __m256i last_step = _mm256_set1_epi32 (max_steps - 1);
+  const __m256i one = _mm256_set1_epi32 (1);
+  const __m256i lane_offsets = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+  // the lanes are stored to, so the table's pointer would be read again
+  // for every vector
+  const int *next_walkers = walker_table->next_walkers;
+  int num_ended = 0;
+  for (int lane = 0; lane < NUM_LANES; lane += VECTOR_WIDTH)
+  {
+    // the counters of the lanes' draws, four 64 bit lanes at a time
+    __m256i old_steps = _mm256_loadu_si256 ((const __m256i *) (lanes->steps
+                                                                + lane));
+    __m256i first_half = hash64_avx2 (_mm256_xor_si256
+        (_mm256_loadu_si256 ((const __m256i *) (lanes->walk_counters
+                                                 + lane)),
+         _mm256_cvtepu32_epi64 (_mm256_castsi256_si128 (old_steps))));
+    __m256i second_half = hash64_avx2 (_mm256_xor_si256
+        (_mm256_loadu_si256 ((const __m256i *) (lanes->walk_counters + lane
+                                                 + VECTOR_WIDTH / 2)),
+         _mm256_cvtepu32_epi64 (_mm256_extracti128_si256 (old_steps, 1))));
+    __m256i draw = _mm256_blend_epi32
+        (_mm256_permutevar8x32_epi32 (first_half, high_halves),
+         _mm256_permutevar8x32_epi32 (second_half, high_halves), 0xF0);
+    __m256i walker = _mm256_loadu_si256 ((const __m256i *) (lanes->walkers
+                                                             + lane));
+    __m256i total = _mm256_and_si256 (_mm256_srli_epi32 (walker,
+                                                         TOTAL_SHIFT),
+                                      total_mask);
+    // the high halves of draw * total: the even lanes' products, then the
+    // odd lanes' ones
+    __m256i even = _mm256_mul_epu32 (draw, total);
+    __m256i odd = _mm256_mul_epu32 (_mm256_srli_epi64 (draw, 32),
+                                    _mm256_srli_epi64 (total, 32));
+    __m256i index = _mm256_blend_epi32 (_mm256_srli_epi64 (even, 32), odd,
+                                        0xAA);
+    __m256i place = _mm256_add_epi32 (_mm256_mullo_epi32
+        (_mm256_and_si256 (walker, state_mask), row_width), index);
+    walker = _mm256_i32gather_epi32 (next_walkers, place, 4);
+    __m256i steps = _mm256_add_epi32 (old_steps, one);
+    __m256i events = _mm256_loadu_si256 ((const __m256i *) (lanes->events
+                                                             + lane));
+    for (int kind = 0; kind < NUM_EVENT_KINDS; kind++)
+    {
+      // the event bit is moved right to its count in a single shift
+      __m256i event = _mm256_and_si256 (walker, _mm256_set1_epi32
+          (1 << (EVENT_SHIFT + kind)));
+      events = _mm256_add_epi32 (events, _mm256_srli_epi32
+          (event, EVENT_SHIFT + kind - EVENT_COUNT_BITS * kind));
+    }
+    _mm256_storeu_si256 ((__m256i *) (lanes->walkers + lane), walker);
+    _mm256_storeu_si256 ((__m256i *) (lanes->steps + lane), steps);
+    _mm256_storeu_si256 ((__m256i *) (lanes->events + lane), events);
+    // END_BIT is next to the sign bit, which movemask takes
+    __m256i ended = _mm256_or_si256 (_mm256_slli_epi32 (walker, 1),
+                                     _mm256_cmpgt_epi32 (steps, last_step));
+    unsigned mask = (unsigned) _mm256_movemask_ps (_mm256_castsi256_ps
+                                                       (ended));
+    __m256i order = _mm256_cvtepu8_epi32 (_mm_loadl_epi64
+        ((const __m128i *) (lanes->packing_orders + mask)));
+    _mm256_storeu_si256 ((__m256i *) (lanes->ended + num_ended),
+                         _mm256_permutevar8x32_epi32 (_mm256_add_epi32
+        (_mm256_set1_epi32 (lane), lane_offsets), order));
+    num_ended += __builtin_popcount (mask);
+  }
+  lanes->num_ended = num_ended;
+}
+#endif
+
+static void start_walk(const WalkerTable *walker_table, Lanes *lanes,
+                       int lane, uint32_t first_state, uint64_t walk_counter)
+{
+  lanes->walkers[lane] = walker_table->walkers[first_state];
+  lanes->steps[lane] = 0;
+  lanes->events[lane] = 0;
+  lanes->walk_counters[lane] = walk_counter;
+  lanes->active[lane] = true;
+}
+
+static void record_walk(const Lanes *lanes, int lane,
+                        WalkerStats *walker_stats)
+{
+  int steps = lanes->steps[lane];
+  if (lanes->walkers[lane] & END_BIT)
+  {
+    walker_stats->steps[steps]++;
+  }
+  else
+  {
+    walker_stats->unfinished++;
+  }
+  walker_stats->total_steps += (uint64_t) steps;
+  for (int kind = 0; kind < NUM_EVENT_KINDS; kind++)
+  {
+    int count = (lanes->events[lane] >> (EVENT_COUNT_BITS * kind))
+                & EVENT_COUNT_MASK;
+    walker_stats->events[kind][count]++;
+    walker_stats->total_events[kind] += (uint64_t) count;
+  }
+  walker_stats->num_walks++;
+}
+
+WalkerStats *simulate_walkers(const WalkerTable *walker_table,
+                              uint32_t first_state, uint64_t num_walks,
+                              int max_steps, uint64_t seed)
+{
+  WalkerStats *walker_stats = calloc (1, sizeof (WalkerStats));
+  Lanes *lanes = calloc (1, sizeof (Lanes));
+  if (!walker_stats || !lanes)
+  {
+    free (walker_stats);
+    free (lanes);
+    return NULL;
+  }
+  walker_stats->max_steps = max_steps;
+  walker_stats->steps = calloc ((size_t) max_steps + 1, sizeof (uint64_t));
+  bool success = walker_stats->steps != NULL;
+  for (int kind = 0; kind < NUM_EVENT_KINDS; kind++)
+  {
+    walker_stats->events[kind] = calloc ((size_t) max_steps + 1,
+                                         sizeof (uint64_t));
+    success = success && walker_stats->events[kind];
+  }
+  if (!success)
+  {
+    free (lanes);
+    free_walker_stats (&walker_stats);
+    return NULL;
+  }
+  if (walker_table->walkers[first_state] & END_BIT)
+  {
+    // every walk ends where it starts
+    walker_stats->num_walks = num_walks;
+    walker_stats->steps[0] = num_walks;
+    for (int kind = 0; kind < NUM_EVENT_KINDS; kind++)
+    {
+      walker_stats->events[kind][0] = num_walks;
+    }
+    free (lanes);
+    return walker_stats;
+  }
+  for (unsigned mask = 0; mask < 1 << VECTOR_WIDTH; mask++)
+  {
+    uint64_t order = 0;
+    int num_set = 0;
+    for (int i = 0; i < VECTOR_WIDTH; i++)
+    {
+      if (mask & 1 << i)
+      {
+        order |= (uint64_t) i << (CHAR_BIT * num_set++);
+      }
+    }
+    lanes->packing_orders[mask] = order;
+  }
+  // the draws of different seeds differ in all the bits of their counters
+  uint64_t key = hash64 (seed);
+  uint64_t next_walk = 0;
+  int num_active = 0;
+  for (int lane = 0; lane < NUM_LANES && next_walk < num_walks; lane++)
+  {
+    start_walk (walker_table, lanes, lane, first_state,
+                key ^ (next_walk++ << STEP_BITS));
+    num_active++;
+  }
+#ifdef HAVE_AVX2_PATH
+  __builtin_cpu_init ();
+  bool use_avx2 = __builtin_cpu_supports ("avx2");
+#endif
+  while (num_active > 0)
+  {
+#ifdef HAVE_AVX2_PATH
+    if (use_avx2)
+    {
+      advance_lanes_avx2 (walker_table, lanes, max_steps);
+    }
+    else
+#endif
+    {
+      advance_lanes (walker_table, lanes, max_steps);
+    }
+    // a list, not a scan of the lanes, whose branches would mispredict
+    // on every ended walk
+    for (int i = 0; i < lanes->num_ended; i++)
+    {
+      int lane = lanes->ended[i];
+      if (!lanes->active[lane])
+      {
+        continue;
+      }
+      record_walk (lanes, lane, walker_stats);
+      if (next_walk < num_walks)
+      {
+        start_walk (walker_table, lanes, lane, first_state,
+                    key ^ (next_walk++ << STEP_BITS));
+      }
+      else
+      {
+        lanes->active[lane] = false;
+        num_active--;
+      }
+    }
+  }
+  free (lanes);
+  return walker_stats;
+}
+
+void free_walker_table(WalkerTable **walker_table)
+{
+  if (!*walker_table)
+  {
+    return;
+  }
+  free ((*walker_table)->next_walkers);
+  free ((*walker_table)->walkers);
+  free (*walker_table);
+  *walker_table = NULL;
+}
+
+void free_walker_stats(WalkerStats **walker_stats)
+{
+  if (!*walker_stats)
+  {
+    return;
+  }
+  free ((*walker_stats)->steps);
+  for (int kind = 0; kind < NUM_EVENT_KINDS; kind++)
+  {
+    free ((*walker_stats)->events[kind]);
+  }
+  free (*walker_stats);
+  *walker_stats = NULL;
+}
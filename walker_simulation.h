@@ -0,0 +1,95 @@
+#ifndef _WALKER_SIMULATION_H_
+#define _WALKER_SIMULATION_H_
+#include <stdbool.h> // for bool
+#include <stdint.h> // for uint32_t, uint64_t
+#include "compiled_chain.h"
+
+// number of kinds of events the walks count (e.g. snakes and ladders)
+#define NUM_EVENT_KINDS 2
+// rows are expanded to one entry per unit of frequency, so chains with a
+// bigger row total can't be simulated
+#define MAX_ROW_TOTAL 255
+// a walker packs its state id in 20 bits
+#define MAX_WALKER_STATES (1 << 20)
+// the event counts of a walk are packed in 16 bits each
+#define MAX_WALKER_STEPS 65535
+
+/**
+ * A compiled chain as an integer transition table, for walks in bulk. A
+ * walker is one word: a state's id, with the state's total frequency, its
+ * event bits and whether walks end in it. Row state has one walker per unit
+ * of its total frequency, so a walker moves by drawing an index in
+ * [0, total) and reading next_walkers[state * row_width + index], which is
+ * a single load.
+ */
+typedef struct WalkerTable {
+    uint32_t num_states;
+    uint32_t row_width;
+    int32_t *next_walkers;
+    int32_t *walkers; // the walker of every state
+} WalkerTable;
+
+/**
+ * Histograms of simulated walks. A walk ends when it reaches a last state
+ * or a state without successors, or after max_steps steps.
+ */
+typedef struct WalkerStats {
+    uint64_t num_walks;
+    uint64_t total_steps; // steps of all the walks
+    int max_steps;
+    // steps[n] walks ended after n steps, max_steps + 1 entries. walks cut
+    // at max_steps that didn't end by themselves are in unfinished.
+    uint64_t *steps;
+    uint64_t unfinished;
+    // events[kind][n] walks passed n states of the event kind, max_steps + 1
+    // entries each
+    uint64_t *events[NUM_EVENT_KINDS];
+    uint64_t total_events[NUM_EVENT_KINDS];
+} WalkerStats;
+
+/**
+ * Build the transition table of a compiled chain.
+ * @param compiled_chain the chain
+ * @param state_events the event bits of every compiled state (bit k for
+ * event kind k), num_states entries. NULL for no events.
+ * @return the table, NULL in case of allocation error, or if the chain has
+ * more than MAX_WALKER_STATES states or a row's total frequency is more than
+ * MAX_ROW_TOTAL
+ */
+WalkerTable *create_walker_table(const CompiledChain *compiled_chain,
+                                 const unsigned char *state_events);
+
+/**
+ * Simulate independent walks from a state, many walkers in lockstep, with
+ * AVX2 where the CPU has it. Only the histograms are kept, not the paths.
+ * Every draw is a hash of a 64 bit counter, the walk's number then the
+ * step's number in 16 bits, xored with a key hashed from the seed (a
+ * counter based generator). So the path of a walk depends only on the seed
+ * and its number, on any CPU and in any lane. An index in [0, total) is
+ * taken from the high bits of a 32 bit draw times the total, whose bias
+ * (under total / 2^32) is negligible for statistics.
+ * @param walker_table the chain's table
+ * @param first_state id of the state every walk starts from
+ * @param num_walks number of walks, below 2^48
+ * @param max_steps maximum number of steps of a walk, in
+ * [1, MAX_WALKER_STEPS]
+ * @param seed the seed
+ * @return the histograms, NULL in case of allocation error
+ */
+WalkerStats *simulate_walkers(const WalkerTable *walker_table,
+                              uint32_t first_state, uint64_t num_walks,
+                              int max_steps, uint64_t seed);
+
+/**
+ * Free a transition table.
+ * @param walker_table the table to free
+ */
+void free_walker_table(WalkerTable **walker_table);
+
+/**
+ * Free simulation histograms.
+ * @param walker_stats the histograms to free
+ */
+void free_walker_stats(WalkerStats **walker_stats);
+
+#endif //_WALKER_SIMULATION_H_